@@ -1,6 +1,8 @@
 #include "utils.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include <boost/algorithm/string.hpp>
 #include <mutex>
 #include <string>
@@ -12,6 +14,8 @@ using namespace std::chrono;
 
 #ifdef _WIN32
 #include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 static int get_system_timezone_impl()
 {
@@ -45,6 +49,18 @@ static unsigned long long get_msec_time_impl()
 #else
 
 #include "../date/date.h"
+#include <sys/stat.h>
+
+#include <sys/file.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef _OSX
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#endif
 
 static int get_system_timezone_impl()
 {
@@ -524,5 +540,978 @@ std::string& escape_quotes(std::string& str)
     boost::replace_all(str, "\"", "\\\"");
     return str;
 }
+std::string escape_json_string(const std::string& str)
+{
+    std::string res;
+    res.reserve(str.size());
+
+    for (char c : str)
+    {
+        if ((c == '"') || (c == '\\'))
+        {
+            res += '\\';
+            res += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+            res += code;
+        }
+        else
+            res += c;
+    }
+
+    return res;
+}
+
+//Deeper nesting is rejected, it keeps recursion of the scanner bounded.
+static const int max_json_depth = 64;
+
+static void skip_json_space(const char*& p, const char* end)
+{
+    while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\n') || (*p == '\r')))
+        p++;
+}
+
+static bool scan_json_digits(const char*& p, const char* end)
+{
+    const char* start = p;
+
+    while ((p < end) && (*p >= '0') && (*p <= '9'))
+        p++;
+
+    return (p != start);
+}
+
+//Every scan_json_* function starts at the first character of its value and moves p past it.
+static bool scan_json_string(const char*& p, const char* end)
+{
+    for (p++; p < end; p++)
+    {
+        unsigned char c = static_cast<unsigned char>(*p);
+
+        if (c == '"')
+        {
+            p++;
+            return true;
+        }
+
+        if (c < 0x20)
+            return false;
+
+        if (c != '\\')
+            continue;
+
+        if (++p >= end)
+            return false;
+
+        switch (*p)
+        {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                break;
+
+            case 'u':
+                for (int i = 0; i < 4; i++)
+                    if ((++p >= end) || !isxdigit(static_cast<unsigned char>(*p)))
+                        return false;
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    return false;
+}
+
+static bool scan_json_number(const char*& p, const char* end)
+{
+    if ((p < end) && (*p == '-'))
+        p++;
+
+    if ((p < end) && (*p == '0'))
+        p++;
+    else if (!scan_json_digits(p, end))
+        return false;
+
+    if ((p < end) && (*p == '.'))
+    {
+        p++;
+        if (!scan_json_digits(p, end))
+            return false;
+    }
+
+    if ((p < end) && ((*p == 'e') || (*p == 'E')))
+    {
+        p++;
+        if ((p < end) && ((*p == '+') || (*p == '-')))
+            p++;
+
+        if (!scan_json_digits(p, end))
+            return false;
+    }
+
+    return true;
+}
+
+static bool scan_json_literal(const char*& p, const char* end, const char* literal)
+{
+    size_t len = strlen(literal);
+
+    if ((static_cast<size_t>(end - p) < len) || (memcmp(p, literal, len) != 0))
+        return false;
+
+    p += len;
+    return true;
+}
+
+//Top level fields picked up while the object is scanned, raw values are returned as they are in json, strings with their quotes.
+struct Json_Fields
+{
+    const char* const* names;
+    size_t count;
+    const char** values;
+    size_t* sizes;
+    bool raw;
+    bool first_only; //scanning stops once the first field is found
+    bool arrays; //raw values of arrays are picked up too
+};
+
+static bool scan_json_members(const char*& p, const char* end, int depth, Json_Fields* fields);
+
+static bool scan_json_value(const char*& p, const char* end, int depth)
+{
+    if ((p >= end) || (depth > max_json_depth))
+        return false;
+
+    switch (*p)
+    {
+        case '{':
+            return scan_json_members(p, end, depth + 1, 0);
+
+        case '[':
+            p++;
+            skip_json_space(p, end);
+
+            if ((p < end) && (*p == ']'))
+            {
+                p++;
+                return true;
+            }
+
+            while (true)
+            {
+                if (!scan_json_value(p, end, depth + 1))
+                    return false;
+
+                skip_json_space(p, end);
+                if (p >= end)
+                    return false;
+
+                if (*p == ']')
+                {
+                    p++;
+                    return true;
+                }
+
+                if (*p != ',')
+                    return false;
+
+                p++;
+                skip_json_space(p, end);
+            }
+
+        case '"':
+            return scan_json_string(p, end);
+
+        case 't':
+            return scan_json_literal(p, end, "true");
+
+        case 'f':
+            return scan_json_literal(p, end, "false");
+
+        case 'n':
+            return scan_json_literal(p, end, "null");
+
+        default:
+            return scan_json_number(p, end);
+    }
+}
+
+static bool scan_json_members(const char*& p, const char* end, int depth, Json_Fields* fields)
+{
+    p++;
+    skip_json_space(p, end);
+
+    if ((p < end) && (*p == '}'))
+    {
+        p++;
+        return true;
+    }
+
+    while (true)
+    {
+        if ((p >= end) || (*p != '"'))
+            return false;
+
+        const char* name = p + 1;
+        if (!scan_json_string(p, end))
+            return false;
+
+        size_t name_size = p - name - 1;
+
+        skip_json_space(p, end);
+        if ((p >= end) || (*p != ':'))
+            return false;
+
+        p++;
+        skip_json_space(p, end);
+
+        const char* value = p;
+        if (!scan_json_value(p, end, depth))
+            return false;
+
+        //the first one wins if the field is repeated
+        for (size_t i = 0; fields && (i < fields->count); i++)
+        {
+            if (fields->values[i] || (strncmp(name, fields->names[i], name_size) != 0) || (fields->names[i][name_size] != 0))
+                continue;
+
+            if ((*value == '"') && !fields->raw)
+            {
+                fields->values[i] = value + 1;
+                fields->sizes[i] = p - value - 2;
+            }
+            else if (fields->raw && (*value != '{') && ((*value != '[') || fields->arrays))
+            {
+                fields->values[i] = value;
+                fields->sizes[i] = p - value;
+            }
+
+            if (fields->first_only && fields->values[i])
+                return true;
+        }
+
+        skip_json_space(p, end);
+        if (p >= end)
+            return false;
+
+        if (*p == '}')
+        {
+            p++;
+            return true;
+        }
+
+        if (*p != ',')
+            return false;
+
+        p++;
+        skip_json_space(p, end);
+    }
+}
+
+bool scan_json_object(const char* json, size_t size, const char* field_name, const char** field_value, size_t* field_size)
+{
+    const char* value = 0;
+    size_t value_size = 0;
+
+    if (field_value)
+        *field_value = 0;
+
+    if (field_size)
+        *field_size = 0;
+
+    if (!json)
+        return false;
+
+    const char* p = json;
+    const char* end = json + size;
+
+    skip_json_space(p, end);
+    if ((p >= end) || (*p != '{'))
+        return false;
+
+    Json_Fields fields = {&field_name, (field_name && field_value && field_size) ? 1u : 0u, &value, &value_size, false, false, false};
+
+    if (!scan_json_members(p, end, 1, &fields))
+        return false;
+
+    skip_json_space(p, end);
+    if (p != end)
+        return false;
+
+    if (field_value && field_size)
+    {
+        *field_value = value;
+        *field_size = value_size;
+    }
+
+    return true;
+}
+
+bool scan_json_fields(const char* json, size_t size, const char* const* field_names, size_t field_count, const char** values, size_t* sizes)
+{
+    for (size_t i = 0; i < field_count; i++)
+    {
+        values[i] = 0;
+        sizes[i] = 0;
+    }
+
+    if (!json)
+        return false;
+
+    const char* p = json;
+    const char* end = json + size;
+
+    skip_json_space(p, end);
+    if ((p >= end) || (*p != '{'))
+        return false;
+
+    Json_Fields fields = {field_names, field_count, values, sizes, true, false, false};
+
+    if (!scan_json_members(p, end, 1, &fields))
+        return false;
+
+    skip_json_space(p, end);
+    return (p == end);
+}
+
+bool find_json_string(const char* json, size_t size, const char* field_name, const char** field_value, size_t* field_size)
+{
+    *field_value = 0;
+    *field_size = 0;
+
+    if (!json || !field_name)
+        return false;
+
+    const char* p = json;
+    const char* end = json + size;
+
+    skip_json_space(p, end);
+    if ((p >= end) || (*p != '{'))
+        return false;
+
+    Json_Fields fields = {&field_name, 1, field_value, field_size, false, true, false};
+
+    return scan_json_members(p, end, 1, &fields) && *field_value;
+}
+
+bool scan_json_batch(const char* json, size_t size, const char* array_name, const char** items, size_t* items_size)
+{
+    *items = 0;
+    *items_size = 0;
+
+    if (!json || !array_name)
+        return false;
+
+    const char* p = json;
+    const char* end = json + size;
+
+    skip_json_space(p, end);
+    if ((p >= end) || (*p != '{'))
+        return false;
+
+    Json_Fields fields = {&array_name, 1, items, items_size, true, false, true};
+
+    if (!scan_json_members(p, end, 1, &fields))
+        return false;
+
+    skip_json_space(p, end);
+    return (p == end) && *items && (**items == '[');
+}
+
+bool scan_json_objects(const char* json, size_t size, size_t* count, const char* field_name, const char** field_value, size_t* field_size)
+{
+    const char* value = 0;
+    size_t value_size = 0;
+
+    *count = 0;
+
+    if (field_value)
+        *field_value = 0;
+
+    if (field_size)
+        *field_size = 0;
+
+    if (!json)
+        return false;
+
+    const char* p = json;
+    const char* end = json + size;
+
+    skip_json_space(p, end);
+    if ((p >= end) || (*p != '['))
+        return false;
+
+    p++;
+    skip_json_space(p, end);
+
+    if ((p < end) && (*p == ']'))
+        p++;
+    else
+    {
+        while (true)
+        {
+            if ((p >= end) || (*p != '{'))
+                return false;
+
+            //the field is taken from the first object only
+            Json_Fields fields = {&field_name, (!*count && field_name && field_value && field_size) ? 1u : 0u, &value, &value_size, false, false, false};
+
+            if (!scan_json_members(p, end, 2, &fields))
+                return false;
+
+            (*count)++;
+
+            skip_json_space(p, end);
+            if (p >= end)
+                return false;
+
+            if (*p == ']')
+            {
+                p++;
+                break;
+            }
+
+            if (*p != ',')
+                return false;
+
+            p++;
+            skip_json_space(p, end);
+        }
+    }
+
+    skip_json_space(p, end);
+    if (p != end)
+    {
+        *count = 0;
+        return false;
+    }
+
+    if (field_value && field_size)
+    {
+        *field_value = value;
+        *field_size = value_size;
+    }
+
+    return true;
+}
+
+Json_Batch_Builder::Json_Batch_Builder(const char* array_name, const std::string& fragment):
+array_name_(array_name ? array_name : ""),
+fragment_(fragment),
+batch_(0),
+count_(0)
+{
+}
+
+Json_Batch_Builder::~Json_Batch_Builder()
+{
+    delete batch_;
+}
+
+void Json_Batch_Builder::start(const std::string& header, size_t reserve)
+{
+    delete batch_;
+
+    batch_ = new std::string();
+    batch_->reserve(header.size() + array_name_.size() + reserve + 4 * fragment_.size() + 8);
+
+    *batch_ += header;
+    *batch_ += ",\"";
+    *batch_ += array_name_;
+    *batch_ += "\":[";
+
+    count_ = 0;
+}
+
+void Json_Batch_Builder::add(const char* json, size_t size)
+{
+    if (!batch_)
+        return;
+
+    if (count_ > 0)
+        *batch_ += ',';
+
+    append_closed(json, size);
+    count_++;
+}
+
+void Json_Batch_Builder::add_items(const char* items, size_t size, size_t count)
+{
+    if (!batch_ || !items)
+        return;
+
+    const char* begin = items;
+    const char* end = items + size;
+
+    //whatever is between the brackets goes in as it is
+    skip_json_space(begin, end);
+    while ((end > begin) && ((end[-1] == ' ') || (end[-1] == '\t') || (end[-1] == '\n') || (end[-1] == '\r')))
+        end--;
+
+    if ((end - begin < 2) || (*begin != '[') || (end[-1] != ']'))
+        return;
+
+    begin++;
+    end--;
+
+    skip_json_space(begin, end);
+    if ((begin == end) || !count)
+        return;
+
+    if (count_ > 0)
+        *batch_ += ',';
+
+    batch_->append(begin, end - begin);
+    count_ += count;
+}
+
+std::string* Json_Batch_Builder::finish()
+{
+    if (!batch_)
+        return 0;
+
+    *batch_ += "]}";
+    append_closed(0, 0);
+
+    std::string* res = batch_;
+    batch_ = 0;
+    count_ = 0;
+
+    return res;
+}
+
+//Appends json with fragment inserted before its closing brace, without json the fragment goes before the closing brace already in the batch.
+void Json_Batch_Builder::append_closed(const char* json, size_t size)
+{
+    if (json)
+        batch_->append(json, size);
+
+    size_t pos = batch_->rfind('}');
+    if (pos == std::string::npos)
+        return;
+
+    batch_->resize(pos);
+
+    //object without fields must not get the leading comma of the fragment
+    size_t last = batch_->find_last_not_of(" \t\r\n");
+    bool empty = (last != std::string::npos) && ((*batch_)[last] == '{');
+
+    if (empty && !fragment_.empty() && (fragment_[0] == ','))
+        batch_->append(fragment_, 1, std::string::npos);
+    else
+        *batch_ += fragment_;
+
+    *batch_ += '}';
+}
+
+File_Watcher::File_Watcher(const std::string& path, std::function<void()> on_change):
+path_(path),
+on_change_(on_change),
+stop_(false),
+wake_fd_(-1),
+thread_(0)
+{
+#if defined(_LINUX) && !defined(_OSX)
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+
+    thread_ = new std::thread(&File_Watcher::watch, this);
+}
+
+File_Watcher::~File_Watcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        stop_cv_.notify_all();
+    }
+
+#if defined(_LINUX) && !defined(_OSX)
+    if (wake_fd_ >= 0)
+    {
+        unsigned long long one = 1;
+        ssize_t res = write(wake_fd_, &one, sizeof(one));
+        (void)res;
+    }
+#endif
+
+    thread_->join();
+    delete thread_;
+
+#if defined(_LINUX) && !defined(_OSX)
+    if (wake_fd_ >= 0)
+        close(wake_fd_);
+#endif
+}
+
+//Modification time and size, both 0 when the file is missing.
+static std::pair<long long, long long> file_stamp(const std::string& path)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path.c_str(), &st) != 0)
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+#endif
+        return std::make_pair(0ll, 0ll);
+
+    return std::make_pair(static_cast<long long>(st.st_mtime), static_cast<long long>(st.st_size));
+}
+
+void File_Watcher::watch()
+{
+#if defined(_LINUX) && !defined(_OSX)
+
+    //editors often write a new file and rename it over the old one, so the directory is watched rather than the file
+    size_t slash = path_.find_last_of('/');
+    std::string dir(slash == std::string::npos ? std::string(".") : path_.substr(0, slash + 1));
+    std::string name(slash == std::string::npos ? path_ : path_.substr(slash + 1));
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if ((fd >= 0) && (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0))
+    {
+        alignas(inotify_event) char buf[4096];
+
+        while (!stop_)
+        {
+            pollfd pfd[2] = {{fd, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+            if ((poll(pfd, (wake_fd_ >= 0) ? 2 : 1, poll_interval) <= 0) || !(pfd[0].revents & POLLIN))
+                continue;
+
+            bool changed = false;
+
+            for (ssize_t len = read(fd, buf, sizeof(buf)); len > 0; len = read(fd, buf, sizeof(buf)))
+            {
+                for (char* event_ptr = buf; event_ptr < buf + len;)
+                {
+                    inotify_event* event = reinterpret_cast<inotify_event*>(event_ptr);
+
+                    if (event->len && (name == event->name))
+                        changed = true;
+
+                    event_ptr += sizeof(inotify_event) + event->len;
+                }
+            }
+
+            if (changed)
+                on_change_();
+        }
+
+        close(fd);
+        return;
+    }
+
+    //no inotify (e.g. out of watches), checking the file once a second does as well
+    if (fd >= 0)
+        close(fd);
+
+#endif
+
+    std::pair<long long, long long> stamp(file_stamp(path_));
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop_cv_.wait_for(lock, std::chrono::milliseconds(poll_interval), [this]() { return stop_; });
+
+            if (stop_)
+                return;
+        }
+
+        std::pair<long long, long long> current(file_stamp(path_));
+        if (current == stamp)
+            continue;
+
+        stamp = current;
+        on_change_();
+    }
+}
+
+Pid_File::Pid_File(const std::string& path):
+path_(path),
+#ifdef _WIN32
+handle_(INVALID_HANDLE_VALUE)
+#else
+fd_(-1)
+#endif
+{
+}
+
+Pid_File::~Pid_File()
+{
+    release();
+}
+
+#ifdef _WIN32
+
+//Windows locks are mandatory, the byte locked is far past the pid so that others can still read it
+static BOOL lock_pid_file(HANDLE handle, DWORD flags)
+{
+    OVERLAPPED overlapped = {0};
+    overlapped.OffsetHigh = 1;
+    return LockFileEx(handle, flags, 0, 1, 0, &overlapped);
+}
+
+static void unlock_pid_file(HANDLE handle)
+{
+    OVERLAPPED overlapped = {0};
+    overlapped.OffsetHigh = 1;
+    UnlockFileEx(handle, 0, 1, 0, &overlapped);
+}
+
+static HANDLE open_pid_file(const std::string& path, DWORD access, DWORD disposition)
+{
+    return CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, disposition, FILE_ATTRIBUTE_NORMAL, 0);
+}
+
+static void write_pid_file(HANDLE handle, const std::string& content)
+{
+    DWORD written = 0;
+
+    SetFilePointer(handle, 0, 0, FILE_BEGIN);
+    if (!content.empty())
+        WriteFile(handle, content.c_str(), static_cast<DWORD>(content.size()), &written, 0);
+
+    SetEndOfFile(handle);
+}
+
+bool Pid_File::acquire()
+{
+    if (handle_ != INVALID_HANDLE_VALUE)
+        return true;
+
+    HANDLE handle = open_pid_file(path_, GENERIC_READ | GENERIC_WRITE, OPEN_ALWAYS);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    //others take a shared lock for a moment to look at the file, so a busy file is tried again for a while
+    for (int i = 0; !lock_pid_file(handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY); i++)
+    {
+        if (i >= acquire_retries)
+        {
+            CloseHandle(handle);
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(acquire_retry_interval));
+    }
+
+    //pid of a crashed process may be left there, the file is empty until set_ready()
+    write_pid_file(handle, "");
+    handle_ = handle;
+    return true;
+}
+
+void Pid_File::set_ready()
+{
+    if (handle_ != INVALID_HANDLE_VALUE)
+        write_pid_file(handle_, std::to_string(GetCurrentProcessId()) + "\n");
+}
+
+void Pid_File::release()
+{
+    if (handle_ == INVALID_HANDLE_VALUE)
+        return;
+
+    write_pid_file(handle_, "");
+    unlock_pid_file(handle_);
+    CloseHandle(handle_);
+    handle_ = INVALID_HANDLE_VALUE;
+}
+
+Pid_File::State Pid_File::state(const std::string& path)
+{
+    HANDLE handle = open_pid_file(path, GENERIC_READ, OPEN_EXISTING);
+    if (handle == INVALID_HANDLE_VALUE)
+        return State::none;
+
+    State res = State::released;
+
+    if (lock_pid_file(handle, LOCKFILE_FAIL_IMMEDIATELY))
+        unlock_pid_file(handle);
+    else
+    {
+        LARGE_INTEGER size = {0};
+        res = (GetFileSizeEx(handle, &size) && size.QuadPart) ? State::ready : State::held;
+    }
+
+    CloseHandle(handle);
+    return res;
+}
+
+void Pid_File::wait_released(const std::string& path)
+{
+    HANDLE handle = open_pid_file(path, GENERIC_READ, OPEN_EXISTING);
+    if (handle == INVALID_HANDLE_VALUE)
+        return;
+
+    if (lock_pid_file(handle, 0))
+        unlock_pid_file(handle);
+
+    CloseHandle(handle);
+}
+
+#else
+
+//Symlinks and files of other users are never used, the file could be planted there to be truncated or to be locked by someone else.
+static int open_pid_file(const std::string& path, int flags)
+{
+    int fd = open(path.c_str(), flags | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_uid != geteuid()))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool Pid_File::acquire()
+{
+    if (fd_ >= 0)
+        return true;
+
+    //directory of the file, such as /run/fplogd, may be gone after a reboot
+    size_t slash = path_.rfind('/');
+    if ((slash != std::string::npos) && (slash > 0))
+        mkdir(path_.substr(0, slash).c_str(), 0755);
+
+    int fd = open_pid_file(path_, O_RDWR | O_CREAT);
+    if (fd < 0)
+        return false;
+
+    //others take a shared lock for a moment to look at the file, so a busy file is tried again for a while
+    for (int i = 0; flock(fd, LOCK_EX | LOCK_NB) != 0; i++)
+    {
+        if ((errno != EWOULDBLOCK) || (i >= acquire_retries))
+        {
+            close(fd);
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(acquire_retry_interval));
+    }
+
+    //pid of a crashed process may be left there, the file is empty until set_ready()
+    int res = ftruncate(fd, 0);
+    (void)res;
+
+    fd_ = fd;
+    return true;
+}
+
+void Pid_File::set_ready()
+{
+    if (fd_ < 0)
+        return;
+
+    //written through a descriptor of its own, File_Watcher of those waiting for the file wakes up when it is closed
+    int fd = open_pid_file(path_, O_WRONLY);
+    if (fd < 0)
+        return;
+
+    int res = ftruncate(fd, 0);
+    (void)res;
+
+    std::string pid(std::to_string(getpid()) + "\n");
+    ssize_t written = write(fd, pid.c_str(), pid.size());
+    (void)written;
+
+    close(fd);
+}
+
+void Pid_File::release()
+{
+    if (fd_ < 0)
+        return;
+
+    int res = ftruncate(fd_, 0);
+    (void)res;
+
+    flock(fd_, LOCK_UN);
+    close(fd_);
+    fd_ = -1;
+}
+
+Pid_File::State Pid_File::state(const std::string& path)
+{
+    int fd = open_pid_file(path, O_RDONLY);
+    if (fd < 0)
+        return State::none;
+
+    State res = State::none;
+
+    if (flock(fd, LOCK_SH | LOCK_NB) == 0)
+    {
+        flock(fd, LOCK_UN);
+        res = State::released;
+    }
+    else if (errno == EWOULDBLOCK)
+    {
+        struct stat st;
+        res = ((fstat(fd, &st) == 0) && (st.st_size > 0)) ? State::ready : State::held;
+    }
+
+    close(fd);
+    return res;
+}
+
+void Pid_File::wait_released(const std::string& path)
+{
+    int fd = open_pid_file(path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    while ((flock(fd, LOCK_SH) != 0) && (errno == EINTR));
+
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+#endif
+
+bool Pid_File::wait_ready(const std::string& path, size_t timeout)
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::chrono::steady_clock::time_point until(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout));
+
+    File_Watcher watcher(path, [&]()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        changed.notify_all();
+    });
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (state(path) != State::ready)
+    {
+        //changes made before the watcher got going are picked up by the next look at the file
+        std::chrono::steady_clock::duration wait = std::chrono::milliseconds(ready_recheck_interval);
+
+        if (timeout)
+        {
+            std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+            if (now >= until)
+                return false;
+
+            wait = std::min(wait, until - now);
+        }
+
+        changed.wait_for(lock, wait);
+    }
+
+    return true;
+}
 
 };
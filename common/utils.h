@@ -5,6 +5,9 @@
 #include <cctype>
 #include <locale>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace generic_util
 {
@@ -56,4 +59,137 @@ static inline std::string &trim(std::string &s) {
 
 std::string& escape_quotes(std::string& str);
 
+//Escapes str to be put between quotes as JSON string value.
+std::string escape_json_string(const std::string& str);
+
+//Checks that json is exactly one well-formed JSON object, surrounding whitespace aside, without building DOM or allocating memory.
+//If field_name is given, raw value of the top level string field with this name is returned through field_value and field_size,
+//it is not unescaped and field_value is 0 when there is no such field.
+bool scan_json_object(const char* json, size_t size, const char* field_name = 0, const char** field_value = 0, size_t* field_size = 0);
+
+//The same check, several top level fields are picked up in one pass. values[i] is the raw value of field_names[i] as it is
+//in json, strings with their quotes and not unescaped, numbers and literals as they are; 0 if the field is missing or holds an object or array.
+bool scan_json_fields(const char* json, size_t size, const char* const* field_names, size_t field_count, const char** values, size_t* sizes);
+
+//Content of the top level string field field_name, without quotes and not unescaped. Scanning stops at the field,
+//so the rest of json is not checked. Returns false if the field is not found before the end or the error.
+bool find_json_string(const char* json, size_t size, const char* field_name, const char** field_value, size_t* field_size);
+
+//Raw value of the top level array array_name of the JSON object, brackets included, e.g. the batch array of a batch message.
+//The whole object is checked, elements of the array are not required to be objects, scan_json_objects does it.
+bool scan_json_batch(const char* json, size_t size, const char* array_name, const char** items, size_t* items_size);
+
+//Checks that json is exactly one JSON array of well-formed objects and counts them. If field_name is given, the string field
+//of the first object is returned through field_value and field_size the same way scan_json_object does.
+bool scan_json_objects(const char* json, size_t size, size_t* count, const char* field_name = 0, const char** field_value = 0, size_t* field_size = 0);
+
+//Assembles a batch message from JSON objects by plain concatenation, objects must be checked with scan_json_object beforehand.
+//Every object goes into the array as it is, with fragment (e.g. ,"hostname":"pc") inserted before its closing brace,
+//the same fragment closes the batch object itself.
+class Json_Batch_Builder
+{
+    public:
+
+        Json_Batch_Builder(const char* array_name, const std::string& fragment = std::string());
+        ~Json_Batch_Builder();
+
+        //header is the opening brace of the batch object followed by its fields, without the closing brace.
+        void start(const std::string& header, size_t reserve = 0);
+        void add(const char* json, size_t size);
+        void add(const std::string& json) { add(json.c_str(), json.size()); }
+        //Objects of an array checked by scan_json_objects go in as they are, without fragment, count is how many there are.
+        void add_items(const char* items, size_t size, size_t count);
+        size_t count() const { return count_; }
+
+        //Returns the assembled batch, builder is empty until next start().
+        std::string* finish();
+
+
+    private:
+
+        std::string array_name_;
+        std::string fragment_;
+        std::string* batch_;
+        size_t count_;
+
+        Json_Batch_Builder(const Json_Batch_Builder&);
+        void append_closed(const char* json, size_t size);
+};
+
+//Calls on_change from a thread of its own every time the file is written or replaced, e.g. saved by an editor through rename.
+//Watches the directory of the file with inotify on Linux, elsewhere compares modification time and size once a second.
+//Destructor returns after the thread has stopped, so on_change is not called anymore.
+class File_Watcher
+{
+    public:
+
+        File_Watcher(const std::string& path, std::function<void()> on_change);
+        ~File_Watcher();
+
+
+    private:
+
+        static const int poll_interval = 1000; //ms
+
+        std::string path_;
+        std::function<void()> on_change_;
+        std::mutex mutex_;
+        std::condition_variable stop_cv_;
+        volatile bool stop_;
+        int wake_fd_; //eventfd that wakes poll() on inotify up when the watcher is destroyed, -1 elsewhere
+        std::thread* thread_;
+
+        File_Watcher(const File_Watcher&);
+        void watch();
+};
+
+//Pidfile a running process keeps locked (flock, LockFileEx on Windows), the lock goes away with the process even if it crashes.
+//The file stays empty until the process calls set_ready(), so others can tell at once whether it runs and is ready,
+//and block until it is, or until it is gone, without looking through the process list.
+class Pid_File
+{
+    public:
+
+        enum class State
+        {
+            none, //no file, it cannot be read or it is not a file of this user
+            released, //left by a process that is gone
+            held, //process is starting
+            ready
+        };
+
+        Pid_File(const std::string& path);
+        ~Pid_File();
+
+        //Locks the file for this process, its directory is created when missing. False if it cannot be created, is a symlink
+        //or a file of another user, or another process holds it.
+        bool acquire();
+        //Writes pid of this process into the file.
+        void set_ready();
+        //Empties the file and drops the lock.
+        void release();
+
+        static State state(const std::string& path);
+        //Waits until the file is ready, at most timeout ms (0 waits for good). Returns whether it is.
+        static bool wait_ready(const std::string& path, size_t timeout = 0);
+        //Waits until no process holds the file.
+        static void wait_released(const std::string& path);
+
+
+    private:
+
+        static const int acquire_retries = 10;
+        static const int acquire_retry_interval = 10; //ms
+        static const int ready_recheck_interval = 1000; //ms
+
+        std::string path_;
+#ifdef _WIN32
+        void* handle_;
+#else
+        int fd_;
+#endif
+
+        Pid_File(const Pid_File&);
+};
+
 };
@@ -16,6 +16,8 @@
 #include <fplog_exceptions.h>
 #include <fplog.h>
 #include <fplog/Queue_Controller.h>
+#include <sprot/compression.h>
+#include <spipc/UDT_Listener.h>
 
 #include <common/utils.h>
 
@@ -111,6 +113,7 @@ class Configuration
             std::ofstream f(config_file_name);
             
             f << "[misc]" << std::endl;
+            f << ";max_queue_size and emergency_* are applied as soon as the file is saved, other keys on restart." << std::endl;
             f << "hostname=auto" << std::endl;
             f << "batch_size=31" << std::endl;
             f << "max_queue_size=21000000" << std::endl;
@@ -128,8 +131,37 @@ class Configuration
             f << "type=ip" << std::endl;
             f << "transport=udp" << std::endl;
             f << "protocol=sprot" << std::endl;
+            f << ";transport=tcp (Linux) accepts persistent connections from fplogd at ip and is used with protocol=none (default for tcp)," << std::endl;
+            f << ";fplogd is not told then whether a batch has arrived, protocol=sprot on both ends tells it." << std::endl;
+            f << ";io=uring receives udp batches through io_uring on Linux 6.0+, datagrams larger than uring_datagram_size (2048) are dropped." << std::endl;
+            f << ";io=uring" << std::endl;
+            f << ";Compressed batches are detected automatically, dictionary must match the one used by fplogd." << std::endl;
+            f << ";compression_dictionary=" << std::endl;
             f << "ip=127.0.0.1" << std::endl;
             f << "uid=18751_18752" << std::endl;
+
+            f << ";One udt port for any number of fplogd instances, served by a pool of worker threads." << std::endl;
+            f << ";Sender ip is not checked unless ip is set." << std::endl;
+            f << ";Breaking change: transport=udt receives every frame as a message (UDT message mode), fplogd of older versions (UDT stream mode) cannot talk to it, upgrade both ends together." << std::endl;
+            f << ";[connection_1]" << std::endl;
+            f << ";type=ip" << std::endl;
+            f << ";transport=udt" << std::endl;
+            f << ";multi=true" << std::endl;
+            f << ";workers=2" << std::endl;
+            f << ";uid=18753_18754" << std::endl;
+        }
+
+        //Parsed once and replaced as a whole by reload(), readers keep the snapshot they got while a reload happens.
+        std::mutex mutex_;
+        std::string file_name_;
+        std::shared_ptr<const boost::property_tree::ptree> ini_;
+
+        Configuration() { reload(); }
+
+        std::shared_ptr<const boost::property_tree::ptree> ini()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return ini_;
         }
 
 
@@ -138,27 +170,43 @@ class Configuration
         static Configuration& instance()
         {
             static Configuration instance;
-            
-            std::string home(get_home_dir());
-            std::string config_file(home + g_config_file_name);
-            
-            std::ifstream file_exists_check(config_file);
-            if (!file_exists_check.good())
-                make_default_configuration(config_file);
-            
             return instance;
         }
 
+        //Reads the ini file again, the default one is written if there is none. Returns true when the content has changed.
+        //Throws if the file cannot be parsed, previous content stays in use then.
+        bool reload()
+        {
+            std::string file_name(get_home_dir() + g_config_file_name);
+
+            std::ifstream file_exists_check(file_name);
+            if (!file_exists_check.good())
+                make_default_configuration(file_name);
+
+            std::shared_ptr<boost::property_tree::ptree> pt(std::make_shared<boost::property_tree::ptree>());
+            read_ini(file_name, *pt);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            bool changed = !ini_ || (file_name != file_name_) || (*ini_ != *pt);
+
+            file_name_ = file_name;
+            ini_ = pt;
+
+            return changed;
+        }
+
+        std::string get_file_name()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return file_name_;
+        }
+
         fplog::Transport_Interface::Params get_misc_config()
         {
-            using boost::property_tree::ptree;
-            ptree pt;
+            std::shared_ptr<const boost::property_tree::ptree> pt(ini());
             fplog::Transport_Interface::Params res;
             
-            std::string home(get_home_dir());
-            read_ini(home + g_config_file_name, pt);
-            
-            for (auto& section: pt)
+            for (auto& section: *pt)
             {
                 if (section.first.find(g_config_file_misc_section_name) == std::string::npos)
                     continue;
@@ -175,14 +223,10 @@ class Configuration
         
         fplog::Transport_Interface::Params get_log_storage_config()
         {
-            using boost::property_tree::ptree;
-            ptree pt;
+            std::shared_ptr<const boost::property_tree::ptree> pt(ini());
             fplog::Transport_Interface::Params res;
             
-            std::string home(get_home_dir());
-            read_ini(home + g_config_file_name, pt);
-            
-            for (auto& section: pt)
+            for (auto& section: *pt)
             {
                 if (section.first.find(g_config_file_storage_section_name) == std::string::npos)
                     continue;
@@ -199,14 +243,10 @@ class Configuration
         
         std::vector<fplog::Transport_Interface::Params> get_connections()
         {
-            using boost::property_tree::ptree;
-            ptree pt;
+            std::shared_ptr<const boost::property_tree::ptree> pt(ini());
             std::vector<fplog::Transport_Interface::Params> res;
             
-            std::string home(get_home_dir());
-            read_ini(home + g_config_file_name, pt);
-            
-            for (auto& section: pt)
+            for (auto& section: *pt)
             {
                 fplog::Transport_Interface::Params params;
                 
@@ -301,9 +341,18 @@ class Impl
             fplog::Transport_Interface::Params misc(Configuration::instance().get_misc_config());
             mq_.apply_config(misc);
 
+            //queue limits and emergency algos follow edits of the ini file from now on
+            config_watcher_.reset(new generic_util::File_Watcher(Configuration::instance().get_file_name(), std::bind(&Impl::reconfigure, this)));
+
             std::vector<fplog::Transport_Interface::Params> params(Configuration::instance().get_connections());
             for (auto param : params)
             {
+                if (generic_util::find_str_no_case(param["transport"], "udt") && generic_util::find_str_no_case(param["multi"], "true"))
+                {
+                    start_udt_ingest(param);
+                    continue;
+                }
+
                 Thread_Data* worker = new Thread_Data();
                 
                 worker->params = param;
@@ -315,6 +364,8 @@ class Impl
 
         void stop()
         {
+            config_watcher_.reset();
+
             {
                 std::lock_guard<std::recursive_mutex> lock(mutex_);
                 should_stop_ = true;
@@ -322,6 +373,16 @@ class Impl
 
             join_all_threads();
 
+            for (auto ingest : ingests_)
+            {
+                for (auto& protocol : ingest->protocols)
+                    delete protocol.second;
+
+                delete ingest;
+            }
+
+            ingests_.clear();
+
             std::string* str = 0;
             do
             {
@@ -340,14 +401,195 @@ class Impl
     private:
 
 
+        //All fplogd instances connected to one UDT port, served by a pool of udt_ingest threads.
+        struct Udt_Ingest
+        {
+            spipc::UDT_Listener listener;
+            std::string dictionary;
+            bool vsprot;
+
+            //protocol chain of every connection, created when the connection sends something for the first time
+            std::mutex mutex;
+            std::map<spipc::UDT_Listener::Connection_Id, fplog::Transport_Interface*> protocols;
+        };
+
         struct Thread_Data
         {
-            Thread_Data(): thread(0) {}
+            Thread_Data(): thread(0), ingest(0) {}
 
             std::thread* thread;
             fplog::Transport_Interface::Params params;
+            Udt_Ingest* ingest;
         };
 
+        //Called by config_watcher_ when the ini file changes, connections and storage are read again on the next start only.
+        void reconfigure()
+        {
+            try
+            {
+                if (!Configuration::instance().reload())
+                    return;
+
+                fplog::Transport_Interface::Params misc(Configuration::instance().get_misc_config());
+
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                mq_.apply_config(misc);
+            }
+            catch(std::exception& e)
+            {
+                printf("Changed configuration is not applied: %s\n", e.what());
+            }
+        }
+
+        //Must be called under mutex_.
+        void enqueue_received(const std::string& str)
+        {
+            fplog::Message msg(str);
+
+            if (!msg.has_batch())
+            {
+                mq_.push(new std::string(str));
+            }
+            else
+            {
+                JSONNode batch(msg.get_batch());
+                for (auto item: batch)
+                    mq_.push(new std::string(item.write()));
+            }
+        }
+
+        void start_udt_ingest(fplog::Transport_Interface::Params& params)
+        {
+            Udt_Ingest* ingest = new Udt_Ingest();
+
+            try
+            {
+                ingest->vsprot = generic_util::find_str_no_case(params["protocol"], "vsprot");
+                ingest->dictionary = sprot::Lz_Codec::load_dictionary(params["compression_dictionary"]);
+                ingest->listener.listen(params);
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                printf("UDT ingest is not started, logs from it will not be coming in: %s\n", e.what().c_str());
+                delete ingest;
+                return;
+            }
+
+            ingests_.push_back(ingest);
+
+            int workers = default_udt_workers;
+
+            try
+            {
+                if (!params["workers"].empty())
+                    workers = std::stoi(params["workers"]);
+            }
+            catch (std::exception&)
+            {
+                workers = default_udt_workers;
+            }
+
+            if ((workers < 1) || (workers > 64))
+                workers = default_udt_workers;
+
+            for (int i = 0; i < workers; ++i)
+            {
+                Thread_Data* worker = new Thread_Data();
+
+                worker->params = params;
+                worker->ingest = ingest;
+                worker->thread = new std::thread(&Impl::udt_ingest, this, worker);
+
+                pool_.push_back(worker);
+            }
+        }
+
+        //Any worker serves any connection, the listener hands a readable connection to one worker at a time,
+        //so sprot state of the connection is never used by two threads at once.
+        void udt_ingest(Thread_Data* data)
+        {
+            Udt_Ingest* ingest = data->ingest;
+            std::vector<char> buf(30 * 1024);
+
+            while(true)
+            {
+                {
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    if (should_stop_)
+                        return;
+                }
+
+                spipc::UDT_Listener::Connection_Id id = 0;
+
+                try
+                {
+                    if (!ingest->listener.wait_readable(id, 1000))
+                        continue;
+                }
+                catch(fplog::exceptions::Generic_Exception)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    continue;
+                }
+
+                fplog::Transport_Interface* protocol = 0;
+
+                {
+                    std::lock_guard<std::mutex> lock(ingest->mutex);
+
+                    //UDT_Transport on the fplogd side always runs sprot, protocol=none is not supported here
+                    protocol = ingest->protocols[id];
+                    if (!protocol)
+                    {
+                        fplog::Transport_Interface* connection = ingest->listener.connection(id);
+
+                        if (ingest->vsprot)
+                            protocol = new vsprot::Protocol(connection);
+                        else
+                            protocol = new sprot::Protocol(connection);
+
+                        protocol = new sprot::Compressing_Protocol(protocol, false, ingest->dictionary);
+                        ingest->protocols[id] = protocol;
+                    }
+                }
+
+                try
+                {
+                    size_t bytes = protocol->read(&buf[0], buf.size() - 1, udt_read_timeout);
+                    buf[bytes] = 0;
+
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    enqueue_received(&buf[0]);
+                }
+                catch(fplog::exceptions::Buffer_Overflow&)
+                {
+                    buf.resize(buf.size() * 2);
+                }
+                catch(fplog::exceptions::Timeout&)
+                {
+                    //readable connection might hold only a part of a batch or a late ACK, the rest comes with the next wakeup
+                }
+                catch(fplog::exceptions::Generic_Exception& e)
+                {
+                    printf("UDT batch from connection %d is not received: %s\n", id, e.what().c_str());
+                }
+
+                if (ingest->listener.is_broken(id))
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(ingest->mutex);
+
+                        delete ingest->protocols[id];
+                        ingest->protocols.erase(id);
+                    }
+
+                    ingest->listener.close_connection(id);
+                }
+                else
+                    ingest->listener.release(id);
+            }
+        }
+
         void fplogd_listener(Thread_Data* data)
         {
             fpcollect::Transport_Factory factory;
@@ -359,6 +601,9 @@ class Impl
 
             std::auto_ptr<fplog::Transport_Interface> autokill(transport);
 
+            //fpcollect is the accepting side of connection oriented transports (tcp)
+            data->params["listen"] = "true";
+
             try
             {
                 transport->connect(data->params);
@@ -379,13 +624,33 @@ class Impl
 					{
 						protocol = new vsprot::Protocol(transport);
 					}
+					else if (generic_util::find_str_no_case(param.second, "none"))
+					{
+						protocol = transport;
+					}
 					else
 						protocol = new sprot::Protocol(transport);
 				}
 			}
 			
 			if (!protocol)
-				protocol = new sprot::Protocol(transport);
+				protocol = generic_util::find_str_no_case(data->params["transport"], "tcp") ? transport : new sprot::Protocol(transport);
+
+            //read without protocol, the transport goes away together with the compression layer
+            if (protocol == transport)
+                autokill.release();
+
+            //compressed batches are detected by their header, uncompressed ones pass through untouched
+            try
+            {
+                protocol = new sprot::Compressing_Protocol(protocol, false, sprot::Lz_Codec::load_dictionary(data->params["compression_dictionary"]));
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                delete protocol;
+                printf("Compression dictionary is not loaded, logs from the connection will not be coming in: %s\n", e.what().c_str());
+                return;
+            }
 				
 			std::auto_ptr<fplog::Transport_Interface> autokill_proto(protocol);
 
@@ -412,18 +677,7 @@ class Impl
                         continue;
                     }
 
-                    fplog::Message msg(new_str);
-
-                    if (!msg.has_batch())
-                    {
-                        mq_.push(new std::string(buf));
-                    }
-                    else
-                    {
-                        JSONNode batch(msg.get_batch());
-                        for (auto item: batch)
-                            mq_.push(new std::string(item.write()));
-                    }
+                    enqueue_received(new_str);
 
                     old_str = new_str;
 
@@ -549,12 +803,20 @@ class Impl
         std::recursive_mutex mutex_;
         Queue_Controller mq_;
 
+        std::unique_ptr<generic_util::File_Watcher> config_watcher_;
+
         std::thread overload_checker_;
         std::thread mq_reader_;
 
         volatile bool should_stop_;
         fplog::Transport_Interface* storage_;
         std::vector<Thread_Data*> pool_;
+
+        std::vector<Udt_Ingest*> ingests_;
+        static const int default_udt_workers = 2;
+        //connection is readable when handed out, but it might be just a late ACK with no data behind it,
+        //long wait here would keep the worker from other connections whose senders wait for ACK
+        static const size_t udt_read_timeout = 200; //ms
 };
 
 class Console_Output: public fplog::Transport_Interface
@@ -576,6 +838,9 @@ static fplog::Transport_Interface* g_storage = 0;
 
 void start()
 {
+    //running fpcollect reads the file once here, changes made later come through reconfigure()
+    fpcollect::Configuration::instance().reload();
+
     //g_impl.set_log_storage(&g_storage);
     fplog::Transport_Interface::Params params(fpcollect::Configuration::instance().get_log_storage_config());
     
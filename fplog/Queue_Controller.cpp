@@ -354,6 +354,16 @@ void Queue_Controller::change_params(size_t size_limit, size_t timeout)
 {
     max_size_ = size_limit;
     emergency_time_trigger_ = timeout;
+    update_algos();
+}
+
+void Queue_Controller::update_algos()
+{
+    if (algo_)
+        algo_->max_size_ = max_size_;
+
+    if (algo_fallback_)
+        algo_fallback_->max_size_ = max_size_;
 }
 
 shared_ptr<Queue_Controller::Algo> Queue_Controller::make_algo(const std::string& name, const std::string& param)
@@ -443,13 +453,19 @@ void Queue_Controller::apply_config(const fplog::Transport_Interface::Params& pa
         }
     }
 
-    if (!emergency_fallback_algo.empty())
+    //unknown name keeps the algo in use, config can be applied again while the queue works
+    std::shared_ptr<Algo> algo;
+
+    if (!emergency_fallback_algo.empty() && (algo = make_algo(emergency_fallback_algo, emergency_prio)))
     {
-        algo_fallback_ = make_algo(emergency_fallback_algo, emergency_prio);
+        algo_fallback_ = algo;
     }
 
-    if (!emergency_algo.empty())
+    if (!emergency_algo.empty() && (algo = make_algo(emergency_algo, emergency_prio)))
     {
-        algo_ = make_algo(emergency_algo, emergency_prio);
+        algo_ = algo;
     }
+
+    //algos kept from before still have the previous max_queue_size
+    update_algos();
 }
@@ -55,6 +55,9 @@ class FPLOG_API Queue_Controller
             private:
                 
                 Algo();
+
+                //max_size_ follows change_params and apply_config of the controller
+                friend class Queue_Controller;
             
 
             protected:    
@@ -110,6 +113,7 @@ class FPLOG_API Queue_Controller
 
         bool state_of_emergency();
         void handle_emergency();
+        void update_algos();
         
         std::shared_ptr<Algo> make_algo(const std::string& name, const std::string& param);
 };
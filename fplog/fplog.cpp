@@ -7,12 +7,19 @@
 #include <lua.hpp>
 #include <spipc/UDT_Transport.h>
 #include <spipc/socket_transport.h>
+#include <spipc/unix_socket_transport.h>
+#include <spipc/shared_memory_transport.h>
 #include <sprot/sprot.h>
+#include <sprot/channel_mux.h>
 #include <mutex>
 #include <chaiscript/chaiscript.hpp>
 #include <chaiscript/chaiscript_stdlib.hpp>
 #include "Queue_Controller.h"
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 namespace fplog
 {
 
@@ -433,6 +440,43 @@ std::vector<std::string> Message::reserved_names_;
 
 FPLOG_API std::vector<std::string> g_test_results_vector;
 
+static In_Process_Sink* g_in_process_sink = 0;
+static std::recursive_mutex g_in_process_sink_mutex;
+
+const char* get_fplogd_pid_file()
+{
+#ifdef _WIN32
+    static std::string path(std::string(getenv("ProgramData") ? getenv("ProgramData") : ".") + "\\fplogd.pid");
+#else
+    //directory others cannot write to, so nobody else can plant or lock the file
+    static std::string path((geteuid() == 0) ? std::string("/run/fplogd/fplogd.pid") :
+        (getenv("XDG_RUNTIME_DIR") ? std::string(getenv("XDG_RUNTIME_DIR")) + "/fplogd.pid" : "/tmp/fplogd-" + std::to_string(geteuid()) + ".pid"));
+#endif
+
+    return path.c_str();
+}
+
+void set_in_process_sink(In_Process_Sink* sink)
+{
+    //waits for pushes in progress, the old sink is not used once this returns
+    std::lock_guard<std::recursive_mutex> lock(g_in_process_sink_mutex);
+    g_in_process_sink = sink;
+}
+
+static bool push_to_in_process_sink(std::string* msg)
+{
+    std::lock_guard<std::recursive_mutex> lock(g_in_process_sink_mutex);
+
+    if (!g_in_process_sink)
+    {
+        delete msg;
+        return false;
+    }
+
+    g_in_process_sink->push(msg);
+    return true;
+}
+
 class FPLOG_API Fplog_Impl
 {
     public:
@@ -441,9 +485,12 @@ class FPLOG_API Fplog_Impl
         appname_("noname"),
         inited_(false),
         own_transport_(true),
+        in_process_(false),
         test_mode_(false),
         stopping_(false),
         transport_(0),
+        protocol_(0),
+        mux_(0),
         mq_reader_(0),
         async_logging_(true)
         {
@@ -458,7 +505,12 @@ class FPLOG_API Fplog_Impl
             std::lock_guard<std::recursive_mutex> lock(mutex_);
 
             delete mq_reader_;
-            delete protocol_;
+
+            //channel protocol is owned by the mux, local transports are used without protocol
+            if (mux_)
+                delete mux_;
+            else if (protocol_ != transport_)
+                delete protocol_;
 
             if (inited_ && own_transport_)
                 delete transport_;
@@ -508,15 +560,34 @@ class FPLOG_API Fplog_Impl
             else
             {
                 own_transport_ = true;
-                transport_ = new spipc::Socket_Transport();
 
-                fplog::Transport_Interface::Params params;
-                params["uid"] = uid;
-                params["ip"] = "127.0.0.1";
+                std::string uid_str(uid ? uid : "");
+
+                //fplogd pipeline lives in this process, messages are pushed to its queue without IPC and sprot
+                if (uid_str == "inproc")
+                {
+                    std::lock_guard<std::recursive_mutex> sink_lock(g_in_process_sink_mutex);
+                    if (!g_in_process_sink)
+                        THROWM(fplog::exceptions::Connect_Failed, "In-process fplogd is not started.");
 
-                transport_->connect(params);
-                protocol_ = new sprot::Protocol(transport_);
+                    in_process_ = true;
+                    inited_ = true;
+                    return;
+                }
 
+                //fplogd that is starting is waited for, so the first messages do not go to a channel it does not listen on yet
+                if (generic_util::Pid_File::state(get_fplogd_pid_file()) == generic_util::Pid_File::State::held)
+                    generic_util::Pid_File::wait_ready(get_fplogd_pid_file(), fplogd_start_timeout);
+
+                //fplogd hands out a channel of its own, uid of the registration endpoint may be prefixed with the wanted transport
+                const std::string register_prefix("register:");
+                if (uid_str.find(register_prefix) == 0)
+                {
+                    registration_ = uid_str.substr(register_prefix.size());
+                    uid_str = register_channel();
+                }
+
+                connect(uid_str);
                 inited_ = true;
             }
         }
@@ -556,6 +627,11 @@ class FPLOG_API Fplog_Impl
 
                 if (test_mode_)
                     g_test_results_vector.push_back(strip_timestamp_and_sequence(msg.as_string()));
+                else if (in_process_)
+                {
+                    //queue of fplogd is asynchronous by itself, so the message goes there right away in both modes
+                    push_to_in_process_sink(new std::string(msg.as_string()));
+                }
                 else
                 {
                     if (async_logging_)
@@ -579,6 +655,10 @@ class FPLOG_API Fplog_Impl
                             {
                                 //std::cout << "message not sent, err = " << e.what() << std::endl;
                                 send_retries--;
+
+                                if (!registration_.empty() && (send_retries % failures_before_registration == 0))
+                                    register_again();
+
                                 std::this_thread::sleep_for(std::chrono::milliseconds(10));
                             }
                         }
@@ -651,6 +731,7 @@ class FPLOG_API Fplog_Impl
         Shared_Sequence_Number sequence_;
         bool inited_;
         bool own_transport_;
+        bool in_process_;
         bool test_mode_;
 
         volatile bool stopping_;
@@ -675,6 +756,160 @@ class FPLOG_API Fplog_Impl
 
         fplog::Transport_Interface* transport_;
         fplog::Transport_Interface* protocol_;
+        sprot::Channel_Mux* mux_;
+
+        //what follows "register:" in initlog uid, empty if the channel was not given by fplogd registration endpoint
+        std::string registration_;
+        static const size_t registration_timeout = 3000; //ms
+        static const size_t fplogd_start_timeout = 5000; //ms
+        static const int failures_before_registration = 5;
+
+        //Opens the channel described by uid in any form initlog takes except "inproc" and "register:",
+        //current transport, protocol and mux are replaced only if it succeeds.
+        void connect(const std::string& uid_str)
+        {
+            const std::string mux_prefix("mux:");
+            const std::string unix_prefix("unix:");
+            const std::string shm_prefix("shm:");
+            bool use_mux = (uid_str.find(mux_prefix) == 0);
+            bool use_unix = (uid_str.find(unix_prefix) == 0);
+            bool use_shm = (uid_str.find(shm_prefix) == 0);
+
+            fplog::Transport_Interface::Params params;
+
+            if (use_unix || use_shm)
+            {
+                //local socket and shared memory ring are reliable and keep message boundaries, no need for sprot
+                params["uid"] = uid_str.substr(use_unix ? unix_prefix.size() : shm_prefix.size());
+
+                std::unique_ptr<fplog::Transport_Interface> transport;
+
+                if (use_unix)
+                    transport.reset(new spipc::Unix_Socket_Transport());
+                else
+                    transport.reset(new spipc::Shared_Memory_Transport());
+
+                transport->connect(params);
+
+                transport_ = transport.release();
+                protocol_ = transport_;
+                mux_ = 0;
+
+                return;
+            }
+
+            std::unique_ptr<spipc::Socket_Transport> socket_transport(new spipc::Socket_Transport());
+
+            params["uid"] = use_mux ? uid_str.substr(mux_prefix.size()) : uid_str;
+            params["ip"] = "127.0.0.1";
+
+            if (use_mux)
+            {
+                //fplogd owns the shared endpoint, local port of this process becomes the channel id
+                params["mux"] = "true";
+
+                socket_transport->connect(params);
+                if (socket_transport->is_mux_endpoint())
+                    THROWM(fplog::exceptions::Connect_Failed, "fplogd is not listening on the shared mux endpoint.");
+
+                mux_ = new sprot::Channel_Mux(socket_transport.get());
+                protocol_ = mux_->channel(socket_transport->local_port());
+            }
+            else
+            {
+                socket_transport->connect(params);
+
+                mux_ = 0;
+                protocol_ = new sprot::Protocol(socket_transport.get());
+            }
+
+            transport_ = socket_transport.release();
+        }
+
+        //Asks fplogd registration endpoint (registration_uid in fplogd.ini) for a channel and returns its uid.
+        std::string register_channel()
+        {
+            //fplogd that is gone is not asked, every attempt would wait for registration_timeout otherwise
+            if (generic_util::Pid_File::state(get_fplogd_pid_file()) == generic_util::Pid_File::State::released)
+                THROWM(fplog::exceptions::Connect_Failed, "fplogd is not running.");
+
+            std::string uid(registration_);
+            std::string transport("udp");
+
+            size_t prefix_end = uid.find(':');
+            if (prefix_end != std::string::npos)
+            {
+                transport = uid.substr(0, prefix_end);
+                uid = uid.substr(prefix_end + 1);
+            }
+
+            spipc::Socket_Transport socket_transport;
+            fplog::Transport_Interface::Params params;
+
+            params["uid"] = uid;
+            params["ip"] = "127.0.0.1";
+            params["mux"] = "true";
+
+            socket_transport.connect(params);
+            if (socket_transport.is_mux_endpoint())
+                THROWM(fplog::exceptions::Connect_Failed, "fplogd is not listening on the registration endpoint.");
+
+            sprot::Channel_Mux mux(&socket_transport);
+            fplog::Transport_Interface* channel = mux.channel(socket_transport.local_port());
+
+            JSONNode request(JSON_NODE);
+            request.push_back(JSONNode(Message::Mandatory_Fields::appname, appname_));
+            request.push_back(JSONNode("transport", transport));
+
+            std::string request_str(request.write());
+            channel->write(request_str.c_str(), request_str.size(), registration_timeout);
+
+            char reply_buf[512];
+            memset(reply_buf, 0, sizeof(reply_buf));
+            channel->read(reply_buf, sizeof(reply_buf) - 1, registration_timeout);
+
+            try
+            {
+                JSONNode reply(libjson::parse(reply_buf));
+
+                auto assigned = reply.find("uid");
+                if (assigned != reply.end())
+                    return assigned->as_string();
+
+                auto error = reply.find("error");
+                THROWM(fplog::exceptions::Connect_Failed, (error != reply.end()) ? error->as_string().c_str() : "Registration is refused by fplogd.");
+            }
+            catch(std::invalid_argument&)
+            {
+                THROWM(fplog::exceptions::Connect_Failed, "Malformed reply from fplogd registration endpoint.");
+            }
+        }
+
+        //Channel given by registration is closed by fplogd after a while without messages, a new one is asked for when writes keep failing.
+        void register_again()
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+            fplog::Transport_Interface* transport = transport_;
+            fplog::Transport_Interface* protocol = protocol_;
+            sprot::Channel_Mux* mux = mux_;
+
+            try
+            {
+                connect(register_channel());
+            }
+            catch(fplog::exceptions::Generic_Exception&)
+            {
+                return;
+            }
+
+            if (mux)
+                delete mux;
+            else if (protocol != transport)
+                delete protocol;
+
+            delete transport;
+        }
 
         void stop_reading_queue()
         {
@@ -702,6 +937,7 @@ class FPLOG_API Fplog_Impl
                 }
 
                 std::auto_ptr<std::string> str_ptr(str);
+                int failures = 0;
 
             retry:
 
@@ -722,6 +958,9 @@ class FPLOG_API Fplog_Impl
                 }
                 catch(fplog::exceptions::Generic_Exception)
                 {
+                    if (!registration_.empty() && (++failures % failures_before_registration == 0))
+                        register_again();
+
                     std::this_thread::sleep_for(std::chrono::milliseconds(10));
                     goto retry;
                 }
@@ -387,11 +387,38 @@ class FPLOG_API Priority_Filter: public Filter_Base
         void construct_numeric();
 };
 
+//Messages that never leave the process go here instead of IPC, implemented by the in-process fplogd (see fplogd::start_in_process).
+class FPLOG_API In_Process_Sink
+{
+    public:
+
+        //Takes ownership of the message, it is serialized already and has appname and sequence set.
+        virtual void push(std::string* msg) = 0;
+        virtual ~In_Process_Sink() {}
+};
+
+//Called by the in-process fplogd when it starts and with 0 when it stops.
+FPLOG_API void set_in_process_sink(In_Process_Sink* sink);
+
+//fplogd keeps this file locked while it runs and writes its pid there once it serves channels, see generic_util::Pid_File.
+//The file is per user: /run/fplogd/fplogd.pid for root, $XDG_RUNTIME_DIR/fplogd.pid or /tmp/fplogd-<uid>.pid for others.
+//Apps only see fplogd run by their own user, for the others there is no file and they connect without waiting, as before.
+FPLOG_API const char* get_fplogd_pid_file();
+
 //One time per application call.
 //async_logging means that log messages are going to the queue before dispatching to the destination.
 //This process is faster than sync logging but it also means that if app crashes with some messages still
 //in the queue, those messages are lost. If you need to debug some app crash, set this parameter to false
 //until you find the reason for the crash.
+//uid is the port pair of the dedicated fplogd channel, e.g. "18749_18750",
+//or "mux:" followed by the port pair of fplogd shared endpoint (mux_uid in fplogd.ini), e.g. "mux:18747_18748",
+//or "unix:" or "shm:" followed by the port pair of a channel that fplogd.ini declares with the same prefix,
+//e.g. "unix:18749_18750", to log over local unix domain socket (Linux only) or shared memory ring without sprot handshake,
+//or "inproc" to hand messages straight to fplogd running inside the application, fplogd::start_in_process() must be called first,
+//or "register:" followed by the port pair of fplogd registration endpoint (registration_uid in fplogd.ini), e.g. "register:18745_18746",
+//to get a udp channel assigned by fplogd without listing the app in fplogd.ini, "register:shm:18745_18746" or "register:unix:18745_18746"
+//asks for a shared memory ring or a unix socket channel instead; a new channel is asked for if fplogd reclaims an idle one.
+//If fplogd is starting right now, initlog waits until it serves channels; registration fails at once if fplogd is not running.
 FPLOG_API void initlog(const char* appname, const char* uid, fplog::Transport_Interface* transport = 0, bool async_logging = true);
 
 //One time per application call to stop logging from an application and free all associated resources.
@@ -45,6 +45,8 @@ int _getch() {
 #include <spipc/UDT_Transport.h>
 #include <spipc/socket_transport.h>
 #include "Queue_Controller.h"
+#include <fplogd/journal.h>
+#include <fplogd/aggregator.h>
 #include <random>
 
 using namespace std;
@@ -1061,6 +1063,43 @@ bool controller_apply_config_test()
     return true;
 }
 
+//Config applied again while the queue works, e.g. after fplogd.ini was edited: algos in use have to follow the new limit.
+bool controller_reapply_config_test()
+{
+    Queue_Controller qc(20000, 0);
+    qc.change_algo(std::make_shared<Queue_Controller::Remove_Oldest>(qc), Queue_Controller::Algo::Fallback_Options::Remove_Oldest);
+
+    fplog::Transport_Interface::Params params;
+    params["max_queue_size"] = "200";
+    params["emergency_algo"] = "no_such_algo";
+
+    qc.apply_config(params);
+
+    std::string msg("Ten bytes.");
+
+    for (int i = 0; i < 30; ++i)
+        qc.push(new std::string(msg));
+
+    std::vector<std::string*> v;
+
+    while (!qc.empty())
+    {
+        v.push_back(qc.front());
+        qc.pop();
+    }
+
+    for (auto str : v)
+        delete str;
+
+    if (v.size() != 20)
+    {
+        cout << "Incorrect size of queue detected! (" << v.size() << ")." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 bool queue_controller_test()
 {
     if (!remove_newest_test())
@@ -1093,6 +1132,12 @@ bool queue_controller_test()
         return false;
     }
 
+    if (!controller_reapply_config_test())
+    {
+        cout << "Queue_Controller::apply_config test of changed config failed!" << std::endl;
+        return false;
+    }
+
     return true;
 }
 
@@ -1182,6 +1227,620 @@ TEST(Message_Test, Add_Json_From_String)
     EXPECT_TRUE(msg.as_string().find("\"inserted_json\":{\"invader\":\"Tim\",\"earth\":false}") != std::string::npos);
 }
 
+TEST(Batch_Test, Json_Scanner)
+{
+    const char* field = 0;
+    size_t field_size = 0;
+
+    std::string msg(" {\"text\":\"a \\\"quoted\\\" }\",\"appname\":\"scanner\\u0021\",\"nested\":{\"appname\":\"inner\",\"list\":[1,-2.5e3,true,null,{}]}} ");
+    EXPECT_TRUE(generic_util::scan_json_object(msg.c_str(), msg.size(), fplog::Message::Mandatory_Fields::appname, &field, &field_size));
+    EXPECT_EQ(std::string(field, field_size), "scanner\\u0021");
+
+    EXPECT_TRUE(generic_util::scan_json_object("{}", 2, fplog::Message::Mandatory_Fields::appname, &field, &field_size));
+    EXPECT_TRUE(field == 0);
+
+    const char* malformed[] = {"", "[1,2]", "{\"a\":1", "{\"a\":1,}", "{\"a\" 1}", "{\"a\":01}", "{\"a\":tru}", "{\"a\":\"\\x\"}", "{\"a\":1}}", "{a:1}", "{\"a\":[1,]}"};
+    for (auto json : malformed)
+        EXPECT_FALSE(generic_util::scan_json_object(json, strlen(json))) << json;
+
+    std::string deep(1000, '[');
+    deep = "{\"a\":" + deep + std::string(1000, ']') + "}";
+    EXPECT_FALSE(generic_util::scan_json_object(deep.c_str(), deep.size()));
+}
+
+TEST(Batch_Test, Json_Fields_Scanner)
+{
+    const char* names[] = {"appname", "duration", "ok", "nested", "missing", "appname"};
+    const char* values[6];
+    size_t sizes[6];
+
+    std::string msg("{\"appname\":\"scanner\",\"duration\":-12.5e1,\"ok\":true,\"nested\":{\"duration\":1},\"appname\":\"second\"}");
+    EXPECT_TRUE(generic_util::scan_json_fields(msg.c_str(), msg.size(), names, 6, values, sizes));
+
+    EXPECT_EQ(std::string(values[0], sizes[0]), "\"scanner\"");
+    EXPECT_EQ(std::string(values[1], sizes[1]), "-12.5e1");
+    EXPECT_EQ(std::string(values[2], sizes[2]), "true");
+    EXPECT_TRUE(values[3] == 0);
+    EXPECT_TRUE(values[4] == 0);
+    EXPECT_EQ(std::string(values[5], sizes[5]), "\"scanner\"");
+
+    EXPECT_FALSE(generic_util::scan_json_fields("{\"a\":1,}", 8, names, 6, values, sizes));
+
+    //lookup stops at the field, what follows it is not checked
+    const char* field = 0;
+    size_t field_size = 0;
+
+    std::string partial("{\"nested\":{\"priority\":\"debug\"},\"priority\":\"critical\",\"text\":");
+    EXPECT_TRUE(generic_util::find_json_string(partial.c_str(), partial.size(), fplog::Message::Mandatory_Fields::priority, &field, &field_size));
+    EXPECT_EQ(std::string(field, field_size), "critical");
+
+    EXPECT_FALSE(generic_util::find_json_string(msg.c_str(), msg.size(), fplog::Message::Mandatory_Fields::priority, &field, &field_size));
+    EXPECT_TRUE(field == 0);
+}
+
+TEST(Batch_Test, Relayed_Batch)
+{
+    const char* items = 0;
+    size_t items_size = 0;
+
+    std::string edge("{\"priority\":\"info\",\"batch\":[{\"appname\":\"a\",\"hostname\":\"edge\"},{\"appname\":\"b\",\"hostname\":\"edge\"}],\"hostname\":\"edge\"}");
+    EXPECT_TRUE(generic_util::scan_json_batch(edge.c_str(), edge.size(), fplog::Message::Optional_Fields::batch, &items, &items_size));
+
+    std::string relayed(items, items_size);
+    EXPECT_EQ(relayed, "[{\"appname\":\"a\",\"hostname\":\"edge\"},{\"appname\":\"b\",\"hostname\":\"edge\"}]");
+
+    EXPECT_FALSE(generic_util::scan_json_batch("{\"batch\":{}}", 11, fplog::Message::Optional_Fields::batch, &items, &items_size));
+    EXPECT_FALSE(generic_util::scan_json_batch("{\"batch\":[1,]}", 13, fplog::Message::Optional_Fields::batch, &items, &items_size));
+
+    const char* field = 0;
+    size_t field_size = 0;
+    size_t count = 0;
+
+    EXPECT_TRUE(generic_util::scan_json_objects(relayed.c_str(), relayed.size(), &count, fplog::Message::Mandatory_Fields::appname, &field, &field_size));
+    EXPECT_EQ(count, 2u);
+    EXPECT_EQ(std::string(field, field_size), "a");
+
+    EXPECT_TRUE(generic_util::scan_json_objects(" [ ] ", 5, &count));
+    EXPECT_EQ(count, 0u);
+    EXPECT_FALSE(generic_util::scan_json_objects("[{},1]", 6, &count));
+    EXPECT_FALSE(generic_util::scan_json_objects("{}", 2, &count));
+
+    //relayed messages keep their hostname, the fragment goes into single messages and the batch only
+    generic_util::Json_Batch_Builder builder(fplog::Message::Optional_Fields::batch, ",\"hostname\":\"relay\"");
+    builder.start("{\"priority\":\"info\"");
+    builder.add(std::string("{\"appname\":\"c\"}"));
+    builder.add_items(relayed.c_str(), relayed.size(), 2);
+    builder.add_items("[]", 2, 0);
+
+    EXPECT_EQ(builder.count(), 3u);
+
+    std::unique_ptr<std::string> batch(builder.finish());
+    EXPECT_EQ(*batch, "{\"priority\":\"info\",\"batch\":[{\"appname\":\"c\",\"hostname\":\"relay\"},{\"appname\":\"a\",\"hostname\":\"edge\"},"
+        "{\"appname\":\"b\",\"hostname\":\"edge\"}],\"hostname\":\"relay\"}");
+    EXPECT_TRUE(generic_util::scan_json_object(batch->c_str(), batch->size()));
+}
+
+TEST(Pid_File_Test, Liveness)
+{
+    std::string path((boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("fplog_test_%%%%%%%%.pid")).string());
+    EXPECT_TRUE(generic_util::Pid_File::state(path) == generic_util::Pid_File::State::none);
+
+    generic_util::Pid_File pid_file(path);
+    EXPECT_TRUE(pid_file.acquire());
+    EXPECT_TRUE(generic_util::Pid_File::state(path) == generic_util::Pid_File::State::held);
+    EXPECT_FALSE(generic_util::Pid_File::wait_ready(path, 100));
+
+    //lock belongs to the open file, another one is refused even within the same process
+    generic_util::Pid_File second(path);
+    EXPECT_FALSE(second.acquire());
+
+    std::thread starter([&pid_file]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        pid_file.set_ready();
+    });
+
+    EXPECT_TRUE(generic_util::Pid_File::wait_ready(path, 5000));
+    EXPECT_TRUE(generic_util::Pid_File::state(path) == generic_util::Pid_File::State::ready);
+    starter.join();
+
+    std::thread stopper([&pid_file]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        pid_file.release();
+    });
+
+    generic_util::Pid_File::wait_released(path);
+    EXPECT_TRUE(generic_util::Pid_File::state(path) == generic_util::Pid_File::State::released);
+    stopper.join();
+
+    EXPECT_TRUE(second.acquire());
+    second.release();
+    boost::filesystem::remove(path);
+}
+
+#ifdef _LINUX
+TEST(Pid_File_Test, Foreign_File)
+{
+    boost::filesystem::path dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("fplog_test_%%%%%%%%"));
+    boost::filesystem::create_directory(dir);
+    std::string path((dir / "fplogd.pid").string());
+    std::string target((dir / "target").string());
+
+    {
+        FILE* f = fopen(target.c_str(), "w");
+        fputs("data", f);
+        fclose(f);
+    }
+
+    //symlink planted at the path is neither followed nor truncated
+    EXPECT_EQ(0, symlink(target.c_str(), path.c_str()));
+    generic_util::Pid_File pid_file(path);
+    EXPECT_FALSE(pid_file.acquire());
+    EXPECT_TRUE(generic_util::Pid_File::state(path) == generic_util::Pid_File::State::none);
+    EXPECT_EQ(4, boost::filesystem::file_size(target));
+    boost::filesystem::remove(path);
+
+    //file of another user is not trusted either
+    if (geteuid() == 0)
+    {
+        generic_util::Pid_File owner(path);
+        EXPECT_TRUE(owner.acquire());
+        EXPECT_EQ(0, chown(path.c_str(), 65534, 65534));
+        EXPECT_TRUE(generic_util::Pid_File::state(path) == generic_util::Pid_File::State::none);
+        EXPECT_FALSE(pid_file.acquire());
+        owner.release();
+    }
+
+    //missing directory is created
+    boost::filesystem::remove_all(dir);
+    EXPECT_TRUE(pid_file.acquire());
+    EXPECT_TRUE(generic_util::Pid_File::state(path) == generic_util::Pid_File::State::held);
+    pid_file.release();
+
+    boost::filesystem::remove_all(dir);
+}
+#endif
+
+static std::string journal_test_message(int number)
+{
+    //1000 bytes take 1008 with the record header, 65 of them fit into a 64KB segment
+    char head[32];
+    sprintf(head, "message %d ", number);
+
+    std::string msg(head);
+    msg.resize(1000, 'x');
+    return msg;
+}
+
+TEST(Journal_Test, Replay_Without_Ack)
+{
+    boost::filesystem::path dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("fplog_test_%%%%%%%%"));
+
+    {
+        fplogd::Journal journal;
+        journal.open(dir.string(), 1024 * 1024, 64 * 1024, fplogd::Journal::Sync::none);
+
+        for (int i = 0; i < 10; i++)
+            EXPECT_TRUE(journal.append(journal_test_message(i).c_str(), 1000));
+
+        //what was read but not acknowledged is replayed too
+        unsigned long long id = 0;
+        std::unique_ptr<std::string> msg(journal.read(id));
+        ASSERT_TRUE(msg != 0);
+        EXPECT_EQ(journal_test_message(0), *msg);
+    }
+
+    EXPECT_TRUE(fplogd::Journal::has_segments(dir.string()));
+
+    for (int round = 0; round < 2; round++)
+    {
+        fplogd::Journal journal;
+        journal.open(dir.string(), 1024 * 1024, 64 * 1024, fplogd::Journal::Sync::none);
+
+        unsigned long long id = 0;
+        for (int i = 0; i < 10; i++)
+        {
+            std::unique_ptr<std::string> msg(journal.read(id));
+            ASSERT_TRUE(msg != 0);
+            EXPECT_EQ(journal_test_message(i), *msg);
+        }
+
+        EXPECT_TRUE(journal.read(id) == 0);
+    }
+
+    boost::filesystem::remove_all(dir);
+}
+
+TEST(Journal_Test, Bad_Checksum_Stops_Replay)
+{
+    boost::filesystem::path dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("fplog_test_%%%%%%%%"));
+
+    {
+        fplogd::Journal journal;
+        journal.open(dir.string(), 1024 * 1024, 64 * 1024, fplogd::Journal::Sync::none);
+
+        for (int i = 0; i < 5; i++)
+            EXPECT_TRUE(journal.append(journal_test_message(i).c_str(), 1000));
+    }
+
+    {
+        //16 bytes of segment header, 1008 per record, 8 of record header: one byte of the third message is changed
+        FILE* f = fopen((dir / "00000001.fpj").string().c_str(), "r+b");
+        ASSERT_TRUE(f != 0);
+        fseek(f, 16 + 2 * 1008 + 8 + 500, SEEK_SET);
+        fputc('y', f);
+        fclose(f);
+    }
+
+    fplogd::Journal journal;
+    journal.open(dir.string(), 1024 * 1024, 64 * 1024, fplogd::Journal::Sync::none);
+
+    unsigned long long id = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        std::unique_ptr<std::string> msg(journal.read(id));
+        ASSERT_TRUE(msg != 0);
+        EXPECT_EQ(journal_test_message(i), *msg);
+    }
+
+    EXPECT_TRUE(journal.read(id) == 0);
+
+    journal.close();
+    boost::filesystem::remove_all(dir);
+}
+
+TEST(Journal_Test, Ack_Releases_Sealed_Segment)
+{
+    boost::filesystem::path dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("fplog_test_%%%%%%%%"));
+    boost::filesystem::path first(dir / "00000001.fpj");
+
+    fplogd::Journal journal;
+    journal.open(dir.string(), 1024 * 1024, 64 * 1024, fplogd::Journal::Sync::none);
+
+    for (int i = 0; i < 100; i++)
+        EXPECT_TRUE(journal.append(journal_test_message(i).c_str(), 1000));
+
+    EXPECT_TRUE(boost::filesystem::exists(first));
+    EXPECT_TRUE(boost::filesystem::exists(dir / "00000002.fpj"));
+    EXPECT_EQ(2 * 64 * 1024, journal.size());
+
+    std::vector<unsigned long long> ids;
+    for (int i = 0; i < 100; i++)
+    {
+        unsigned long long id = 0;
+        std::unique_ptr<std::string> msg(journal.read(id));
+        ASSERT_TRUE(msg != 0);
+        EXPECT_EQ(journal_test_message(i), *msg);
+        ids.push_back(id);
+    }
+
+    //first segment took 65 messages, acking one of them many times does not make up for the other ones
+    for (int i = 0; i < 100; i++)
+        journal.ack(ids[0]);
+
+    journal.ack(std::vector<unsigned long long>(ids.begin() + 1, ids.begin() + 64));
+    EXPECT_TRUE(boost::filesystem::exists(first));
+
+    journal.ack(ids[64]);
+    EXPECT_FALSE(boost::filesystem::exists(first));
+    EXPECT_EQ(64 * 1024, journal.size());
+
+    //second one is not sealed, it stays while appends might still go there
+    journal.ack(std::vector<unsigned long long>(ids.begin() + 65, ids.end()));
+    EXPECT_TRUE(boost::filesystem::exists(dir / "00000002.fpj"));
+
+    journal.close();
+    boost::filesystem::remove_all(dir);
+}
+
+TEST(Journal_Test, Max_Size)
+{
+    boost::filesystem::path dir(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("fplog_test_%%%%%%%%"));
+
+    fplogd::Journal journal;
+    journal.open(dir.string(), 2 * 64 * 1024, 64 * 1024, fplogd::Journal::Sync::none);
+
+    int appended = 0;
+    while ((appended < 1000) && journal.append(journal_test_message(appended).c_str(), 1000))
+        appended++;
+
+    EXPECT_EQ(2 * 65, appended);
+    EXPECT_EQ(2 * 64 * 1024, journal.size());
+
+    //room comes back once the first segment is delivered
+    std::vector<unsigned long long> ids;
+    for (int i = 0; i < 66; i++)
+    {
+        unsigned long long id = 0;
+        std::unique_ptr<std::string> msg(journal.read(id));
+        ASSERT_TRUE(msg != 0);
+        ids.push_back(id);
+    }
+
+    ids.pop_back();
+    journal.ack(ids);
+    EXPECT_TRUE(journal.append(journal_test_message(appended).c_str(), 1000));
+
+    journal.close();
+    boost::filesystem::remove_all(dir);
+}
+
+static bool aggregator_add(fplogd::Aggregator& aggregator, const std::string& msg)
+{
+    std::vector<const char*> values(aggregator.fields().size());
+    std::vector<size_t> sizes(aggregator.fields().size());
+
+    EXPECT_TRUE(generic_util::scan_json_fields(msg.c_str(), msg.size(), &aggregator.fields()[0], values.size(), &values[0], &sizes[0]));
+    return aggregator.add(&values[0], &sizes[0]);
+}
+
+//Summaries of a flush by their group value, counters are checked on the parsed JSON.
+static std::map<std::string, JSONNode> aggregator_flush(fplogd::Aggregator& aggregator, const char* group_field)
+{
+    std::vector<std::string*> summaries;
+    aggregator.flush(summaries, true);
+
+    std::map<std::string, JSONNode> res;
+    for (auto summary : summaries)
+    {
+        EXPECT_TRUE(libjson::is_valid(*summary));
+        JSONNode json(libjson::parse(*summary));
+        delete summary;
+
+        EXPECT_EQ("fplogd", json.at(fplog::Message::Mandatory_Fields::appname).as_string());
+        res[group_field ? json.at("group").at(group_field).as_string() : std::string()] = json;
+    }
+
+    return res;
+}
+
+TEST(Aggregator_Test, Make_Rule)
+{
+    fplog::Transport_Interface::Params params;
+    params["group_by"] = " appname , module ,";
+    params["prio"] = "error, warning";
+    params["drop"] = "error";
+    params["histogram"] = " duration ";
+    params["buckets"] = "100, x, 10, 10, 1";
+    params["interval"] = "2000";
+    params["max_groups"] = "5";
+
+    fplogd::Aggregator::Rule rule(fplogd::Aggregator::make_rule("aggregate_test", params));
+    EXPECT_EQ("aggregate_test", rule.name);
+    EXPECT_EQ(2, rule.group_by.size());
+    EXPECT_EQ("module", rule.group_by[1]);
+    EXPECT_EQ(2, rule.prios.size());
+    EXPECT_EQ(1, rule.drop.count("error"));
+    EXPECT_EQ("duration", rule.histogram);
+    EXPECT_EQ(2000, rule.interval);
+    EXPECT_EQ(5, rule.max_groups);
+
+    //bounds that are not numbers are skipped, the rest is sorted without duplicates
+    EXPECT_EQ(3, rule.buckets.size());
+    EXPECT_EQ(1, rule.buckets[0]);
+    EXPECT_EQ(100, rule.buckets[2]);
+
+    //wrong values fall back to defaults
+    params.clear();
+    params["interval"] = "10";
+    params["max_groups"] = "many";
+    params["buckets"] = "x,y";
+
+    rule = fplogd::Aggregator::make_rule("aggregate_bad", params);
+    EXPECT_EQ(static_cast<size_t>(fplogd::Aggregator::default_interval), rule.interval);
+    EXPECT_EQ(static_cast<size_t>(fplogd::Aggregator::default_max_groups), rule.max_groups);
+    EXPECT_TRUE(rule.buckets.empty());
+    EXPECT_TRUE(rule.group_by.empty());
+    EXPECT_TRUE(rule.prios.empty());
+
+    rule = fplogd::Aggregator::make_rule("aggregate_empty", fplog::Transport_Interface::Params());
+    EXPECT_EQ(5, rule.buckets.size());
+    EXPECT_TRUE(rule.histogram.empty());
+}
+
+TEST(Aggregator_Test, Prio_And_Drop)
+{
+    fplog::Transport_Interface::Params params;
+    params["group_by"] = "appname";
+    params["prio"] = "error,warning";
+    params["drop"] = "error";
+
+    fplogd::Aggregator aggregator;
+    aggregator.configure(std::vector<fplogd::Aggregator::Rule>(1, fplogd::Aggregator::make_rule("aggregate_errors", params)));
+
+    EXPECT_TRUE(aggregator_add(aggregator, "{\"priority\":\"error\",\"appname\":\"a\"}"));
+    EXPECT_FALSE(aggregator_add(aggregator, "{\"priority\":\"warning\",\"appname\":\"a\"}"));
+    EXPECT_FALSE(aggregator_add(aggregator, "{\"priority\":\"debug\",\"appname\":\"a\"}"));
+    EXPECT_FALSE(aggregator_add(aggregator, "{\"priority\":\"debug\",\"appname\":\"b\"}"));
+    EXPECT_TRUE(aggregator_add(aggregator, "{\"priority\":\"error\",\"appname\":\"b\"}"));
+
+    std::map<std::string, JSONNode> summaries(aggregator_flush(aggregator, "appname"));
+    ASSERT_EQ(2, summaries.size());
+    EXPECT_EQ(2, summaries["a"].at("count").as_int());
+    EXPECT_EQ(1, summaries["b"].at("count").as_int());
+    EXPECT_EQ("aggregate_errors", summaries["a"].at("aggregate").as_string());
+}
+
+TEST(Aggregator_Test, Max_Groups)
+{
+    fplog::Transport_Interface::Params params;
+    params["group_by"] = "appname";
+    params["max_groups"] = "2";
+
+    fplogd::Aggregator aggregator;
+    aggregator.configure(std::vector<fplogd::Aggregator::Rule>(1, fplogd::Aggregator::make_rule("aggregate_apps", params)));
+
+    const char* apps[] = {"a", "b", "c", "d", "a", "c"};
+    for (auto app : apps)
+        EXPECT_FALSE(aggregator_add(aggregator, std::string("{\"priority\":\"info\",\"appname\":\"") + app + "\"}"));
+
+    //groups seen once the limit is reached are counted together
+    std::map<std::string, JSONNode> summaries(aggregator_flush(aggregator, "appname"));
+    ASSERT_EQ(3, summaries.size());
+    EXPECT_EQ(2, summaries["a"].at("count").as_int());
+    EXPECT_EQ(1, summaries["b"].at("count").as_int());
+    EXPECT_EQ(3, summaries["*"].at("count").as_int());
+}
+
+TEST(Aggregator_Test, Histogram_Buckets)
+{
+    fplog::Transport_Interface::Params params;
+    params["histogram"] = "duration";
+    params["buckets"] = "1,10,100";
+
+    fplogd::Aggregator aggregator;
+    aggregator.configure(std::vector<fplogd::Aggregator::Rule>(1, fplogd::Aggregator::make_rule("aggregate_duration", params)));
+
+    //bound is the upper one and belongs to its bucket, strings and missing values are counted only as messages
+    const char* durations[] = {"0.5", "1", "1.5", "10", "100", "101", "\"7\"", "1e400"};
+    for (auto duration : durations)
+        aggregator_add(aggregator, std::string("{\"priority\":\"info\",\"duration\":") + duration + "}");
+
+    aggregator_add(aggregator, "{\"priority\":\"info\"}");
+
+    std::map<std::string, JSONNode> summaries(aggregator_flush(aggregator, 0));
+    ASSERT_EQ(1, summaries.size());
+
+    JSONNode& summary = summaries[""];
+    EXPECT_EQ(9, summary.at("count").as_int());
+
+    JSONNode& histogram = summary.at("histogram");
+    EXPECT_EQ("duration", histogram.at("field").as_string());
+    EXPECT_EQ(6, histogram.at("count").as_int());
+    EXPECT_DOUBLE_EQ(214, histogram.at("sum").as_float());
+    EXPECT_DOUBLE_EQ(0.5, histogram.at("min").as_float());
+    EXPECT_DOUBLE_EQ(101, histogram.at("max").as_float());
+
+    JSONNode& buckets = histogram.at("buckets");
+    EXPECT_EQ(2, buckets.at("1").as_int());
+    EXPECT_EQ(2, buckets.at("10").as_int());
+    EXPECT_EQ(1, buckets.at("100").as_int());
+    EXPECT_EQ(1, buckets.at("+inf").as_int());
+}
+
+TEST(Aggregator_Test, Flush)
+{
+    fplog::Transport_Interface::Params params;
+    params["group_by"] = "appname, module";
+
+    fplogd::Aggregator aggregator;
+    aggregator.configure(std::vector<fplogd::Aggregator::Rule>(1, fplogd::Aggregator::make_rule("aggregate_modules", params)));
+
+    aggregator_add(aggregator, "{\"priority\":\"info\",\"appname\":\"a\\\"b\",\"module\":\"m\"}");
+    aggregator_add(aggregator, "{\"priority\":\"info\",\"module\":\"m\",\"appname\":\"a\\\"b\"}");
+
+    //interval has not passed yet
+    std::vector<std::string*> summaries;
+    aggregator.flush(summaries);
+    EXPECT_TRUE(summaries.empty());
+
+    std::map<std::string, JSONNode> groups(aggregator_flush(aggregator, "appname"));
+    ASSERT_EQ(1, groups.size());
+    EXPECT_EQ(2, groups["a\"b"].at("count").as_int());
+    EXPECT_EQ(60000, groups["a\"b"].at("interval").as_int());
+
+    //counters start over after a flush, a missing field is grouped as null
+    EXPECT_TRUE(aggregator_flush(aggregator, "appname").empty());
+
+    aggregator_add(aggregator, "{\"priority\":\"info\",\"appname\":\"c\"}");
+    groups = aggregator_flush(aggregator, "appname");
+    ASSERT_EQ(1, groups.size());
+    EXPECT_EQ(1, groups["c"].at("count").as_int());
+    EXPECT_EQ(JSON_NULL, groups["c"].at("group").at("module").type());
+}
+
+static const char* batch_test_hostname = ",\"hostname\":\"batch_test/127.0.0.1\"";
+
+//Batch assembly of fplogd before Json_Batch_Builder: every message is parsed into DOM and the whole batch is written again.
+static std::string* assemble_batch_with_dom(const std::vector<std::string>& messages)
+{
+    JSONNode json_batch(JSON_ARRAY);
+
+    for (auto& msg : messages)
+    {
+        JSONNode validated(libjson::parse(msg));
+
+        std::string item(msg);
+        item.resize(item.rfind('}'));
+        item += std::string(batch_test_hostname) + "}";
+
+        json_batch.push_back(fplog::Message(item).as_json());
+    }
+
+    std::string* batch = new std::string(fplog::Message(fplog::Prio::critical, "fplog").add_batch(json_batch).as_string());
+    batch->resize(batch->rfind('}'));
+    *batch += std::string(batch_test_hostname) + "}";
+
+    return batch;
+}
+
+static std::string* assemble_batch_with_builder(const std::vector<std::string>& messages)
+{
+    std::string header(std::string("{\"") + fplog::Message::Mandatory_Fields::timestamp + "\":\"" + generic_util::get_iso8601_timestamp() +
+        "\",\"" + fplog::Message::Mandatory_Fields::priority + "\":\"" + fplog::Prio::critical +
+        "\",\"" + fplog::Message::Mandatory_Fields::facility + "\":\"" + fplog::Facility::fplog + "\"");
+
+    generic_util::Json_Batch_Builder builder(fplog::Message::Optional_Fields::batch, batch_test_hostname);
+    builder.start(header);
+
+    for (auto& msg : messages)
+        if (generic_util::scan_json_object(msg.c_str(), msg.size(), fplog::Message::Mandatory_Fields::appname))
+            builder.add(msg);
+
+    return builder.finish();
+}
+
+TEST(Batch_Test, Assembly_Performance)
+{
+    using namespace std::chrono;
+
+    const int batch_size = 31;
+    const int batch_count = 3000;
+
+    std::vector<std::string> messages;
+    for (int i = 0; i < batch_size; i++)
+    {
+        //appname is normally put by fplog::write
+        std::string msg(get_random_message().add("number", i).as_string());
+        msg.resize(msg.rfind('}'));
+        messages.push_back(msg + ",\"" + fplog::Message::Mandatory_Fields::appname + "\":\"batch_test\"}");
+    }
+
+    std::unique_ptr<std::string> dom(assemble_batch_with_dom(messages));
+    std::unique_ptr<std::string> built(assemble_batch_with_builder(messages));
+
+    //both ways must give fpcollect the same batch
+    fplog::Message parsed(*built);
+    EXPECT_TRUE(parsed.has_batch());
+    EXPECT_EQ(parsed.get_batch().size(), static_cast<size_t>(batch_size));
+    EXPECT_EQ(strip_timestamp_and_sequence(parsed.as_string()), strip_timestamp_and_sequence(*dom));
+
+    size_t bytes = 0;
+
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    for (int i = 0; i < batch_count; i++)
+        delete assemble_batch_with_dom(messages);
+
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    for (int i = 0; i < batch_count; i++)
+    {
+        std::string* batch = assemble_batch_with_builder(messages);
+        bytes += batch->size();
+        delete batch;
+    }
+
+    high_resolution_clock::time_point t3 = high_resolution_clock::now();
+
+    double dom_seconds = duration_cast<duration<double>>(t2 - t1).count();
+    double builder_seconds = duration_cast<duration<double>>(t3 - t2).count();
+
+    std::cout << "Batch assembly, batch_size = " << batch_size << std::endl;
+    std::cout << "DOM: " << static_cast<unsigned>(batch_count * batch_size / dom_seconds) << " mps" << std::endl;
+    std::cout << "Builder: " << static_cast<unsigned>(batch_count * batch_size / builder_seconds) << " mps, " <<
+        static_cast<unsigned>(bytes / builder_seconds / (1024 * 1024)) << " MB/s" << std::endl;
+}
+
 void start_thread(const char *facility)
 {
     openlog(facility);
@@ -1,6 +1,9 @@
 #include "Transport_Factory.h"
 #include <spipc/UDT_Transport.h>
 #include <spipc/socket_transport.h>
+#ifdef _LINUX
+#include <spipc/tcp_transport.h>
+#endif
 #include <utils.h>
 
 namespace fplogd {
@@ -20,6 +23,13 @@ fplog::Transport_Interface* Transport_Factory::create(const fplog::Transport_Int
                         {
                             return new spipc::Socket_Transport();
                         }
+
+#ifdef _LINUX
+                        if (generic_util::find_str_no_case(p2.second, "tcp"))
+                        {
+                            return new spipc::Tcp_Transport();
+                        }
+#endif
                     }
 
                 return new spipc::UDT_Transport();
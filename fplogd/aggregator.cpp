@@ -0,0 +1,293 @@
+#include "aggregator.h"
+
+#include "../fplog/fplog.h"
+#include <utils.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+
+namespace fplogd {
+
+static const char* g_default_buckets = "1,10,100,1000,10000";
+
+//Comma separated list with spaces around items removed, empty items skipped.
+static std::vector<std::string> split_list(const std::string& list)
+{
+    std::vector<std::string> res;
+    std::stringstream stream(list);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+    {
+        generic_util::trim(item);
+        if (!item.empty())
+            res.push_back(item);
+    }
+
+    return res;
+}
+
+static std::string format_number(double value)
+{
+    char str[64];
+    snprintf(str, sizeof(str), "%.15g", value);
+    return str;
+}
+
+Aggregator::Rule Aggregator::make_rule(const std::string& name, const fplog::Transport_Interface::Params& params)
+{
+    Rule rule;
+    rule.name = name;
+
+    std::string buckets(g_default_buckets);
+
+    for (auto& param : params)
+    {
+        try
+        {
+            if (generic_util::find_str_no_case(param.first, "group_by"))
+                rule.group_by = split_list(param.second);
+
+            if (generic_util::find_str_no_case(param.first, "interval"))
+            {
+                int interval = std::stoi(param.second);
+
+                if (interval >= 1000)
+                    rule.interval = interval;
+            }
+
+            if (generic_util::find_str_no_case(param.first, "max_groups"))
+            {
+                int groups = std::stoi(param.second);
+
+                if (groups > 0)
+                    rule.max_groups = groups;
+            }
+
+            if (generic_util::find_str_no_case(param.first, "prio"))
+            {
+                std::vector<std::string> prios(split_list(param.second));
+                rule.prios.insert(prios.begin(), prios.end());
+            }
+
+            if (generic_util::find_str_no_case(param.first, "drop"))
+            {
+                std::vector<std::string> prios(split_list(param.second));
+                rule.drop.insert(prios.begin(), prios.end());
+            }
+
+            if (generic_util::find_str_no_case(param.first, "histogram"))
+            {
+                rule.histogram = param.second;
+                generic_util::trim(rule.histogram);
+            }
+
+            if (generic_util::find_str_no_case(param.first, "buckets"))
+                buckets = param.second;
+        }
+        catch (std::exception&)
+        {
+            continue;
+        }
+    }
+
+    for (auto& bound : split_list(buckets))
+    {
+        char* end = 0;
+        double value = strtod(bound.c_str(), &end);
+
+        if (end && (*end == 0))
+            rule.buckets.push_back(value);
+    }
+
+    std::sort(rule.buckets.begin(), rule.buckets.end());
+    rule.buckets.erase(std::unique(rule.buckets.begin(), rule.buckets.end()), rule.buckets.end());
+
+    return rule;
+}
+
+Aggregator::Aggregator():
+priority_field_(0)
+{
+}
+
+size_t Aggregator::field_index(const std::string& name)
+{
+    auto it = std::find(fields_.begin(), fields_.end(), name);
+    if (it != fields_.end())
+        return it - fields_.begin();
+
+    fields_.push_back(name);
+    return fields_.size() - 1;
+}
+
+void Aggregator::configure(const std::vector<Rule>& rules)
+{
+    rules_.clear();
+    fields_.clear();
+    field_names_.clear();
+
+    if (rules.empty())
+        return;
+
+    //priority decides which rules count a message and whether it is dropped
+    priority_field_ = field_index(fplog::Message::Mandatory_Fields::priority);
+
+    for (auto& rule : rules)
+    {
+        State state;
+        state.rule = rule;
+        state.histogram_field = rule.histogram.empty() ? 0 : field_index(rule.histogram);
+        state.started = std::chrono::steady_clock::now();
+        state.from = generic_util::get_iso8601_timestamp();
+
+        for (auto& field : rule.group_by)
+            state.group_fields.push_back(field_index(field));
+
+        rules_.push_back(state);
+    }
+
+    for (auto& field : fields_)
+        field_names_.push_back(field.c_str());
+}
+
+bool Aggregator::add(const char* const* values, const size_t* sizes)
+{
+    bool drop = false;
+    std::string prio;
+
+    const char* prio_value = values[priority_field_];
+    if (prio_value && (sizes[priority_field_] >= 2) && (*prio_value == '"'))
+        prio.assign(prio_value + 1, sizes[priority_field_] - 2);
+
+    for (auto& state : rules_)
+    {
+        if (!state.rule.prios.empty() && !state.rule.prios.count(prio))
+            continue;
+
+        //raw JSON values are the key and go into the summary as they are, a missing field is null
+        std::vector<std::string> group;
+        group.reserve(state.group_fields.size());
+
+        for (auto i : state.group_fields)
+            group.push_back(values[i] ? std::string(values[i], sizes[i]) : std::string("null"));
+
+        auto counts = state.groups.find(group);
+        if (counts == state.groups.end())
+        {
+            if (state.groups.size() >= state.rule.max_groups)
+                group.assign(group.size(), "\"*\"");
+
+            counts = state.groups.insert(std::make_pair(group, std::make_pair(0ull, Histogram()))).first;
+        }
+
+        counts->second.first++;
+
+        const char* value = state.rule.histogram.empty() ? 0 : values[state.histogram_field];
+        size_t size = value ? sizes[state.histogram_field] : 0;
+        char number[64];
+
+        if (value && (*value != '"') && (size < sizeof(number)))
+        {
+            memcpy(number, value, size);
+            number[size] = 0;
+
+            char* end = 0;
+            double sample = strtod(number, &end);
+
+            if ((end == number + size) && std::isfinite(sample))
+            {
+                Histogram& histogram = counts->second.second;
+
+                if (histogram.buckets.empty())
+                    histogram.buckets.resize(state.rule.buckets.size() + 1);
+
+                histogram.min = histogram.count ? std::min(histogram.min, sample) : sample;
+                histogram.max = histogram.count ? std::max(histogram.max, sample) : sample;
+                histogram.sum += sample;
+                histogram.count++;
+
+                //bucket of the first bound not below the value
+                histogram.buckets[std::lower_bound(state.rule.buckets.begin(), state.rule.buckets.end(), sample) - state.rule.buckets.begin()]++;
+            }
+        }
+
+        if (state.rule.drop.count(prio))
+            drop = true;
+    }
+
+    return drop;
+}
+
+void Aggregator::flush(std::vector<std::string*>& summaries, bool all)
+{
+    std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+
+    for (auto& state : rules_)
+    {
+        if (!all && (now - state.started < std::chrono::milliseconds(state.rule.interval)))
+            continue;
+
+        for (auto& group : state.groups)
+            summaries.push_back(new std::string(summary(state, group.first, group.second)));
+
+        state.groups.clear();
+        state.started = now;
+        state.from = generic_util::get_iso8601_timestamp();
+    }
+}
+
+std::string Aggregator::summary(const State& state, const std::vector<std::string>& group, const std::pair<unsigned long long, Histogram>& counts)
+{
+    std::string res(std::string("{\"") + fplog::Message::Mandatory_Fields::timestamp + "\":\"" + generic_util::get_iso8601_timestamp() +
+        "\",\"" + fplog::Message::Mandatory_Fields::priority + "\":\"" + fplog::Prio::info +
+        "\",\"" + fplog::Message::Mandatory_Fields::facility + "\":\"" + fplog::Facility::fplog +
+        "\",\"" + fplog::Message::Mandatory_Fields::appname + "\":\"fplogd\",\"" + fplog::Message::Optional_Fields::text + "\":\"Aggregated messages\"");
+
+    res += ",\"aggregate\":\"" + generic_util::escape_json_string(state.rule.name) + "\"";
+    res += ",\"from\":\"" + state.from + "\"";
+    res += ",\"interval\":" + std::to_string(state.rule.interval);
+    res += ",\"count\":" + std::to_string(counts.first);
+
+    if (!group.empty())
+    {
+        res += ",\"group\":{";
+
+        for (size_t i = 0; i < group.size(); i++)
+            res += std::string(i ? "," : "") + "\"" + generic_util::escape_json_string(state.rule.group_by[i]) + "\":" + group[i];
+
+        res += "}";
+    }
+
+    if (!state.rule.histogram.empty())
+    {
+        const Histogram& histogram = counts.second;
+
+        res += ",\"histogram\":{\"field\":\"" + generic_util::escape_json_string(state.rule.histogram) + "\",\"count\":" + std::to_string(histogram.count);
+
+        if (histogram.count)
+        {
+            res += ",\"sum\":" + format_number(histogram.sum) + ",\"min\":" + format_number(histogram.min) + ",\"max\":" + format_number(histogram.max);
+            res += ",\"buckets\":{";
+
+            for (size_t i = 0; i < histogram.buckets.size(); i++)
+            {
+                std::string bound((i < state.rule.buckets.size()) ? format_number(state.rule.buckets[i]) : std::string("+inf"));
+                res += std::string(i ? "," : "") + "\"" + bound + "\":" + std::to_string(histogram.buckets[i]);
+            }
+
+            res += "}";
+        }
+
+        res += "}";
+    }
+
+    res += "}";
+    return res;
+}
+
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+#include <fplog_transport.h>
+
+namespace fplogd {
+
+//Counts messages by rules of [aggregate...] sections of fplogd.ini and turns the counts into one summary message
+//per group and interval, so numbers on dashboards do not need every raw line to reach fpcollect.
+//Messages counted by a rule may be dropped right away, only the summary goes further then.
+//Not thread safe, every batching thread of fplogd has its own, so with batch_threads above 1
+//counts of a group come in several summaries of the same interval.
+class Aggregator
+{
+    public:
+
+        struct Rule
+        {
+            Rule(): interval(default_interval), max_groups(default_max_groups) {}
+
+            std::string name; //section of the ini file, goes into summaries as "aggregate"
+            std::vector<std::string> group_by; //top level fields, e.g. appname, priority, facility, module
+            std::set<std::string> prios; //priorities counted, all of them if empty
+            std::set<std::string> drop; //priorities of counted messages that are not sent on
+            std::string histogram; //numeric top level field
+            std::vector<double> buckets; //upper bounds of histogram buckets, ascending
+            size_t interval; //ms
+            size_t max_groups; //groups above it within one interval are counted together with every field "*"
+        };
+
+        static const size_t default_interval = 60000; //ms
+        static const size_t default_max_groups = 1000;
+
+        //Missing or wrong values of the section fall back to defaults.
+        static Rule make_rule(const std::string& name, const fplog::Transport_Interface::Params& params);
+
+        Aggregator();
+
+        void configure(const std::vector<Rule>& rules);
+        bool empty() const { return rules_.empty(); }
+
+        //Top level fields the rules look at, add() takes their raw values in this order, as generic_util::scan_json_fields gives them.
+        const std::vector<const char*>& fields() const { return field_names_; }
+
+        //Counts the message by every rule it matches. Returns true if the message is to be dropped.
+        bool add(const char* const* values, const size_t* sizes);
+
+        //Summaries of rules whose interval has passed, all rules with counts if all is true.
+        //Messages are complete JSON objects without hostname, caller owns them.
+        void flush(std::vector<std::string*>& summaries, bool all = false);
+
+
+    private:
+
+        struct Histogram
+        {
+            Histogram(): count(0), sum(0), min(0), max(0) {}
+
+            unsigned long long count;
+            double sum;
+            double min;
+            double max;
+            std::vector<unsigned long long> buckets; //one more than bounds, the last one has no upper bound
+        };
+
+        struct State
+        {
+            Rule rule;
+            std::vector<size_t> group_fields; //indexes into field_names_
+            size_t histogram_field;
+            std::chrono::steady_clock::time_point started;
+            std::string from; //timestamp of the interval start
+            std::map<std::vector<std::string>, std::pair<unsigned long long, Histogram>> groups;
+        };
+
+        std::vector<State> rules_;
+        std::vector<std::string> fields_;
+        std::vector<const char*> field_names_;
+        size_t priority_field_;
+
+        Aggregator(const Aggregator&);
+
+        size_t field_index(const std::string& name);
+        std::string summary(const State& state, const std::vector<std::string>& group, const std::pair<unsigned long long, Histogram>& counts);
+};
+
+};
@@ -9,36 +9,28 @@
 #include "../fplog/fplog.h"
 #include <libjson/libjson.h>
 #include "Transport_Factory.h"
+#include "journal.h"
+#include "aggregator.h"
 #include <Queue_Controller.h>
+#include <sprot/channel_mux.h>
+#include <sprot/compression.h>
+#include <sprot/async_writer.h>
+#include <spipc/socket_transport.h>
+#include <spipc/unix_socket_transport.h>
+#include <spipc/shared_memory_transport.h>
 
 #include <fstream> 
+#include <memory>
 #include <stdio.h>
 
-#ifndef _LINUX
-#include <conio.h>
-#else
-
-#include <stdio.h>
-#include <termios.h>
-#include <unistd.h>
-
-int _getch() {
-  struct termios oldt,
-                 newt;
-  int            ch;
-  tcgetattr( STDIN_FILENO, &oldt );
-  newt = oldt;
-  newt.c_lflag &= ~( ICANON | ECHO );
-  tcsetattr( STDIN_FILENO, TCSANOW, &newt );
-  ch = getchar();
-  tcsetattr( STDIN_FILENO, TCSANOW, &oldt );
-  return ch;
-}
-
-#endif
-
 #include <queue>
+#include <deque>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
 #include <mutex>
+#include <atomic>
 #include <fplog_exceptions.h>
 #include <utils.h>
 #include <boost/interprocess/sync/file_lock.hpp>
@@ -53,21 +45,18 @@ int _getch() {
 #include <WinSock2.h>
 #include <Ws2tcpip.h>
 #include <windows.h>
-#include <tlhelp32.h>
 #include <Shlobj.h>
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 #define MAX_PATH 255
 #endif
 
-#ifdef WIN32
-static char* g_process_name = "fplogd.exe";
-#else
-static char* g_process_name = "fplogd";
-
+#ifndef WIN32
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
@@ -82,53 +71,28 @@ static char* g_emergency_log_file_name = "fplogd.log";
 static char* g_config_file_channels_section_name = "channels";
 static char* g_config_file_transport_section_name = "transport";
 static char* g_config_file_misc_section_name = "misc";
+static const char* g_config_file_aggregate_section_name = "aggregate";
+static const char* g_config_file_relay_section_name = "relay";
+static const char* g_default_priority_lane = "emergency,alert,critical";
 
-/*!
-\brief Check if a process is running
-\param [in] processName Name of process to check if is running
-\returns \c True if the process is running, or \c False if the process is not running
-*/
-bool IsProcessRunning(const char *processName)
-{
-#ifdef WIN32
-    bool exists = false;
-    PROCESSENTRY32 entry;
-    entry.dwSize = sizeof(PROCESSENTRY32);
-
-    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, NULL);
+static const char* g_mux_config_setting_name = "mux_uid";
+static const char* g_registration_config_setting_name = "registration_uid";
 
-    if (Process32First(snapshot, &entry))
-        while (Process32Next(snapshot, &entry))
-            if (!_stricmp(entry.szExeFile, processName))
-                exists = true;
-
-    CloseHandle(snapshot);
-    return exists;
-#else
- 
-    FILE* proc = 0;
-    std::string cmd;
-    cmd = "ps cax | grep " + std::string(processName);
-
-    char line[256];
-    memset(line, 0, sizeof(line));
+//Comma separated priorities, spaces around them removed.
+static std::set<std::string> split_prios(const std::string& list)
+{
+    std::set<std::string> prios;
+    std::stringstream stream(list);
+    std::string prio;
 
-    proc = popen(cmd.c_str(), "r");
-  
-    if (proc != 0)
+    while (std::getline(stream, prio, ','))
     {
-        if (fgets(line, 256, proc))
-        {
-            pclose(proc);
-            std::string str(line);
-            return (str.find(processName) != std::string::npos);
-        }
-        else
-            pclose(proc);
+        generic_util::trim(prio);
+        if (!prio.empty())
+            prios.insert(prio);
     }
 
-    return false;
-#endif
+    return prios;
 }
 
 static std::string get_home_dir()
@@ -240,7 +204,17 @@ namespace fplogd {
 
 bool is_started()
 {
-    return IsProcessRunning(g_process_name);
+    return generic_util::Pid_File::state(fplog::get_fplogd_pid_file()) == generic_util::Pid_File::State::ready;
+}
+
+void wait_until_started()
+{
+    generic_util::Pid_File::wait_ready(fplog::get_fplogd_pid_file());
+}
+
+void wait_until_stopped()
+{
+    generic_util::Pid_File::wait_released(fplog::get_fplogd_pid_file());
 }
 
 class Notification_Helper
@@ -278,79 +252,208 @@ class Configuration
             std::ofstream f(config_file_name);
 
             f << "[misc]" << std::endl;
+            f << ";batch_*, max_queue_size, emergency_* and channel_idle_timeout are applied as soon as the file is saved, other keys on restart." << std::endl;
             f << "hostname=auto" << std::endl;
             f << "batch_size=31" << std::endl;
+            f << ";Batch goes out when it has batch_size messages, reaches batch_bytes or its first message has waited batch_linger ms." << std::endl;
+            f << ";Number of messages grows towards batch_size only under load, single messages are sent right away when it is quiet." << std::endl;
+            f << ";batch_bytes=8192" << std::endl;
+            f << ";batch_linger=50" << std::endl;
+            f << ";Threads batching messages, messages of one channel always go through the same thread and keep their order." << std::endl;
+            f << ";max_queue_size is split between them, with a journal every thread but the first keeps its part in a numbered subdirectory of journal_dir." << std::endl;
+            f << ";batch_threads=1" << std::endl;
             f << "max_queue_size=21000000" << std::endl;
             f << "emergency_timeout=30000" << std::endl;
             f << "emergency_algo=remove_newest_below_prio" << std::endl;
             f << "emergency_fallback_algo=remove_newest" << std::endl;
             f << "emergency_prio=warning" << std::endl;
+            f << ";Messages of priority_lane priorities (empty turns it off) skip the queue and journal backlog of the others and are sent" << std::endl;
+            f << ";in the next round without batch_linger. Up to priority_lane_size KB of them wait apart, more go the usual way." << std::endl;
+            f << ";They are not journaled and may come to fpcollect ahead of earlier messages of the same app." << std::endl;
+            f << ";priority_lane=emergency,alert,critical" << std::endl;
+            f << ";priority_lane_size=1024" << std::endl;
+            f << ";Shared endpoint for apps that use initlog with \"mux:<uid>\" instead of a dedicated channel." << std::endl;
+            f << ";Its clients are served by one thread, a client without messages for channel_idle_timeout ms is forgotten." << std::endl;
+            f << ";mux_uid=18747_18748" << std::endl;
+            f << ";Registration endpoint for apps that use initlog with \"register:<uid>\" (or \"register:shm:<uid>\", \"register:unix:<uid>\"):" << std::endl;
+            f << ";every such app gets a channel of its own from channel_pool ports, closed after channel_idle_timeout ms without messages." << std::endl;
+            f << ";registration_uid=18745_18746" << std::endl;
+            f << ";channel_pool=19000-19999" << std::endl;
+            f << ";channel_idle_timeout=300000" << std::endl;
+            f << ";Threads serving all udp channels (Linux), pin_ipc_threads=true binds each one to its own CPU." << std::endl;
+            f << ";ipc_threads=1" << std::endl;
+            f << ";pin_ipc_threads=false" << std::endl;
+            f << ";udp_io=uring receives udp channels through io_uring on Linux 6.0+ (recvmmsg is kept on older kernels)." << std::endl;
+            f << ";udp_io=uring" << std::endl;
+            f << ";How batches are spread over several [transport...] sections: failover (first healthy one, default)," << std::endl;
+            f << ";round_robin or hash (by appname, every app sticks to one destination while it is healthy)." << std::endl;
+            f << ";routing=failover" << std::endl;
+            f << ";Write-ahead journal, messages are kept in journal_dir until fpcollect acknowledges them and are sent again after restart or crash." << std::endl;
+            f << ";It also holds messages while fpcollect is down, up to journal_size MB in segment files of journal_segment_size MB." << std::endl;
+            f << ";Every [transport...] needs protocol=sprot or vsprot with it, fplogd does not start with protocol=none." << std::endl;
+            f << ";journal_fsync: none (left to the OS, survives crash of fplogd only), interval (every journal_fsync_interval ms) or always." << std::endl;
+            f << ";journal_dir=" << std::endl;
+            f << ";journal_size=256" << std::endl;
+            f << ";journal_segment_size=16" << std::endl;
+            f << ";journal_fsync=interval" << std::endl;
+            f << ";journal_fsync_interval=100" << std::endl;
+            f << ";Aggregation rule, any section with \"aggregate\" in its name is one more. Messages of prio priorities (all if not set)" << std::endl;
+            f << ";are counted by group_by fields per interval ms and one summary message per group goes to fpcollect," << std::endl;
+            f << ";matched messages of drop priorities are not sent themselves. histogram adds count, sum, min, max and buckets" << std::endl;
+            f << ";(upper bounds) of a numeric field. Groups over max_groups within one interval are counted together as \"*\"." << std::endl;
+            f << ";[aggregate_errors]" << std::endl;
+            f << ";group_by=appname,priority" << std::endl;
+            f << ";interval=60000" << std::endl;
+            f << ";prio=error,warning" << std::endl;
+            f << ";drop=" << std::endl;
+            f << ";histogram=" << std::endl;
+            f << ";buckets=1,10,100,1000,10000" << std::endl;
+            f << ";max_groups=1000" << std::endl;
+            f << ";Relay, fplogd takes batches of other fplogds instead of fpcollect, any section with \"relay\" in its name is one more." << std::endl;
+            f << ";Keys are those of a [connection...] section of fpcollect: ip of the sending fplogd and uid of its [transport]," << std::endl;
+            f << ";so every udp or udt sender, and every sender with protocol=sprot, has a section of its own. Senders with transport=tcp" << std::endl;
+            f << ";and protocol=none can share one, ip=0.0.0.0 takes them from any address. Relayed messages go into batches" << std::endl;
+            f << ";of this fplogd as they are with the hostname of the fplogd they came from, aggregation and priority_lane are not" << std::endl;
+            f << ";applied to them again. batch_size and batch_bytes above those of the senders merge their batches into larger ones." << std::endl;
+            f << ";[relay]" << std::endl;
+            f << ";type=ip" << std::endl;
+            f << ";transport=udp" << std::endl;
+            f << ";protocol=sprot" << std::endl;
+            f << ";compression_dictionary=" << std::endl;
+            f << ";ip=10.0.0.3" << std::endl;
+            f << ";uid=18751_18752" << std::endl;
             
             f << ";Setting the transport of log messages from fplogd to fpcollect." << std::endl;
             f << "[transport]" << std::endl;
             f << "type=ip" << std::endl;
             f << "transport=udp" << std::endl;
             f << "protocol=sprot" << std::endl;
+            f << ";transport=tcp (Linux) keeps one persistent connection to fpcollect and is used with protocol=none (default for tcp)," << std::endl;
+            f << ";a batch then counts as sent once it is in the socket send buffer, fpcollect does not acknowledge it, protocol=sprot does." << std::endl;
+            f << ";io=uring receives ACKs of udp transport through io_uring on Linux 6.0+." << std::endl;
+            f << ";transport=udt with cc=fplog uses congestion control made for log batches, optional cc_max_rate=<Mbps> caps the rate," << std::endl;
+            f << ";cc_max_delay=<ms> is queuing delay tolerated before slowing down (5), cc_burst=<packets> is sent right away (128)." << std::endl;
+            f << ";Breaking change: transport=udt sends every frame as a message (UDT message mode), it cannot talk to fpcollect or fplogd of older versions (UDT stream mode), upgrade both ends together." << std::endl;
+            f << ";Batch compression, fpcollect must use the same dictionary (built-in one if not set)." << std::endl;
+            f << ";compression=lz" << std::endl;
+            f << ";compression_dictionary=" << std::endl;
             f << "ip=127.0.0.1" << std::endl;
             f << "uid=18751_18752" << std::endl;
+            f << ";Another fpcollect, any section with \"transport\" in its name is one more destination." << std::endl;
+            f << ";[transport_standby]" << std::endl;
+            f << ";type=ip" << std::endl;
+            f << ";transport=udp" << std::endl;
+            f << ";protocol=sprot" << std::endl;
+            f << ";ip=10.0.0.2" << std::endl;
+            f << ";uid=18751_18752" << std::endl;
             
             f << ";All subscribed apps, i.e. apps sending logs to fplogd." << std::endl;
+            f << ";Prefix uid with \"unix:\" to use local unix domain socket or with \"shm:\" to use shared memory ring instead of udp," << std::endl;
+            f << ";app must use the same prefix in initlog." << std::endl;
             f << "[channels]" << std::endl;
             f << "fplog_test=18749_18750" << std::endl;
             f << "fplog_testapp=18849_18850" << std::endl;
         }
-    
-    
-    public:
-    
-        static Configuration& instance()
-        {
-            static Configuration instance;
 
-            std::string home(get_home_dir());
-            std::string config_file(home + g_config_file_name);
+        //Parsed once and replaced as a whole by reload(), readers keep the snapshot they got while a reload happens.
+        std::mutex mutex_;
+        std::string file_name_;
+        std::shared_ptr<const boost::property_tree::ptree> ini_;
 
-            std::ifstream file_exists_check(config_file);
-            if (!file_exists_check.good())
-                make_default_configuration(config_file);
+        Configuration() { reload(); }
 
-            return instance;
+        std::shared_ptr<const boost::property_tree::ptree> ini()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return ini_;
         }
 
-        fplog::Transport_Interface::Params get_log_transort_config()
+        //Sections with name_part in their name, in the order of the ini file.
+        std::vector<std::pair<std::string, fplog::Transport_Interface::Params>> get_sections(const char* name_part)
         {
-            using boost::property_tree::ptree;
-            ptree pt;
-            fplog::Transport_Interface::Params res;
+            std::shared_ptr<const boost::property_tree::ptree> pt(ini());
+            std::vector<std::pair<std::string, fplog::Transport_Interface::Params>> res;
             
-            std::string home(get_home_dir());
-            read_ini(home + g_config_file_name, pt);
-            
-            for (auto& section: pt)
+            for (auto& section: *pt)
             {
-                if (section.first.find(g_config_file_transport_section_name) == std::string::npos)
+                if (section.first.find(name_part) == std::string::npos)
                     continue;
                 
+                fplog::Transport_Interface::Params params;
+
                 for (auto& key: section.second)
                 {
                     fplog::Transport_Interface::Param param(key.first, key.second.get_value<std::string>());
-                    res.insert(param);
+                    params.insert(param);
                 }
+
+                res.push_back(std::make_pair(section.first, params));
             }
             
             return res;
         }
-        
+    
+    
+    public:
+    
+        static Configuration& instance()
+        {
+            static Configuration instance;
+            return instance;
+        }
+
+        //Reads the ini file again, the default one is written if there is none. Returns true when the content has changed.
+        //Throws if the file cannot be parsed, previous content stays in use then.
+        bool reload()
+        {
+            std::string file_name(get_home_dir() + g_config_file_name);
+
+            std::ifstream file_exists_check(file_name);
+            if (!file_exists_check.good())
+                make_default_configuration(file_name);
+
+            std::shared_ptr<boost::property_tree::ptree> pt(std::make_shared<boost::property_tree::ptree>());
+            read_ini(file_name, *pt);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            bool changed = !ini_ || (file_name != file_name_) || (*ini_ != *pt);
+
+            file_name_ = file_name;
+            ini_ = pt;
+
+            return changed;
+        }
+
+        std::string get_file_name()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return file_name_;
+        }
+
+        //Every section with "transport" in its name is a separate destination, in the order of the ini file.
+        std::vector<std::pair<std::string, fplog::Transport_Interface::Params>> get_log_transport_configs()
+        {
+            return get_sections(g_config_file_transport_section_name);
+        }
+
+        //Every section with "aggregate" in its name is a separate aggregation rule.
+        std::vector<std::pair<std::string, fplog::Transport_Interface::Params>> get_aggregate_configs()
+        {
+            return get_sections(g_config_file_aggregate_section_name);
+        }
+
+        //Every section with "relay" in its name is a separate listener for batches of other fplogds.
+        std::vector<std::pair<std::string, fplog::Transport_Interface::Params>> get_relay_configs()
+        {
+            return get_sections(g_config_file_relay_section_name);
+        }
+
         fplog::Transport_Interface::Params get_misc_config()
         {
-            using boost::property_tree::ptree;
-            ptree pt;
+            std::shared_ptr<const boost::property_tree::ptree> pt(ini());
             fplog::Transport_Interface::Params res;
             
-            std::string home(get_home_dir());
-            read_ini(home + g_config_file_name, pt);
-            
-            for (auto& section: pt)
+            for (auto& section: *pt)
             {
                 if (section.first.find(g_config_file_misc_section_name) == std::string::npos)
                     continue;
@@ -367,14 +470,10 @@ class Configuration
         
         std::vector<Channel_Data> get_registered_channels()
         {
-            using boost::property_tree::ptree;
-            ptree pt;
+            std::shared_ptr<const boost::property_tree::ptree> pt(ini());
             std::vector<Channel_Data> res;
             
-            std::string home(get_home_dir());
-            read_ini(home + g_config_file_name, pt);
-            
-            for (auto& section: pt)
+            for (auto& section: *pt)
             {
                 Channel_Data data;
                 
@@ -384,6 +483,16 @@ class Configuration
                 for (auto& key: section.second)
                 {
                     std::string str_uid(key.second.get_value<std::string>());
+
+                    data.transport.clear();
+
+                    size_t prefix_end = str_uid.find(':');
+                    if (prefix_end != std::string::npos)
+                    {
+                        data.transport = str_uid.substr(0, prefix_end);
+                        str_uid = str_uid.substr(prefix_end + 1);
+                    }
+
                     data.uid.from_string(str_uid);
                     data.app_name = key.first;
                     res.push_back(data);
@@ -395,14 +504,10 @@ class Configuration
         
         std::string get_config_key_value(const std::string& section, const std::string& key)
         {
-            using boost::property_tree::ptree;
-            ptree pt;
+            std::shared_ptr<const boost::property_tree::ptree> pt(ini());
             std::string res = "";
             
-            std::string home(get_home_dir());
-            read_ini(home + g_config_file_name, pt);
-            
-            for (auto& ini_section : pt)
+            for (auto& ini_section : *pt)
             {
                 if (ini_section.first.find(section) == std::string::npos)
                     continue;
@@ -432,93 +537,351 @@ class Configuration
         }
 };
 
+//Protocol of a [transport...] or [relay...] section on top of its transport, the transport itself when it is read and written without one.
+static fplog::Transport_Interface* make_protocol(fplog::Transport_Interface* trans, fplog::Transport_Interface::Params& params)
+{
+    for (auto param : params)
+    {
+        if (generic_util::find_str_no_case(param.first, "protocol"))
+        {
+            if (generic_util::find_str_no_case(param.second, "vsprot"))
+                return new vsprot::Protocol(trans);
+
+            if (generic_util::find_str_no_case(param.second, "none"))
+                return trans;
 
-class Impl
+            return new sprot::Protocol(trans);
+        }
+    }
+
+    //tcp is reliable by itself, sprot on top of it only adds ACK round trips
+    return generic_util::find_str_no_case(params["transport"], "tcp") ? trans : new sprot::Protocol(trans);
+}
+
+
+class Impl: public fplog::In_Process_Sink
 {
     public:
 
         Impl():
+        hostname_fragment_(hostname_field("")),
+        batch_size_(30),
+        batch_bytes_(default_batch_bytes),
+        batch_linger_(default_batch_linger),
+        ipc_threads_(1),
+        pin_ipc_threads_(false),
+        udp_uring_(false),
+        batch_threads_(1),
+        next_shard_key_(0),
+        journal_size_(fplogd::Journal::default_max_size),
+        journal_segment_size_(fplogd::Journal::default_segment_size),
+        journal_sync_(fplogd::Journal::Sync::interval),
+        journal_sync_interval_(fplogd::Journal::default_sync_interval),
+        priority_lane_size_(default_priority_lane_size),
+        epoll_fd_(-1),
+        next_reactor_id_(0),
         should_stop_(false),
-        log_transport_(0),
-        overload_checker_(&Impl::overload_prevention, this),
-        mq_reader_(&Impl::mq_reader, this),
-        protocol_(0)
+        routing_(Routing::failover),
+        next_destination_(0),
+        ring_version_(0),
+        registration_thread_(0),
+        pool_first_(default_pool_first),
+        pool_last_(default_pool_last),
+        next_pool_pair_(0),
+        channel_idle_timeout_(default_channel_idle_timeout),
+        overload_checker_(&Impl::overload_prevention, this)
         {
         };
 
-        void set_log_transport(fplog::Transport_Interface* transport, fplog::Transport_Interface* protocol)
+        //name is the ini section of the destination, it places the destination on the hash ring
+        void add_destination(const std::string& name, fplog::Transport_Interface* transport, fplog::Transport_Interface* protocol, bool protocol_owns_transport = false)
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+            Destination* destination = new Destination();
+
+            destination->name = name;
+            destination->transport = transport;
+            destination->protocol = protocol;
+            destination->protocol_owns_transport = protocol_owns_transport;
+
+            destinations_.push_back(destination);
+        }
+
+        bool has_destinations()
         {
             std::lock_guard<std::recursive_mutex> lock(mutex_);
-            log_transport_ = transport;
-            protocol_ = protocol;
+            return !destinations_.empty();
+        }
+
+        //Message of the application fplogd runs in, it goes to the same queue as messages from channels.
+        virtual void push(std::string* msg)
+        {
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                if (should_stop_ || !msg)
+                {
+                    delete msg;
+                    return;
+                }
+            }
+
+            //not under mutex_, with journal_fsync=always append waits for the sync;
+            //messages of one thread of the app keep their order, threads are spread over the shards
+            enqueue(std::hash<std::thread::id>()(std::this_thread::get_id()), msg);
         }
 
-        void start()
+        //Without ipc no channel is opened, messages come only from fplog of this process through push().
+        void start(bool ipc = true)
         {
             std::lock_guard<std::recursive_mutex> lock(mutex_);
             should_stop_ = false;
-            batch_size_ = 30;
+            ipc_threads_ = 1;
+            pin_ipc_threads_ = false;
+            udp_uring_ = false;
+            routing_ = Routing::failover;
+            pool_first_ = default_pool_first;
+            pool_last_ = default_pool_last;
+            batch_threads_ = 1;
+            journal_dir_.clear();
+            journal_size_ = fplogd::Journal::default_max_size;
+            journal_segment_size_ = fplogd::Journal::default_segment_size;
+            journal_sync_ = fplogd::Journal::Sync::interval;
+            journal_sync_interval_ = fplogd::Journal::default_sync_interval;
+            priority_lane_ = split_prios(g_default_priority_lane);
+            priority_lane_size_ = default_priority_lane_size;
 
             fplog::Transport_Interface::Params misc(Configuration::instance().get_misc_config());
 
-            mq_.apply_config(misc);
+            apply_live_config(misc);
 
             for (auto& param : misc)
             {
-                if (generic_util::find_str_no_case(param.first, "batch_size"))
-                {
-                    int batch_sz = std::stoi(param.second);
-                    
-                    if ((batch_sz > 0) && (batch_sz < 1000))
-                        batch_size_ = batch_sz;
-                }
-                
-                if (generic_util::find_str_no_case(param.first, "hostname"))
+                //malformed number keeps the default
+                try
                 {
-                    hostname_ = "auto";
-
-                    if (generic_util::find_str_no_case(param.second, "auto"))
+                    if (generic_util::find_str_no_case(param.first, "routing"))
                     {
-                        char ip_str[255], comp_name[255];
-                        memset(ip_str, 0, sizeof(ip_str));
-                        memset(comp_name, 0, sizeof(comp_name));
+                        if (generic_util::find_str_no_case(param.second, "round_robin"))
+                            routing_ = Routing::round_robin;
+                        else if (generic_util::find_str_no_case(param.second, "hash"))
+                            routing_ = Routing::hash_appname;
+                    }
 
-                        GetPrimaryIp(ip_str, sizeof(ip_str));
-                        unsigned long name_len = sizeof(comp_name);
-                        gethostname(comp_name, name_len);
+                    if (generic_util::find_str_no_case(param.first, "channel_pool"))
+                    {
+                        int first = 0, last = 0;
 
-                        if (std::string(ip_str).empty() && std::string(comp_name).empty())
+                        if ((2 == sscanf(param.second.c_str(), "%d-%d", &first, &last)) && (first > 0) && (last <= 65535) && (last > first))
                         {
-                            THROWM(fplog::exceptions::Incorrect_Parameter, "Cannot resolve hostname, please set it manually in ini file.");
+                            pool_first_ = static_cast<unsigned short>(first);
+                            pool_last_ = static_cast<unsigned short>(last);
                         }
+                    }
+
+                    if (generic_util::find_str_no_case(param.first, "journal_dir"))
+                    {
+                        journal_dir_ = param.second;
+                        generic_util::trim(journal_dir_);
+                    }
+
+                    if (generic_util::find_str_no_case(param.first, "journal_size"))
+                    {
+                        int mb = std::stoi(param.second);
+
+                        if (mb > 0)
+                            journal_size_ = static_cast<size_t>(mb) * 1024 * 1024;
+                    }
+
+                    if (generic_util::find_str_no_case(param.first, "journal_segment_size"))
+                    {
+                        int mb = std::stoi(param.second);
+
+                        if ((mb > 0) && (mb <= 1024))
+                            journal_segment_size_ = static_cast<size_t>(mb) * 1024 * 1024;
+                    }
+
+                    if (generic_util::find_str_no_case(param.first, "journal_fsync_interval"))
+                    {
+                        int interval = std::stoi(param.second);
+
+                        if (interval > 0)
+                            journal_sync_interval_ = interval;
+                    }
+                    else if (generic_util::find_str_no_case(param.first, "journal_fsync"))
+                    {
+                        if (generic_util::find_str_no_case(param.second, "none"))
+                            journal_sync_ = fplogd::Journal::Sync::none;
+                        else if (generic_util::find_str_no_case(param.second, "always"))
+                            journal_sync_ = fplogd::Journal::Sync::always;
                         else
-                            hostname_ = std::string(comp_name) + "/" + std::string(ip_str);
+                            journal_sync_ = fplogd::Journal::Sync::interval;
                     }
-                    else
-                        hostname_ = param.second;
 
-                    if (hostname_.compare("auto") == 0)
+                    if (generic_util::find_str_no_case(param.first, "batch_threads"))
+                    {
+                        int threads = std::stoi(param.second);
+
+                        if ((threads > 0) && (threads <= max_batch_threads))
+                            batch_threads_ = threads;
+                    }
+
+                    if (generic_util::find_str_no_case(param.first, "priority_lane_size"))
+                    {
+                        int kb = std::stoi(param.second);
+
+                        if (kb >= 0)
+                            priority_lane_size_ = static_cast<size_t>(kb) * 1024;
+                    }
+                    else if (generic_util::find_str_no_case(param.first, "priority_lane"))
+                        priority_lane_ = split_prios(param.second);
+
+                    if (generic_util::find_str_no_case(param.first, "udp_io"))
+                        udp_uring_ = generic_util::find_str_no_case(param.second, "uring");
+
+                    if (generic_util::find_str_no_case(param.first, "pin_ipc_threads"))
+                        pin_ipc_threads_ = generic_util::find_str_no_case(param.second, "true") || (param.second == "1");
+                    else if (generic_util::find_str_no_case(param.first, "ipc_threads"))
+                    {
+                        int threads = std::stoi(param.second);
+
+                        if ((threads > 0) && (threads <= 64))
+                            ipc_threads_ = threads;
+                    }
+                
+                    if (generic_util::find_str_no_case(param.first, "hostname"))
                     {
-                        THROWM(fplog::exceptions::Incorrect_Parameter, "Cannot resolve hostname, please set it manually in ini file.");
+                        hostname_ = "auto";
+
+                        if (generic_util::find_str_no_case(param.second, "auto"))
+                        {
+                            char ip_str[255], comp_name[255];
+                            memset(ip_str, 0, sizeof(ip_str));
+                            memset(comp_name, 0, sizeof(comp_name));
+
+                            GetPrimaryIp(ip_str, sizeof(ip_str));
+                            unsigned long name_len = sizeof(comp_name);
+                            gethostname(comp_name, name_len);
+
+                            if (std::string(ip_str).empty() && std::string(comp_name).empty())
+                            {
+                                THROWM(fplog::exceptions::Incorrect_Parameter, "Cannot resolve hostname, please set it manually in ini file.");
+                            }
+                            else
+                                hostname_ = std::string(comp_name) + "/" + std::string(ip_str);
+                        }
+                        else
+                            hostname_ = param.second;
+
+                        if (hostname_.compare("auto") == 0)
+                        {
+                            THROWM(fplog::exceptions::Incorrect_Parameter, "Cannot resolve hostname, please set it manually in ini file.");
+                        }
                     }
                 }
+                catch (std::exception&)
+                {
+                    continue;
+                }
+            }
+
+            hostname_fragment_ = hostname_field(hostname_);
+
+            //journal lets messages go once a destination has the batch, which is known only from ACKs of sprot or vsprot
+            if (!journal_dir_.empty())
+                for (auto destination : destinations_)
+                    if (destination->protocol_owns_transport)
+                        THROWM(fplog::exceptions::Incorrect_Parameter, ("journal_dir needs protocol=sprot or vsprot in [" + destination->name + "], with protocol=none "
+                            "nothing tells that fpcollect has got a batch.").c_str());
+
+            aggregate_rules_.clear();
+            for (auto& config : Configuration::instance().get_aggregate_configs())
+                aggregate_rules_.push_back(fplogd::Aggregator::make_rule(config.first, config.second));
+
+            start_destinations();
+
+            //messages of the previous run left in the journal go out first, channels are opened after the shards
+            start_shards(misc);
+
+            //batching and queue limits follow edits of the ini file from now on
+            config_watcher_.reset(new generic_util::File_Watcher(Configuration::instance().get_file_name(), std::bind(&Impl::reconfigure, this)));
+
+            if (!ipc)
+            {
+                fplog::set_in_process_sink(this);
+                return;
             }
 
             std::vector<Channel_Data> channels(Configuration::instance().get_registered_channels());
             for (auto channel : channels)
             {
+#ifdef _LINUX
+                //udp channels are served all together by the reactor threads, see start_reactor()
+                if (channel.transport.empty())
+                {
+                    add_reactor_channel(channel);
+                    continue;
+                }
+#endif
+
                 Thread_Data* worker = new Thread_Data();
                 
                 worker->app_name = channel.app_name;
                 worker->uid = channel.uid.to_string(channel.uid);
+                worker->transport = channel.transport;
+                worker->shard_key = next_shard_key_++;
                 worker->thread = new std::thread(&Impl::ipc_listener, this, worker);
                 
                 pool_.push_back(worker);
             }
+
+            std::string mux_uid(Configuration::instance().get_config_key_value(g_config_file_misc_section_name, g_mux_config_setting_name));
+            generic_util::trim(mux_uid);
+
+            if (!mux_uid.empty())
+            {
+                Thread_Data* worker = new Thread_Data();
+
+                worker->app_name = "mux";
+                worker->uid = mux_uid;
+                worker->thread = new std::thread(&Impl::mux_listener, this, worker);
+
+                pool_.push_back(worker);
+            }
+
+            for (auto& config : Configuration::instance().get_relay_configs())
+            {
+                Thread_Data* worker = new Thread_Data();
+
+                worker->app_name = config.first;
+                worker->params = config.second;
+                worker->uid = worker->params["uid"];
+                worker->shard_key = next_shard_key_++;
+                worker->thread = new std::thread(&Impl::relay_listener, this, worker);
+
+                pool_.push_back(worker);
+            }
+
+            registration_uid_ = Configuration::instance().get_config_key_value(g_config_file_misc_section_name, g_registration_config_setting_name);
+            generic_util::trim(registration_uid_);
+
+#ifdef _LINUX
+            start_reactor();
+#endif
+
+            //after the reactor, udp channels handed out by registration go to its epoll set
+            if (!registration_uid_.empty())
+                registration_thread_ = new std::thread(&Impl::registration_listener, this);
         }
 
         void stop()
         {
+            //reconfigure() must not run while shards go away
+            config_watcher_.reset();
+
+            fplog::set_in_process_sink(0);
+
             {
                 std::lock_guard<std::recursive_mutex> lock(mutex_);
                 should_stop_ = true;
@@ -526,68 +889,242 @@ class Impl
 
             join_all_threads();
 
-            std::string* str = 0;
-            do
-            {
-                str = 0;
+#ifdef _LINUX
+            stop_reactor();
+#endif
 
-                if (!mq_.empty())
-                {
-                    str = mq_.front();
-                    mq_.pop();
-                    delete str;
-                }
-            } while (str);
+            stop_destinations();
 
-            delete protocol_;
-            delete log_transport_;
+            //after the writers are done, so every acknowledged batch is taken off the journals
+            stop_shards();
         }
 
 
     private:
 
         std::string hostname_;
-        int batch_size_;
+        std::string hostname_fragment_; //hostname as JSON field with a leading comma, spliced into every message
+        int batch_size_; //most messages in a batch, adaptive target of a lane never goes above it
+        size_t batch_bytes_;
+        size_t batch_linger_; //ms
+        int ipc_threads_;
+        bool pin_ipc_threads_;
+        bool udp_uring_;
+
+        enum class Channel_State
+        {
+            opening,
+            open,
+            failed
+        };
 
         struct Thread_Data
         {
-            Thread_Data(): thread(0) {}
+            Thread_Data(): thread(0), shard_key(0), pool_port(0), state(Channel_State::opening), stop(false), last_active(0) {}
 
             std::thread* thread;
             std::string uid;
             std::string app_name;
+            std::string transport;
+            size_t shard_key;
+            fplog::Transport_Interface::Params params; //section of a relay listener
+
+            //channels handed out by registration take a port pair of the pool and are stopped when idle, static ones have pool_port 0
+            unsigned short pool_port;
+            Channel_State state;
+            volatile bool stop;
+            std::atomic<long long> last_active; //ms of steady_clock, set by the channel thread without mutex_
+        };
+
+        //Udp channel served by the reactor, sprot state stays with the channel whichever thread reads it.
+        //epoll refers to it by id, so an event that comes after the channel is reclaimed finds nothing instead of a deleted object.
+        struct Reactor_Channel
+        {
+            Reactor_Channel(): ipc(&transport), shard_key(0), pool_port(0), busy(false) {}
+
+            std::string uid;
+            std::string app_name;
+            spipc::Socket_Transport transport;
+            spipc::IPC ipc;
+            size_t shard_key;
+
+            unsigned short pool_port;
+            bool busy; //being read by a reactor thread
+            std::chrono::steady_clock::time_point last_active; //set while busy, reclaim leaves busy channels alone
+        };
+
+        //failover sends everything to the first destination that is up, round_robin spreads batches over all of them,
+        //hash_appname keeps every application on its own destination and moves it to the next one on the ring only while that one is down
+        enum class Routing
+        {
+            failover,
+            round_robin,
+            hash_appname
+        };
+
+        //One [transport...] section of the ini file with its own sender thread and window of batches in flight.
+        struct Destination
+        {
+            Destination(): transport(0), protocol(0), protocol_owns_transport(false), writer(0), failures(0) {}
+
+            std::string name;
+            fplog::Transport_Interface* transport;
+            fplog::Transport_Interface* protocol;
+            bool protocol_owns_transport;
+            sprot::Async_Writer* writer;
+
+            //batches failed in a row, destination is skipped until down_until and the pause grows with every failure
+            int failures;
+            std::chrono::steady_clock::time_point down_until;
+        };
+
+        //Messages collected by mq_reader, hash routing keeps one lane per destination so a batch never mixes applications of different destinations.
+        //Lane is sent when it has target messages, reaches batch_bytes_ or its oldest message has waited batch_linger_,
+        //target doubles while messages keep coming faster than batches go out and drops to what arrived within the linger time when they do not.
+        struct Lane
+        {
+            Lane(): key(0), count(0), bytes(0), target(1), send_now(false) {}
+
+            std::vector<std::string*> messages;
+            std::vector<size_t> relayed; //per item of messages, see Pending::relayed
+            std::vector<unsigned long long> journal_ids;
+            unsigned key;
+            size_t count; //messages in the lane, those of relayed batches counted one by one
+            size_t bytes;
+            size_t target;
+            bool send_now;
+            std::chrono::steady_clock::time_point first_added;
+        };
+
+        //Message taken out of the queue or journal of a shard by its mq_reader, it is checked once outside of the lock and then waits for room in its lane.
+        struct Pending
+        {
+            Pending(std::string* s, unsigned long long id = 0, bool u = false): str(s), journal_id(id), checked(false), urgent(u), relayed(0), lane(0), key(0) {}
+
+            std::string* str;
+            unsigned long long journal_id; //0 for messages that came through the queue or the priority lane
+            bool checked;
+            bool urgent; //from the priority lane, batched apart from the rest and sent without linger
+            size_t relayed; //number of messages if str is the array of a batch from another fplogd, 0 for a single message
+            size_t lane;
+            unsigned key;
+        };
+
+        struct Shard;
+
+        //Batch on its way to fpcollect, remembers destinations it has failed on already.
+        //Its journaled messages are acknowledged to the journal of its shard once a destination has the batch.
+        struct Outgoing
+        {
+            Outgoing(): key(0), shard(0) {}
+
+            std::unique_ptr<std::string> batch;
+            unsigned key;
+            std::set<size_t> tried;
+            std::vector<unsigned long long> journal_ids;
+            Shard* shard;
+        };
+
+        //Validation and batching run on batch_threads shards, each with its own thread, queue, journal and lanes.
+        //All messages of a channel go to the same shard, so they keep their order while other shards
+        //work on other channels on other cores. Channels push to their shard without taking mutex_.
+        //Messages of priority_lane_ priorities skip the journal and the queue, so a backlog of others does not hold them up.
+        struct Shard
+        {
+            Shard(): urgent_bytes(0), urgent_max_bytes(0), thread(0) {}
+
+            std::mutex mutex; //mq, urgent, rerouted and held
+            Queue_Controller mq;
+            std::deque<std::string*> urgent;
+            size_t urgent_bytes;
+            size_t urgent_max_bytes; //priority lane budget of the shard, messages over it go the usual way
+            fplogd::Journal journal;
+            fplogd::Aggregator aggregator; //used by the thread of the shard only
+            std::vector<std::shared_ptr<Outgoing>> rerouted;
+            std::vector<std::shared_ptr<Outgoing>> held; //failed on every destination, journaled messages wait in them for one to come back
+            std::thread* thread;
         };
 
 
         void ipc_listener(Thread_Data* data)
         {
             spipc::IPC ipc;
+            spipc::Unix_Socket_Transport local_socket;
+            spipc::Shared_Memory_Transport ring;
             spipc::IPC::Params params;
 
             params["type"] = "ip";
             params["ip"] = "127.0.0.1";
             params["uid"] = data->uid;
-            
-            ipc.connect(params);
 
-            size_t buf_sz = 2048;
-            char *buf = new char [buf_sz];
             std::string emergency_log_file_path = Configuration::instance().get_log_error_file_full_path();
 
-            while(true)
+            //unix socket and shared memory ring are reliable and keep message boundaries, so they are read directly without sprot
+            fplog::Transport_Interface* channel = &ipc;
+
+            try
             {
-                memset(buf, 0, buf_sz);
+                if (data->transport == "unix")
+                    channel = &local_socket;
+                else if (data->transport == "shm")
+                    channel = &ring;
+                else if (!data->transport.empty())
+                    THROWM(fplog::exceptions::Incorrect_Parameter, ("Unknown channel transport " + data->transport + ".").c_str());
 
-                try
-                {
-                    ipc.read(buf, buf_sz - 1, 1000);
+                if (channel != &ipc)
+                    params["listen"] = "true";
 
-                    std::lock_guard<std::recursive_mutex> lock(mutex_);
-                    
-                    mq_.push(new std::string(buf));
+                channel->connect(params);
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                data->state = Channel_State::failed;
 
-                    if (buf_sz > 2048)
-                    {
+                //registration just tries the next port pair of the pool
+                if (!data->pool_port)
+                    report_ipc_error(data->app_name, data->transport.empty() ? data->uid : data->transport + ":" + data->uid, e, emergency_log_file_path);
+
+                return;
+            }
+
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                data->state = Channel_State::open;
+                data->last_active = now_ms();
+            }
+
+            size_t buf_sz = 2048;
+            char *buf = new char [buf_sz];
+
+            while(true)
+            {
+                try
+                {
+                    std::string* msg = 0;
+
+                    if (channel == &ring)
+                    {
+                        //message is copied straight from the ring into the queue
+                        size_t size = 0;
+                        const char* in_place = static_cast<const char*>(ring.acquire(size, 1000));
+
+                        msg = new std::string(in_place, strnlen(in_place, size));
+                        ring.release();
+                    }
+                    else
+                    {
+                        memset(buf, 0, buf_sz);
+                        channel->read(buf, buf_sz - 1, 1000);
+
+                        msg = new std::string(buf);
+                    }
+
+                    enqueue(data->shard_key, msg);
+                    data->last_active = now_ms();
+
+                    if (buf_sz > 2048)
+                    {
                         buf_sz = 2048;
                         delete[] buf;
                         buf = new char[buf_sz];
@@ -601,58 +1138,1374 @@ class Impl
                 }
                 catch(fplog::exceptions::Timeout&)
                 {
+                    //writes of the app to a ring fplogd no longer reads would not fail, so the ring is kept while the app runs
+                    bool producer = data->pool_port && (channel == &ring) && ring.has_producer();
+
+                    if (producer)
+                        data->last_active = now_ms();
+
+                    {
+                        std::lock_guard<std::recursive_mutex> lock(mutex_);
+                        if (should_stop_ || data->stop)
+                        {
+                            delete [] buf;
+                            return;
+                        }
+                    }
+                    continue;
+                }
+                catch(fplog::exceptions::Generic_Exception& e)
+                {
+                    report_ipc_error(data->app_name, data->uid, e, emergency_log_file_path);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+
+                {
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    if (should_stop_ || data->stop)
+                    {
+                        delete [] buf;
+                        return;
+                    }
+                }
+            }
+        }
+
+        //Batches of other fplogds whose [transport] points here, read the way fpcollect reads them. Messages are not unpacked,
+        //the array of a batch goes through the shard as one item and mq_reader merges it into batches of this fplogd as it is.
+        void relay_listener(Thread_Data* data)
+        {
+            std::string emergency_log_file_path = Configuration::instance().get_log_error_file_full_path();
+            std::string uid(data->params["ip"] + ":" + data->uid);
+
+            Transport_Factory factory;
+            fplog::Transport_Interface* transport = factory.create(data->params);
+
+            if (!transport)
+                return;
+
+            std::unique_ptr<fplog::Transport_Interface> transport_owner(transport);
+            fplog::Transport_Interface* protocol = 0;
+
+            //accepting side of connection oriented transports (tcp), as fpcollect is
+            data->params["listen"] = "true";
+
+            try
+            {
+                transport->connect(data->params);
+                protocol = make_protocol(transport, data->params);
+
+                //read without protocol, the transport goes away together with the compression layer
+                if (protocol == transport)
+                    transport_owner.release();
+
+                std::unique_ptr<fplog::Transport_Interface> protocol_owner(protocol);
+
+                //compressed batches are detected by their header, uncompressed ones pass through untouched
+                protocol = new sprot::Compressing_Protocol(protocol, false, sprot::Lz_Codec::load_dictionary(data->params["compression_dictionary"]));
+                protocol_owner.release();
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                report_ipc_error(data->app_name, uid, e, emergency_log_file_path);
+                return;
+            }
+
+            std::unique_ptr<fplog::Transport_Interface> protocol_owner(protocol);
+
+            size_t buf_sz = 30 * 1024;
+            char *buf = new char [buf_sz];
+
+            while(true)
+            {
+                try
+                {
+                    size_t size = protocol->read(buf, buf_sz - 1, 1000);
+
+                    //anything but a batch (of one message at least) is dropped, a single message already carries the hostname of its fplogd
+                    const char* items = 0;
+                    size_t items_size = 0;
+
+                    if (generic_util::scan_json_batch(buf, strnlen(buf, size), fplog::Message::Optional_Fields::batch, &items, &items_size))
+                        enqueue(data->shard_key, new std::string(items, items_size));
+
+                    if (buf_sz > 30 * 1024)
+                    {
+                        buf_sz = 30 * 1024;
+                        delete[] buf;
+                        buf = new char[buf_sz];
+                    }
+                }
+                catch(fplog::exceptions::Buffer_Overflow&)
+                {
+                    buf_sz *= 2;
+                    delete [] buf;
+                    buf = new char [buf_sz];
+                }
+                catch(fplog::exceptions::Timeout&)
+                {
+                }
+                catch(fplog::exceptions::Generic_Exception& e)
+                {
+                    report_ipc_error(data->app_name, uid, e, emergency_log_file_path);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+
+                {
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    if (should_stop_ || data->stop)
+                    {
+                        delete [] buf;
+                        return;
+                    }
+                }
+            }
+        }
+
+        //Single receive loop serving every app connected to the shared mux endpoint,
+        //each app is a separate logical channel with its own sprot state.
+        void mux_listener(Thread_Data* data)
+        {
+            std::string emergency_log_file_path = Configuration::instance().get_log_error_file_full_path();
+
+            spipc::Socket_Transport transport;
+            spipc::Socket_Transport::Params params;
+
+            params["type"] = "ip";
+            params["ip"] = "127.0.0.1";
+            params["uid"] = data->uid;
+            params["mux"] = "true";
+
+            try
+            {
+                transport.connect(params);
+                if (!transport.is_mux_endpoint())
+                    THROWM(fplog::exceptions::Connect_Failed, "Shared endpoint port is already taken by another process.");
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                report_ipc_error(data->app_name, data->uid, e, emergency_log_file_path);
+                return;
+            }
+
+            sprot::Channel_Mux mux(&transport);
+
+            //channel id is the port of the client, a closed channel lets a later client on the same port start with fresh sprot state
+            std::map<sprot::Channel_Mux::Channel_Id, long long> last_active;
+            long long last_reclaim = now_ms();
+
+            size_t buf_sz = 2048;
+            char *buf = new char [buf_sz];
+
+            while(true)
+            {
+                sprot::Channel_Mux::Channel_Id channel_id = 0;
+
+                try
+                {
+                    if (mux.wait_readable(channel_id, 1000))
+                    {
+                        last_active[channel_id] = now_ms();
+
+                        //short timeout, the rest of a multi-frame message follows right after its first frame and other clients are not held up
+                        size_t bytes = mux.channel(channel_id)->read(buf, buf_sz - 1, reactor_read_timeout);
+                        buf[bytes] = 0;
+
+                        //channel id stays with the connection, each mux client keeps its order within one shard
+                        enqueue(static_cast<size_t>(channel_id), new std::string(buf));
+
+                        if (buf_sz > 2048)
+                        {
+                            buf_sz = 2048;
+                            delete[] buf;
+                            buf = new char[buf_sz];
+                        }
+                    }
+                }
+                catch(fplog::exceptions::Buffer_Overflow&)
+                {
+                    buf_sz *= 2;
+                    delete [] buf;
+                    buf = new char [buf_sz];
+                }
+                catch(fplog::exceptions::Timeout&)
+                {
+                }
+                catch(fplog::exceptions::Generic_Exception& e)
+                {
+                    mux.close_channel(channel_id);
+                    last_active.erase(channel_id);
+                    report_ipc_error(data->app_name, data->uid + "/" + std::to_string(channel_id), e, emergency_log_file_path);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                }
+
+                long long idle_timeout = 0;
+
+                {
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    if (should_stop_)
+                    {
+                        delete [] buf;
+                        return;
+                    }
+
+                    idle_timeout = static_cast<long long>(channel_idle_timeout_);
+                }
+
+                //clients that went away are not told apart from quiet ones, channels without messages for channel_idle_timeout are closed
+                long long now = now_ms();
+                if (now - last_reclaim < 1000)
+                    continue;
+
+                last_reclaim = now;
+
+                for (auto id : mux.get_channels())
+                {
+                    auto active = last_active.insert(std::make_pair(id, now)).first;
+
+                    if (now - active->second >= idle_timeout)
+                    {
+                        mux.close_channel(id);
+                        last_active.erase(active);
+                    }
+                }
+            }
+        }
+
+        //Registration endpoint is a Channel_Mux shared endpoint like mux_uid, every app asking it gets a channel of its own
+        //on the next free port pair of channel_pool, so apps do not have to be listed in [channels].
+        //Request is {"appname":"<app>","transport":"udp|unix|shm"}, reply is {"uid":"<uid for initlog>"} or {"error":"<reason>"}.
+        void registration_listener()
+        {
+            std::string emergency_log_file_path = Configuration::instance().get_log_error_file_full_path();
+
+            spipc::Socket_Transport transport;
+            spipc::Socket_Transport::Params params;
+
+            params["type"] = "ip";
+            params["ip"] = "127.0.0.1";
+            params["uid"] = registration_uid_;
+            params["mux"] = "true";
+
+            try
+            {
+                transport.connect(params);
+                if (!transport.is_mux_endpoint())
+                    THROWM(fplog::exceptions::Connect_Failed, "Registration endpoint port is already taken by another process.");
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                report_ipc_error("registration", registration_uid_, e, emergency_log_file_path);
+                return;
+            }
+
+            sprot::Channel_Mux mux(&transport);
+            char buf[1024];
+
+            while(true)
+            {
+                {
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    if (should_stop_)
+                        return;
+                }
+
+                sprot::Channel_Mux::Channel_Id channel_id = 0;
+
+                try
+                {
+                    if (mux.wait_readable(channel_id, 1000))
+                    {
+                        size_t bytes = mux.channel(channel_id)->read(buf, sizeof(buf) - 1, registration_timeout);
+                        buf[bytes] = 0;
+
+                        std::string reply(register_channel(buf));
+                        mux.channel(channel_id)->write(reply.c_str(), reply.size(), registration_timeout);
+
+                        //the app talks to its own channel from now on
+                        mux.close_channel(channel_id);
+                    }
+                }
+                catch(fplog::exceptions::Timeout&)
+                {
+                    mux.close_channel(channel_id);
+                }
+                catch(fplog::exceptions::Generic_Exception& e)
+                {
+                    mux.close_channel(channel_id);
+                    report_ipc_error("registration", registration_uid_ + "/" + std::to_string(channel_id), e, emergency_log_file_path);
+                }
+
+                reclaim_idle_channels();
+            }
+        }
+
+        std::string register_channel(const char* request)
+        {
+            JSONNode reply(JSON_NODE);
+
+            try
+            {
+                JSONNode json(libjson::parse(request));
+
+                auto appname = json.find(fplog::Message::Mandatory_Fields::appname);
+                auto transport = json.find("transport");
+
+                std::string uid(open_pool_channel((appname != json.end()) ? appname->as_string() : std::string("noname"), (transport != json.end()) ? transport->as_string() : std::string("udp")));
+                reply.push_back(JSONNode("uid", uid));
+            }
+            catch(std::invalid_argument&)
+            {
+                reply.push_back(JSONNode("error", "Malformed registration request."));
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                reply.push_back(JSONNode("error", e.what()));
+            }
+
+            return reply.write();
+        }
+
+        //Starts listening on the next free port pair of the pool and returns uid of the channel as initlog takes it.
+        std::string open_pool_channel(const std::string& app_name, const std::string& transport)
+        {
+            if ((transport != "udp") && (transport != "unix") && (transport != "shm"))
+                THROWM(fplog::exceptions::Incorrect_Parameter, ("Unknown channel transport " + transport + ".").c_str());
+
+            size_t pairs = (pool_last_ - pool_first_ + 1) / 2;
+
+            for (size_t i = 0; i < pairs; i++)
+            {
+                size_t pair = (next_pool_pair_ + i) % pairs;
+                unsigned short port = static_cast<unsigned short>(pool_first_ + 2 * pair);
+
+                {
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    if (pool_ports_in_use_.find(port) != pool_ports_in_use_.end())
+                        continue;
+                }
+
+                Channel_Data data;
+                data.app_name = app_name;
+                data.uid.high = port;
+                data.uid.low = port + 1;
+
+                if (transport != "udp")
+                    data.transport = transport;
+
+                if (start_pool_channel(data, port))
+                {
+                    next_pool_pair_ = pair + 1;
+
+                    std::string uid(data.uid.to_string(data.uid));
+                    return data.transport.empty() ? uid : data.transport + ":" + uid;
+                }
+            }
+
+            THROWM(fplog::exceptions::Connect_Failed, "No free port pair left in channel_pool.");
+        }
+
+        //Returns false if the port pair is taken by some other process.
+        bool start_pool_channel(Channel_Data& data, unsigned short port)
+        {
+#ifdef _LINUX
+            if (data.transport.empty())
+            {
+                Reactor_Channel* channel = 0;
+
+                try
+                {
+                    channel = open_reactor_channel(data);
+                }
+                catch(fplog::exceptions::Generic_Exception&)
+                {
+                    return false;
+                }
+
+                //first port of the pair must be ours, the app binds the second one
+                if (channel->transport.local_port() != port)
+                {
+                    delete channel;
+                    return false;
+                }
+
+                channel->pool_port = port;
+
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                unsigned long long id = ++next_reactor_id_;
+                reactor_channels_[id] = channel;
+
+                if (!watch_reactor_channel(id, channel))
+                {
+                    reactor_channels_.erase(id);
+                    delete channel;
+                    THROWM(fplog::exceptions::Connect_Failed, ("Cannot add channel to epoll, error = " + std::to_string(errno)).c_str());
+                }
+
+                pool_ports_in_use_.insert(port);
+                return true;
+            }
+#endif
+
+            Thread_Data* worker = new Thread_Data();
+
+            worker->app_name = data.app_name;
+            worker->uid = data.uid.to_string(data.uid);
+            worker->transport = data.transport;
+            worker->pool_port = port;
+            worker->shard_key = next_shard_key_++;
+            worker->thread = new std::thread(&Impl::ipc_listener, this, worker);
+
+            //the worker connects on its own thread, its outcome decides whether the pair is handed out
+            std::chrono::steady_clock::time_point timer_start(std::chrono::steady_clock::now());
+            Channel_State state = Channel_State::opening;
+
+            while (state == Channel_State::opening)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                state = worker->state;
+
+                if ((state == Channel_State::opening) && (std::chrono::steady_clock::now() - timer_start > std::chrono::milliseconds(static_cast<long long>(channel_open_timeout))))
+                {
+                    worker->stop = true;
+                    break;
+                }
+            }
+
+            if (state != Channel_State::open)
+            {
+                worker->thread->join();
+                delete worker->thread;
+                delete worker;
+                return false;
+            }
+
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+            pool_.push_back(worker);
+            pool_ports_in_use_.insert(port);
+
+            return true;
+        }
+
+        //Pool channels without messages for channel_idle_timeout_ are closed and their port pairs go back to the pool,
+        //shared memory rings only after their app has exited.
+        void reclaim_idle_channels()
+        {
+            std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+            std::vector<Thread_Data*> idle_workers;
+
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                std::chrono::milliseconds idle_timeout(channel_idle_timeout_); //changes with the ini file
+
+#ifdef _LINUX
+                for (auto channel = reactor_channels_.begin(); channel != reactor_channels_.end();)
+                {
+                    Reactor_Channel* reactor_channel = channel->second;
+
+                    //channel being read now is not idle anyway
+                    if (!reactor_channel->pool_port || reactor_channel->busy || (now - reactor_channel->last_active < idle_timeout))
+                    {
+                        ++channel;
+                        continue;
+                    }
+
+                    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, reactor_channel->transport.poll_handle(), 0);
+                    pool_ports_in_use_.erase(reactor_channel->pool_port);
+
+                    delete reactor_channel;
+                    channel = reactor_channels_.erase(channel);
+                }
+#endif
+
+                for (auto worker = pool_.begin(); worker != pool_.end();)
+                {
+                    if (!(*worker)->pool_port || (now_ms() - (*worker)->last_active < static_cast<long long>(channel_idle_timeout_)))
+                    {
+                        ++worker;
+                        continue;
+                    }
+
+                    (*worker)->stop = true;
+                    idle_workers.push_back(*worker);
+                    worker = pool_.erase(worker);
+                }
+            }
+
+            //workers notice stop within their 1 second read timeout
+            for (auto worker : idle_workers)
+            {
+                worker->thread->join();
+
+                //producer is gone, the next app given this pair starts with an empty ring
+                if (worker->transport == "shm")
+                    spipc::Shared_Memory_Transport::remove(fplog::UID::Helper::from_string(worker->uid));
+
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                pool_ports_in_use_.erase(worker->pool_port);
+
+                delete worker->thread;
+                delete worker;
+            }
+        }
+
+#ifdef _LINUX
+        //Connected channel, udp ports of its uid are taken by another process when connect throws or leaves fplogd on the second port.
+        Reactor_Channel* open_reactor_channel(Channel_Data& channel_data)
+        {
+            std::unique_ptr<Reactor_Channel> channel(new Reactor_Channel());
+            spipc::IPC::Params params;
+
+            channel->app_name = channel_data.app_name;
+            channel->uid = channel_data.uid.to_string(channel_data.uid);
+            channel->shard_key = next_shard_key_++;
+            channel->last_active = std::chrono::steady_clock::now();
+
+            params["type"] = "ip";
+            params["ip"] = "127.0.0.1";
+            params["uid"] = channel->uid;
+
+            if (udp_uring_)
+                params["io"] = "uring";
+
+            channel->ipc.connect(params);
+            return channel.release();
+        }
+
+        void add_reactor_channel(Channel_Data& channel_data)
+        {
+            try
+            {
+                Reactor_Channel* channel = open_reactor_channel(channel_data);
+                reactor_channels_[++next_reactor_id_] = channel;
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                report_ipc_error(channel_data.app_name, channel_data.uid.to_string(channel_data.uid), e, Configuration::instance().get_log_error_file_full_path());
+            }
+        }
+
+        bool watch_reactor_channel(unsigned long long id, Reactor_Channel* channel)
+        {
+            epoll_event event;
+            event.events = EPOLLIN | EPOLLONESHOT;
+            event.data.u64 = id;
+
+            //with io_uring the socket is drained by the kernel and only the completion ring signals new datagrams
+            return (0 == epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, channel->transport.poll_handle(), &event));
+        }
+
+        //Instead of a thread per channel, ipc_threads_ threads wait on one epoll set with every udp channel socket in it.
+        //Sockets are registered one-shot, so a channel is read by one thread at a time and is rearmed when that thread is done.
+        void start_reactor()
+        {
+            //channels handed out by registration join the set later
+            if (reactor_channels_.empty() && registration_uid_.empty())
+                return;
+
+            std::string emergency_log_file_path = Configuration::instance().get_log_error_file_full_path();
+
+            epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_fd_ < 0)
+            {
+                fplog::exceptions::Connect_Failed e(__FUNCTION__, __SHORT_FORM_OF_FILE__, __LINE__, ("Cannot create epoll, error = " + std::to_string(errno)).c_str());
+                report_ipc_error("reactor", "", e, emergency_log_file_path);
+                return;
+            }
+
+            for (auto& channel : reactor_channels_)
+            {
+                if (!watch_reactor_channel(channel.first, channel.second))
+                {
+                    fplog::exceptions::Connect_Failed e(__FUNCTION__, __SHORT_FORM_OF_FILE__, __LINE__, ("Cannot add channel to epoll, error = " + std::to_string(errno)).c_str());
+                    report_ipc_error(channel.second->app_name, channel.second->uid, e, emergency_log_file_path);
+                }
+            }
+
+            unsigned int cpus = std::thread::hardware_concurrency();
+
+            for (int i = 0; i < ipc_threads_; ++i)
+            {
+                Thread_Data* worker = new Thread_Data();
+
+                worker->app_name = "reactor";
+                worker->thread = new std::thread(&Impl::ipc_reactor, this, worker);
+
+                if (pin_ipc_threads_ && (cpus > 0))
+                {
+                    cpu_set_t cpu_set;
+                    CPU_ZERO(&cpu_set);
+                    CPU_SET(i % cpus, &cpu_set);
+
+                    pthread_setaffinity_np(worker->thread->native_handle(), sizeof(cpu_set), &cpu_set);
+                }
+
+                pool_.push_back(worker);
+            }
+        }
+
+        //Reactor threads must be joined already.
+        void stop_reactor()
+        {
+            if (epoll_fd_ >= 0)
+                close(epoll_fd_);
+
+            epoll_fd_ = -1;
+
+            for (auto& channel : reactor_channels_)
+                delete channel.second;
+
+            reactor_channels_.clear();
+        }
+
+        void ipc_reactor(Thread_Data* data)
+        {
+            std::string emergency_log_file_path = Configuration::instance().get_log_error_file_full_path();
+
+            std::vector<char> buf(2048);
+            epoll_event events[max_reactor_events];
+
+            while(true)
+            {
+                {
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    if (should_stop_)
+                        return;
+                }
+
+                int count = epoll_wait(epoll_fd_, events, max_reactor_events, 1000);
+
+                for (int i = 0; i < count; ++i)
+                {
+                    Reactor_Channel* channel = 0;
+
+                    {
+                        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                        auto found = reactor_channels_.find(events[i].data.u64);
+                        if (found == reactor_channels_.end())
+                            continue;
+
+                        channel = found->second;
+                        channel->busy = true;
+                    }
+
+                    serve_reactor_channel(*channel, buf, emergency_log_file_path);
+
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    channel->busy = false;
+
+                    //level-triggered, so if more datagrams came in the meantime the channel is reported again right away
+                    epoll_event event;
+                    event.events = EPOLLIN | EPOLLONESHOT;
+                    event.data.u64 = events[i].data.u64;
+
+                    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, channel->transport.poll_handle(), &event);
+                }
+            }
+        }
+
+        void serve_reactor_channel(Reactor_Channel& channel, std::vector<char>& buf, const std::string& emergency_log_file_path)
+        {
+            do
+            {
+                try
+                {
+                    size_t bytes = channel.ipc.read(&buf[0], buf.size() - 1, reactor_read_timeout);
+                    enqueue(channel.shard_key, new std::string(&buf[0], strnlen(&buf[0], bytes)));
+                    channel.last_active = std::chrono::steady_clock::now();
+                }
+                catch(fplog::exceptions::Buffer_Overflow&)
+                {
+                    //message is lost as before, the buffer of this thread is ready for the next one
+                    buf.resize(buf.size() * 2);
+                }
+                catch(fplog::exceptions::Timeout&)
+                {
+                }
+                catch(fplog::exceptions::Generic_Exception& e)
+                {
+                    report_ipc_error(channel.app_name, channel.uid, e, emergency_log_file_path);
+                }
+            }
+            //datagrams fetched ahead by the transport are already out of the socket and will not wake epoll
+            while (channel.transport.has_read_ahead());
+        }
+#endif
+
+        void report_ipc_error(const std::string& app_name, const std::string& uid, fplog::exceptions::Generic_Exception& e, const std::string& emergency_log_file_path)
+        {
+            fplog::Message error_msg = FPL_ERROR((std::string("Error from IPC: %s") + std::string(", app = ") + app_name + std::string(", uid = ") + uid).c_str(),
+                e.what().c_str()).set(fplog::Message::Mandatory_Fields::appname, "fplogd").add(fplog::Message::Optional_Fields::sequence, 0).set(fplog::Message::Mandatory_Fields::facility, fplog::Facility::fplog);
+            std::string error_str = error_msg.as_string();
+            append_hostname(&error_str);
+
+            fplog::Transport_Interface* protocol = error_protocol();
+
+            if (protocol)
+            {
+                try
+                {
+                    protocol->write(error_str.c_str(), error_str.size() + 1, 200);
+                }
+                catch(...)
+                {
+                    std::ofstream file(emergency_log_file_path, std::ios::app);
+                    if (file.is_open())
+                    {
+                        file << error_str + "\n";
+                        file.close();
+                    }
+                }
+            }
+        }
+
+        //On shutdown the error goes straight to the emergency file, retries over the network would hold up stop() for every leftover batch.
+        void report_send_error(const std::string& batch, fplog::exceptions::Generic_Exception& e, const std::string& emergency_log_file_path, bool stopping = false)
+        {
+            fplog::Message error_msg = FPL_ERROR(std::string("Error: " + e.what() + " Log message:" + batch).c_str()).set(fplog::Message::Mandatory_Fields::appname, "fplogd").add(fplog::Message::Optional_Fields::sequence, 0).set(fplog::Message::Mandatory_Fields::facility, fplog::Facility::fplog);
+            std::string error_str = error_msg.as_string();
+            append_hostname(&error_str);
+
+            if (stopping)
+            {
+                std::ofstream file(emergency_log_file_path, std::ios::app);
+                if (file.is_open())
+                {
+                    file << error_str + "\n";
+                    file.close();
+                }
+
+                return;
+            }
+
+            int retries_error = 5;
+
+        retry_error:
+
+            try
+            {
+                fplog::Transport_Interface* protocol = error_protocol();
+
+                if (protocol)
+                {
+                    protocol->write(error_str.c_str(), error_str.size() + 1, 200);
+                }
+                else
+                {
+                    THROW(fplog::exceptions::Transport_Missing);
+                }
+            }
+            catch (fplog::exceptions::Generic_Exception&)
+            {
+                if (retries_error <= 0)
+                {
+                    std::ofstream file(emergency_log_file_path, std::ios::app);
+                    if (file.is_open())
+                    {
+                        file << error_str + "\n";
+                        file.close();
+                    }
+                }
+                else
+                {
+                    retries_error--;
+                    goto retry_error;
+                }
+            }
+        }
+
+        //Message goes to the journal of the shard of its channel, or to the queue of the shard when the journal is off or refuses it.
+        //Messages of priority_lane_ priorities go to the priority lane of the shard while it has room.
+        void enqueue(size_t shard_key, std::string* msg)
+        {
+            if (shards_.empty())
+            {
+                delete msg;
+                return;
+            }
+
+            Shard* shard = shards_[shard_key % shards_.size()];
+
+            if (!priority_lane_.empty())
+            {
+                const char* prio = 0;
+                size_t prio_size = 0;
+
+                //priority comes first in messages of fplog, the rest is checked later by mq_reader anyway
+                if (generic_util::find_json_string(msg->c_str(), msg->size(), fplog::Message::Mandatory_Fields::priority, &prio, &prio_size) &&
+                    priority_lane_.count(std::string(prio, prio_size)))
+                {
+                    std::lock_guard<std::mutex> lock(shard->mutex);
+
+                    if (shard->urgent_bytes + msg->size() <= shard->urgent_max_bytes)
+                    {
+                        shard->urgent_bytes += msg->size();
+                        shard->urgent.push_back(msg);
+                        return;
+                    }
+                }
+            }
+
+            if (shard->journal.append(msg->c_str(), msg->size()))
+            {
+                delete msg;
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->mq.push(msg);
+        }
+
+        static long long now_ms()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        //Journal of shard 0 is journal_dir itself, the others are its numbered subdirectories.
+        std::string shard_journal_dir(int shard)
+        {
+            return shard ? journal_dir_ + "/" + std::to_string(shard) : journal_dir_;
+        }
+
+        //Settings that can change while fplogd runs, mutex_ is held. Missing keys go back to their defaults.
+        void apply_live_config(const fplog::Transport_Interface::Params& misc)
+        {
+            batch_size_ = 30;
+            batch_bytes_ = default_batch_bytes;
+            batch_linger_ = default_batch_linger;
+            channel_idle_timeout_ = default_channel_idle_timeout;
+
+            for (auto& param : misc)
+            {
+                //malformed number keeps the default
+                try
+                {
+                    if (generic_util::find_str_no_case(param.first, "batch_size"))
+                    {
+                        int batch_sz = std::stoi(param.second);
+                    
+                        if ((batch_sz > 0) && (batch_sz < 1000))
+                            batch_size_ = batch_sz;
+                    }
+
+                    if (generic_util::find_str_no_case(param.first, "batch_bytes"))
+                    {
+                        int bytes = std::stoi(param.second);
+
+                        if ((bytes >= 512) && (bytes <= 1024 * 1024))
+                            batch_bytes_ = bytes;
+                    }
+
+                    if (generic_util::find_str_no_case(param.first, "batch_linger"))
+                    {
+                        int linger = std::stoi(param.second);
+
+                        if ((linger >= 0) && (linger <= 60000))
+                            batch_linger_ = linger;
+                    }
+
+                    if (generic_util::find_str_no_case(param.first, "channel_idle_timeout"))
+                    {
+                        int timeout = std::stoi(param.second);
+
+                        if (timeout > 0)
+                            channel_idle_timeout_ = timeout;
+                    }
+                }
+                catch (std::exception&)
+                {
+                    continue;
+                }
+            }
+        }
+
+        //max_queue_size is shared by all shard queues
+        fplog::Transport_Interface::Params shard_queue_config(const fplog::Transport_Interface::Params& misc)
+        {
+            fplog::Transport_Interface::Params queue_config(misc);
+
+            //malformed value is passed on as it is, the queue ignores it
+            for (auto& param : queue_config)
+            {
+                try
+                {
+                    if (generic_util::find_str_no_case(param.first, "max_queue_size"))
+                        param.second = std::to_string(std::stoull(param.second) / batch_threads_);
+                }
+                catch (std::exception&)
+                {
+                    continue;
+                }
+            }
+
+            return queue_config;
+        }
+
+        //Called by config_watcher_ when the ini file changes. Batching, queue limits with emergency algos and channel_idle_timeout
+        //are applied right away, other settings (destinations, channels, threads, journal) wait for the next start.
+        void reconfigure()
+        {
+            fplog::Transport_Interface::Params misc;
+
+            try
+            {
+                if (!Configuration::instance().reload())
+                    return;
+
+                misc = Configuration::instance().get_misc_config();
+
+                {
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    apply_live_config(misc);
+                }
+
+                fplog::Transport_Interface::Params queue_config(shard_queue_config(misc));
+
+                for (auto shard : shards_)
+                {
+                    std::lock_guard<std::mutex> lock(shard->mutex);
+                    shard->mq.apply_config(queue_config);
+                }
+            }
+            catch(std::exception& e)
+            {
+                report_config_error(e);
+            }
+        }
+
+        void start_shards(const fplog::Transport_Interface::Params& misc)
+        {
+            fplog::Transport_Interface::Params queue_config(shard_queue_config(misc));
+
+            for (int i = 0; i < batch_threads_; i++)
+            {
+                Shard* shard = new Shard();
+                shard->mq.apply_config(queue_config);
+                shard->urgent_max_bytes = priority_lane_size_ / batch_threads_;
+                shard->aggregator.configure(aggregate_rules_);
+
+                if (!journal_dir_.empty())
+                {
+                    try
+                    {
+                        shard->journal.open(shard_journal_dir(i), std::max(journal_size_ / batch_threads_, journal_segment_size_), journal_segment_size_, journal_sync_, journal_sync_interval_);
+                    }
+                    catch(fplog::exceptions::Generic_Exception& e)
+                    {
+                        report_journal_error(shard_journal_dir(i), e);
+                    }
+                }
+
+                shards_.push_back(shard);
+            }
+
+            //journals of shards gone since batch_threads was lowered are moved to the remaining ones, before any new message comes
+            for (int i = batch_threads_; !journal_dir_.empty() && (i < max_batch_threads); i++)
+            {
+                if (!fplogd::Journal::has_segments(shard_journal_dir(i)))
+                    continue;
+
+                Shard* shard = shards_[i % batch_threads_];
+                fplogd::Journal old;
+                std::vector<unsigned long long> moved;
+
+                try
+                {
+                    old.open(shard_journal_dir(i), std::numeric_limits<size_t>::max(), journal_segment_size_, fplogd::Journal::Sync::none);
+                }
+                catch(fplog::exceptions::Generic_Exception& e)
+                {
+                    report_journal_error(shard_journal_dir(i), e);
+                    continue;
+                }
+
+                unsigned long long id = 0;
+                for (std::string* msg = old.read(id); msg; msg = old.read(id))
+                {
+                    if (shard->journal.append(msg->c_str(), msg->size()))
+                        moved.push_back(id);
+
+                    delete msg;
+                }
+
+                old.ack(moved);
+                old.close();
+            }
+
+            for (auto shard : shards_)
+                shard->thread = new std::thread(&Impl::mq_reader, this, shard);
+        }
+
+        //Threads of the shards are joined already and writers are done with their batches.
+        void stop_shards()
+        {
+            for (auto shard : shards_)
+            {
+                //pop() looks at the message to keep track of the queue size, so it is deleted afterwards
+                while (!shard->mq.empty())
+                {
+                    std::string* msg = shard->mq.front();
+                    shard->mq.pop();
+                    delete msg;
+                }
+
+                for (auto msg : shard->urgent)
+                    delete msg;
+
+                shard->journal.close();
+                delete shard;
+            }
+
+            shards_.clear();
+        }
+
+        void report_config_error(std::exception& e)
+        {
+            fplog::Message error_msg = FPL_ERROR((std::string("Changed configuration is not applied: %s") + std::string(", config_file = ") + Configuration::instance().get_file_name()).c_str(),
+                e.what()).set(fplog::Message::Mandatory_Fields::appname, "fplogd").add(fplog::Message::Optional_Fields::sequence, 0).set(fplog::Message::Mandatory_Fields::facility, fplog::Facility::fplog);
+            std::string error_str = error_msg.as_string();
+            append_hostname(&error_str);
+
+            std::ofstream file(Configuration::instance().get_log_error_file_full_path(), std::ios::app);
+            if (file.is_open())
+            {
+                file << error_str + "\n";
+                file.close();
+            }
+        }
+
+        void report_journal_error(const std::string& dir, fplog::exceptions::Generic_Exception& e)
+        {
+            fplog::Message error_msg = FPL_ERROR((std::string("Journal is not used: %s") + std::string(", journal_dir = ") + dir).c_str(),
+                e.what().c_str()).set(fplog::Message::Mandatory_Fields::appname, "fplogd").add(fplog::Message::Optional_Fields::sequence, 0).set(fplog::Message::Mandatory_Fields::facility, fplog::Facility::fplog);
+            std::string error_str = error_msg.as_string();
+            append_hostname(&error_str);
+
+            std::ofstream file(Configuration::instance().get_log_error_file_full_path(), std::ios::app);
+            if (file.is_open())
+            {
+                file << error_str + "\n";
+                file.close();
+            }
+        }
+
+        static unsigned hash(const char* str, size_t size)
+        {
+            //FNV-1a, stable between runs and platforms unlike std::hash
+            unsigned res = 2166136261u;
+
+            for (size_t i = 0; i < size; i++)
+            {
+                res ^= static_cast<unsigned char>(str[i]);
+                res *= 16777619u;
+            }
+
+            return res;
+        }
+
+        static unsigned hash(const std::string& str)
+        {
+            return hash(str.c_str(), str.size());
+        }
+
+        void start_destinations()
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+            //with somewhere else to go a failed batch is re-routed right away instead of being retried on the same destination
+            int retries = (destinations_.size() > 1) ? 1 : 5;
+
+            ring_.clear();
+            next_destination_ = 0;
+
+            for (size_t i = 0; i < destinations_.size(); i++)
+            {
+                Destination* destination = destinations_[i];
+
+                if (!destination->writer)
+                    destination->writer = new sprot::Async_Writer(destination->protocol, max_batches_in_flight, retries);
+
+                destination->failures = 0;
+                destination->down_until = std::chrono::steady_clock::time_point();
+
+                for (int node = 0; node < ring_nodes_per_destination; node++)
+                    ring_[hash(destination->name + "#" + std::to_string(node))] = i;
+            }
+
+            ring_version_++;
+        }
+
+        void stop_destinations()
+        {
+            //writers are flushed and deleted without mutex_, their completion callbacks take it
+            for (auto destination : destinations_)
+                if (destination->writer)
+                    destination->writer->flush(stop_flush_timeout);
+
+            for (auto destination : destinations_)
+            {
+                delete destination->writer;
+                destination->writer = 0;
+            }
+
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+            for (auto destination : destinations_)
+            {
+                delete destination->protocol;
+
+                if (!destination->protocol_owns_transport)
+                    delete destination->transport;
+
+                delete destination;
+            }
+
+            destinations_.clear();
+            ring_.clear();
+            ring_version_++;
+        }
+
+        //Destinations in the order they are tried for the batch with the given key.
+        std::vector<size_t> route_order(unsigned key)
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+            std::vector<size_t> order;
+            size_t count = destinations_.size();
+
+            if (count == 0)
+                return order;
+
+            if ((routing_ == Routing::hash_appname) && !ring_.empty())
+            {
+                //walking the ring from the key gives the owner first and then the same fallbacks for every batch of the application
+                std::set<size_t> seen;
+                auto node = ring_.lower_bound(key);
+
+                for (size_t n = 0; (n < ring_.size()) && (order.size() < count); n++, node++)
+                {
+                    if (node == ring_.end())
+                        node = ring_.begin();
+
+                    if (seen.insert(node->second).second)
+                        order.push_back(node->second);
+                }
+
+                return order;
+            }
+
+            size_t first = (routing_ == Routing::round_robin) ? (next_destination_++ % count) : 0;
+
+            for (size_t n = 0; n < count; n++)
+                order.push_back((first + n) % count);
+
+            return order;
+        }
+
+        //Shards look up owners in their own copy of the ring, without mutex_ for every message.
+        static size_t ring_owner(const std::map<unsigned, size_t>& ring, unsigned key)
+        {
+            if (ring.empty())
+                return 0;
+
+            auto node = ring.lower_bound(key);
+            return (node == ring.end()) ? ring.begin()->second : node->second;
+        }
+
+        void destination_ok(size_t index)
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+            if (index >= destinations_.size())
+                return;
+
+            destinations_[index]->failures = 0;
+            destinations_[index]->down_until = std::chrono::steady_clock::time_point();
+        }
+
+        void destination_failed(size_t index)
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+            if (index >= destinations_.size())
+                return;
+
+            Destination* destination = destinations_[index];
+            size_t pause = min_down_time << ((destination->failures < 6) ? destination->failures : 6);
+            if (pause > max_down_time)
+                pause = max_down_time;
+
+            destination->failures++;
+            destination->down_until = std::chrono::steady_clock::now() + std::chrono::milliseconds(pause);
+        }
+
+        //Error reports are written straight to the first destination that is up, bypassing its writer queue.
+        fplog::Transport_Interface* error_protocol()
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+            std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+
+            for (auto destination : destinations_)
+                if (destination->down_until <= now)
+                    return destination->protocol;
+
+            return 0;
+        }
+
+        bool destination_due()
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+            std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+
+            for (auto destination : destinations_)
+                if (destination->down_until <= now)
+                    return true;
+
+            return false;
+        }
+
+        //Queues the batch on the next destination it has not failed on yet, returns false when there is none left.
+        bool send_batch(std::shared_ptr<Outgoing> out, const std::string& emergency_log_file_path)
+        {
+            size_t chosen = 0;
+            sprot::Async_Writer* writer = 0;
+
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                if (destinations_.empty())
+                    THROW(fplog::exceptions::Transport_Missing);
+
+                std::vector<size_t> order(route_order(out->key));
+                std::chrono::steady_clock::time_point now(std::chrono::steady_clock::now());
+                bool found = false;
+
+                //round robin skips destinations with a full window first, so one slow fpcollect does not hold up the rest
+                for (int pass = (routing_ == Routing::round_robin) ? 0 : 1; (pass < 2) && !found; pass++)
+                {
+                    for (size_t index : order)
                     {
-                        std::lock_guard<std::recursive_mutex> lock(mutex_);
-                        if (should_stop_)
-                        {
-                            delete [] buf;
-                            return;
-                        }
+                        Destination* destination = destinations_[index];
+
+                        if (out->tried.count(index) || (destination->down_until > now))
+                            continue;
+
+                        if ((pass == 0) && (destination->writer->in_flight() >= max_batches_in_flight))
+                            continue;
+
+                        chosen = index;
+                        found = true;
+                        break;
                     }
-                    continue;
                 }
-                catch(fplog::exceptions::Generic_Exception& e)
-                {
-                    fplog::Message error_msg = FPL_ERROR((std::string("Error from IPC: %s") + std::string(", app = ") + data->app_name + std::string(", uid = ") + data->uid).c_str(),
-                        e.what().c_str()).set(fplog::Message::Mandatory_Fields::appname, "fplogd").add(fplog::Message::Optional_Fields::sequence, 0).set(fplog::Message::Mandatory_Fields::facility, fplog::Facility::fplog);
-                    std::string error_str = error_msg.as_string();
-                    append_hostname(&error_str);
 
-                    if (log_transport_ && protocol_)
+                //everything left is down, the one that is due back first gets the batch as a probe
+                if (!found)
+                {
+                    for (size_t index : order)
                     {
-                        try
-                        {
-                            protocol_->write(error_str.c_str(), error_str.size() + 1, 200);
-                        }
-                        catch(...)
+                        if (out->tried.count(index))
+                            continue;
+
+                        if (!found || (destinations_[index]->down_until < destinations_[chosen]->down_until))
                         {
-                            std::ofstream file(emergency_log_file_path, std::ios::app);
-                            if (file.is_open())
-                            {
-                                file << error_str + "\n";
-                                file.close();
-                            }
+                            chosen = index;
+                            found = true;
                         }
                     }
+                }
 
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                if (!found)
+                    return false;
+
+                out->tried.insert(chosen);
+                writer = destinations_[chosen]->writer;
+            }
+
+            size_t timeout = 400;
+            size_t str_len = out->batch->size();
+
+            //not under mutex_, write blocks while the window of the destination is full
+            writer->write(out->batch->c_str(), str_len + 1, [this, out, chosen, emergency_log_file_path](size_t, fplog::exceptions::Generic_Exception* e)
+            {
+                if (!e)
+                {
+                    destination_ok(chosen);
+                    out->shard->journal.ack(out->journal_ids);
+                    return;
                 }
 
+                destination_failed(chosen);
+                reroute(out, *e, emergency_log_file_path);
+            }, timeout * (1 + str_len / 3096));
+
+            return true;
+        }
+
+        //Called on the sender thread of the failed destination, which cannot queue anything itself without risking
+        //to block on its own full window, so the batch is handed back to mq_reader.
+        void reroute(std::shared_ptr<Outgoing> out, fplog::exceptions::Generic_Exception& e, const std::string& emergency_log_file_path)
+        {
+            bool stopping = false;
+            bool retry = false;
+
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                stopping = should_stop_;
+                retry = !should_stop_ && (out->tried.size() < destinations_.size());
+            }
+
+            if (retry)
+            {
+                std::lock_guard<std::mutex> lock(out->shard->mutex);
+                out->shard->rerouted.push_back(out);
+                return;
+            }
+
+            //journaled messages are not given up, the batch waits until a destination is due back
+            //and if fplogd stops before that they are sent again on the next start
+            if (!out->journal_ids.empty())
+            {
+                if (!stopping)
                 {
-                    std::lock_guard<std::recursive_mutex> lock(mutex_);
-                    if (should_stop_)
-                    {
-                        delete [] buf;
-                        return;
-                    }
+                    out->tried.clear();
+
+                    std::lock_guard<std::mutex> lock(out->shard->mutex);
+                    out->shard->held.push_back(out);
                 }
+
+                return;
             }
+
+            report_send_error(*out->batch, e, emergency_log_file_path, stopping);
         }
 
         void join_all_threads()
         {
             overload_checker_.join();
-            mq_reader_.join();
+
+            for (auto shard : shards_)
+            {
+                if (shard->thread)
+                    shard->thread->join();
+
+                delete shard->thread;
+                shard->thread = 0;
+            }
+
+            //it adds channel threads to the pool, so it goes first
+            if (registration_thread_)
+            {
+                registration_thread_->join();
+                delete registration_thread_;
+                registration_thread_ = 0;
+            }
 
             for (auto worker : pool_)
             {
@@ -684,259 +2537,513 @@ class Impl
             }
         }
 
+        static std::string hostname_field(const std::string& hostname)
+        {
+            return std::string(",\"") + fplog::Message::Mandatory_Fields::hostname + "\":\"" + generic_util::escape_json_string(hostname) + "\"";
+        }
+
+        //Opening of the batch message up to its closing brace, the same fields fplog::Message(fplog::Prio::critical, "fplog") has.
+        static std::string batch_header()
+        {
+            return std::string("{\"") + fplog::Message::Mandatory_Fields::timestamp + "\":\"" + generic_util::get_iso8601_timestamp() +
+                "\",\"" + fplog::Message::Mandatory_Fields::priority + "\":\"" + fplog::Prio::critical +
+                "\",\"" + fplog::Message::Mandatory_Fields::facility + "\":\"" + fplog::Facility::fplog + "\"";
+        }
+
         void append_hostname(std::string* str)
         {
             if (!str)
                 return;
 
+            std::string fragment;
+
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                fragment = hostname_fragment_;
+            }
+
             //Hackish way of adding json representation of hostname to the log message.
-            int pos = static_cast<int>(str->rfind('}'));
+            size_t pos = str->rfind('}');
             if ((pos > 0) && (pos != std::string::npos))
             {
-                (*str)[pos] = ',';
-                (*str) += "\"hostname\":\"";
-                (*str) += hostname_;
-                (*str) += "\"}";
+                str->resize(pos);
+                (*str) += fragment;
+                (*str) += '}';
             }
         }
 
-        void mq_reader()
+        void mq_reader(Shard* shard)
         {
             std::string emergency_log_file_path = Configuration::instance().get_log_error_file_full_path();
-            std::vector<std::string*> batch;
+            std::vector<Lane> lanes(1);
+            std::vector<Lane> urgent_lanes(1);
+            std::deque<Pending> pending; //messages of the priority lane come first
+            std::map<unsigned, size_t> ring;
+            unsigned ring_version = 0;
+
+            //appname for hash routing first, then the fields aggregation rules look at
+            std::vector<const char*> fields(1, fplog::Message::Mandatory_Fields::appname);
+            fields.insert(fields.end(), shard->aggregator.fields().begin(), shard->aggregator.fields().end());
+            std::vector<const char*> values(fields.size());
+            std::vector<size_t> sizes(fields.size());
 
-            size_t batch_flush_counter = 0;
-            
             while(true)
             {
-                std::string* str = 0;
-                bool send_batch = false;
+                //batches failed on one destination go out first, ahead of the new ones
+                std::vector<std::shared_ptr<Outgoing>> ready;
+                std::string hostname_fragment;
+                size_t lane_count = 1;
+                size_t batch_size = 0;
+                size_t batch_bytes = 0;
+                size_t batch_linger = 0;
+                bool more_queued = false;
+                bool read_journal = false;
+                bool due = false;
 
                 {
                     std::lock_guard<std::recursive_mutex> lock(mutex_);
                     if (should_stop_)
+                    {
+                        for (auto& item : pending)
+                            delete item.str;
+
+                        for (auto& lane : lanes)
+                            for (auto item : lane.messages)
+                                delete item;
+
+                        for (auto& lane : urgent_lanes)
+                            for (auto item : lane.messages)
+                                delete item;
+
                         return;
+                    }
+
+                    due = destination_due();
+
+                    lane_count = ((routing_ == Routing::hash_appname) && !destinations_.empty()) ? destinations_.size() : 1;
+                    if (lanes.size() < lane_count)
+                    {
+                        lanes.resize(lane_count);
+                        urgent_lanes.resize(lane_count);
+                    }
+
+                    hostname_fragment = hostname_fragment_;
+                    batch_size = static_cast<size_t>(batch_size_);
+                    batch_bytes = batch_bytes_;
+                    batch_linger = batch_linger_;
+
+                    if ((lane_count > 1) && (ring_version != ring_version_))
+                    {
+                        ring = ring_;
+                        ring_version = ring_version_;
+                    }
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(shard->mutex);
+
+                    ready.swap(shard->rerouted);
+
+                    //held batches are tried again once a destination is due back, new journaled messages wait on disk meanwhile
+                    if (!shard->held.empty() && due)
+                    {
+                        ready.insert(ready.end(), shard->held.begin(), shard->held.end());
+                        shard->held.clear();
+                    }
+
+                    read_journal = shard->held.empty();
+
+                    //priority lane goes ahead of what is pending already, as much as its lanes can take,
+                    //the rest stays in the shard and counts against its budget
+                    size_t urgent_pending = 0;
+                    while ((urgent_pending < pending.size()) && pending[urgent_pending].urgent)
+                        urgent_pending++;
+
+                    while (!shard->urgent.empty() && (urgent_pending < lane_count * batch_size))
+                    {
+                        shard->urgent_bytes -= shard->urgent.front()->size();
+                        pending.insert(pending.begin() + urgent_pending, Pending(shard->urgent.front(), 0, true));
+                        shard->urgent.pop_front();
+                        urgent_pending++;
+                    }
+
+                    //only as much as lanes can take is moved out, the rest stays under control of the queue overload algorithm
+                    while (!shard->mq.empty() && (pending.size() < lane_count * batch_size))
+                    {
+                        pending.push_back(Pending(shard->mq.front()));
+                        shard->mq.pop();
+                    }
+
+                    more_queued = !shard->mq.empty() || !shard->urgent.empty();
+                }
+
+                //journal has its own lock, channels appending to it are not held up by the shard either
+                while (read_journal && (pending.size() < lane_count * batch_size))
+                {
+                    unsigned long long id = 0;
+                    std::string* str = shard->journal.read(id);
+
+                    if (!str)
+                        break;
 
-                    while (!mq_.empty() && ((int)(batch.size()) < batch_size_) && !send_batch)
+                    pending.push_back(Pending(str, id));
+
+                    if (pending.size() >= lane_count * batch_size)
+                        more_queued = true;
+                }
+
+                //summaries are made by fplogd itself, they skip the check and aggregation
+                if (!shard->aggregator.empty())
+                {
+                    std::vector<std::string*> summaries;
+                    shard->aggregator.flush(summaries);
+
+                    for (auto summary : summaries)
+                    {
+                        pending.push_back(Pending(summary));
+                        pending.back().checked = true;
+                    }
+                }
+
+                //messages are checked without the lock, so channels pushing to the shard do not wait for it
+                while (!pending.empty())
+                {
+                    Pending& item = pending.front();
+
+                    if (!item.checked)
                     {
-                        str = mq_.front();
+                        //messages of fplog are objects, an array is a batch relayed from another fplogd
+                        bool relayed = item.str && !item.str->empty() && ((*item.str)[0] == '[');
+                        bool valid = false;
 
-                        try
+                        if (relayed)
                         {
-                            if (str != 0)
-                                JSONNode json_object(libjson::parse(*str));
+                            //aggregation was done by the fplogd that sent it, the batch is routed by appname of its first message
+                            valid = generic_util::scan_json_objects(item.str->c_str(), item.str->size(), &item.relayed,
+                                (lane_count > 1) ? fields[0] : 0, &values[0], &sizes[0]) && item.relayed;
                         }
-                        catch (std::invalid_argument&)
+                        else
                         {
-                            delete str;
-                            mq_.pop();
-                            continue;
+                            //fields are picked up only when something needs them
+                            size_t field_count = ((lane_count > 1) || !shard->aggregator.empty()) ? fields.size() : 0;
+                            valid = item.str && generic_util::scan_json_fields(item.str->c_str(), item.str->size(), &fields[0], field_count, &values[0], &sizes[0]);
                         }
 
-                        append_hostname(str);
-                        
-                        //This is needed for sending larger messages - large messages are sent independently,
-                        //separate from the batch, i.e. large message cannot be part of the batch along with other messages
-                        //because in that case batch byte size could become too great to be optimal for sending over any transport.
-                        if ((int)(str->length()) >= (batch_size_ * 300 / 2))
+                        //messages summarized by a rule with drop do not go further, they are done with as if sent
+                        if (!valid || (!relayed && !shard->aggregator.empty() && shard->aggregator.add(&values[1], &sizes[1])))
                         {
-                            if (batch.size() == 0)
-                            {
-                                send_batch = true;
-                                mq_.pop();
-                                batch.push_back(str);
-                            }
-                            else
-                            {
-                                send_batch = true;
-                            }
+                            if (item.journal_id)
+                                shard->journal.ack(item.journal_id);
+
+                            delete item.str;
+                            pending.pop_front();
+                            continue;
                         }
-                        else
+
+                        if (lane_count > 1)
                         {
-                            mq_.pop();
-                            batch.push_back(str);
+                            //raw value of appname comes with its quotes, the key is made of the content as scan_json_objects gives it
+                            if (relayed)
+                                item.key = values[0] ? hash(values[0], sizes[0]) : hash(0, 0);
+                            else
+                                item.key = (values[0] && (*values[0] == '"')) ? hash(values[0] + 1, sizes[0] - 2) : hash(0, 0);
+                            item.lane = ring_owner(ring, item.key);
                         }
+
+                        item.checked = true;
+                    }
+
+                    std::vector<Lane>& class_lanes = item.urgent ? urgent_lanes : lanes;
+                    Lane& lane = class_lanes[(item.lane < class_lanes.size()) ? item.lane : 0];
+
+                    //messages wait in order until their lane is sent, priority lanes are not held back for a larger batch
+                    if (lane.send_now || (lane.count >= (item.urgent ? batch_size : std::min(lane.target, batch_size))))
+                        break;
+
+                    //Batch is kept within batch_bytes, a message that would overflow it starts the next batch
+                    //and a message larger than that goes alone, batch byte size too great is not optimal for any transport.
+                    //Relayed batch is not split and has hostnames in its messages already, batch_size is kept the same way.
+                    size_t count = item.relayed ? item.relayed : 1;
+                    size_t bytes = item.str->length() + (item.relayed ? 0 : hostname_fragment.length()) + 1;
+
+                    if (!lane.messages.empty() && ((lane.bytes + bytes > batch_bytes) || (lane.count + count > batch_size)))
+                    {
+                        lane.send_now = true;
+                        break;
                     }
+
+                    if (lane.messages.empty())
+                    {
+                        lane.key = item.key;
+                        lane.first_added = std::chrono::steady_clock::now();
+                    }
+
+                    if (bytes >= batch_bytes)
+                        lane.send_now = true;
+
+                    lane.bytes += bytes;
+                    lane.count += count;
+                    lane.messages.push_back(item.str);
+                    lane.relayed.push_back(item.relayed);
+
+                    if (item.journal_id)
+                        lane.journal_ids.push_back(item.journal_id);
+
+                    pending.pop_front();
                 }
 
-                if (((int)(batch.size()) < batch_size_) && !send_batch)
+                bool backlog = more_queued || !pending.empty();
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                size_t sleep_time = 10; //ms
+
+                //priority lanes go out every round without linger and ahead of the other batches, other lanes are still
+                //sent in the same round, so a flood of high priorities delays the rest by one batch per lane at most
+                size_t urgent_ready = 0;
+
+                for (size_t i = 0; i < urgent_lanes.size() + lanes.size(); i++)
                 {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    
-                    if (batch.size() > 0)
-                        batch_flush_counter++;
-                    
-                    if (batch_flush_counter < 300)
+                    bool urgent = (i < urgent_lanes.size());
+                    Lane& lane = urgent ? urgent_lanes[i] : lanes[i - urgent_lanes.size()];
+
+                    if (lane.messages.empty())
                         continue;
+
+                    bool full = urgent || lane.send_now || (lane.count >= std::min(lane.target, batch_size));
+
+                    if (full)
+                    {
+                        //batches are filled faster than they go out, larger ones cost fewer frames and ACKs per message
+                        if (backlog && !urgent)
+                            lane.target = std::min(lane.target * 2, batch_size);
+                    }
                     else
-                        batch_flush_counter = 0; //we are sending messages even despite the fact that we do not have a full batch
-                        //this is done in order to prevent situations when some messages are not sent because they were last and thus stuck in the queue
-                }
-                else
-                    batch_flush_counter = 0;
+                    {
+                        size_t waited = static_cast<size_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - lane.first_added).count());
+
+                        //partial batch is held only for batch_linger, so the last messages before a pause are not stuck in the lane
+                        if (waited < batch_linger)
+                        {
+                            sleep_time = std::min(sleep_time, batch_linger - waited);
+                            continue;
+                        }
 
-                JSONNode json_batch(JSON_ARRAY);
-                for (auto item: batch)
-                    json_batch.push_back(fplog::Message(*item).as_json());
+                        //load went down, next messages are not held for more than arrived within the linger time
+                        lane.target = std::max<size_t>(lane.count, 1);
+                    }
 
-                str = new std::string(fplog::Message(fplog::Prio::critical, "fplog").add_batch(json_batch).as_string());
+                    lane.send_now = false;
+                    lane.bytes = 0;
+                    lane.count = 0;
 
-                if (str)
-                {
-                    append_hostname(str);
+                    //messages were checked already and go into the batch as they are, hostname is spliced into each of them and into the batch,
+                    //messages of relayed batches keep the hostname of the fplogd they came from
+                    size_t batch_bytes = 0;
+                    for (size_t j = 0; j < lane.messages.size(); j++)
+                        batch_bytes += lane.messages[j]->size() + (lane.relayed[j] ? 0 : hostname_fragment.size()) + 1;
 
+                    generic_util::Json_Batch_Builder builder(fplog::Message::Optional_Fields::batch, hostname_fragment);
+                    builder.start(batch_header(), batch_bytes);
+
+                    for (size_t j = 0; j < lane.messages.size(); j++)
                     {
-                        std::vector<std::string*> empty_batch;
-                        
-                        for (auto item: batch)
-                            delete item;
+                        if (lane.relayed[j])
+                            builder.add_items(lane.messages[j]->c_str(), lane.messages[j]->size(), lane.relayed[j]);
+                        else
+                            builder.add(*lane.messages[j]);
 
-                        batch.swap(empty_batch);
+                        delete lane.messages[j];
                     }
 
-                    std::auto_ptr<std::string> str_ptr(str);
-                    int retries = 5;
+                    //batch lives until a writer reports the outcome, next one is assembled while this one waits for ACKs
+                    std::shared_ptr<Outgoing> out(new Outgoing());
+                    out->batch.reset(builder.finish());
+                    out->key = lane.key;
+                    out->journal_ids.swap(lane.journal_ids);
+                    out->shard = shard;
+
+                    lane.messages.clear();
+                    lane.relayed.clear();
+
+                    if (urgent)
+                        ready.insert(ready.begin() + urgent_ready++, out);
+                    else
+                        ready.push_back(out);
+                }
 
-                retry:
+                if (ready.empty())
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(std::max<size_t>(sleep_time, 1)));
+                    continue;
+                }
 
+                for (auto& out : ready)
+                {
                     try
                     {
-                        if (log_transport_ && protocol_)
-                        {
-                            size_t timeout = 400;
-                            size_t str_len = str->size();
-
-                            protocol_->write(str->c_str(), str_len + 1, timeout * (1 + str_len / 3096) * (6 - retries));
-                        }
-                        else
+                        if (!send_batch(out, emergency_log_file_path))
                         {
                             THROW(fplog::exceptions::Transport_Missing);
                         }
                     }
                     catch(fplog::exceptions::Generic_Exception& e)
                     {
-                        if (retries <= 0)
-                        {
-                            fplog::Message error_msg = FPL_ERROR(std::string("Error: " + e.what() + " Log message:" + *str).c_str()).set(fplog::Message::Mandatory_Fields::appname, "fplogd").add(fplog::Message::Optional_Fields::sequence, 0).set(fplog::Message::Mandatory_Fields::facility, fplog::Facility::fplog);
-                            std::string error_str = error_msg.as_string();
-                            append_hostname(&error_str);
-
-                            int retries_error = 5;
-
-                        retry_error:
-
-                            try
-                            {
-                                if (log_transport_ && protocol_)
-                                {
-                                    protocol_->write(error_str.c_str(), error_str.size() + 1, 200);
-                                }
-                                else
-                                {
-                                    THROW(fplog::exceptions::Transport_Missing);
-                                }
-                            }
-                            catch (fplog::exceptions::Generic_Exception&)
-                            {
-                                if (retries_error <= 0)
-                                {
-                                    std::ofstream file(emergency_log_file_path, std::ios::app);
-                                    if (file.is_open())
-                                    {
-                                        file << error_str + "\n";
-                                        file.close();
-                                    }
-                                }
-                                else
-                                {
-                                    retries_error--;
-                                    goto retry_error;
-                                }
-                            }
-                        }
-                        else
-                        {
-                            retries--;
-                            goto retry;
-                        }
+                        report_send_error(*out->batch, e, emergency_log_file_path);
                     }
                 }
-                else
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
             }
         }
 
         std::recursive_mutex mutex_;
-        Queue_Controller mq_;
+
+        //channels take shards in turn, messages of a channel stay on its shard
+        static const int max_batch_threads = 64;
+        int batch_threads_;
+        std::vector<Shard*> shards_;
+        std::atomic<size_t> next_shard_key_;
+
+        std::string journal_dir_;
+        size_t journal_size_; //all shards together
+        size_t journal_segment_size_;
+        fplogd::Journal::Sync journal_sync_;
+        size_t journal_sync_interval_; //ms
+
+        std::unique_ptr<generic_util::File_Watcher> config_watcher_;
+
+        std::vector<fplogd::Aggregator::Rule> aggregate_rules_; //every shard counts by the same rules
+
+        //priorities of the priority lane, empty turns it off; read by channel threads without a lock, set only in start()
+        std::set<std::string> priority_lane_;
+        size_t priority_lane_size_; //bytes, all shards together
+        static const size_t default_priority_lane_size = 1024 * 1024;
 
         std::thread overload_checker_;
-        std::thread mq_reader_;
 
         std::vector<Thread_Data*> pool_;
+
+        //udp channels and the epoll set of the reactor threads
+        std::map<unsigned long long, Reactor_Channel*> reactor_channels_;
+        int epoll_fd_;
+        unsigned long long next_reactor_id_;
+        static const int max_reactor_events = 16;
+        static const size_t reactor_read_timeout = 200; //ms, rest of a multi-frame message follows right after the first frame
+
         volatile bool should_stop_;
-        fplog::Transport_Interface* log_transport_;
-        fplog::Transport_Interface* protocol_;
+
+        //batches prepared but not yet acknowledged by fpcollect, per destination, mq_reader blocks when there are too many
+        static const size_t max_batches_in_flight = 4;
+        static const size_t stop_flush_timeout = 5000; //ms
+        static const size_t min_down_time = 500; //ms, destination is skipped at least that long after a failed batch
+        static const size_t max_down_time = 30000; //ms
+        static const int ring_nodes_per_destination = 64;
+
+        //8 sprot frames of the default MTU, i.e. two ACK windows, a large batch still goes out in a couple of round trips
+        static const size_t default_batch_bytes = 8192;
+        static const size_t default_batch_linger = 50; //ms
+
+        std::vector<Destination*> destinations_;
+        Routing routing_;
+        size_t next_destination_;
+        std::map<unsigned, size_t> ring_;
+        unsigned ring_version_; //changes with ring_, shards then copy it
+
+        //channels handed out by the registration endpoint take port pairs of channel_pool in turn
+        static const unsigned short default_pool_first = 19000;
+        static const unsigned short default_pool_last = 19999;
+        static const size_t default_channel_idle_timeout = 300000; //ms
+        static const size_t registration_timeout = 1000; //ms
+        static const size_t channel_open_timeout = 2000; //ms
+
+        std::string registration_uid_;
+        std::thread* registration_thread_;
+        unsigned short pool_first_;
+        unsigned short pool_last_;
+        size_t next_pool_pair_;
+        size_t channel_idle_timeout_; //ms
+        std::set<unsigned short> pool_ports_in_use_;
 };
 
 static Impl g_impl;
 
-void start()
+//held by fplogd serving channels, in-process one does not take it
+static generic_util::Pid_File g_pid_file(fplog::get_fplogd_pid_file());
+
+static void start_impl(bool ipc)
 {    
     Transport_Factory factory;
-    fplog::Transport_Interface::Params params(Configuration::instance().get_log_transort_config());
-    fplog::Transport_Interface* trans = factory.create(params);
-	
-	fplog::Transport_Interface* protocol = 0;
-	
-	for (auto param : params)
-	{
-		if (generic_util::find_str_no_case(param.first, "protocol"))
-		{
-			if (generic_util::find_str_no_case(param.second, "vsprot"))
-			{
-				protocol = new vsprot::Protocol(trans);
-			}
-			else
-				protocol = new sprot::Protocol(trans);
-		}
-	}
-	
-	if (!protocol)
-		protocol = new sprot::Protocol(trans);
-
-    if (trans)
+
+    //running fplogd reads the file once here, changes made later come through reconfigure()
+    Configuration::instance().reload();
+
+    //every [transport...] section is a separate destination, routing in [misc] decides how batches are spread between them
+    for (auto& config : Configuration::instance().get_log_transport_configs())
     {
+        fplog::Transport_Interface::Params params(config.second);
+        fplog::Transport_Interface* trans = factory.create(params);
+
+        if (!trans)
+            continue;
+
+        fplog::Transport_Interface* protocol = make_protocol(trans, params);
+
+        //written without protocol, the transport is owned by whatever is deleted as protocol
+        bool protocol_owns_transport = (protocol == trans);
+
+        //fpcollect recognizes compressed messages on its own, only the dictionary has to match on both ends
+        if (generic_util::find_str_no_case(params["compression"], "lz"))
+            protocol = new sprot::Compressing_Protocol(protocol, true, sprot::Lz_Codec::load_dictionary(params["compression_dictionary"]));
+
         trans->connect(params);
-        g_impl.set_log_transport(trans, protocol);
-        g_impl.start();
+        g_impl.add_destination(config.first, trans, protocol, protocol_owns_transport);
     }
-}
 
-void stop()
-{
-    g_impl.stop();
+    if (g_impl.has_destinations())
+        g_impl.start(ipc);
 }
 
-};
-
-int main()
+static void start(bool ipc)
 {
-    try
+    //fplogd that apps cannot see would look stopped to them, so it does not run without the file
+    if (ipc && !g_pid_file.acquire())
     {
-        fplogd::start();
+        generic_util::Pid_File::State state(generic_util::Pid_File::state(fplog::get_fplogd_pid_file()));
 
-        _getch();
-        generic_util::process_suicide(13000);
+        if ((state == generic_util::Pid_File::State::held) || (state == generic_util::Pid_File::State::ready))
+            THROWM(fplog::exceptions::Connect_Failed, "fplogd is already running.");
 
-        fplogd::stop();
-        generic_util::suicide_prevention();
+        THROWM(fplog::exceptions::Connect_Failed, ("Cannot lock pid file " + std::string(fplog::get_fplogd_pid_file()) + ", it must be a file of this user and not a symlink.").c_str());
     }
-    catch (std::exception& e)
+
+    try
     {
-        printf("Terminated! Error: %s\n", e.what());
+        start_impl(ipc);
     }
-    catch (boost::exception& e)
+    catch(...)
     {
-        printf("Terminated! Error: %s\n", boost::diagnostic_information(e).c_str());
+        g_pid_file.release();
+        throw;
     }
+
+    //apps waiting in initlog or wait_until_started() go on once channels are open
+    if (ipc && g_impl.has_destinations())
+        g_pid_file.set_ready();
+    else
+        g_pid_file.release();
+}
+
+void start()
+{
+    start(true);
+}
+
+void start_in_process()
+{
+    start(false);
+}
+
+void stop()
+{
+    g_impl.stop();
+    g_pid_file.release();
 }
+
+};
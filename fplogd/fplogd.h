@@ -8,23 +8,26 @@ namespace fplogd {
     
 typedef void (*Start_Stop_Notification) (void);
 
-//better to subscribe for notification.
+//fplogd daemon is running and serves channels. Looks at the lock of fplog::get_fplogd_pid_file(), so it is cheap to call.
 bool is_started();
 
+//Blocks until fplogd has started and serves channels, woken up by changes of the pid file and rechecking it every second.
+void wait_until_started();
+//Blocks until fplogd is gone, returns at once if no process holds the pid file.
+void wait_until_stopped();
+
 void notify_when_started(Start_Stop_Notification callback);
 void notify_when_stopped(Start_Stop_Notification callback);
 
 template <class T> void start_notify_thread(void (T::*callback) (void), T* instance)
 {
-    while (!is_started())
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    wait_until_started();
     (instance->*callback)();
 };
 
 template <class T> void stop_notify_thread(void (T::*callback) (void), T* instance)
 {
-    while (is_started())
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    wait_until_stopped();
     (instance->*callback)();
 };
 
@@ -50,9 +53,16 @@ struct Channel_Data
 {
     fplog::UID uid;
     std::string app_name;
+    std::string transport; //"unix" or "shm" when channel uid is prefixed with "unix:" or "shm:" in the ini file, empty for udp
 };
 
 void start();
 void stop();
 
+//Runs fplogd inside the application instead of a separate process, for embedded devices and single-process containers.
+//Configuration is read from the same fplogd.ini, [channels] and mux_uid are ignored. Queue, batching, hostname and
+//forwarding to fpcollect work as in the daemon, fplog::initlog with uid "inproc" then pushes messages straight into
+//the queue without IPC and sprot. Application links fplogd.cpp, journal.cpp, aggregator.cpp and Transport_Factory.cpp, stop() ends both modes.
+void start_in_process();
+
 };
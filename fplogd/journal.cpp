@@ -0,0 +1,575 @@
+#include "journal.h"
+
+#include <fplog_exceptions.h>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _LINUX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+namespace fplogd {
+
+//Segment file starts with the magic and its number, records follow aligned to 8 bytes:
+//message size, checksum of the message, message itself. Zero size (file is created zero filled) or wrong checksum ends the segment.
+static const char g_segment_magic[8] = {'f', 'p', 'l', 'o', 'g', 'j', 'r', '1'};
+static const size_t g_segment_header_size = 16;
+static const size_t g_record_header_size = 8;
+
+static size_t align_record(size_t size)
+{
+    return (g_record_header_size + size + 7) & ~static_cast<size_t>(7);
+}
+
+static uint32_t checksum(const char* data, size_t size)
+{
+    //FNV-1a, enough to tell a torn record from a written one
+    uint32_t res = 2166136261u;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        res ^= static_cast<unsigned char>(data[i]);
+        res *= 16777619u;
+    }
+
+    return res;
+}
+
+struct Journal::Segment
+{
+    Segment(): number(0), data(0), capacity(0), end(g_segment_header_size), records(0), acked_count(0), synced(0), sealed(false), remove(false) {}
+
+    ~Segment()
+    {
+        region.reset();
+        mapping.reset();
+
+        if (remove)
+            ::remove(path.c_str());
+    }
+
+    unsigned number;
+    std::string path;
+
+    std::unique_ptr<boost::interprocess::file_mapping> mapping;
+    std::unique_ptr<boost::interprocess::mapped_region> region;
+    char* data;
+    size_t capacity;
+
+    size_t end; //offset after the last record
+    unsigned records;
+    std::vector<bool> acked; //per record, so an id acknowledged twice is counted once
+    unsigned acked_count;
+    size_t synced; //offset up to which the segment is synced
+    bool sealed; //no more appends, the next segment takes them
+    bool remove; //file is deleted with the last reference, syncer might still hold one
+};
+
+Journal::Journal():
+max_size_(default_max_size),
+segment_size_(default_segment_size),
+sync_(Sync::interval),
+sync_interval_(default_sync_interval),
+open_(false),
+failed_(false),
+next_segment_(1),
+read_segment_(0),
+read_offset_(0),
+read_index_(0),
+appended_(0),
+synced_(0),
+sync_requested_(false),
+syncer_(0)
+{
+}
+
+Journal::~Journal()
+{
+    close();
+}
+
+static std::string segment_path(const std::string& dir, unsigned number)
+{
+    char name[32];
+    sprintf(name, "%08x.fpj", number);
+
+    return dir + "/" + name;
+}
+
+static std::vector<unsigned> find_segments(const std::string& dir)
+{
+    std::vector<unsigned> numbers;
+
+#ifdef _LINUX
+
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return numbers;
+
+    for (dirent* entry = readdir(d); entry; entry = readdir(d))
+    {
+        unsigned number = 0;
+        char ext[8] = {0};
+
+        if ((2 == sscanf(entry->d_name, "%8x.%3s", &number, ext)) && (strcmp(ext, "fpj") == 0) && number)
+            numbers.push_back(number);
+    }
+
+    closedir(d);
+
+#else
+
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((dir + "/*.fpj").c_str(), &entry);
+    if (find == INVALID_HANDLE_VALUE)
+        return numbers;
+
+    do
+    {
+        unsigned number = 0;
+        if ((1 == sscanf(entry.cFileName, "%8x", &number)) && number)
+            numbers.push_back(number);
+    } while (FindNextFileA(find, &entry));
+
+    FindClose(find);
+
+#endif
+
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+bool Journal::has_segments(const std::string& dir)
+{
+    return !find_segments(dir).empty();
+}
+
+void Journal::open(const std::string& dir, size_t max_size, size_t segment_size, Sync sync, size_t sync_interval)
+{
+    close();
+
+    if (dir.empty() || (segment_size < 64 * 1024) || (segment_size > 0xffffffffu) || (max_size < segment_size))
+        THROW(fplog::exceptions::Incorrect_Parameter);
+
+#ifdef _LINUX
+    mkdir(dir.c_str(), 0755);
+#else
+    CreateDirectoryA(dir.c_str(), 0);
+#endif
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    dir_ = dir;
+    max_size_ = max_size;
+    segment_size_ = segment_size;
+    sync_ = sync;
+    sync_interval_ = sync_interval ? sync_interval : 1;
+    failed_ = false;
+    next_segment_ = 1;
+    appended_ = 0;
+    synced_ = 0;
+    sync_requested_ = false;
+
+    //segments of the previous run are replayed as they are and nothing is appended to them anymore
+    for (unsigned number : find_segments(dir_))
+    {
+        Segment_Ptr segment(new Segment());
+        segment->number = number;
+        segment->path = segment_path(dir_, number);
+        segment->sealed = true;
+
+        try
+        {
+            segment->mapping.reset(new boost::interprocess::file_mapping(segment->path.c_str(), boost::interprocess::read_write));
+            segment->region.reset(new boost::interprocess::mapped_region(*segment->mapping, boost::interprocess::read_write));
+        }
+        catch (boost::interprocess::interprocess_exception& e)
+        {
+            segments_.clear();
+            THROWM(fplog::exceptions::Connect_Failed, (segment->path + ": " + e.what()).c_str());
+        }
+
+        segment->data = static_cast<char*>(segment->region->get_address());
+        segment->capacity = segment->region->get_size();
+
+        if ((segment->capacity < g_segment_header_size) || (memcmp(segment->data, g_segment_magic, sizeof(g_segment_magic)) != 0))
+        {
+            segment->remove = true;
+            continue;
+        }
+
+        while (segment->end + g_record_header_size <= segment->capacity)
+        {
+            uint32_t size = 0, sum = 0;
+            memcpy(&size, segment->data + segment->end, sizeof(size));
+            memcpy(&sum, segment->data + segment->end + 4, sizeof(sum));
+
+            if ((size == 0) || (segment->end + align_record(size) > segment->capacity) || (sum != checksum(segment->data + segment->end + g_record_header_size, size)))
+                break;
+
+            segment->end += align_record(size);
+            segment->records++;
+        }
+
+        segment->synced = segment->end;
+        segment->acked.resize(segment->records);
+        segment->remove = (segment->records == 0);
+
+        if (segment->records)
+            segments_[number] = segment;
+
+        next_segment_ = number + 1;
+    }
+
+    read_segment_ = segments_.empty() ? next_segment_ : segments_.begin()->first;
+    read_offset_ = g_segment_header_size;
+    read_index_ = 0;
+
+    open_ = true;
+
+    if (sync_ != Sync::none)
+        syncer_ = new std::thread(&Journal::syncer, this);
+}
+
+void Journal::close()
+{
+    std::thread* syncer = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (!open_)
+            return;
+
+        open_ = false;
+        syncer = syncer_;
+        syncer_ = 0;
+    }
+
+    sync_request_cv_.notify_all();
+    synced_cv_.notify_all();
+
+    if (syncer)
+    {
+        syncer->join();
+        delete syncer;
+    }
+
+    sync_all();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    //acknowledged messages are not replayed, whatever is left of the current segment is
+    for (auto& segment : segments_)
+        if (segment.second->acked_count >= segment.second->records)
+            segment.second->remove = true;
+
+    segments_.clear();
+}
+
+bool Journal::is_open()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return open_;
+}
+
+size_t Journal::size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t res = 0;
+    for (auto& segment : segments_)
+        res += segment.second->capacity;
+
+    return res;
+}
+
+Journal::Segment_Ptr Journal::create_segment()
+{
+    if ((segments_.size() + 1) * segment_size_ > max_size_)
+        return Segment_Ptr();
+
+    Segment_Ptr segment(new Segment());
+    segment->number = next_segment_;
+    segment->path = segment_path(dir_, next_segment_);
+
+#ifdef _LINUX
+
+    //blocks are allocated right away, a write to a mapped page the full disk has no block for would kill fplogd with SIGBUS
+    int fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return Segment_Ptr();
+
+    int res = posix_fallocate(fd, 0, static_cast<off_t>(segment_size_));
+    ::close(fd);
+
+    if (res != 0)
+    {
+        ::remove(segment->path.c_str());
+        return Segment_Ptr();
+    }
+
+#else
+
+    {
+        //NTFS file that is not marked sparse gets all its clusters when it is extended
+        std::ofstream file(segment->path, std::ios::binary | std::ios::trunc);
+        file.seekp(segment_size_ - 1);
+        file.put(0);
+
+        if (!file.good())
+        {
+            ::remove(segment->path.c_str());
+            return Segment_Ptr();
+        }
+    }
+
+#endif
+
+    try
+    {
+        segment->mapping.reset(new boost::interprocess::file_mapping(segment->path.c_str(), boost::interprocess::read_write));
+        segment->region.reset(new boost::interprocess::mapped_region(*segment->mapping, boost::interprocess::read_write));
+    }
+    catch (boost::interprocess::interprocess_exception&)
+    {
+        segment->remove = true;
+        return Segment_Ptr();
+    }
+
+    segment->data = static_cast<char*>(segment->region->get_address());
+    segment->capacity = segment->region->get_size();
+
+    memcpy(segment->data, g_segment_magic, sizeof(g_segment_magic));
+    memcpy(segment->data + sizeof(g_segment_magic), &segment->number, sizeof(segment->number));
+
+    next_segment_++;
+    segments_[segment->number] = segment;
+
+    return segment;
+}
+
+bool Journal::append(const char* msg, size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (!open_ || failed_ || !msg || (size == 0) || (g_segment_header_size + align_record(size) > segment_size_))
+        return false;
+
+    Segment_Ptr segment;
+    if (!segments_.empty() && !segments_.rbegin()->second->sealed)
+        segment = segments_.rbegin()->second;
+
+    if (segment && (segment->end + align_record(size) > segment->capacity))
+    {
+        segment->sealed = true;
+        segment.reset();
+    }
+
+    if (!segment)
+    {
+        segment = create_segment();
+        if (!segment)
+            return false;
+    }
+
+    char* record = segment->data + segment->end;
+    uint32_t record_size = static_cast<uint32_t>(size);
+    uint32_t sum = checksum(msg, size);
+
+    //size goes last, record is not seen by a replay before its message is there
+    memcpy(record + g_record_header_size, msg, size);
+    memcpy(record + 4, &sum, sizeof(sum));
+    memcpy(record, &record_size, sizeof(record_size));
+
+    segment->end += align_record(size);
+    segment->records++;
+    segment->acked.push_back(false);
+
+    unsigned long long ticket = ++appended_;
+
+    if (sync_ != Sync::always)
+        return true;
+
+    sync_requested_ = true;
+    sync_request_cv_.notify_one();
+
+    //message is in the journal whatever the outcome of the sync, a failed one only stops further appends
+    synced_cv_.wait(lock, [this, ticket] { return (synced_ >= ticket) || !open_ || failed_; });
+    return true;
+}
+
+std::string* Journal::read(unsigned long long& id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    while (open_)
+    {
+        auto found = segments_.lower_bound(read_segment_);
+        if (found == segments_.end())
+            return 0;
+
+        Segment_Ptr segment = found->second;
+
+        if (found->first != read_segment_)
+        {
+            read_segment_ = found->first;
+            read_offset_ = g_segment_header_size;
+            read_index_ = 0;
+        }
+
+        if (read_offset_ < segment->end)
+        {
+            uint32_t size = 0;
+            memcpy(&size, segment->data + read_offset_, sizeof(size));
+
+            std::string* msg = new std::string(segment->data + read_offset_ + g_record_header_size, size);
+            id = (static_cast<unsigned long long>(read_segment_) << 32) | read_index_;
+
+            read_offset_ += align_record(size);
+            read_index_++;
+
+            return msg;
+        }
+
+        if (!segment->sealed)
+            return 0;
+
+        read_segment_++;
+        read_offset_ = g_segment_header_size;
+        read_index_ = 0;
+
+        release_segments();
+    }
+
+    return 0;
+}
+
+void Journal::ack(unsigned long long id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    mark_acked(id);
+    release_segments();
+}
+
+void Journal::ack(const std::vector<unsigned long long>& ids)
+{
+    if (ids.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (auto id : ids)
+        mark_acked(id);
+
+    release_segments();
+}
+
+void Journal::mark_acked(unsigned long long id)
+{
+    auto found = segments_.find(static_cast<unsigned>(id >> 32));
+    if (found == segments_.end())
+        return;
+
+    Segment& segment = *found->second;
+    unsigned index = static_cast<unsigned>(id & 0xffffffffu);
+
+    if ((index < segment.acked.size()) && !segment.acked[index])
+    {
+        segment.acked[index] = true;
+        segment.acked_count++;
+    }
+}
+
+void Journal::release_segments()
+{
+    //segment goes when it is sealed, read through and every message of it is acknowledged
+    for (auto segment = segments_.begin(); segment != segments_.end();)
+    {
+        if (!segment->second->sealed || (segment->first >= read_segment_) || (segment->second->acked_count < segment->second->records))
+        {
+            ++segment;
+            continue;
+        }
+
+        segment->second->remove = true;
+        segment = segments_.erase(segment);
+    }
+}
+
+void Journal::syncer()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            //with Sync::always appenders wake the syncer, the interval then only limits how long a sync request might wait
+            sync_request_cv_.wait_for(lock, std::chrono::milliseconds(static_cast<long long>(sync_interval_)), [this] { return sync_requested_ || !open_; });
+
+            if (!open_)
+                return;
+        }
+
+        sync_all();
+    }
+}
+
+void Journal::sync_all()
+{
+    std::vector<std::pair<Segment_Ptr, size_t>> dirty;
+    unsigned long long ticket = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        ticket = appended_;
+        sync_requested_ = false;
+
+        for (auto& segment : segments_)
+            if (segment.second->end > segment.second->synced)
+                dirty.push_back(std::make_pair(segment.second, segment.second->end));
+    }
+
+    //msync is done without the lock, appends and reads go on meanwhile
+    //flush() does not align the address it gives to msync, the range has to start on a page
+    size_t page = boost::interprocess::mapped_region::get_page_size();
+
+    bool ok = true;
+    for (auto& range : dirty)
+    {
+        size_t from = range.first->synced & ~(page - 1);
+        if (!range.first->region->flush(from, range.second - from, false))
+            ok = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto& range : dirty)
+            range.first->synced = std::max(range.first->synced, range.second);
+
+        if (ok)
+            synced_ = std::max(synced_, ticket);
+        else
+            failed_ = true;
+    }
+
+    synced_cv_.notify_all();
+}
+
+};
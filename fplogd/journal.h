@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace fplogd {
+
+//Write-ahead journal of messages received by fplogd, kept in memory-mapped segment files of one directory.
+//Messages are appended on receipt and read back in the same order by the batcher, a segment file is deleted once
+//every message of it was read and acknowledged by fpcollect. Segments left by the previous run are replayed on open(),
+//so messages survive restart or crash of fplogd, and messages already delivered might be sent once more.
+//While fpcollect is unreachable messages stay on disk, up to max_size bytes, instead of piling up in memory.
+class Journal
+{
+    public:
+
+        //none leaves writing of the mapped pages to the OS, which survives crash of fplogd but not of the machine;
+        //interval syncs what was appended every sync_interval ms; always makes append() wait until its message is synced,
+        //appends coming in while one sync runs are covered by the next one together.
+        enum class Sync
+        {
+            none,
+            interval,
+            always
+        };
+
+        static const size_t default_max_size = 256 * 1024 * 1024;
+        static const size_t default_segment_size = 16 * 1024 * 1024;
+        static const size_t default_sync_interval = 100; //ms
+
+        Journal();
+        ~Journal();
+
+        //Creates the directory if needed and picks up segments found there, throws if it cannot be used.
+        void open(const std::string& dir, size_t max_size = default_max_size, size_t segment_size = default_segment_size,
+            Sync sync = Sync::interval, size_t sync_interval = default_sync_interval);
+        //Syncs and unmaps all segments, unacknowledged messages stay on disk for the next open().
+        void close();
+        bool is_open();
+
+        //Returns false when the journal is closed, full, failing or the disk has no room for a new segment, message then has to go elsewhere.
+        bool append(const char* msg, size_t size);
+        //Next message not read yet, id is given to ack() once fpcollect has it. Returns 0 if there is none.
+        std::string* read(unsigned long long& id);
+        void ack(unsigned long long id);
+        void ack(const std::vector<unsigned long long>& ids);
+
+        //Bytes taken by segment files.
+        size_t size();
+
+        //Whether the directory holds segments to replay.
+        static bool has_segments(const std::string& dir);
+
+
+    private:
+
+        struct Segment;
+        typedef std::shared_ptr<Segment> Segment_Ptr;
+
+        std::mutex mutex_;
+        std::condition_variable synced_cv_;
+        std::condition_variable sync_request_cv_;
+
+        std::string dir_;
+        size_t max_size_;
+        size_t segment_size_;
+        Sync sync_;
+        size_t sync_interval_;
+        bool open_;
+        bool failed_;
+
+        //id of a message is segment number in the high 32 bits and index of the message within its segment in the low ones
+        std::map<unsigned, Segment_Ptr> segments_;
+        unsigned next_segment_;
+        unsigned read_segment_;
+        size_t read_offset_;
+        unsigned read_index_;
+
+        //appends are counted, sync covers all that were counted when it started
+        unsigned long long appended_;
+        unsigned long long synced_;
+        bool sync_requested_;
+        std::thread* syncer_;
+
+        Journal(const Journal&);
+
+        Segment_Ptr create_segment();
+        void mark_acked(unsigned long long id);
+        void release_segments();
+        void syncer();
+        void sync_all();
+};
+
+};
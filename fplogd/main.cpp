@@ -0,0 +1,54 @@
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+
+#ifndef _LINUX
+#include "targetver.h"
+#endif
+
+#include <stdio.h>
+#include "fplogd.h"
+#include <utils.h>
+#include <boost/exception/all.hpp>
+
+#ifndef _LINUX
+#include <conio.h>
+#else
+
+#include <termios.h>
+#include <unistd.h>
+
+int _getch() {
+  struct termios oldt,
+                 newt;
+  int            ch;
+  tcgetattr( STDIN_FILENO, &oldt );
+  newt = oldt;
+  newt.c_lflag &= ~( ICANON | ECHO );
+  tcsetattr( STDIN_FILENO, TCSANOW, &newt );
+  ch = getchar();
+  tcsetattr( STDIN_FILENO, TCSANOW, &oldt );
+  return ch;
+}
+
+#endif
+
+int main()
+{
+    try
+    {
+        fplogd::start();
+
+        _getch();
+        generic_util::process_suicide(13000);
+
+        fplogd::stop();
+        generic_util::suicide_prevention();
+    }
+    catch (std::exception& e)
+    {
+        printf("Terminated! Error: %s\n", e.what());
+    }
+    catch (boost::exception& e)
+    {
+        printf("Terminated! Error: %s\n", boost::diagnostic_information(e).c_str());
+    }
+}
@@ -0,0 +1,433 @@
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+
+#ifndef _LINUX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include <string.h>
+#include "UDT_Listener.h"
+
+#include <udt.h>
+#include <test_util.h>
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <thread>
+
+using namespace std::chrono;
+
+namespace spipc
+{
+    class UDT_Listener::Impl
+    {
+        public:
+
+            class Connection: public fplog::Transport_Interface
+            {
+                public:
+
+                    Connection(UDTSOCKET sock): sock_(sock), busy_(false), broken_(false) {}
+                    ~Connection() { UDT::close(sock_); }
+
+                    virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait)
+                    {
+                        //UDT_RCVTIMEO is not used, recvmsg with it waits for the next packet even when a message is already there
+                        wait(false, timeout);
+
+                        int sz = UDT::recvmsg(sock_, (char*)buf, static_cast<int>(buf_size));
+                        if (sz == UDT::ERROR)
+                            fail(false);
+
+                        return sz;
+                    }
+
+                    virtual size_t write(const void* buf, size_t buf_size, size_t timeout = infinite_wait)
+                    {
+                        wait(true, timeout);
+
+                        int sz = UDT::sendmsg(sock_, (const char*)buf, static_cast<int>(buf_size), -1, true);
+                        if (sz == UDT::ERROR)
+                            fail(true);
+
+                        return sz;
+                    }
+
+                    UDTSOCKET sock_;
+                    bool busy_; //handed out by wait_readable and not released yet
+                    volatile bool broken_;
+
+
+                private:
+
+                    void wait(bool for_write, size_t timeout)
+                    {
+                        UDT::UDSET set;
+                        UD_SET(sock_, &set);
+
+                        timeval to;
+                        to.tv_sec = static_cast<long>(timeout / 1000);
+                        to.tv_usec = static_cast<long>((timeout % 1000) * 1000);
+
+                        int res = UDT::select(sock_ + 1, for_write ? 0 : &set, for_write ? &set : 0, 0, (timeout == infinite_wait) ? 0 : &to);
+                        if (res < 0)
+                            fail(for_write);
+
+                        if (set.size() == 0)
+                            THROW(fplog::exceptions::Timeout);
+                    }
+
+                    void fail(bool writing)
+                    {
+                        int code = UDT::getlasterror().getErrorCode();
+
+                        if ((code == CUDTException::ETIMEOUT) || (code == CUDTException::EASYNCRCV) || (code == CUDTException::EASYNCSND))
+                            THROW(fplog::exceptions::Timeout);
+
+                        if (UDT::getsockstate(sock_) >= BROKEN)
+                            broken_ = true;
+
+                        if (writing)
+                        {
+                            THROWM(fplog::exceptions::Write_Failed, UDT::getlasterror().getErrorMessage());
+                        }
+                        else
+                            THROWM(fplog::exceptions::Read_Failed, UDT::getlasterror().getErrorMessage());
+                    }
+            };
+
+            Impl():
+            serv_sock_(UDT::INVALID_SOCK),
+            eid_(-1),
+            any_peer_(true),
+            listening_(false)
+            {
+                memset(ip_, 0, sizeof(ip_));
+            }
+
+            ~Impl()
+            {
+                close();
+            }
+
+            void listen(const fplog::Transport_Interface::Params& params)
+            {
+                static UDTUpDown udt_initer;
+
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                std::string uidstr;
+
+                if (params.find("uid") == params.end())
+                {
+                    if (params.find("UID") == params.end())
+                    {
+                        THROW(fplog::exceptions::Incorrect_Parameter);
+                    }
+                    else
+                        uidstr = (*params.find("UID")).second;
+                }
+                else
+                    uidstr = (*params.find("uid")).second;
+
+                fplog::UID uid;
+                uid.from_string(uidstr);
+
+                if ((uid.high > 65535) || (uid.high < 1))
+                    THROW(fplog::exceptions::Incorrect_Parameter);
+
+                any_peer_ = true;
+
+                auto ip = params.find("ip");
+                if (ip == params.end())
+                    ip = params.find("IP");
+
+                if (ip != params.end())
+                {
+                    if (1 != inet_pton(AF_INET, ip->second.c_str(), ip_))
+                        THROW(fplog::exceptions::Incorrect_Parameter);
+
+                    any_peer_ = false;
+                }
+
+                close();
+
+                sockaddr_in listen_addr;
+                memset(&listen_addr, 0, sizeof(listen_addr));
+                listen_addr.sin_family = AF_INET;
+                listen_addr.sin_port = htons(static_cast<unsigned short>(uid.high));
+                listen_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+                serv_sock_ = UDT::socket(AF_INET, SOCK_DGRAM, 0);
+
+                //accept is done only when epoll reports pending connections and must never block
+                bool sync = false;
+                UDT::setsockopt(serv_sock_, 0, UDT_RCVSYN, &sync, sizeof(sync));
+
+                if ((UDT::ERROR == UDT::bind(serv_sock_, (sockaddr*)&listen_addr, sizeof(listen_addr))) || (UDT::ERROR == UDT::listen(serv_sock_, max_pending_connections)))
+                {
+                    std::string error(UDT::getlasterror().getErrorMessage());
+
+                    UDT::close(serv_sock_);
+                    serv_sock_ = UDT::INVALID_SOCK;
+
+                    THROWM(fplog::exceptions::Connect_Failed, error.c_str());
+                }
+
+                eid_ = UDT::epoll_create();
+
+                int events = UDT_EPOLL_IN | UDT_EPOLL_ERR;
+                UDT::epoll_add_usock(eid_, serv_sock_, &events);
+
+                listening_ = true;
+            }
+
+            void close()
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                if (!listening_)
+                    return;
+
+                listening_ = false;
+
+                //waiters get an error from epoll_wait and return
+                UDT::epoll_release(eid_);
+                eid_ = -1;
+
+                for (auto& connection : connections_)
+                    delete connection.second;
+
+                connections_.clear();
+
+                UDT::close(serv_sock_);
+                serv_sock_ = UDT::INVALID_SOCK;
+            }
+
+            bool wait_readable(Connection_Id& id, size_t timeout)
+            {
+                steady_clock::time_point timer_start(steady_clock::now());
+
+                while (true)
+                {
+                    int eid = -1;
+                    int64_t wait = -1;
+
+                    {
+                        std::lock_guard<std::recursive_mutex> lock(mutex_);
+                        if (!listening_)
+                            THROW(fplog::exceptions::Read_Failed);
+
+                        eid = eid_;
+                    }
+
+                    if (timeout != fplog::Transport_Interface::infinite_wait)
+                    {
+                        long long elapsed = duration_cast<milliseconds>(steady_clock::now() - timer_start).count();
+                        if (elapsed >= static_cast<long long>(timeout))
+                            return false;
+
+                        wait = static_cast<int64_t>(timeout) - elapsed;
+                    }
+
+                    std::set<UDTSOCKET> readable;
+                    if (UDT::ERROR == UDT::epoll_wait(eid, &readable, 0, wait))
+                    {
+                        if (UDT::getlasterror().getErrorCode() == CUDTException::ETIMEOUT)
+                            return false;
+
+                        std::lock_guard<std::recursive_mutex> lock(mutex_);
+                        if (!listening_ || (eid != eid_))
+                            THROW(fplog::exceptions::Read_Failed);
+
+                        THROWM(fplog::exceptions::Read_Failed, UDT::getlasterror().getErrorMessage());
+                    }
+
+                    std::lock_guard<std::recursive_mutex> lock(mutex_);
+                    if (!listening_ || (eid != eid_))
+                        THROW(fplog::exceptions::Read_Failed);
+
+                    for (UDTSOCKET sock : readable)
+                    {
+                        if (sock == serv_sock_)
+                        {
+                            accept_connections();
+                            continue;
+                        }
+
+                        //another thread might have taken it between epoll_wait and now
+                        auto connection = connections_.find(sock);
+                        if ((connection == connections_.end()) || connection->second->busy_)
+                            continue;
+
+                        connection->second->busy_ = true;
+                        UDT::epoll_remove_usock(eid_, sock);
+
+                        id = sock;
+                        return true;
+                    }
+                }
+            }
+
+            void release(Connection_Id id)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                auto connection = connections_.find(id);
+                if ((connection == connections_.end()) || !connection->second->busy_)
+                    return;
+
+                connection->second->busy_ = false;
+
+                //data received meanwhile is reported right away, UDT checks its buffers when the socket is added
+                int events = UDT_EPOLL_IN | UDT_EPOLL_ERR;
+                UDT::epoll_add_usock(eid_, id, &events);
+            }
+
+            fplog::Transport_Interface* connection(Connection_Id id)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                auto connection = connections_.find(id);
+                if (connection == connections_.end())
+                    THROW(fplog::exceptions::Incorrect_Parameter);
+
+                return connection->second;
+            }
+
+            void close_connection(Connection_Id id)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                auto connection = connections_.find(id);
+                if (connection == connections_.end())
+                    return;
+
+                if (!connection->second->busy_)
+                    UDT::epoll_remove_usock(eid_, id);
+
+                delete connection->second;
+                connections_.erase(connection);
+            }
+
+            bool is_broken(Connection_Id id)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                auto connection = connections_.find(id);
+                return ((connection == connections_.end()) || connection->second->broken_ || (UDT::getsockstate(id) >= BROKEN));
+            }
+
+            std::vector<Connection_Id> get_connections()
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+                std::vector<Connection_Id> res;
+                for (auto& connection : connections_)
+                    res.push_back(connection.first);
+
+                return res;
+            }
+
+
+        private:
+
+            static const int max_pending_connections = 1024;
+
+            std::recursive_mutex mutex_;
+
+            UDTSOCKET serv_sock_;
+            int eid_;
+
+            unsigned char ip_[4];
+            bool any_peer_;
+            bool listening_;
+
+            std::map<UDTSOCKET, Connection*> connections_;
+
+            void accept_connections()
+            {
+                while (true)
+                {
+                    sockaddr_in peer_addr;
+                    int addr_len = sizeof(peer_addr);
+
+                    UDTSOCKET sock = UDT::accept(serv_sock_, (sockaddr*)&peer_addr, &addr_len);
+                    if (sock == UDT::INVALID_SOCK)
+                        return;
+
+                    if (!any_peer_ && (memcmp(&peer_addr.sin_addr, ip_, sizeof(ip_)) != 0))
+                    {
+                        UDT::close(sock);
+                        continue;
+                    }
+
+                    //listening socket is non-blocking, accepted ones inherit it but their readers wait with timeouts
+                    bool sync = true;
+                    UDT::setsockopt(sock, 0, UDT_RCVSYN, &sync, sizeof(sync));
+                    UDT::setsockopt(sock, 0, UDT_SNDSYN, &sync, sizeof(sync));
+
+                    connections_[sock] = new Connection(sock);
+
+                    int events = UDT_EPOLL_IN | UDT_EPOLL_ERR;
+                    UDT::epoll_add_usock(eid_, sock, &events);
+                }
+            }
+    };
+
+    void UDT_Listener::listen(const Params& params)
+    {
+        impl_->listen(params);
+    }
+
+    void UDT_Listener::close()
+    {
+        impl_->close();
+    }
+
+    bool UDT_Listener::wait_readable(Connection_Id& id, size_t timeout)
+    {
+        return impl_->wait_readable(id, timeout);
+    }
+
+    void UDT_Listener::release(Connection_Id id)
+    {
+        impl_->release(id);
+    }
+
+    fplog::Transport_Interface* UDT_Listener::connection(Connection_Id id)
+    {
+        return impl_->connection(id);
+    }
+
+    void UDT_Listener::close_connection(Connection_Id id)
+    {
+        impl_->close_connection(id);
+    }
+
+    bool UDT_Listener::is_broken(Connection_Id id)
+    {
+        return impl_->is_broken(id);
+    }
+
+    std::vector<UDT_Listener::Connection_Id> UDT_Listener::get_connections()
+    {
+        return impl_->get_connections();
+    }
+
+    UDT_Listener::UDT_Listener()
+    {
+        impl_ = new Impl();
+    }
+
+    UDT_Listener::~UDT_Listener()
+    {
+        delete impl_;
+    }
+};
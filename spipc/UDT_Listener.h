@@ -0,0 +1,60 @@
+#pragma once
+
+#include <fplog_transport.h>
+#include <fplog_exceptions.h>
+#include <vector>
+
+#ifdef SPIPC_EXPORT
+#define SPIPC_API __declspec(dllexport)
+#else
+#define SPIPC_API __declspec(dllimport)
+#endif
+
+#ifdef _LINUX
+#define SPIPC_API
+#endif
+
+namespace spipc
+{
+    //Accepts any number of UDT_Transport connections on one port and waits on all of them with UDT epoll,
+    //so a few threads can serve every connected peer instead of one UDT_Transport and one thread per peer.
+    //Connection params:
+    //uid = port pair, the listener binds the high port the same way UDT_Transport does;
+    //ip = the only peer address connections are accepted from, any peer is accepted if omitted.
+    class SPIPC_API UDT_Listener
+    {
+        public:
+
+            typedef int Connection_Id;
+            typedef fplog::Transport_Interface::Params Params;
+
+            void listen(const Params& params);
+            //Readers must be done with all connections before close().
+            void close();
+
+            //Accepts pending connections and waits until any connection has data or is broken, returns false on timeout.
+            //Returned connection is taken out of the wait set, so the calling thread is its only reader until release().
+            bool wait_readable(Connection_Id& id, size_t timeout = fplog::Transport_Interface::infinite_wait);
+            void release(Connection_Id id);
+
+            //Transport of a connection, whatever protocol is used goes on top of it.
+            //Returned object is owned by the listener and stays valid until close_connection() or close().
+            fplog::Transport_Interface* connection(Connection_Id id);
+            void close_connection(Connection_Id id);
+
+            //Broken connection is never reported readable again and should be closed by its reader.
+            bool is_broken(Connection_Id id);
+            std::vector<Connection_Id> get_connections();
+
+            UDT_Listener();
+            ~UDT_Listener();
+
+
+        private:
+
+            class Impl;
+            Impl* impl_;
+
+            UDT_Listener(const UDT_Listener&);
+    };
+};
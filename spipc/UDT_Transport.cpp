@@ -13,10 +13,12 @@
 #include "UDT_Transport.h"
 
 #include <udt.h>
+#include <ccc.h>
 #include <test_util.h>
 
 #include <mutex>
 #include <fplog_exceptions.h>
+#include <utils.h>
 #include <thread>
 
 #include <boost/tokenizer.hpp>
@@ -36,7 +38,11 @@ namespace spipc
             serv_sock_(-1),
             localhost_(false),
             disconnecting_(false),
-            connected_(false)
+            connected_(false),
+            fplog_cc_(false),
+            cc_max_rate_(0),
+            cc_max_delay_(5),
+            cc_burst_(128)
             {
                 std::lock_guard<std::recursive_mutex> lock(mutex_);
             }
@@ -115,6 +121,32 @@ namespace spipc
                 if (memcmp(ip_, localhost, sizeof(localhost)) == 0)
                     localhost_ = true;
 
+                fplog_cc_ = false;
+                auto cc = params.find("cc");
+                if ((cc != params.end()) && generic_util::find_str_no_case(cc->second, "fplog"))
+                {
+                    fplog_cc_ = true;
+
+                    try
+                    {
+                        auto param = params.find("cc_max_rate");
+                        cc_max_rate_ = (param == params.end()) ? 0 : boost::lexical_cast<double>(param->second);
+
+                        param = params.find("cc_max_delay");
+                        cc_max_delay_ = (param == params.end()) ? 5 : boost::lexical_cast<int>(param->second);
+
+                        param = params.find("cc_burst");
+                        cc_burst_ = (param == params.end()) ? 128 : boost::lexical_cast<int>(param->second);
+                    }
+                    catch(boost::bad_lexical_cast&)
+                    {
+                        THROW(fplog::exceptions::Incorrect_Parameter);
+                    }
+
+                    if ((cc_max_rate_ < 0) || (cc_max_delay_ < 1) || (cc_burst_ < 2))
+                        THROW(fplog::exceptions::Incorrect_Parameter);
+                }
+
                 fplog::UID uid;
                 uid.from_string(UIDstr);
 
@@ -191,7 +223,7 @@ namespace spipc
                 if (read_set.size() == 0)
                     THROW(fplog::exceptions::Timeout);
 
-                int sz = UDT::recv(client_sock_, (char*)buf, static_cast<int>(buf_size), 0);
+                int sz = UDT::recvmsg(client_sock_, (char*)buf, static_cast<int>(buf_size));
                 if (sz == UDT::ERROR)
                 {
                     int status = UDT::getsockstate(client_sock_);
@@ -240,7 +272,8 @@ namespace spipc
                 if (write_set.size() == 0)
                     THROW(fplog::exceptions::Timeout);
 
-                int sz = UDT::send(client_sock_, (char*)buf, static_cast<int>(buf_size), 0);
+                //message mode keeps frame boundaries, in stream mode sprot frames got merged and split on the way
+                int sz = UDT::sendmsg(client_sock_, (char*)buf, static_cast<int>(buf_size), -1, true);
                 if (sz == UDT::ERROR)
                 {
                     int status = UDT::getsockstate(client_sock_);
@@ -275,6 +308,22 @@ namespace spipc
             bool localhost_;
             bool disconnecting_;
 
+            //congestion control tuned for log batches instead of the default bulk transfer one
+            bool fplog_cc_;
+            double cc_max_rate_; //Mbps, 0 - no ceiling
+            int cc_max_delay_; //ms of queuing delay before backing off
+            int cc_burst_; //packets sent right away at the start of a burst
+
+            void set_congestion_control(UDTSOCKET socket)
+            {
+                if (!fplog_cc_)
+                    return;
+
+                //accepted sockets inherit it from the listening one
+                CFplogCCFactory factory(cc_max_rate_, cc_max_delay_ * 1000, cc_burst_);
+                UDT::setsockopt(socket, 0, UDT_CC, &factory, sizeof(factory));
+            }
+
             bool check_socket(UDTSOCKET& socket)
             {
                 if (socket > -1)
@@ -315,7 +364,7 @@ namespace spipc
 
                     hints.ai_flags = AI_PASSIVE;
                     hints.ai_family = AF_INET;
-                    hints.ai_socktype = SOCK_STREAM;
+                    hints.ai_socktype = SOCK_DGRAM;
 
                     std::string port(std::to_string(uid_.high));
                     high_uid_ = true;
@@ -328,6 +377,7 @@ namespace spipc
                         THROWM(fplog::exceptions::Connect_Failed, ("Port is in use, cannot connect. Error = " + std::to_string(err)).c_str());
 
                     serv_sock_ = UDT::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+                    set_congestion_control(serv_sock_);
                     if (UDT::ERROR == UDT::bind(serv_sock_, res->ai_addr, static_cast<int>(res->ai_addrlen)))
                     {
                         UDT::close(serv_sock_);
@@ -413,13 +463,14 @@ re_accept:
 
                     hints.ai_flags = AI_PASSIVE;
                     hints.ai_family = AF_INET;
-                    hints.ai_socktype = SOCK_STREAM;
+                    hints.ai_socktype = SOCK_DGRAM;
 
                     high_uid_ = false;
 
                     struct addrinfo *peer;
 
                     client_sock_ = UDT::socket(hints.ai_family, hints.ai_socktype, hints.ai_protocol);
+                    set_congestion_control(client_sock_);
 
                     // Windows UDP issue
                     // For better performance, modify HKLM\System\CurrentControlSet\Services\Afd\Parameters\FastSendDatagramThreshold
@@ -15,6 +15,10 @@
 
 namespace spipc
 {
+    //Optional connection params besides uid and ip:
+    //cc = fplog selects congestion control made for log batches instead of UDT default one made for bulk transfers,
+    //cc_max_rate = rate ceiling in Mbps (no ceiling by default), cc_max_delay = ms of queuing delay above the minimum RTT
+    //before the rate goes down (5 by default), cc_burst = packets sent right away at the start of a burst (128 by default).
     class SPIPC_API UDT_Transport: public fplog::Transport_Interface
     {
         public:
@@ -0,0 +1,687 @@
+#include "shared_memory_transport.h"
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#ifdef _LINUX
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#endif
+
+using namespace std::chrono;
+
+namespace spipc {
+
+static const unsigned int g_ring_magic = 0x676e6972; //"ring"
+static const unsigned int g_ring_version = 1;
+static const unsigned int g_padding_record = 0xffffffff; //rest of the ring up to its end is unused, next record is at the start
+static const size_t g_data_offset = 256;
+static const int g_spin_count = 2000;
+
+//Fields written by the producer and by the consumer live on separate cache lines.
+struct Ring_Header
+{
+    std::atomic<unsigned int> magic; //set last by the consumer, producer does not touch the ring until then
+    unsigned int version;
+    unsigned long long capacity;
+    char reserved0[48];
+
+    std::atomic<unsigned long long> head; //total bytes published by the producer
+    std::atomic<unsigned int> data_ready; //futex word the consumer sleeps on
+    std::atomic<unsigned int> producer_waiting;
+    std::atomic<int> producer_pid;
+    char reserved1[44];
+
+    std::atomic<unsigned long long> tail; //total bytes released by the consumer
+    std::atomic<unsigned int> space_ready; //futex word the producer sleeps on
+    std::atomic<unsigned int> consumer_waiting;
+    char reserved2[48];
+};
+
+static inline size_t record_size(size_t message_size)
+{
+    return (sizeof(unsigned int) + message_size + 7) & ~static_cast<size_t>(7);
+}
+
+class Shared_Memory_Transport::Impl
+{
+    public:
+
+        Impl():
+        shared_mem_(0),
+        region_(0),
+        header_(0),
+        data_(0),
+        connected_(false),
+        listening_(false),
+        claimed_(false),
+        reserved_(false),
+        acquired_(false),
+        pending_head_(0),
+        pending_tail_(0),
+        acquired_tail_(0)
+        {
+        }
+
+        ~Impl()
+        {
+            disconnect();
+        }
+
+        void connect(const Params& params);
+        void disconnect();
+
+        const void* acquire(size_t& size, size_t timeout);
+        void release();
+        void unacquire();
+
+        void* reserve(size_t size, size_t timeout);
+        void commit();
+
+        bool has_producer();
+
+        std::recursive_mutex read_mutex_;
+        std::recursive_mutex write_mutex_;
+
+
+    private:
+
+        std::recursive_mutex mutex_;
+
+        std::string name_;
+        boost::interprocess::shared_memory_object* shared_mem_;
+        boost::interprocess::mapped_region* region_;
+        Ring_Header* header_;
+        unsigned char* data_;
+
+        bool connected_;
+        bool listening_;
+        bool claimed_;
+
+        bool reserved_;
+        bool acquired_;
+        unsigned long long pending_head_;
+        unsigned long long pending_tail_;
+        unsigned long long acquired_tail_;
+
+        bool open_segment();
+        void close_segment();
+        void publish_tail();
+        void wait_space(unsigned long long head, size_t needed, const steady_clock::time_point* deadline);
+        void publish_head(unsigned long long head);
+
+        static void wait(std::atomic<unsigned int>& word, unsigned int value, const steady_clock::time_point* deadline);
+        static void wake(std::atomic<unsigned int>& word);
+};
+
+std::string Shared_Memory_Transport::segment_name(const fplog::UID& uid)
+{
+    return "fplog_ring_" + std::to_string(uid.high) + "_" + std::to_string(uid.low);
+}
+
+void Shared_Memory_Transport::remove(const fplog::UID& uid)
+{
+    boost::interprocess::shared_memory_object::remove(segment_name(uid).c_str());
+}
+
+void Shared_Memory_Transport::Impl::wait(std::atomic<unsigned int>& word, unsigned int value, const steady_clock::time_point* deadline)
+{
+    long long left = 1;
+    if (deadline)
+    {
+        left = duration_cast<microseconds>(*deadline - steady_clock::now()).count();
+        if (left <= 0)
+            THROW(fplog::exceptions::Timeout);
+    }
+
+#ifdef _LINUX
+
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(left / 1000000);
+    ts.tv_nsec = static_cast<long>((left % 1000000) * 1000);
+
+    //not FUTEX_WAIT_PRIVATE: the word is shared between processes
+    syscall(SYS_futex, reinterpret_cast<unsigned int*>(&word), FUTEX_WAIT, value, deadline ? &ts : 0, 0, 0);
+
+#else
+
+    if (word.load() == value)
+        std::this_thread::sleep_for(milliseconds(1));
+
+#endif
+}
+
+void Shared_Memory_Transport::Impl::wake(std::atomic<unsigned int>& word)
+{
+    word.fetch_add(1);
+
+#ifdef _LINUX
+
+    syscall(SYS_futex, reinterpret_cast<unsigned int*>(&word), FUTEX_WAKE, 1, 0, 0, 0);
+
+#endif
+}
+
+void Shared_Memory_Transport::Impl::connect(const Params& params)
+{
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    std::string uidstr;
+
+    if (params.find("uid") == params.end())
+    {
+        if (params.find("UID") == params.end())
+        {
+            THROW(fplog::exceptions::Invalid_Uid);
+        }
+        else
+            uidstr = (*params.find("UID")).second;
+    }
+    else
+        uidstr = (*params.find("uid")).second;
+
+    bool listen_mode = false;
+
+    auto listen_param = params.find("listen");
+    if (listen_param != params.end())
+        listen_mode = ((listen_param->second == "true") || (listen_param->second == "TRUE") || (listen_param->second == "1"));
+
+    size_t ring_size = default_ring_size;
+
+    auto size_param = params.find("ring_size");
+    if (size_param != params.end())
+    {
+        try
+        {
+            ring_size = std::stoul(size_param->second);
+        }
+        catch (std::exception&)
+        {
+            THROWM(fplog::exceptions::Incorrect_Parameter, "ring_size must be a number of bytes.");
+        }
+
+        if (ring_size < 4096)
+            THROWM(fplog::exceptions::Incorrect_Parameter, "ring_size must be at least 4096 bytes.");
+    }
+
+    size_t capacity = 4096;
+    while (capacity < ring_size)
+        capacity <<= 1;
+
+    fplog::UID uid;
+    uid.from_string(uidstr);
+
+    disconnect();
+
+    name_ = segment_name(uid);
+    listening_ = listen_mode;
+
+    if (listening_)
+    {
+        try
+        {
+            shared_mem_ = new boost::interprocess::shared_memory_object(boost::interprocess::open_or_create, name_.c_str(), boost::interprocess::read_write);
+
+            boost::interprocess::offset_t existing_size = 0;
+            shared_mem_->get_size(existing_size);
+
+            //ring left by the previous consumer keeps its size and messages
+            if (existing_size == 0)
+                shared_mem_->truncate(static_cast<boost::interprocess::offset_t>(g_data_offset + capacity));
+
+            region_ = new boost::interprocess::mapped_region(*shared_mem_, boost::interprocess::read_write);
+        }
+        catch (boost::interprocess::interprocess_exception& e)
+        {
+            close_segment();
+            THROWM(fplog::exceptions::Connect_Failed, e.what());
+        }
+
+        header_ = static_cast<Ring_Header*>(region_->get_address());
+        data_ = static_cast<unsigned char*>(region_->get_address()) + g_data_offset;
+
+        if ((header_->magic.load() != g_ring_magic) || (header_->version != g_ring_version)
+            || (g_data_offset + header_->capacity != region_->get_size()))
+        {
+            if (g_data_offset + capacity != region_->get_size())
+            {
+                close_segment();
+                THROWM(fplog::exceptions::Connect_Failed, "Shared memory segment has unexpected size.");
+            }
+
+            new (header_) Ring_Header();
+
+            header_->version = g_ring_version;
+            header_->capacity = capacity;
+            header_->head.store(0);
+            header_->tail.store(0);
+            header_->data_ready.store(0);
+            header_->space_ready.store(0);
+            header_->producer_waiting.store(0);
+            header_->consumer_waiting.store(0);
+            header_->producer_pid.store(0);
+
+            header_->magic.store(g_ring_magic);
+        }
+
+        pending_tail_ = header_->tail.load();
+    }
+    else
+    {
+        //consumer might not be running yet, write will try again
+        open_segment();
+    }
+
+    connected_ = true;
+}
+
+bool Shared_Memory_Transport::Impl::open_segment()
+{
+    try
+    {
+        shared_mem_ = new boost::interprocess::shared_memory_object(boost::interprocess::open_only, name_.c_str(), boost::interprocess::read_write);
+        region_ = new boost::interprocess::mapped_region(*shared_mem_, boost::interprocess::read_write);
+    }
+    catch (boost::interprocess::interprocess_exception&)
+    {
+        close_segment();
+        return false;
+    }
+
+    header_ = static_cast<Ring_Header*>(region_->get_address());
+    data_ = static_cast<unsigned char*>(region_->get_address()) + g_data_offset;
+
+    if ((region_->get_size() < g_data_offset) || (header_->magic.load() != g_ring_magic) || (header_->version != g_ring_version)
+        || (g_data_offset + header_->capacity != region_->get_size()))
+    {
+        close_segment();
+        return false;
+    }
+
+#ifdef _LINUX
+
+    //ring is single producer, a channel owned by a crashed process is taken over
+    int pid = static_cast<int>(getpid());
+    int owner = 0;
+
+    while (!header_->producer_pid.compare_exchange_strong(owner, pid))
+    {
+        if ((owner == pid) || (kill(owner, 0) == 0) || (errno != ESRCH))
+        {
+            close_segment();
+            THROWM(fplog::exceptions::Connect_Failed, ("Channel is already used by process " + std::to_string(owner) + ".").c_str());
+        }
+    }
+
+#endif
+
+    claimed_ = true;
+    pending_head_ = header_->head.load();
+
+    return true;
+}
+
+bool Shared_Memory_Transport::Impl::has_producer()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    if (!connected_ || !header_)
+        return false;
+
+#ifdef _LINUX
+
+    int owner = header_->producer_pid.load();
+    return (owner != 0) && ((kill(owner, 0) == 0) || (errno != ESRCH));
+
+#else
+
+    return true;
+
+#endif
+}
+
+void Shared_Memory_Transport::Impl::close_segment()
+{
+#ifdef _LINUX
+
+    if (claimed_ && header_)
+    {
+        int pid = static_cast<int>(getpid());
+        header_->producer_pid.compare_exchange_strong(pid, 0);
+    }
+
+#endif
+
+    claimed_ = false;
+
+    delete region_;
+    delete shared_mem_;
+
+    region_ = 0;
+    shared_mem_ = 0;
+    header_ = 0;
+    data_ = 0;
+}
+
+void Shared_Memory_Transport::Impl::disconnect()
+{
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    if (!connected_)
+        return;
+
+    close_segment();
+
+    reserved_ = false;
+    acquired_ = false;
+    connected_ = false;
+}
+
+void* Shared_Memory_Transport::Impl::reserve(size_t size, size_t timeout)
+{
+    if (!connected_ || listening_)
+        THROW(fplog::exceptions::Write_Failed);
+
+    if (reserved_)
+        THROWM(fplog::exceptions::Write_Failed, "Previous reserved message is not committed.");
+
+    if (!header_ && !open_segment())
+        THROWM(fplog::exceptions::Write_Failed, "Listener is not running.");
+
+    const unsigned long long capacity = header_->capacity;
+    const size_t record = record_size(size);
+
+    if ((size >= g_padding_record) || (record > capacity))
+        THROWM(fplog::exceptions::Incorrect_Parameter, "Message does not fit into shared memory ring.");
+
+    steady_clock::time_point deadline(steady_clock::now() + milliseconds(timeout));
+    const steady_clock::time_point* deadline_ptr = (timeout == fplog::Transport_Interface::infinite_wait) ? 0 : &deadline;
+
+    unsigned long long head = pending_head_;
+    size_t offset = static_cast<size_t>(head & (capacity - 1));
+    size_t contiguous = static_cast<size_t>(capacity - offset);
+
+    //record is never split, when it does not fit before the end of the ring it goes to the start
+    if (record > contiguous)
+    {
+        //padding and record together may be more than the whole ring, then the padding goes alone
+        //and the record waits for the consumer to get past it
+        if (record + contiguous > capacity)
+        {
+            wait_space(head, contiguous, deadline_ptr);
+
+            unsigned int marker = g_padding_record;
+            memcpy(data_ + offset, &marker, sizeof(marker));
+
+            head += contiguous;
+            pending_head_ = head;
+            publish_head(head);
+
+            wait_space(head, record, deadline_ptr);
+        }
+        else
+        {
+            wait_space(head, record + contiguous, deadline_ptr);
+
+            unsigned int marker = g_padding_record;
+            memcpy(data_ + offset, &marker, sizeof(marker));
+
+            head += contiguous;
+        }
+
+        offset = 0;
+    }
+    else
+        wait_space(head, record, deadline_ptr);
+
+    unsigned int length = static_cast<unsigned int>(size);
+    memcpy(data_ + offset, &length, sizeof(length));
+
+    pending_head_ = head + record;
+    reserved_ = true;
+
+    return data_ + offset + sizeof(length);
+}
+
+void Shared_Memory_Transport::Impl::commit()
+{
+    if (!reserved_)
+        THROWM(fplog::exceptions::Write_Failed, "Nothing to commit.");
+
+    reserved_ = false;
+    publish_head(pending_head_);
+}
+
+void Shared_Memory_Transport::Impl::publish_head(unsigned long long head)
+{
+    header_->head.store(head, std::memory_order_release);
+
+    //pairs with the consumer raising its flag and then checking the head once more before it sleeps
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->consumer_waiting.load(std::memory_order_relaxed))
+        wake(header_->data_ready);
+}
+
+//Spins for a while and then sleeps until the consumer has freed needed bytes after head.
+void Shared_Memory_Transport::Impl::wait_space(unsigned long long head, size_t needed, const steady_clock::time_point* deadline)
+{
+    const unsigned long long capacity = header_->capacity;
+
+    int spins = 0;
+    while (capacity - (head - header_->tail.load(std::memory_order_acquire)) < needed)
+    {
+        if (++spins < g_spin_count)
+            continue;
+
+        unsigned int seq = header_->space_ready.load();
+        header_->producer_waiting.store(1);
+
+        if (capacity - (head - header_->tail.load()) < needed)
+        {
+            try
+            {
+                wait(header_->space_ready, seq, deadline);
+            }
+            catch (fplog::exceptions::Timeout&)
+            {
+                header_->producer_waiting.store(0);
+                throw;
+            }
+        }
+
+        header_->producer_waiting.store(0);
+    }
+}
+
+const void* Shared_Memory_Transport::Impl::acquire(size_t& size, size_t timeout)
+{
+    if (!connected_ || !listening_)
+        THROW(fplog::exceptions::Read_Failed);
+
+    if (acquired_)
+        THROWM(fplog::exceptions::Read_Failed, "Previous acquired message is not released.");
+
+    const unsigned long long capacity = header_->capacity;
+
+    steady_clock::time_point deadline(steady_clock::now() + milliseconds(timeout));
+    const steady_clock::time_point* deadline_ptr = (timeout == fplog::Transport_Interface::infinite_wait) ? 0 : &deadline;
+
+    int spins = 0;
+
+    while (true)
+    {
+        unsigned long long tail = pending_tail_;
+
+        if (header_->head.load(std::memory_order_acquire) == tail)
+        {
+            if (++spins < g_spin_count)
+                continue;
+
+            unsigned int seq = header_->data_ready.load();
+            header_->consumer_waiting.store(1);
+
+            if (header_->head.load() == tail)
+            {
+                try
+                {
+                    wait(header_->data_ready, seq, deadline_ptr);
+                }
+                catch (fplog::exceptions::Timeout&)
+                {
+                    header_->consumer_waiting.store(0);
+                    throw;
+                }
+            }
+
+            header_->consumer_waiting.store(0);
+            continue;
+        }
+
+        size_t offset = static_cast<size_t>(tail & (capacity - 1));
+
+        unsigned int length = 0;
+        memcpy(&length, data_ + offset, sizeof(length));
+
+        if (length == g_padding_record)
+        {
+            pending_tail_ = tail + (capacity - offset);
+            publish_tail();
+            continue;
+        }
+
+        if (record_size(length) > capacity - offset)
+            THROWM(fplog::exceptions::Read_Failed, "Shared memory ring is corrupted.");
+
+        size = length;
+        acquired_tail_ = tail;
+        pending_tail_ = tail + record_size(length);
+        acquired_ = true;
+
+        return data_ + offset + sizeof(length);
+    }
+}
+
+void Shared_Memory_Transport::Impl::release()
+{
+    if (!acquired_)
+        THROWM(fplog::exceptions::Read_Failed, "Nothing to release.");
+
+    acquired_ = false;
+    publish_tail();
+}
+
+void Shared_Memory_Transport::Impl::unacquire()
+{
+    acquired_ = false;
+    pending_tail_ = acquired_tail_;
+}
+
+void Shared_Memory_Transport::Impl::publish_tail()
+{
+    header_->tail.store(pending_tail_, std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->producer_waiting.load(std::memory_order_relaxed))
+        wake(header_->space_ready);
+}
+
+Shared_Memory_Transport::Shared_Memory_Transport()
+{
+    impl_ = new Shared_Memory_Transport::Impl();
+}
+
+Shared_Memory_Transport::~Shared_Memory_Transport()
+{
+    delete impl_;
+}
+
+void Shared_Memory_Transport::connect(const Params& params)
+{
+    impl_->connect(params);
+}
+
+void Shared_Memory_Transport::disconnect()
+{
+    impl_->disconnect();
+}
+
+size_t Shared_Memory_Transport::read(void* buf, size_t buf_size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> lock(impl_->read_mutex_);
+
+    size_t size = 0;
+    const void* msg = impl_->acquire(size, timeout);
+
+    if (size > buf_size)
+    {
+        //message stays in the ring for the next read with a bigger buffer
+        impl_->unacquire();
+        throw fplog::exceptions::Buffer_Overflow(__FUNCTION__, __SHORT_FORM_OF_FILE__, __LINE__, "Buffer too small.", size);
+    }
+
+    memcpy(buf, msg, size);
+    impl_->release();
+
+    return size;
+}
+
+size_t Shared_Memory_Transport::write(const void* buf, size_t buf_size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> lock(impl_->write_mutex_);
+
+    if (buf_size == 0)
+        return 0;
+
+    void* slot = impl_->reserve(buf_size, timeout);
+    memcpy(slot, buf, buf_size);
+    impl_->commit();
+
+    return buf_size;
+}
+
+const void* Shared_Memory_Transport::acquire(size_t& size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> lock(impl_->read_mutex_);
+    return impl_->acquire(size, timeout);
+}
+
+void Shared_Memory_Transport::release()
+{
+    std::lock_guard<std::recursive_mutex> lock(impl_->read_mutex_);
+    impl_->release();
+}
+
+void* Shared_Memory_Transport::reserve(size_t size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> lock(impl_->write_mutex_);
+    return impl_->reserve(size, timeout);
+}
+
+void Shared_Memory_Transport::commit()
+{
+    std::lock_guard<std::recursive_mutex> lock(impl_->write_mutex_);
+    impl_->commit();
+}
+
+bool Shared_Memory_Transport::has_producer()
+{
+    return impl_->has_producer();
+}
+
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <fplog_exceptions.h>
+#include <fplog_transport.h>
+
+#ifdef SPIPC_EXPORT
+#define SPIPC_API __declspec(dllexport)
+#else
+#define SPIPC_API __declspec(dllimport)
+#endif
+
+#ifdef _LINUX
+#define SPIPC_API
+#endif
+
+namespace spipc {
+
+//Single producer single consumer ring of messages in a named shared memory segment, one segment per channel.
+//Steady state needs no syscalls: positions are atomics in shared memory and the sides sleep on a futex
+//(Linux, other platforms poll) only when the ring is empty or full.
+//Connection params:
+//uid = port pair of the channel, used only to derive the segment name, e.g. 18749_18750 -> fplog_ring_18749_18750;
+//listen = true for the consumer (fplogd), it creates the segment, otherwise the side is the producer (app);
+//ring_size = ring capacity in bytes for the consumer, rounded up to a power of two, default_ring_size if omitted.
+//Segment outlives the consumer, so messages written while fplogd restarts are not lost.
+//Only one producer process may use a channel at a time, the next one gets Connect_Failed until the first one exits.
+class SPIPC_API Shared_Memory_Transport: public fplog::Transport_Interface
+{
+    public:
+
+        static const size_t default_ring_size = 4 * 1024 * 1024;
+
+        virtual void connect(const Params& params);
+        virtual void disconnect();
+
+        virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait);
+        virtual size_t write(const void* buf, size_t buf_size, size_t timeout = infinite_wait);
+
+        //Consumer side without copying: returns the next message right inside the ring,
+        //it stays valid and occupies the ring until release().
+        const void* acquire(size_t& size, size_t timeout = infinite_wait);
+        void release();
+
+        //Producer side without copying: message of exactly size bytes is built in place and published by commit().
+        void* reserve(size_t size, size_t timeout = infinite_wait);
+        void commit();
+
+        //Consumer side: whether a running process holds the producer end, always true on platforms where it is not tracked.
+        bool has_producer();
+
+        Shared_Memory_Transport();
+        ~Shared_Memory_Transport();
+
+        static std::string segment_name(const fplog::UID& uid);
+
+        //Deletes the segment of the channel, messages still in the ring are lost.
+        static void remove(const fplog::UID& uid);
+
+
+    private:
+
+        class Impl;
+        Impl* impl_;
+
+        Shared_Memory_Transport(const Shared_Memory_Transport&);
+};
+
+};
@@ -2,7 +2,13 @@
 #include <boost/lexical_cast.hpp>
 
 #include "socket_transport.h"
+#include "socket_uring.h"
 #include <chrono>
+#include <algorithm>
+
+#ifdef _LINUX
+#include <errno.h>
+#endif
 
 using namespace std::chrono;
 
@@ -37,6 +43,8 @@ void Socket_Transport::connect(const Params& params)
 {
     static WSA_Up_Down sock_initer;
 
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
     std::string uidstr;
@@ -100,6 +108,16 @@ void Socket_Transport::connect(const Params& params)
     if (memcmp(ip_, localhost, sizeof(localhost)) == 0)
         localhost_ = true;
 
+    mux_ = false;
+    mux_endpoint_ = false;
+
+    auto mux = params.find("mux");
+    if (mux != params.end())
+        mux_ = ((mux->second == "true") || (mux->second == "TRUE") || (mux->second == "1"));
+
+    if (mux_ && !localhost_)
+        THROWM(fplog::exceptions::Incorrect_Parameter, "Shared endpoint (mux) mode is supported only on localhost.");
+
     fplog::UID uid;
     uid.from_string(uidstr);
 
@@ -163,7 +181,28 @@ void Socket_Transport::connect(const Params& params)
  
     #endif
 
-    if (0 != bind(socket_, (sockaddr*)&listen_addr, sizeof(listen_addr)))
+    if (mux_)
+    {
+        high_uid_ = false;
+
+        if (0 == bind(socket_, (sockaddr*)&listen_addr, sizeof(listen_addr)))
+        {
+            mux_endpoint_ = true;
+            high_uid_ = true;
+        }
+        else
+        {
+            //high port is already taken by the shared endpoint, any free port will do for us
+            listen_addr.sin_port = 0;
+            if (0 != bind(socket_, (sockaddr*)&listen_addr, sizeof(listen_addr)))
+            {
+                shutdown(socket_, SD_BOTH);
+                closesocket(socket_);
+                THROW(fplog::exceptions::Connect_Failed);
+            }
+        }
+    }
+    else if (0 != bind(socket_, (sockaddr*)&listen_addr, sizeof(listen_addr)))
     {
         if (!localhost_)
         {
@@ -183,17 +222,56 @@ void Socket_Transport::connect(const Params& params)
     else
         high_uid_ = true;
 
+#if defined(_LINUX) && !defined(_OSX)
+
+    auto io = params.find("io");
+    if ((io != params.end()) && (io->second == "uring"))
+    {
+        size_t datagram_size = Socket_Uring::default_datagram_size;
+        size_t buffers = Socket_Uring::default_buffers;
+
+        try
+        {
+            if (params.find("uring_datagram_size") != params.end())
+                datagram_size = boost::lexical_cast<size_t>(params.find("uring_datagram_size")->second);
+
+            if (params.find("uring_buffers") != params.end())
+                buffers = boost::lexical_cast<size_t>(params.find("uring_buffers")->second);
+        }
+        catch(boost::bad_lexical_cast&)
+        {
+            shutdown(socket_, SD_BOTH);
+            closesocket(socket_);
+            THROW(fplog::exceptions::Incorrect_Parameter);
+        }
+
+        //0 when the kernel cannot do it, recvmmsg is used then
+        uring_ = Socket_Uring::create(socket_, datagram_size, buffers);
+    }
+
+#endif
+
     uid_ = uid;
     connected_ = true;
 }
 
 void Socket_Transport::disconnect()
 {
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
     std::lock_guard<std::recursive_mutex> lock(mutex_);
 
     if (!connected_)
         return;
 
+#if defined(_LINUX) && !defined(_OSX)
+
+    //receive buffers are released only after recvmsg is cancelled, so it has to happen before the socket is gone
+    delete uring_;
+    uring_ = 0;
+
+#endif
+
     int res = 0;
     if (SOCKET_ERROR == shutdown(socket_, SD_BOTH))
     {
@@ -226,89 +304,47 @@ void Socket_Transport::disconnect()
     }
 
     connected_ = false;
+
+    //datagrams read ahead belong to the closed socket
+    read_ahead_next_ = 0;
+    read_ahead_count_ = 0;
 }
 
-size_t Socket_Transport::read(void* buf, size_t buf_size, size_t timeout)
+static size_t time_left(const time_point<system_clock, system_clock::duration>& timer_start, size_t timeout)
 {
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
-    if (!connected_)
-        THROW(fplog::exceptions::Read_Failed);
-    
-    time_point<system_clock, system_clock::duration> timer_start(system_clock::now());
-    auto check_time_out = [&timeout, &timer_start]()
-    {
-        auto timer_start_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(timer_start);
-        auto timer_stop_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(std::chrono::system_clock::now());
-        std::chrono::milliseconds timeout_ms(timeout);
-        
-        if (timer_stop_ms - timer_start_ms >= timeout_ms)
-            THROW(fplog::exceptions::Timeout);
-    };
-
-retry:
-    
-    check_time_out();
-
-    sockaddr_in remote_addr;
-    int addr_len = sizeof(remote_addr);
-    
-    fd_set fdset;
- 
-#ifndef _LINUX
-
-    fdset.fd_count = 1;
-    fdset.fd_array[0] = socket_;
-
-#else
+    if (timeout == fplog::Transport_Interface::infinite_wait)
+        return timeout;
 
-	FD_ZERO(&fdset);
-	FD_SET(socket_, &fdset);
-
-#endif
+    auto timer_start_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(timer_start);
+    auto timer_stop_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(std::chrono::system_clock::now());
+    long long elapsed = (timer_stop_ms - timer_start_ms).count();
 
-    timeval to;
-    to.tv_sec = static_cast<long>(timeout / 1000);
-    to.tv_usec = static_cast<long>((timeout % 1000) * 1000);
-    
-    int res = select(static_cast<int>(socket_ + 1), &fdset, 0, 0, &to);
-    if (res == 0)
-        THROW(fplog::exceptions::Timeout);
-    if (res != 1)
-        THROW(fplog::exceptions::Read_Failed);
+    return (elapsed >= static_cast<long long>(timeout)) ? 0 : timeout - static_cast<size_t>(elapsed);
+}
 
-#ifdef _OSX
-    res = recvfrom((int)socket_, buf, buf_size, 0, (sockaddr*)&remote_addr, (socklen_t *)&addr_len);
-#else
-    res = recvfrom(socket_, (char*)buf, static_cast<int>(buf_size), 0, (sockaddr*)&remote_addr, &addr_len);
-#endif
+bool Socket_Transport::accepted(sockaddr_in& remote_addr)
+{
+    unsigned short port = ntohs(remote_addr.sin_port);
 
-    if (res != SOCKET_ERROR)
+    if (mux_)
     {
-        remote_addr.sin_port = ntohs(remote_addr.sin_port);
-        
-        if ((remote_addr.sin_port != uid_.high) && (remote_addr.sin_port != uid_.low))
-            goto retry;
+        //shared endpoint talks to any local port, its clients talk only to the endpoint
+        if (!mux_endpoint_ && (port != uid_.high))
+            return false;
+    }
+    else if ((port != uid_.high) && (port != uid_.low))
+        return false;
 
-        if (!localhost_)
-            if (memcmp(&(remote_addr.sin_addr.s_addr), ip_, sizeof(ip_)) != 0)
-                goto retry;
+    if (!localhost_)
+        if (memcmp(&(remote_addr.sin_addr.s_addr), ip_, sizeof(ip_)) != 0)
+            return false;
 
-        return res;
-    }
-    else
-        THROW(fplog::exceptions::Read_Failed);
-    
-    return 0;
+    return true;
 }
 
-size_t Socket_Transport::write(const void* buf, size_t buf_size, size_t timeout)
-{    
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
-    if (!connected_)
-        THROW(fplog::exceptions::Write_Failed);
-
-    sockaddr_in remote_addr;
-    int addr_len = sizeof(remote_addr);
+void Socket_Transport::remote_address(const void* buf, size_t buf_size, sockaddr_in& remote_addr)
+{
+    memset(&remote_addr, 0, sizeof(remote_addr));
 
     if (localhost_)
     {
@@ -331,10 +367,37 @@ size_t Socket_Transport::write(const void* buf, size_t buf_size, size_t timeout)
     if (!localhost_)
         remote_addr.sin_port = (u_short)uid_.high;
 
+    if (mux_)
+    {
+        if (mux_endpoint_)
+        {
+            //destination port is the channel id written in front of the datagram by sprot::Channel_Mux
+            unsigned short channel_port = 0;
+            if (buf_size < sizeof(channel_port))
+                THROW(fplog::exceptions::Incorrect_Parameter);
+
+            memcpy(&channel_port, buf, sizeof(channel_port));
+            remote_addr.sin_port = channel_port;
+        }
+        else
+            remote_addr.sin_port = (u_short)uid_.high;
+    }
+
     remote_addr.sin_port = htons(remote_addr.sin_port);
-    
+}
+
+bool Socket_Transport::wait(bool for_write, size_t timeout)
+{
+#if defined(_LINUX) && !defined(_OSX)
+
+    //socket is drained by the kernel into the ring buffers and never becomes readable for select
+    if (!for_write && uring_)
+        return uring_->wait(timeout);
+
+#endif
+
     fd_set fdset;
-	
+ 
 #ifndef _LINUX
 
     fdset.fd_count = 1;
@@ -347,39 +410,392 @@ size_t Socket_Transport::write(const void* buf, size_t buf_size, size_t timeout)
 
 #endif
 
-
     timeval to;
     to.tv_sec = static_cast<long>(timeout / 1000);
     to.tv_usec = static_cast<long>((timeout % 1000) * 1000);
 
-    int res = select(static_cast<int>(socket_ + 1), 0, &fdset, 0, &to);
+    int res = select(static_cast<int>(socket_ + 1), for_write ? 0 : &fdset, for_write ? &fdset : 0, 0, (timeout == infinite_wait) ? 0 : &to);
     if (res == 0)
-        THROW(fplog::exceptions::Timeout);
+        return false;
+
     if (res != 1)
+    {
+        if (for_write)
+        {
+            THROW(fplog::exceptions::Write_Failed);
+        }
+
+        THROW(fplog::exceptions::Read_Failed);
+    }
+
+    return true;
+}
+
+size_t Socket_Transport::receive(Datagram* datagrams, size_t count)
+{
+    if (count > max_batch)
+        count = max_batch;
+
+#if defined(_LINUX) && !defined(_OSX)
+
+    if (uring_)
+    {
+        size_t received = 0;
+        Socket_Uring::Received datagram;
+
+        while ((received < count) && uring_->receive(datagram))
+        {
+            //dropped the same way recvmmsg drops truncated datagrams
+            if (accepted(datagram.addr) && !datagram.truncated && (datagram.size <= datagrams[received].buf_size))
+            {
+                memcpy(datagrams[received].buf, datagram.data, datagram.size);
+                datagrams[received].size = datagram.size;
+                received++;
+            }
+
+            uring_->recycle(datagram);
+        }
+
+        return received;
+    }
+
+    mmsghdr msgs[max_batch];
+    iovec iovs[max_batch];
+    sockaddr_in addrs[max_batch];
+
+    memset(msgs, 0, sizeof(mmsghdr) * count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        iovs[i].iov_base = datagrams[i].buf;
+        iovs[i].iov_len = datagrams[i].buf_size;
+
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+
+    int res = recvmmsg(socket_, msgs, static_cast<unsigned int>(count), MSG_DONTWAIT, 0);
+    if (res < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+            return 0;
+
+        THROW(fplog::exceptions::Read_Failed);
+    }
+
+    //datagrams from foreign ports are dropped one by one, the rest of the batch is still good
+    size_t received = 0;
+    for (int i = 0; i < res; ++i)
+    {
+        if (!accepted(addrs[i]) || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+            continue;
+
+        datagrams[i].size = msgs[i].msg_len;
+
+        if (received != static_cast<size_t>(i))
+            std::swap(datagrams[received], datagrams[i]);
+
+        received++;
+    }
+
+    return received;
+
+#else
+
+    if ((count == 0) || !wait(false, 0))
+        return 0;
+
+    sockaddr_in remote_addr;
+    int addr_len = sizeof(remote_addr);
+
+#ifdef _OSX
+    int res = recvfrom((int)socket_, datagrams[0].buf, datagrams[0].buf_size, 0, (sockaddr*)&remote_addr, (socklen_t *)&addr_len);
+#else
+    int res = recvfrom(socket_, (char*)datagrams[0].buf, static_cast<int>(datagrams[0].buf_size), 0, (sockaddr*)&remote_addr, &addr_len);
+#endif
+
+    if (res == SOCKET_ERROR)
+        THROW(fplog::exceptions::Read_Failed);
+
+    if (!accepted(remote_addr))
+        return 0;
+
+    datagrams[0].size = res;
+    return 1;
+
+#endif
+}
+
+size_t Socket_Transport::send(const Datagram* datagrams, size_t count)
+{
+    if (count > max_batch)
+        count = max_batch;
+
+#if defined(_LINUX) && !defined(_OSX)
+
+    mmsghdr msgs[max_batch];
+    iovec iovs[max_batch];
+    sockaddr_in addrs[max_batch];
+
+    memset(msgs, 0, sizeof(mmsghdr) * count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        remote_address(datagrams[i].buf, datagrams[i].size, addrs[i]);
+
+        iovs[i].iov_base = datagrams[i].buf;
+        iovs[i].iov_len = datagrams[i].size;
+
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+
+    int res = sendmmsg(socket_, msgs, static_cast<unsigned int>(count), MSG_DONTWAIT);
+    if (res < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+            return 0;
+
         THROW(fplog::exceptions::Write_Failed);
+    }
 
-    res = sendto(socket_, (char*)buf, static_cast<int>(buf_size), 0, (sockaddr*)&remote_addr, addr_len);
-    if (res != SOCKET_ERROR)
-        return res;
-    else
+    return res;
+
+#else
+
+    if ((count == 0) || !wait(true, 0))
+        return 0;
+
+    sockaddr_in remote_addr;
+    remote_address(datagrams[0].buf, datagrams[0].size, remote_addr);
+
+    int res = sendto(socket_, (char*)datagrams[0].buf, static_cast<int>(datagrams[0].size), 0, (sockaddr*)&remote_addr, sizeof(remote_addr));
+    if (res == SOCKET_ERROR)
+        THROW(fplog::exceptions::Write_Failed);
+
+    return 1;
+
+#endif
+}
+
+size_t Socket_Transport::read(void* buf, size_t buf_size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> lock(read_mutex_);
+    if (!connected_)
+        THROW(fplog::exceptions::Read_Failed);
+    
+    time_point<system_clock, system_clock::duration> timer_start(system_clock::now());
+
+#if defined(_LINUX) && !defined(_OSX)
+
+    //datagram is copied from the ring buffer straight to the caller, read-ahead would only add a copy
+    if (uring_)
+    {
+        Datagram datagram;
+
+        datagram.buf = buf;
+        datagram.buf_size = buf_size;
+
+        while (receive(&datagram, 1) == 0)
+        {
+            size_t left = time_left(timer_start, timeout);
+            if ((left == 0) || !wait(false, left))
+                THROW(fplog::exceptions::Timeout);
+        }
+
+        return datagram.size;
+    }
+
+#endif
+
+    //read-ahead buffers fit the largest buffer the caller has used so far
+    if ((read_ahead_next_ >= read_ahead_count_) && (read_ahead_buf_.size() < buf_size * max_batch))
     {
-        int e = errno;
+        read_ahead_buf_.resize(buf_size * max_batch);
+        read_ahead_.resize(max_batch);
+
+        for (size_t i = 0; i < max_batch; ++i)
+        {
+            read_ahead_[i].buf = &read_ahead_buf_[i * buf_size];
+            read_ahead_[i].buf_size = buf_size;
+        }
+    }
+
+retry:
+
+    if (read_ahead_next_ < read_ahead_count_)
+    {
+        Datagram& datagram = read_ahead_[read_ahead_next_++];
+
+        //datagram longer than the read-ahead buffer was dropped by receive(), one that only fit a larger buffer
+        //of an earlier read is cut to this one
+        size_t size = (datagram.size < buf_size) ? datagram.size : buf_size;
+        memcpy(buf, datagram.buf, size);
+
+        return size;
+    }
+
+    read_ahead_next_ = 0;
+    read_ahead_count_ = receive(&read_ahead_[0], read_ahead_.size());
+
+    if (read_ahead_count_ > 0)
+        goto retry;
+
+    size_t left = time_left(timer_start, timeout);
+    if ((left == 0) || !wait(false, left))
+        THROW(fplog::exceptions::Timeout);
+
+    goto retry;
+}
+
+size_t Socket_Transport::read_batch(Datagram* datagrams, size_t count, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> lock(read_mutex_);
+    if (!connected_)
+        THROW(fplog::exceptions::Read_Failed);
+
+    if (count == 0)
+        return 0;
+
+    //leftovers of previous reads go first to keep the order
+    size_t received = 0;
+    while ((received < count) && (read_ahead_next_ < read_ahead_count_))
+    {
+        Datagram& datagram = read_ahead_[read_ahead_next_++];
+
+        datagrams[received].size = (datagram.size < datagrams[received].buf_size) ? datagram.size : datagrams[received].buf_size;
+        memcpy(datagrams[received].buf, datagram.buf, datagrams[received].size);
+
+        received++;
+    }
+
+    if (received > 0)
+        return received;
+
+    time_point<system_clock, system_clock::duration> timer_start(system_clock::now());
+
+retry:
+
+    received = receive(datagrams, count);
+    if (received > 0)
+        return received;
+
+    size_t left = time_left(timer_start, timeout);
+    if ((left == 0) || !wait(false, left))
+        THROW(fplog::exceptions::Timeout);
+
+    goto retry;
+}
+
+size_t Socket_Transport::write(const void* buf, size_t buf_size, size_t timeout)
+{    
+    Datagram datagram;
+
+    datagram.buf = const_cast<void*>(buf);
+    datagram.buf_size = buf_size;
+    datagram.size = buf_size;
+
+    write_batch(&datagram, 1, timeout);
+    return buf_size;
+}
+
+size_t Socket_Transport::write_batch(const Datagram* datagrams, size_t count, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> lock(write_mutex_);
+    if (!connected_)
         THROW(fplog::exceptions::Write_Failed);
+
+    time_point<system_clock, system_clock::duration> timer_start(system_clock::now());
+    size_t sent = 0;
+
+    while (sent < count)
+    {
+        size_t bytes = send(datagrams + sent, count - sent);
+        sent += bytes;
+
+        if (bytes > 0)
+            continue;
+
+        //socket buffer is full, only now it is worth waiting
+        size_t left = time_left(timer_start, timeout);
+        if ((left == 0) || !wait(true, left))
+        {
+            if (sent > 0)
+                return sent;
+
+            THROW(fplog::exceptions::Timeout);
+        }
     }
 
-    return 0;
+    return sent;
+}
+
+unsigned short Socket_Transport::local_port()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    if (!connected_)
+        THROW(fplog::exceptions::Connect_Failed);
+
+    sockaddr_in local_addr;
+
+#ifdef _LINUX
+    socklen_t addr_len = sizeof(local_addr);
+#else
+    int addr_len = sizeof(local_addr);
+#endif
+
+    if (0 != getsockname(socket_, (sockaddr*)&local_addr, &addr_len))
+        THROW(fplog::exceptions::Connect_Failed);
+
+    return ntohs(local_addr.sin_port);
+}
+
+bool Socket_Transport::has_read_ahead()
+{
+    std::lock_guard<std::recursive_mutex> lock(read_mutex_);
+
+#if defined(_LINUX) && !defined(_OSX)
+
+    if (uring_ && uring_->has_received())
+        return true;
+
+#endif
+
+    return (read_ahead_next_ < read_ahead_count_);
+}
+
+int Socket_Transport::poll_handle()
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+#if defined(_LINUX) && !defined(_OSX)
+
+    if (uring_)
+        return uring_->handle();
+
+#endif
+
+    return static_cast<int>(socket_);
 }
 
 Socket_Transport::Socket_Transport():
 connected_(false),
-high_uid_(false)
+high_uid_(false),
+mux_(false),
+mux_endpoint_(false),
+read_ahead_(max_batch),
+read_ahead_next_(0),
+read_ahead_count_(0),
+uring_(0)
 {
 }
 
 Socket_Transport::~Socket_Transport()
 {
-    std::lock_guard<std::recursive_mutex> lock(mutex_);
-
     disconnect();
 }
 
@@ -24,6 +24,7 @@
 #endif
 
 #include <mutex>
+#include <vector>
 
 #ifdef SPIPC_EXPORT
 #define SPIPC_API __declspec(dllexport)
@@ -37,29 +38,94 @@
 
 namespace spipc {
 
+class Socket_Uring;
+
+//Connection params:
+//uid = high_low port pair, whoever binds the high port first talks to the low port and vice versa;
+//ip = remote address, localhost is assumed if omitted;
+//mux = true makes the high port a shared endpoint for sprot::Channel_Mux: the first process to bind it
+//accepts datagrams from any local port and routes every outgoing datagram to the port stored in its
+//channel id prefix, all other processes bind an ephemeral port (see local_port()) and use it as their channel id.
+//Socket is tried first and waited for only when it is not ready, so timeout = 0 makes read and write non-blocking.
+//On Linux read fetches up to max_batch datagrams with one recvmmsg and serves the following reads from them,
+//a datagram longer than the largest buf_size used so far is dropped then rather than truncated as by recvfrom.
+//io = uring receives through io_uring instead (Linux 6.0+, see Socket_Uring), datagrams are taken from ring buffers
+//filled by the kernel without a syscall per read; uring_datagram_size (2048) is the largest datagram accepted then,
+//uring_buffers (256) is the number of ring buffers. Older kernels silently stay with recvmmsg.
 class SPIPC_API Socket_Transport: public fplog::Transport_Interface
 {
     public:
 
+        static const size_t max_batch = 32;
+
+        //For read_batch buf/buf_size is the space to receive into and size is set to the datagram length,
+        //for write_batch buf/size is the datagram to send.
+        struct Datagram
+        {
+            Datagram(): buf(0), buf_size(0), size(0) {}
+
+            void* buf;
+            size_t buf_size;
+            size_t size;
+        };
+
         virtual void connect(const Params& params);
         virtual void disconnect();
 
         virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait);
         virtual size_t write(const void* buf, size_t buf_size, size_t timeout = infinite_wait);
 
+        //Receives whatever is already queued, up to count datagrams (at most max_batch), waiting only if nothing is.
+        //Returns the number of datagrams received, they are at the start of the array: entries of datagrams
+        //that were filtered out (wrong sender or truncated) are swapped towards the end together with their buffers.
+        size_t read_batch(Datagram* datagrams, size_t count, size_t timeout = infinite_wait);
+
+        //Sends datagrams in order with as few syscalls as possible, returns how many were sent before timeout.
+        size_t write_batch(const Datagram* datagrams, size_t count, size_t timeout = infinite_wait);
+
         Socket_Transport();
         ~Socket_Transport();
 
+        unsigned short local_port();
+        bool is_mux_endpoint() { return mux_endpoint_; }
+
+        //For event loops (epoll etc.): datagrams already fetched ahead by read are not signalled by the socket
+        //any more, so after a readiness event the owner should keep reading while has_read_ahead() is true.
+        SOCKET socket_handle() { return socket_; }
+        bool has_read_ahead();
+
+        //What event loops should wait on for reads: the io_uring completion ring when it receives for the socket, the socket otherwise.
+        int poll_handle();
+        bool uses_uring() { return uring_ != 0; }
+
 
     private:
 
+        bool accepted(sockaddr_in& remote_addr);
+        void remote_address(const void* buf, size_t buf_size, sockaddr_in& remote_addr);
+        bool wait(bool for_write, size_t timeout);
+        size_t receive(Datagram* datagrams, size_t count);
+        size_t send(const Datagram* datagrams, size_t count);
+
         SOCKET socket_;
         bool connected_;
         std::recursive_mutex mutex_;
+        std::recursive_mutex read_mutex_;
+        std::recursive_mutex write_mutex_;
         fplog::UID uid_;
         bool high_uid_;
         unsigned char ip_[4];
         bool localhost_;
+        bool mux_;
+        bool mux_endpoint_;
+
+        //datagrams received ahead by read, entries point into read_ahead_buf_
+        std::vector<Datagram> read_ahead_;
+        std::vector<char> read_ahead_buf_;
+        size_t read_ahead_next_;
+        size_t read_ahead_count_;
+
+        Socket_Uring* uring_;
 };
 
 };
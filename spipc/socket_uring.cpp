@@ -0,0 +1,501 @@
+#include "socket_uring.h"
+
+#if defined(_LINUX) && !defined(_OSX)
+
+#include <fplog_exceptions.h>
+#include <fplog_transport.h>
+
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+namespace spipc {
+
+//multishot recvmsg (6.0) came after buffer rings and EXT_ARG, so its flag tells whether the headers have everything
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+
+//Submission and completion queues shared with the kernel plus the ring of receive buffers.
+struct Socket_Uring::Ring
+{
+    Ring(): fd(-1), sq_ptr(0), cq_ptr(0), sq_size(0), cq_size(0), sqes(0), sqes_size(0), bufs(0), bufs_size(0), bufs_tail(0), bufs_mask(0) {}
+
+    int fd;
+
+    void* sq_ptr;
+    void* cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    //io_uring_buf_ring is not used, its flexible array is shifted in C++ by the empty struct of __DECLARE_FLEX_ARRAY,
+    //the tail is the resv field of the first entry
+    io_uring_buf* bufs;
+    size_t bufs_size;
+    unsigned short bufs_tail;
+    unsigned short bufs_mask;
+
+    bool open(unsigned entries, unsigned cq_entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_entries;
+
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0)
+            return false;
+
+        //no timeout for io_uring_enter and no guarantee that overflowing completions are kept otherwise
+        if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+            return false;
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+
+        sq_ptr = mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED)
+        {
+            sq_ptr = 0;
+            return false;
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            cq_ptr = sq_ptr;
+        else
+        {
+            cq_ptr = mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED)
+            {
+                cq_ptr = 0;
+                return false;
+            }
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+        {
+            sqes = 0;
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+
+        char* cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    //Registers the ring of receive buffers as buffer group 0, entries must be a power of 2.
+    bool register_buffers(unsigned entries)
+    {
+        bufs_size = entries * sizeof(io_uring_buf);
+
+        void* mem = mmap(0, bufs_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return false;
+
+        bufs = static_cast<io_uring_buf*>(mem);
+        bufs_tail = 0;
+        bufs_mask = static_cast<unsigned short>(entries - 1);
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+
+        reg.ring_addr = reinterpret_cast<__u64>(mem);
+        reg.ring_entries = entries;
+        reg.bgid = 0;
+
+        return (0 == syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1));
+    }
+
+    void close()
+    {
+        //closing the fd cancels whatever is still armed
+        if (fd >= 0)
+            ::close(fd);
+
+        if (sqes)
+            munmap(sqes, sqes_size);
+
+        if (cq_ptr && (cq_ptr != sq_ptr))
+            munmap(cq_ptr, cq_size);
+
+        if (sq_ptr)
+            munmap(sq_ptr, sq_size);
+
+        if (bufs)
+            munmap(bufs, bufs_size);
+
+        fd = -1;
+        sq_ptr = cq_ptr = 0;
+        sqes = 0;
+        bufs = 0;
+    }
+
+    //Buffer goes to the tail of the ring, the kernel sees it once the tail is published.
+    void add_buffer(void* addr, unsigned len, unsigned short id)
+    {
+        io_uring_buf* buf = &bufs[bufs_tail & bufs_mask];
+
+        buf->addr = reinterpret_cast<__u64>(addr);
+        buf->len = len;
+        buf->bid = id;
+
+        bufs_tail++;
+    }
+
+    void publish_buffers()
+    {
+        __atomic_store_n(&bufs[0].resv, bufs_tail, __ATOMIC_RELEASE);
+    }
+
+    io_uring_sqe* next_sqe()
+    {
+        unsigned tail = *sq_tail;
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+        if (tail - head >= sq_entries)
+            return 0;
+
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        return sqe;
+    }
+
+    io_uring_cqe* peek()
+    {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+        return (head == tail) ? 0 : &cqes[head & *cq_mask];
+    }
+
+    void advance()
+    {
+        __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+    }
+
+    //Submits queued entries and waits for min_complete completions, returns -errno on failure (-ETIME on timeout).
+    int enter(unsigned to_submit, unsigned min_complete, size_t timeout)
+    {
+        unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+        __kernel_timespec ts;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+
+        void* argp = 0;
+        size_t argsz = _NSIG / 8;
+
+        if (min_complete && (timeout != fplog::Transport_Interface::infinite_wait))
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000;
+
+            arg.ts = reinterpret_cast<__u64>(&ts);
+            argp = &arg;
+            argsz = sizeof(arg);
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+
+        int res = static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, argp, argsz));
+        return (res < 0) ? -errno : res;
+    }
+};
+
+static const __u64 recv_tag = 1;
+static const __u64 cancel_tag = 2;
+
+Socket_Uring* Socket_Uring::create(int socket, size_t datagram_size, size_t buffers)
+{
+    if ((datagram_size == 0) || (buffers == 0))
+        THROW(fplog::exceptions::Incorrect_Parameter);
+
+    //buffer ring size must be a power of 2
+    unsigned count = 1;
+    while ((count < buffers) && (count < 32768))
+        count <<= 1;
+
+    Socket_Uring* uring = new Socket_Uring();
+    uring->socket_ = socket;
+
+    //every buffer starts with the recvmsg header and the sender address, the datagram follows
+    uring->buffer_size_ = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + datagram_size;
+    uring->buffer_count_ = count;
+    uring->buffers_ = new char[uring->buffer_size_ * count];
+
+    uring->msg_.msg_namelen = sizeof(sockaddr_in);
+
+    //completion queue holds a completion for every buffer, so a slow reader never makes the kernel stop receiving
+    if (!uring->ring_->open(4, 2 * count) || !uring->ring_->register_buffers(count))
+    {
+        delete uring;
+        return 0;
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+        uring->ring_->add_buffer(uring->buffers_ + i * uring->buffer_size_, static_cast<unsigned>(uring->buffer_size_), static_cast<unsigned short>(i));
+
+    uring->ring_->publish_buffers();
+
+    //kernels without multishot recvmsg reject it right away, nothing is consumed from the socket in that case
+    if (!uring->arm())
+    {
+        delete uring;
+        return 0;
+    }
+
+    io_uring_cqe* cqe = uring->ring_->peek();
+    if (cqe && (cqe->res < 0) && !(cqe->flags & IORING_CQE_F_MORE))
+    {
+        uring->armed_ = false;
+        delete uring;
+        return 0;
+    }
+
+    return uring;
+}
+
+Socket_Uring::Socket_Uring():
+ring_(new Ring()),
+socket_(-1),
+buffers_(0),
+buffer_size_(0),
+buffer_count_(0),
+armed_(false)
+{
+    memset(&msg_, 0, sizeof(msg_));
+}
+
+Socket_Uring::~Socket_Uring()
+{
+    cancel();
+
+    ring_->close();
+    delete ring_;
+
+    delete [] buffers_;
+}
+
+int Socket_Uring::handle()
+{
+    return ring_->fd;
+}
+
+bool Socket_Uring::has_received()
+{
+    return (ring_->peek() != 0);
+}
+
+bool Socket_Uring::arm()
+{
+    io_uring_sqe* sqe = ring_->next_sqe();
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = socket_;
+    sqe->addr = reinterpret_cast<__u64>(&msg_);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = recv_tag;
+
+    if (ring_->enter(1, 0, 0) != 1)
+        return false;
+
+    armed_ = true;
+    return true;
+}
+
+//Buffers must not be freed while recvmsg can still write to them.
+void Socket_Uring::cancel()
+{
+    if (!armed_ || (ring_->fd < 0))
+        return;
+
+    io_uring_sqe* sqe = ring_->next_sqe();
+    if (!sqe)
+        return;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = recv_tag;
+    sqe->user_data = cancel_tag;
+
+    if (ring_->enter(1, 0, 0) != 1)
+        return;
+
+    for (int attempts = 0; armed_ && (attempts < 10); )
+    {
+        io_uring_cqe* cqe = ring_->peek();
+        if (!cqe)
+        {
+            if (ring_->enter(0, 1, 100) == -ETIME)
+                attempts++;
+
+            continue;
+        }
+
+        if ((cqe->user_data == recv_tag) && !(cqe->flags & IORING_CQE_F_MORE))
+            armed_ = false;
+
+        ring_->advance();
+    }
+}
+
+bool Socket_Uring::receive(Received& received)
+{
+    while (true)
+    {
+        io_uring_cqe* cqe = ring_->peek();
+        if (!cqe)
+        {
+            //multishot recvmsg ends when the buffers run out or on an error, it is rearmed once the queue is drained
+            if (!armed_ && !arm())
+                THROWM(fplog::exceptions::Read_Failed, "Cannot arm io_uring recvmsg.");
+
+            return false;
+        }
+
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        bool recv = (cqe->user_data == recv_tag);
+
+        ring_->advance();
+
+        if (!recv)
+            continue;
+
+        if (!(flags & IORING_CQE_F_MORE))
+            armed_ = false;
+
+        if (!(flags & IORING_CQE_F_BUFFER))
+        {
+            if ((res < 0) && (res != -ENOBUFS) && (res != -ECANCELED))
+                THROWM(fplog::exceptions::Read_Failed, ("io_uring recvmsg failed, error = " + std::to_string(-res)).c_str());
+
+            continue;
+        }
+
+        unsigned short id = static_cast<unsigned short>(flags >> IORING_CQE_BUFFER_SHIFT);
+        char* buf = buffers_ + id * buffer_size_;
+        io_uring_recvmsg_out* out = reinterpret_cast<io_uring_recvmsg_out*>(buf);
+
+        size_t header = sizeof(io_uring_recvmsg_out) + msg_.msg_namelen + msg_.msg_controllen;
+
+        memset(&received.addr, 0, sizeof(received.addr));
+        memcpy(&received.addr, buf + sizeof(io_uring_recvmsg_out), (out->namelen < sizeof(received.addr)) ? out->namelen : sizeof(received.addr));
+
+        received.buffer = id;
+        received.data = buf + header;
+        received.size = (res > static_cast<int>(header)) ? res - header : 0;
+        received.truncated = ((out->flags & MSG_TRUNC) != 0) || (out->payloadlen > received.size);
+
+        return true;
+    }
+}
+
+void Socket_Uring::recycle(const Received& received)
+{
+    ring_->add_buffer(buffers_ + received.buffer * buffer_size_, static_cast<unsigned>(buffer_size_), received.buffer);
+    ring_->publish_buffers();
+}
+
+bool Socket_Uring::wait(size_t timeout)
+{
+    if (has_received())
+        return true;
+
+    if (!armed_ && !arm())
+        THROWM(fplog::exceptions::Read_Failed, "Cannot arm io_uring recvmsg.");
+
+    int res = ring_->enter(0, 1, timeout);
+    if ((res < 0) && (res != -ETIME) && (res != -EINTR))
+        THROWM(fplog::exceptions::Read_Failed, ("io_uring wait failed, error = " + std::to_string(-res)).c_str());
+
+    return has_received();
+}
+
+#else
+
+//headers are too old for multishot recvmsg, Socket_Transport stays with recvmmsg
+struct Socket_Uring::Ring
+{
+};
+
+Socket_Uring* Socket_Uring::create(int, size_t, size_t)
+{
+    return 0;
+}
+
+Socket_Uring::~Socket_Uring()
+{
+}
+
+int Socket_Uring::handle()
+{
+    return -1;
+}
+
+bool Socket_Uring::has_received()
+{
+    return false;
+}
+
+bool Socket_Uring::receive(Received&)
+{
+    return false;
+}
+
+void Socket_Uring::recycle(const Received&)
+{
+}
+
+bool Socket_Uring::wait(size_t)
+{
+    return false;
+}
+
+#endif
+
+};
+
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef _LINUX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+namespace spipc {
+
+#if defined(_LINUX) && !defined(_OSX)
+
+//Receiving side of Socket_Transport with io=uring.
+//One multishot recvmsg stays armed on the socket and the kernel puts every datagram into a buffer of a ring
+//registered with it, so while datagrams keep coming they are picked up from the completion queue without any syscall.
+//Needs Linux 6.0 or newer, create() returns 0 when the kernel or the headers lack something and the caller stays with recvmmsg.
+//Not thread safe, Socket_Transport uses it under its read lock.
+class Socket_Uring
+{
+    public:
+
+        //Points into a ring buffer, which is given back to the kernel with recycle().
+        struct Received
+        {
+            const void* data;
+            size_t size;
+            bool truncated;
+            sockaddr_in addr;
+            unsigned short buffer;
+        };
+
+        static const size_t default_datagram_size = 2048;
+        static const size_t default_buffers = 256;
+
+        static Socket_Uring* create(int socket, size_t datagram_size = default_datagram_size, size_t buffers = default_buffers);
+        ~Socket_Uring();
+
+        //Ring fd is readable while completions are waiting, it replaces the socket in epoll sets.
+        int handle();
+        bool has_received();
+
+        //Takes the next received datagram, returns false if there is none.
+        bool receive(Received& received);
+        void recycle(const Received& received);
+
+        //Waits for the next datagram with one io_uring_enter, returns false on timeout.
+        bool wait(size_t timeout);
+
+
+    private:
+
+        struct Ring;
+
+        Ring* ring_;
+        int socket_;
+
+        char* buffers_;
+        size_t buffer_size_;
+        unsigned buffer_count_;
+
+        msghdr msg_;
+        bool armed_;
+
+        Socket_Uring();
+        Socket_Uring(const Socket_Uring&);
+
+        bool arm();
+        void cancel();
+};
+
+#endif
+
+};
@@ -1,11 +1,22 @@
 #include <stdio.h>
 #include <thread>
 #include <atomic>
+#include <algorithm>
 #include <gtest/gtest.h>
 
 #include "spipc.h"
+#include "socket_transport.h"
+#include "unix_socket_transport.h"
+#include "shared_memory_transport.h"
+#include "tcp_transport.h"
+#include "UDT_Transport.h"
+#include "UDT_Listener.h"
 #include "utils.h"
 
+#ifdef _LINUX
+#include <poll.h>
+#endif
+
 namespace spipc { namespace testing {
 
 std::recursive_mutex g_test_mutex;
@@ -292,6 +303,946 @@ retry:
     return true;
 }
 
+#ifdef _LINUX
+
+bool Unix_Socket_Test()
+{
+    fplog::UID uid;
+    uid.high = 18743;
+    uid.low = 18744;
+
+    spipc::Unix_Socket_Transport::Params params;
+    params["uid"] = uid.to_string(uid);
+
+    spipc::Unix_Socket_Transport listener;
+    params["listen"] = "true";
+    listener.connect(params);
+    params.erase("listen");
+
+    //several apps write to the same channel at once, messages of every app must arrive whole and in order
+    const int apps = 3;
+    const int messages = 50000;
+
+    std::chrono::time_point<std::chrono::steady_clock> begin(std::chrono::steady_clock::now());
+
+    std::vector<std::thread*> writers;
+    for (int app = 0; app < apps; ++app)
+        writers.push_back(new std::thread([app, &params]()
+        {
+            try
+            {
+                spipc::Unix_Socket_Transport transport;
+                transport.connect(params);
+
+                char msg[64];
+                for (int i = 0; i < messages; ++i)
+                {
+                    int len = sprintf(msg, "%d_%d_", app, i);
+                    transport.write(msg, len + 1, 3000);
+                }
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                printf("EXCEPTION in unix socket writer: %s\n", e.what().c_str());
+            }
+        }));
+
+    auto join_writers = [&writers]()
+    {
+        for (auto writer : writers)
+        {
+            writer->join();
+            delete writer;
+        }
+    };
+
+    std::vector<int> next(apps, 0);
+    char buf[64];
+
+    try
+    {
+        for (int i = 0; i < apps * messages; ++i)
+        {
+            size_t bytes = listener.read(buf, sizeof(buf), 3000);
+
+            int app = -1, index = -1;
+            if ((bytes == 0) || (buf[bytes - 1] != 0) || (sscanf(buf, "%d_%d_", &app, &index) != 2) || (app < 0) || (app >= apps) || (next[app] != index))
+            {
+                printf("ERROR: unix socket delivered unexpected message.\n");
+                join_writers();
+                return false;
+            }
+
+            next[app]++;
+        }
+    }
+    catch(fplog::exceptions::Generic_Exception& e)
+    {
+        printf("ERROR: unix socket read failed: %s\n", e.what().c_str());
+        join_writers();
+        return false;
+    }
+
+    join_writers();
+
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    printf("Unix socket delivers %g messages per second.\n", apps * messages * 1000.0 / (ms ? ms : 1));
+
+    //message that does not fit stays in the socket until the reader comes back with a bigger buffer
+    spipc::Unix_Socket_Transport app;
+    app.connect(params);
+
+    std::vector<char> big(100000, 'x');
+    app.write(&big[0], big.size(), 3000);
+
+    size_t required = 0;
+    try
+    {
+        listener.read(buf, sizeof(buf), 3000);
+    }
+    catch(fplog::exceptions::Buffer_Overflow& e)
+    {
+        required = e.get_required_size();
+    }
+
+    std::vector<char> big_read(required);
+    if ((required != big.size()) || (listener.read(&big_read[0], big_read.size(), 3000) != big.size()) || (big_read != big))
+    {
+        printf("ERROR: unix socket lost too long message.\n");
+        return false;
+    }
+
+    //app reconnects by itself when fplogd restarts
+    listener.disconnect();
+
+    spipc::Unix_Socket_Transport restarted;
+    params["listen"] = "true";
+    restarted.connect(params);
+
+    try
+    {
+        app.write("hello", 6, 3000);
+        if ((restarted.read(buf, sizeof(buf), 3000) != 6) || (strcmp(buf, "hello") != 0))
+        {
+            printf("ERROR: unix socket did not deliver message after reconnect.\n");
+            return false;
+        }
+    }
+    catch(fplog::exceptions::Generic_Exception& e)
+    {
+        printf("ERROR: unix socket did not reconnect: %s\n", e.what().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool Tcp_Test()
+{
+    spipc::Tcp_Transport::Params params;
+    params["uid"] = "18741_18742";
+    params["ip"] = "127.0.0.1";
+
+    spipc::Tcp_Transport listener;
+    params["listen"] = "true";
+    listener.connect(params);
+    params.erase("listen");
+
+    spipc::Tcp_Transport sender;
+    sender.connect(params);
+
+    //sizes vary so that messages end at any place of the stream chunks read by the listener
+    const int messages = 100000;
+
+    auto make_message = [](int i, std::vector<char>& msg)
+    {
+        msg.resize(1 + (i * 7919) % 3000);
+        for (size_t j = 0; j < msg.size(); ++j)
+            msg[j] = static_cast<char>(i + j);
+        memcpy(&msg[0], &i, (msg.size() < sizeof(i)) ? msg.size() : sizeof(i));
+    };
+
+    std::chrono::time_point<std::chrono::steady_clock> begin(std::chrono::steady_clock::now());
+
+    std::thread writer([&sender, &make_message]()
+    {
+        try
+        {
+            std::vector<char> msg;
+            for (int i = 0; i < messages; ++i)
+            {
+                make_message(i, msg);
+                sender.write(&msg[0], msg.size(), 3000);
+            }
+        }
+        catch(fplog::exceptions::Generic_Exception& e)
+        {
+            printf("EXCEPTION in tcp writer: %s\n", e.what().c_str());
+        }
+    });
+
+    std::vector<char> expected, buf(3000);
+
+    try
+    {
+        for (int i = 0; i < messages; ++i)
+        {
+            make_message(i, expected);
+            size_t bytes = listener.read(&buf[0], buf.size(), 3000);
+
+            if ((bytes != expected.size()) || (memcmp(&buf[0], &expected[0], bytes) != 0))
+            {
+                printf("ERROR: tcp delivered unexpected message.\n");
+                writer.join();
+                return false;
+            }
+        }
+    }
+    catch(fplog::exceptions::Generic_Exception& e)
+    {
+        printf("ERROR: tcp read failed: %s\n", e.what().c_str());
+        writer.join();
+        return false;
+    }
+
+    writer.join();
+
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    printf("TCP delivers %g messages per second.\n", messages * 1000.0 / (ms ? ms : 1));
+
+    //message that does not fit stays in the transport until the reader comes back with a bigger buffer
+    std::vector<char> big(1000000, 'x');
+    sender.write(&big[0], big.size(), 3000);
+
+    size_t required = 0;
+    try
+    {
+        listener.read(&buf[0], buf.size(), 3000);
+    }
+    catch(fplog::exceptions::Buffer_Overflow& e)
+    {
+        required = e.get_required_size();
+    }
+
+    std::vector<char> big_read(required);
+    if ((required != big.size()) || (listener.read(&big_read[0], big_read.size(), 3000) != big.size()) || (big_read != big))
+    {
+        printf("ERROR: tcp lost too long message.\n");
+        return false;
+    }
+
+    //second sender does not push out the first one, and what the first one has sent before it hung up is still read
+    {
+        spipc::Tcp_Transport second;
+        second.connect(params);
+
+        const int each = 1000;
+        for (int i = 0; i < each; ++i)
+        {
+            sender.write("first", 6, 3000);
+            second.write("second", 7, 3000);
+        }
+
+        second.disconnect();
+
+        int firsts = 0, seconds = 0;
+
+        try
+        {
+            for (int i = 0; i < 2 * each; ++i)
+            {
+                listener.read(&buf[0], buf.size(), 3000);
+
+                if (strcmp(&buf[0], "first") == 0)
+                    firsts++;
+                else if (strcmp(&buf[0], "second") == 0)
+                    seconds++;
+            }
+        }
+        catch(fplog::exceptions::Generic_Exception& e)
+        {
+            printf("EXCEPTION in tcp reader: %s\n", e.what().c_str());
+        }
+
+        if ((firsts != each) || (seconds != each))
+        {
+            printf("ERROR: tcp listener got %d and %d of %d messages from two senders.\n", firsts, seconds, each);
+            return false;
+        }
+    }
+
+    //sender notices closed connection and reconnects by itself when fpcollect restarts
+    listener.disconnect();
+
+    spipc::Tcp_Transport restarted;
+    params["listen"] = "true";
+    restarted.connect(params);
+
+    try
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        sender.write("hello", 6, 3000);
+        if ((restarted.read(&buf[0], buf.size(), 3000) != 6) || (strcmp(&buf[0], "hello") != 0))
+        {
+            printf("ERROR: tcp did not deliver message after reconnect.\n");
+            return false;
+        }
+    }
+    catch(fplog::exceptions::Generic_Exception& e)
+    {
+        printf("ERROR: tcp did not reconnect: %s\n", e.what().c_str());
+        return false;
+    }
+
+    //relay takes senders from any address with ip=0.0.0.0
+    restarted.disconnect();
+    sender.disconnect();
+
+    spipc::Tcp_Transport any;
+    params["uid"] = "18743_18744";
+    params["ip"] = "0.0.0.0";
+    params["listen"] = "true";
+    any.connect(params);
+
+    params["ip"] = "127.0.0.1";
+    params.erase("listen");
+    sender.connect(params);
+
+    try
+    {
+        sender.write("hello", 6, 3000);
+        if ((any.read(&buf[0], buf.size(), 3000) != 6) || (strcmp(&buf[0], "hello") != 0))
+        {
+            printf("ERROR: tcp listener on 0.0.0.0 delivered unexpected message.\n");
+            return false;
+        }
+    }
+    catch(fplog::exceptions::Generic_Exception& e)
+    {
+        printf("ERROR: tcp listener on 0.0.0.0 did not accept connection: %s\n", e.what().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool UDT_Listener_Test()
+{
+    spipc::UDT_Listener::Params params;
+    params["uid"] = "18739_18740";
+    params["ip"] = "127.0.0.1";
+
+    spipc::UDT_Listener listener;
+    listener.listen(params);
+
+    //several fplogd instances send to the same port, two workers serve all of them
+    const int senders = 5;
+    const int messages = 200;
+
+    std::vector<std::thread*> threads;
+    for (int sender = 0; sender < senders; ++sender)
+        threads.push_back(new std::thread([sender, &params]()
+        {
+            try
+            {
+                spipc::UDT_Transport transport;
+                transport.connect(params);
+
+                sprot::Protocol protocol(&transport);
+
+                char msg[64];
+                for (int i = 0; i < messages; ++i)
+                {
+                    int len = sprintf(msg, "%d_%d_", sender, i);
+                    protocol.write(msg, len + 1, 3000);
+                }
+
+                //connection stays open until the listener has had time to read everything
+                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+            }
+            catch(fplog::exceptions::Generic_Exception& e)
+            {
+                printf("EXCEPTION in udt sender: %s\n", e.what().c_str());
+            }
+        }));
+
+    std::mutex mutex;
+    std::vector<int> next(senders, 0);
+    std::map<spipc::UDT_Listener::Connection_Id, sprot::Protocol*> protocols;
+    std::atomic<int> received(0);
+    std::atomic<bool> failed(false);
+
+    auto worker = [&]()
+    {
+        std::chrono::time_point<std::chrono::steady_clock> begin(std::chrono::steady_clock::now());
+
+        while ((received < senders * messages) && !failed && (std::chrono::steady_clock::now() - begin < std::chrono::seconds(30)))
+        {
+            spipc::UDT_Listener::Connection_Id id;
+            if (!listener.wait_readable(id, 100))
+                continue;
+
+            sprot::Protocol* protocol = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!protocols[id])
+                    protocols[id] = new sprot::Protocol(listener.connection(id));
+                protocol = protocols[id];
+            }
+
+            try
+            {
+                char buf[64];
+                //same as fpcollect, readable connection might have only a late ACK, so workers do not wait long
+                protocol->read(buf, sizeof(buf), 200);
+
+                int sender = -1, index = -1;
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if ((sscanf(buf, "%d_%d_", &sender, &index) != 2) || (sender < 0) || (sender >= senders) || (next[sender] != index))
+                    failed = true;
+                else
+                {
+                    next[sender]++;
+                    received++;
+                }
+            }
+            catch(fplog::exceptions::Generic_Exception&)
+            {
+            }
+
+            listener.release(id);
+        }
+    };
+
+    std::thread worker1(worker), worker2(worker);
+    worker1.join();
+    worker2.join();
+
+    for (auto thread : threads)
+    {
+        thread->join();
+        delete thread;
+    }
+
+    bool res = (!failed && (received == senders * messages) && (listener.get_connections().size() == senders));
+    if (!res)
+        printf("ERROR: udt listener received %d of %d messages from %d connections.\n", (int)received, senders * messages, (int)listener.get_connections().size());
+
+    //senders are gone, their connections are reported broken
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    for (auto id : listener.get_connections())
+    {
+        if (!listener.is_broken(id))
+        {
+            printf("ERROR: closed udt connection is not reported broken.\n");
+            res = false;
+        }
+
+        delete protocols[id];
+        listener.close_connection(id);
+    }
+
+    return res;
+}
+
+struct Udt_Benchmark_Result
+{
+    std::vector<double> latencies; //ms from write() of a log batch to its arrival
+    double log_mbps;
+    double bulk_mbps;
+
+    double percentile(double p)
+    {
+        if (latencies.empty())
+            return 0;
+
+        std::sort(latencies.begin(), latencies.end());
+        size_t i = static_cast<size_t>(p * (latencies.size() - 1));
+        return latencies[i];
+    }
+};
+
+//Log side sends bursts of 8 batches of 30000 bytes every 50 ms, like fplogd under load,
+//bulk side (default congestion control) pushes 60000 byte messages on its own connection as fast as it can.
+Udt_Benchmark_Result run_udt_benchmark(spipc::UDT_Transport::Params log_params, spipc::UDT_Transport::Params bulk_params, bool with_bulk, size_t seconds)
+{
+    typedef std::chrono::steady_clock clock;
+
+    const size_t batch_size = 30000;
+    const size_t bulk_size = 60000;
+
+    std::atomic<bool> stop(false);
+    std::atomic<long long> log_bytes(0), bulk_bytes(0);
+    Udt_Benchmark_Result result;
+
+    auto receiver = [&stop](spipc::UDT_Transport::Params params, std::atomic<long long>& bytes, std::vector<double>* latencies)
+    {
+        spipc::UDT_Transport transport;
+        transport.connect(params);
+
+        std::vector<char> buf(64 * 1024);
+        while (!stop)
+        {
+            try
+            {
+                size_t sz = transport.read(&buf[0], buf.size(), 200);
+                if (sz < sizeof(clock::rep))
+                    continue;
+
+                bytes += sz;
+
+                if (latencies)
+                {
+                    clock::rep sent;
+                    memcpy(&sent, &buf[0], sizeof(sent));
+                    latencies->push_back((clock::now().time_since_epoch().count() - sent) * 1000.0 * clock::period::num / clock::period::den);
+                }
+            }
+            catch(fplog::exceptions::Generic_Exception&)
+            {
+            }
+        }
+    };
+
+    std::thread log_receiver(receiver, log_params, std::ref(log_bytes), &result.latencies);
+    std::thread* bulk_receiver = with_bulk ? new std::thread(receiver, bulk_params, std::ref(bulk_bytes), nullptr) : nullptr;
+
+    std::thread* bulk_sender = with_bulk ? new std::thread([&]()
+    {
+        spipc::UDT_Transport transport;
+        transport.connect(bulk_params);
+
+        std::vector<char> msg(bulk_size, 'b');
+        while (!stop)
+        {
+            try
+            {
+                transport.write(&msg[0], msg.size(), 1000);
+            }
+            catch(fplog::exceptions::Generic_Exception&)
+            {
+            }
+        }
+    }) : nullptr;
+
+    {
+        spipc::UDT_Transport transport;
+        transport.connect(log_params);
+
+        std::vector<char> batch(batch_size, 'l');
+        clock::time_point start(clock::now()), next_burst(start);
+
+        while (clock::now() - start < std::chrono::seconds(seconds))
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                clock::rep now = clock::now().time_since_epoch().count();
+                memcpy(&batch[0], &now, sizeof(now));
+
+                try
+                {
+                    transport.write(&batch[0], batch.size(), 1000);
+                }
+                catch(fplog::exceptions::Generic_Exception&)
+                {
+                }
+            }
+
+            next_burst += std::chrono::milliseconds(50);
+            std::this_thread::sleep_until(next_burst);
+        }
+
+        //last burst has time to arrive before the receivers stop
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        stop = true;
+
+        if (bulk_sender)
+        {
+            bulk_sender->join();
+            delete bulk_sender;
+        }
+
+        log_receiver.join();
+
+        if (bulk_receiver)
+        {
+            bulk_receiver->join();
+            delete bulk_receiver;
+        }
+    }
+
+    result.log_mbps = log_bytes * 8.0 / seconds / 1000000.0;
+    result.bulk_mbps = bulk_bytes * 8.0 / seconds / 1000000.0;
+
+    return result;
+}
+
+//Tail latency of log bursts and share of the bandwidth left to other traffic, with default UDT congestion control
+//and the fplog one, over loopback. Runs only on demand (spipc_test benchmark), takes about a minute.
+void udt_cc_benchmark()
+{
+    const size_t seconds = 5;
+
+    printf("%-22s %5s %8s %8s %8s %8s %9s %9s %9s\n",
+           "cc", "bulk", "p50 ms", "p90 ms", "p99 ms", "max ms", "batches", "log Mbps", "bulk Mbps");
+
+    //every run gets its own ports, closed UDT sockets linger for a while
+    int port = 18801;
+
+    auto run = [&port](const char* name, const char* cc, const char* max_rate, bool with_bulk)
+    {
+        spipc::UDT_Transport::Params params, bulk_params;
+        params["uid"] = std::to_string(port) + "_" + std::to_string(port + 1);
+        params["ip"] = "127.0.0.1";
+        params["cc"] = cc;
+        if (max_rate)
+            params["cc_max_rate"] = max_rate;
+
+        bulk_params["uid"] = std::to_string(port + 2) + "_" + std::to_string(port + 3);
+        bulk_params["ip"] = "127.0.0.1";
+        port += 4;
+
+        Udt_Benchmark_Result r(run_udt_benchmark(params, bulk_params, with_bulk, seconds));
+
+        printf("%-22s %5s %8.2f %8.2f %8.2f %8.2f %9d %9.1f %9.1f\n",
+               name, with_bulk ? "yes" : "no", r.percentile(0.5), r.percentile(0.9), r.percentile(0.99), r.percentile(1.0),
+               (int)r.latencies.size(), r.log_mbps, r.bulk_mbps);
+    };
+
+    for (int with_bulk = 0; with_bulk < 2; ++with_bulk)
+    {
+        run("udt", "udt", nullptr, with_bulk != 0);
+        run("fplog", "fplog", nullptr, with_bulk != 0);
+        run("fplog cc_max_rate=100", "fplog", "100", with_bulk != 0);
+    }
+}
+
+bool Socket_Batch_Test(const char* io = 0)
+{
+    spipc::Socket_Transport::Params params;
+    params["uid"] = "18749_18750";
+    params["ip"] = "127.0.0.1";
+
+    if (io)
+        params["io"] = io;
+
+    spipc::Socket_Transport sender, receiver;
+    sender.connect(params);
+    receiver.connect(params);
+
+    //datagram from a port outside of the uid pair must be dropped without spoiling the rest of the batch
+    spipc::Socket_Transport::Params stranger_params;
+    stranger_params["uid"] = "18750_18751";
+    stranger_params["ip"] = "127.0.0.1";
+
+    spipc::Socket_Transport stranger;
+    stranger.connect(stranger_params);
+
+    const size_t count = spipc::Socket_Transport::max_batch;
+    char out[count][16], in[count][16];
+    spipc::Socket_Transport::Datagram outgoing[count], incoming[count];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        outgoing[i].buf = out[i];
+        outgoing[i].size = sprintf(out[i], "datagram_%d", (int)i) + 1;
+
+        incoming[i].buf = in[i];
+        incoming[i].buf_size = sizeof(in[i]);
+    }
+
+    try
+    {
+        receiver.read(in[0], sizeof(in[0]), 0);
+
+        printf("ERROR: read without timeout did not return immediately.\n");
+        return false;
+    }
+    catch(fplog::exceptions::Timeout&)
+    {
+    }
+
+    if (sender.write_batch(outgoing, count / 2, 1000) != count / 2)
+        return false;
+
+    stranger.write("stranger", 9, 1000);
+
+    if (sender.write_batch(outgoing + count / 2, count - count / 2, 1000) != count - count / 2)
+        return false;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+#ifdef _LINUX
+    //whatever receives for the socket, event loops are woken by poll_handle
+    pollfd pfd;
+    pfd.fd = receiver.poll_handle();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if ((poll(&pfd, 1, 1000) != 1) || !(pfd.revents & POLLIN))
+    {
+        printf("ERROR: poll_handle is not readable with datagrams waiting.\n");
+        return false;
+    }
+#endif
+
+    size_t received = 0;
+    while (received < count)
+    {
+        size_t batch = receiver.read_batch(incoming, count, 1000);
+
+        for (size_t i = 0; i < batch; ++i, ++received)
+            if ((incoming[i].size != outgoing[received].size) || (strcmp((char*)incoming[i].buf, out[received]) != 0))
+            {
+                printf("ERROR: read_batch returned unexpected datagram.\n");
+                return false;
+            }
+    }
+
+    //single reads are served from the same batch
+    sender.write_batch(outgoing, count, 1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        char buf[16];
+        if ((receiver.read(buf, sizeof(buf), 1000) != outgoing[i].size) || (strcmp(buf, out[i]) != 0))
+        {
+            printf("ERROR: read after batch returned unexpected datagram.\n");
+            return false;
+        }
+
+        //event loops rely on it, the rest of the batch is no longer in the socket
+        if (receiver.has_read_ahead() != (i + 1 < count))
+        {
+            printf("ERROR: has_read_ahead does not match datagrams left in the batch.\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Shared_Memory_Test()
+{
+    fplog::UID uid;
+    uid.high = 18745;
+    uid.low = 18746;
+
+    spipc::Shared_Memory_Transport::remove(uid);
+
+    spipc::Shared_Memory_Transport::Params params;
+    params["uid"] = uid.to_string(uid);
+
+    //small ring makes the producer wrap around and wait for space all the time
+    spipc::Shared_Memory_Transport consumer;
+    params["listen"] = "true";
+    params["ring_size"] = "65536";
+    consumer.connect(params);
+    params.erase("listen");
+    params.erase("ring_size");
+
+    spipc::Shared_Memory_Transport producer;
+    producer.connect(params);
+
+    spipc::Shared_Memory_Transport second_producer;
+    try
+    {
+        second_producer.connect(params);
+        second_producer.write("x", 1, 100);
+
+        printf("ERROR: shared memory ring accepted second producer.\n");
+        return false;
+    }
+    catch(fplog::exceptions::Generic_Exception&)
+    {
+    }
+
+    const int messages = 200000;
+
+    auto make_message = [](int i, std::vector<char>& msg)
+    {
+        msg.resize(1 + (i * 7919) % 3000);
+        for (size_t j = 0; j < msg.size(); ++j)
+            msg[j] = static_cast<char>(i + j);
+        memcpy(&msg[0], &i, (msg.size() < sizeof(i)) ? msg.size() : sizeof(i));
+    };
+
+    std::chrono::time_point<std::chrono::steady_clock> begin(std::chrono::steady_clock::now());
+
+    std::thread writer([&]()
+    {
+        std::vector<char> msg;
+
+        try
+        {
+            for (int i = 0; i < messages; ++i)
+            {
+                make_message(i, msg);
+
+                if (i % 2)
+                    producer.write(&msg[0], msg.size(), 3000);
+                else
+                {
+                    memcpy(producer.reserve(msg.size(), 3000), &msg[0], msg.size());
+                    producer.commit();
+                }
+            }
+        }
+        catch(fplog::exceptions::Generic_Exception& e)
+        {
+            printf("EXCEPTION in shared memory writer: %s\n", e.what().c_str());
+        }
+    });
+
+    std::vector<char> expected, buf(3000);
+    bool res = true;
+
+    try
+    {
+        for (int i = 0; (i < messages) && res; ++i)
+        {
+            make_message(i, expected);
+
+            if (i % 2)
+            {
+                size_t bytes = consumer.read(&buf[0], buf.size(), 3000);
+                res = (bytes == expected.size()) && (memcmp(&buf[0], &expected[0], bytes) == 0);
+            }
+            else
+            {
+                size_t size = 0;
+                const void* msg = consumer.acquire(size, 3000);
+                res = (size == expected.size()) && (memcmp(msg, &expected[0], size) == 0);
+                consumer.release();
+            }
+        }
+    }
+    catch(fplog::exceptions::Generic_Exception& e)
+    {
+        printf("EXCEPTION in shared memory reader: %s\n", e.what().c_str());
+        res = false;
+    }
+
+    writer.join();
+
+    if (!res)
+    {
+        printf("ERROR: shared memory ring delivered unexpected message.\n");
+        return false;
+    }
+
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    printf("Shared memory ring delivers %g messages per second.\n", messages * 1000.0 / (ms ? ms : 1));
+
+    //message over half of the ring at an offset where padding to the end of the ring and the message do not fit together,
+    //30000 bytes from the start of a fresh ring put the next 40000 ones there
+    fplog::UID large_uid;
+    large_uid.high = 18747;
+    large_uid.low = 18748;
+
+    spipc::Shared_Memory_Transport::remove(large_uid);
+
+    spipc::Shared_Memory_Transport::Params large_params;
+    large_params["uid"] = large_uid.to_string(large_uid);
+    large_params["listen"] = "true";
+    large_params["ring_size"] = "65536";
+
+    spipc::Shared_Memory_Transport large_consumer;
+    large_consumer.connect(large_params);
+    large_params.erase("listen");
+    large_params.erase("ring_size");
+
+    spipc::Shared_Memory_Transport large_producer;
+    large_producer.connect(large_params);
+
+    const size_t large_sizes[] = {30000, 40000, 40000, 30000};
+
+    std::thread large_writer([&]()
+    {
+        std::vector<char> msg;
+
+        try
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                msg.assign(large_sizes[i], static_cast<char>('a' + i));
+                large_producer.write(&msg[0], msg.size(), 3000);
+            }
+        }
+        catch(fplog::exceptions::Generic_Exception& e)
+        {
+            printf("EXCEPTION in shared memory writer: %s\n", e.what().c_str());
+        }
+    });
+
+    buf.resize(40000);
+
+    try
+    {
+        for (int i = 0; (i < 4) && res; ++i)
+        {
+            size_t bytes = large_consumer.read(&buf[0], buf.size(), 3000);
+            res = (bytes == large_sizes[i]) && (buf[0] == 'a' + i) && (buf[bytes - 1] == 'a' + i);
+        }
+    }
+    catch(fplog::exceptions::Generic_Exception& e)
+    {
+        printf("EXCEPTION in shared memory reader: %s\n", e.what().c_str());
+        res = false;
+    }
+
+    large_writer.join();
+    large_producer.disconnect();
+    large_consumer.disconnect();
+    spipc::Shared_Memory_Transport::remove(large_uid);
+
+    if (!res)
+    {
+        printf("ERROR: shared memory ring lost a message larger than half of the ring.\n");
+        return false;
+    }
+
+    //message that does not fit stays in the ring, so does everything written while the consumer is away
+    producer.write("hello", 6, 3000);
+
+    char small[4];
+    size_t required = 0;
+    try
+    {
+        consumer.read(small, sizeof(small), 3000);
+    }
+    catch(fplog::exceptions::Buffer_Overflow& e)
+    {
+        required = e.get_required_size();
+    }
+
+    consumer.disconnect();
+    producer.write("world", 6, 3000);
+
+    params["listen"] = "true";
+    spipc::Shared_Memory_Transport restarted;
+    restarted.connect(params);
+
+    char hello[6], world[6];
+    res = (required == 6) && (restarted.read(hello, sizeof(hello), 3000) == 6) && (strcmp(hello, "hello") == 0)
+        && (restarted.read(world, sizeof(world), 3000) == 6) && (strcmp(world, "world") == 0);
+
+    producer.disconnect();
+    restarted.disconnect();
+    spipc::Shared_Memory_Transport::remove(uid);
+
+    if (!res)
+        printf("ERROR: shared memory ring lost messages across consumer restart.\n");
+
+    return res;
+}
+
+#endif
+
 bool run_all_tests()
 {
     g_written_items.clear();
@@ -361,8 +1312,54 @@ TEST(Buffer_Overflow_IPC_Test, BufferOverflow)
     EXPECT_TRUE(spipc::testing::Buffer_Overflow_Test());
 }
 
+#ifdef _LINUX
+
+TEST(Unix_Socket_Test, ManyAppsOneListener)
+{
+    EXPECT_TRUE(spipc::testing::Unix_Socket_Test());
+}
+
+TEST(Socket_Batch_Test, BatchReadWrite)
+{
+    EXPECT_TRUE(spipc::testing::Socket_Batch_Test());
+}
+
+#ifdef _LINUX
+TEST(Socket_Batch_Test, BatchReadWriteUring)
+{
+    //falls back to recvmmsg on kernels without io_uring, the behaviour must be the same either way
+    EXPECT_TRUE(spipc::testing::Socket_Batch_Test("uring"));
+}
+#endif
+
+TEST(Shared_Memory_Test, RingWrapAndRestart)
+{
+    EXPECT_TRUE(spipc::testing::Shared_Memory_Test());
+}
+
+TEST(Tcp_Test, FramingAndReconnect)
+{
+    EXPECT_TRUE(spipc::testing::Tcp_Test());
+}
+
+TEST(UDT_Listener_Test, ManyConnectionsTwoWorkers)
+{
+    EXPECT_TRUE(spipc::testing::UDT_Listener_Test());
+}
+
+#endif
+
 int main(int argc, char **argv)
 {
+#ifdef _LINUX
+    if ((argc > 1) && (strcmp(argv[1], "benchmark") == 0))
+    {
+        spipc::testing::udt_cc_benchmark();
+        return 0;
+    }
+#endif
+
+
     //tests should complete under 5 minutes or be aborted and considered a failure
     generic_util::process_suicide(5 * 60000);
     
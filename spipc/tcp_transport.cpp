@@ -0,0 +1,562 @@
+#include "tcp_transport.h"
+#include <chrono>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _LINUX
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#endif
+
+using namespace std::chrono;
+
+namespace spipc {
+
+Tcp_Transport::Tcp_Transport():
+connected_(false),
+listening_(false),
+localhost_(true),
+port_(0),
+listen_socket_(-1),
+next_peer_(0),
+reply_peer_(-1)
+{
+    memset(ip_, 0, sizeof(ip_));
+}
+
+Tcp_Transport::~Tcp_Transport()
+{
+    disconnect();
+}
+
+#ifdef _LINUX
+
+//-1 means infinite wait, 0 means the time is up
+static int time_left(size_t timeout, const steady_clock::time_point& start)
+{
+    if (timeout == fplog::Transport_Interface::infinite_wait)
+        return -1;
+
+    long long elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count();
+    if (elapsed >= static_cast<long long>(timeout))
+        return 0;
+
+    return static_cast<int>(timeout - elapsed);
+}
+
+static void setup_socket(int sock)
+{
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    int opt_val = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&opt_val, sizeof(opt_val));
+
+#ifdef SO_NOSIGPIPE
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (char*)&opt_val, sizeof(opt_val));
+#endif
+}
+
+void Tcp_Transport::connect(const Params& params)
+{
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    std::string uidstr;
+
+    if (params.find("uid") == params.end())
+    {
+        if (params.find("UID") == params.end())
+        {
+            THROW(fplog::exceptions::Invalid_Uid);
+        }
+        else
+            uidstr = (*params.find("UID")).second;
+    }
+    else
+        uidstr = (*params.find("uid")).second;
+
+    fplog::UID uid;
+    uid.from_string(uidstr);
+
+    if ((uid.high > 65535) || (uid.high < 1))
+        THROW(fplog::exceptions::Invalid_Uid);
+
+    std::string ip("127.0.0.1");
+
+    if (params.find("ip") != params.end())
+        ip = params.find("ip")->second;
+    else if (params.find("IP") != params.end())
+        ip = params.find("IP")->second;
+
+    unsigned char addr[4];
+    if (1 != inet_pton(AF_INET, ip.c_str(), addr))
+        THROW(fplog::exceptions::Incorrect_Parameter);
+
+    bool listen_mode = false;
+
+    auto listen_param = params.find("listen");
+    if (listen_param != params.end())
+        listen_mode = ((listen_param->second == "true") || (listen_param->second == "TRUE") || (listen_param->second == "1"));
+
+    disconnect();
+
+    memcpy(ip_, addr, sizeof(ip_));
+    localhost_ = (ip_[0] == 127);
+    port_ = static_cast<unsigned short>(uid.high);
+    listening_ = listen_mode;
+
+    if (listening_)
+    {
+        listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listen_socket_ < 0)
+            THROWM(fplog::exceptions::Connect_Failed, ("Connect failed, socket error = " + std::to_string(errno)).c_str());
+
+        setup_socket(listen_socket_);
+
+        //restarted listener must be able to bind while old connections are still in TIME_WAIT
+        int opt_val = 1;
+        setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, (char*)&opt_val, sizeof(opt_val));
+
+        sockaddr_in listen_addr;
+        memset(&listen_addr, 0, sizeof(listen_addr));
+        listen_addr.sin_family = AF_INET;
+        listen_addr.sin_port = htons(port_);
+        listen_addr.sin_addr.s_addr = htonl(localhost_ ? INADDR_LOOPBACK : INADDR_ANY);
+
+        if ((0 != bind(listen_socket_, (sockaddr*)&listen_addr, sizeof(listen_addr))) || (0 != listen(listen_socket_, SOMAXCONN)))
+        {
+            std::string error("Connect failed, socket error = " + std::to_string(errno));
+
+            close(listen_socket_);
+            listen_socket_ = -1;
+
+            THROWM(fplog::exceptions::Connect_Failed, error.c_str());
+        }
+    }
+    else
+    {
+        //listener might not be running yet, write will try again
+        open_connection(0);
+    }
+
+    connected_ = true;
+}
+
+void Tcp_Transport::disconnect()
+{
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    if (!connected_)
+        return;
+
+    while (!peers_.empty())
+        close_peer(peers_.size() - 1);
+
+    if (listen_socket_ >= 0)
+        close(listen_socket_);
+
+    listen_socket_ = -1;
+    next_peer_ = 0;
+    connected_ = false;
+}
+
+bool Tcp_Transport::open_connection(size_t timeout)
+{
+    int peer = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (peer < 0)
+        return false;
+
+    setup_socket(peer);
+
+    sockaddr_in remote_addr;
+    memset(&remote_addr, 0, sizeof(remote_addr));
+    remote_addr.sin_family = AF_INET;
+    remote_addr.sin_port = htons(port_);
+    memcpy(&remote_addr.sin_addr.s_addr, ip_, sizeof(ip_));
+
+    if (0 != ::connect(peer, (sockaddr*)&remote_addr, sizeof(remote_addr)))
+    {
+        if (errno != EINPROGRESS)
+        {
+            close(peer);
+            return false;
+        }
+
+        int wait = static_cast<int>(((timeout == infinite_wait) || (timeout > connect_timeout)) ? connect_timeout : timeout);
+        pollfd fd = { peer, POLLOUT, 0 };
+
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+
+        if ((poll(&fd, 1, wait) != 1) || (0 != getsockopt(peer, SOL_SOCKET, SO_ERROR, (char*)&error, &error_len)) || (error != 0))
+        {
+            close(peer);
+            return false;
+        }
+    }
+
+    add_peer(peer);
+    return true;
+}
+
+void Tcp_Transport::add_peer(int socket)
+{
+    Peer peer;
+    peer.socket = socket;
+    peer.gone = false;
+    peer.in.resize(recv_chunk);
+    peer.in_begin = peer.in_end = 0;
+
+    peers_.push_back(peer);
+}
+
+void Tcp_Transport::accept_peer()
+{
+    sockaddr_in remote_addr;
+    socklen_t addr_len = sizeof(remote_addr);
+
+    int peer = accept(listen_socket_, (sockaddr*)&remote_addr, &addr_len);
+    if (peer < 0)
+        return;
+
+    static const unsigned char any_address[4] = {0, 0, 0, 0};
+
+    if (!localhost_ && (memcmp(ip_, any_address, sizeof(ip_)) != 0) && (memcmp(&remote_addr.sin_addr.s_addr, ip_, sizeof(ip_)) != 0))
+    {
+        close(peer);
+        return;
+    }
+
+    setup_socket(peer);
+
+    //connections are never replaced, one whose side is gone without FIN or RST is found out by keepalive
+    int opt_val = 1;
+    setsockopt(peer, SOL_SOCKET, SO_KEEPALIVE, (char*)&opt_val, sizeof(opt_val));
+
+    add_peer(peer);
+}
+
+void Tcp_Transport::close_peer(size_t index)
+{
+    if (peers_[index].socket == reply_peer_)
+        reply_peer_ = -1;
+
+    close(peers_[index].socket);
+    peers_.erase(peers_.begin() + index);
+}
+
+void Tcp_Transport::drop_peer(int socket)
+{
+    for (size_t i = 0; i < peers_.size(); ++i)
+        if (peers_[i].socket == socket)
+        {
+            close_peer(i);
+            return;
+        }
+}
+
+static bool peer_closed(int peer)
+{
+    //listening side never sends anything to the connecting one, so readable connection means FIN or RST has arrived
+    char c;
+    ssize_t res = recv(peer, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return ((res == 0) || ((res < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)));
+}
+
+//False if the peer has no complete message yet, there is room for more of it in its buffer then.
+bool Tcp_Transport::take_message(size_t index, void* buf, size_t buf_size, size_t& size)
+{
+    Peer& peer = peers_[index];
+    size_t available = peer.in_end - peer.in_begin;
+
+    if (available >= sizeof(uint32_t))
+    {
+        uint32_t length = 0;
+        memcpy(&length, &peer.in[peer.in_begin], sizeof(length));
+        length = ntohl(length);
+
+        if ((length == 0) || (length > max_message_size))
+        {
+            close_peer(index);
+            THROWM(fplog::exceptions::Read_Failed, "Invalid message length, connection dropped.");
+        }
+
+        if (available >= sizeof(length) + length)
+        {
+            //message stays in the buffer, so the caller can retry with a larger one
+            if (length > buf_size)
+                throw fplog::exceptions::Buffer_Overflow(__FUNCTION__, __SHORT_FORM_OF_FILE__, __LINE__, "Buffer too small.", length);
+
+            memcpy(buf, &peer.in[peer.in_begin + sizeof(length)], length);
+            peer.in_begin += sizeof(length) + length;
+
+            if (peer.in_begin == peer.in_end)
+                peer.in_begin = peer.in_end = 0;
+
+            size = length;
+            return true;
+        }
+
+        if (peer.in.size() < sizeof(length) + length)
+            peer.in.resize(sizeof(length) + length);
+    }
+
+    //partial message is moved to the front to make room for the rest of it
+    if ((peer.in_begin > 0) && (peer.in.size() - peer.in_end < recv_chunk))
+    {
+        memmove(&peer.in[0], &peer.in[peer.in_begin], available);
+        peer.in_begin = 0;
+        peer.in_end = available;
+    }
+
+    if (peer.in.size() - peer.in_end < recv_chunk)
+        peer.in.resize(peer.in_end + recv_chunk);
+
+    return false;
+}
+
+void Tcp_Transport::receive(size_t index)
+{
+    Peer& peer = peers_[index];
+
+    ssize_t received = recv(peer.socket, &peer.in[peer.in_end], peer.in.size() - peer.in_end, MSG_DONTWAIT);
+
+    if (received > 0)
+        peer.in_end += received;
+    else if ((received == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
+        peer.gone = true;
+}
+
+size_t Tcp_Transport::read(void* buf, size_t buf_size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    if (!connected_)
+        THROW(fplog::exceptions::Read_Failed);
+
+    steady_clock::time_point timer_start(steady_clock::now());
+    std::vector<pollfd> fds;
+
+retry:
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        for (size_t i = 0; i < peers_.size(); ++i)
+        {
+            size_t index = (next_peer_ + i) % peers_.size();
+            size_t size = 0;
+
+            if (take_message(index, buf, buf_size, size))
+            {
+                reply_peer_ = peers_[index].socket;
+                next_peer_ = index + 1;
+                return size;
+            }
+        }
+
+        //the other side is gone, incomplete message it has left is useless
+        for (size_t index = peers_.size(); index-- > 0;)
+            if (peers_[index].gone)
+                close_peer(index);
+    }
+
+    int wait = time_left(timeout, timer_start);
+    if (wait == 0)
+        THROW(fplog::exceptions::Timeout);
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (!listening_ && peers_.empty() && !open_connection(wait))
+            THROWM(fplog::exceptions::Read_Failed, "Listener is not running.");
+
+        fds.clear();
+        for (auto& peer : peers_)
+        {
+            pollfd fd = { peer.socket, POLLIN, 0 };
+            fds.push_back(fd);
+        }
+
+        if (listening_)
+        {
+            pollfd fd = { listen_socket_, POLLIN, 0 };
+            fds.push_back(fd);
+        }
+    }
+
+    int res = poll(&fds[0], static_cast<nfds_t>(fds.size()), wait);
+    if (res == 0)
+        THROW(fplog::exceptions::Timeout);
+
+    if (res < 0)
+    {
+        if (errno == EINTR)
+            goto retry;
+
+        THROW(fplog::exceptions::Read_Failed);
+    }
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (listening_ && (fds.back().revents & POLLIN))
+            accept_peer();
+
+        size_t count = fds.size() - (listening_ ? 1 : 0);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            //connection may have been closed by write in the meantime
+            for (size_t index = 0; index < peers_.size(); ++index)
+                if (peers_[index].socket == fds[i].fd)
+                {
+                    receive(index);
+                    break;
+                }
+        }
+    }
+
+    goto retry;
+}
+
+size_t Tcp_Transport::write(const void* buf, size_t buf_size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
+    if (!connected_)
+        THROW(fplog::exceptions::Write_Failed);
+
+    if (buf_size == 0)
+        return 0;
+
+    if (buf_size > max_message_size)
+        THROW(fplog::exceptions::Incorrect_Parameter);
+
+    steady_clock::time_point timer_start(steady_clock::now());
+    bool reconnected = false;
+
+    uint32_t header = htonl(static_cast<uint32_t>(buf_size));
+    const size_t total = sizeof(header) + buf_size;
+    size_t sent = 0;
+
+retry:
+
+    int wait = time_left(timeout, timer_start);
+    int peer = -1;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (!listening_ && (sent == 0))
+        {
+            if (!peers_.empty() && peer_closed(peers_.front().socket))
+                close_peer(0);
+
+            if (peers_.empty() && ((wait == 0) || !open_connection(wait)))
+                THROWM(fplog::exceptions::Write_Failed, "Listener is not running.");
+        }
+
+        if (listening_)
+            peer = reply_peer_;
+        else if (!peers_.empty())
+            peer = peers_.front().socket;
+    }
+
+    if (peer < 0)
+        THROWM(fplog::exceptions::Write_Failed, "No connected peer.");
+
+    iovec parts[2];
+    int part_count = 0;
+
+    if (sent < sizeof(header))
+    {
+        parts[part_count].iov_base = (char*)&header + sent;
+        parts[part_count].iov_len = sizeof(header) - sent;
+        part_count++;
+
+        parts[part_count].iov_base = (void*)buf;
+        parts[part_count].iov_len = buf_size;
+        part_count++;
+    }
+    else
+    {
+        parts[part_count].iov_base = (char*)buf + (sent - sizeof(header));
+        parts[part_count].iov_len = total - sent;
+        part_count++;
+    }
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = parts;
+    msg.msg_iovlen = part_count;
+
+    ssize_t res = sendmsg(peer, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (res > 0)
+    {
+        sent += res;
+        if (sent == total)
+            return buf_size;
+
+        goto retry;
+    }
+
+    int error = errno;
+
+    if ((res < 0) && ((error == EAGAIN) || (error == EWOULDBLOCK) || (error == EINTR)))
+    {
+        pollfd fd = { peer, POLLOUT, 0 };
+
+        if ((wait == 0) || (poll(&fd, 1, wait) == 0))
+        {
+            //the rest of a half sent message can not be dropped without breaking the stream
+            if (sent > 0)
+            {
+                std::lock_guard<std::recursive_mutex> lock(mutex_);
+                drop_peer(peer);
+            }
+
+            THROW(fplog::exceptions::Timeout);
+        }
+
+        goto retry;
+    }
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        drop_peer(peer);
+    }
+
+    //listener was restarted, connection is stale
+    if (!listening_ && !reconnected && (sent == 0))
+    {
+        reconnected = true;
+        goto retry;
+    }
+
+    THROWM(fplog::exceptions::Write_Failed, ("Write failed, socket error = " + std::to_string(error)).c_str());
+}
+
+#endif
+
+};
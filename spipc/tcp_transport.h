@@ -0,0 +1,93 @@
+#pragma once
+
+#include <fplog_exceptions.h>
+#include <fplog_transport.h>
+
+#include <vector>
+#include <mutex>
+
+#ifdef SPIPC_EXPORT
+#define SPIPC_API __declspec(dllexport)
+#else
+#define SPIPC_API __declspec(dllimport)
+#endif
+
+#ifdef _LINUX
+#define SPIPC_API
+#endif
+
+namespace spipc {
+
+//Stream transport over persistent TCP connections, every message is framed with 4-byte length prefix (network byte order).
+//TCP is reliable and ordered, so unlike Socket_Transport it is used without sprot (protocol=none in fplogd and fpcollect),
+//flow control and retransmissions are left to the kernel. Without sprot a finished write only means that the message
+//is in the send buffer of the socket, nothing tells the writer that the other side has read it.
+//Connection params:
+//uid = port pair as for udp, the connection always goes to the high port;
+//ip = address of the listening side for the connecting side and the only address connections are accepted from
+//for the listening side (0.0.0.0 accepts any), localhost is assumed if omitted;
+//listen = true for the receiving side (fpcollect), it keeps every accepted connection until it fails and reads from all of them,
+//what a closed connection has sent in full is still read; connecting side (fplogd) connects lazily and reconnects
+//by itself on the next write if the connection was lost.
+//Linux only, it is not part of the Windows build.
+//Each write sends length and message with one syscall and TCP_NODELAY, so the batch is pushed out right away
+//instead of waiting for the next one, a write that times out halfway closes the connection to keep the framing intact.
+class SPIPC_API Tcp_Transport: public fplog::Transport_Interface
+{
+    public:
+
+        static const size_t max_message_size = 64 * 1024 * 1024;
+
+        virtual void connect(const Params& params);
+        virtual void disconnect();
+
+        virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait);
+        virtual size_t write(const void* buf, size_t buf_size, size_t timeout = infinite_wait);
+
+        Tcp_Transport();
+        ~Tcp_Transport();
+
+
+    private:
+
+        static const size_t connect_timeout = 1000; //ms, used when the caller waits infinitely
+        static const size_t recv_chunk = 64 * 1024;
+
+        bool connected_;
+        bool listening_;
+        bool localhost_;
+        unsigned char ip_[4];
+        unsigned short port_;
+
+        struct Peer
+        {
+            int socket;
+            bool gone; //closed by the other side, it is dropped once no complete message is left in its buffer
+
+            //bytes received from the peer, unread messages are between in_begin and in_end
+            std::vector<char> in;
+            size_t in_begin;
+            size_t in_end;
+        };
+
+        int listen_socket_;
+        std::vector<Peer> peers_; //accepted connections when listening, single connection otherwise
+        size_t next_peer_; //peer to check first, so that a busy sender does not starve the rest
+        int reply_peer_; //listening side answers the peer it has read from last
+
+        std::recursive_mutex mutex_;
+        std::recursive_mutex read_mutex_;
+        std::recursive_mutex write_mutex_;
+
+        bool open_connection(size_t timeout);
+        void add_peer(int socket);
+        void accept_peer();
+        void close_peer(size_t index);
+        void drop_peer(int socket);
+        bool take_message(size_t index, void* buf, size_t buf_size, size_t& size);
+        void receive(size_t index);
+
+        Tcp_Transport(const Tcp_Transport&);
+};
+
+};
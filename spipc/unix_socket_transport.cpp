@@ -0,0 +1,405 @@
+#include "unix_socket_transport.h"
+#include <chrono>
+
+#ifdef _LINUX
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+
+#endif
+
+using namespace std::chrono;
+
+namespace spipc {
+
+std::string Unix_Socket_Transport::socket_name(const fplog::UID& uid)
+{
+    return "fplog_" + std::to_string(uid.high) + "_" + std::to_string(uid.low);
+}
+
+Unix_Socket_Transport::Unix_Socket_Transport():
+connected_(false),
+listening_(false),
+listen_socket_(-1),
+next_peer_(0),
+reply_peer_(-1)
+{
+}
+
+Unix_Socket_Transport::~Unix_Socket_Transport()
+{
+    disconnect();
+}
+
+#ifdef _LINUX
+
+static socklen_t make_address(const std::string& name, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (name.size() + 1 > sizeof(addr.sun_path))
+        THROW(fplog::exceptions::Invalid_Uid);
+
+    //leading zero puts the name into abstract namespace: no file is left behind if the process crashes
+    memcpy(addr.sun_path + 1, name.c_str(), name.size());
+    return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+}
+
+static int time_left(size_t timeout, const steady_clock::time_point& start)
+{
+    if (timeout == fplog::Transport_Interface::infinite_wait)
+        return -1;
+
+    long long elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count();
+    if (elapsed >= static_cast<long long>(timeout))
+        THROW(fplog::exceptions::Timeout);
+
+    return static_cast<int>(timeout - elapsed);
+}
+
+void Unix_Socket_Transport::connect(const Params& params)
+{
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    std::string uidstr;
+
+    if (params.find("uid") == params.end())
+    {
+        if (params.find("UID") == params.end())
+        {
+            THROW(fplog::exceptions::Invalid_Uid);
+        }
+        else
+            uidstr = (*params.find("UID")).second;
+    }
+    else
+        uidstr = (*params.find("uid")).second;
+
+    bool listen_mode = false;
+
+    auto listen_param = params.find("listen");
+    if (listen_param != params.end())
+        listen_mode = ((listen_param->second == "true") || (listen_param->second == "TRUE") || (listen_param->second == "1"));
+
+    fplog::UID uid;
+    uid.from_string(uidstr);
+
+    disconnect();
+
+    name_ = socket_name(uid);
+    listening_ = listen_mode;
+
+    if (listening_)
+    {
+        listen_socket_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (listen_socket_ < 0)
+            THROWM(fplog::exceptions::Connect_Failed, ("Connect failed, socket error = " + std::to_string(errno)).c_str());
+
+        sockaddr_un addr;
+        socklen_t addr_len = make_address(name_, addr);
+
+        if ((0 != bind(listen_socket_, (sockaddr*)&addr, addr_len)) || (0 != listen(listen_socket_, SOMAXCONN)))
+        {
+            std::string error("Connect failed, socket error = " + std::to_string(errno));
+
+            close(listen_socket_);
+            listen_socket_ = -1;
+
+            THROWM(fplog::exceptions::Connect_Failed, error.c_str());
+        }
+    }
+    else
+    {
+        //listener might not be running yet, write will try again
+        open_connection();
+    }
+
+    connected_ = true;
+}
+
+void Unix_Socket_Transport::disconnect()
+{
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    if (!connected_)
+        return;
+
+    while (!peers_.empty())
+        close_peer(peers_.size() - 1);
+
+    if (listen_socket_ >= 0)
+        close(listen_socket_);
+
+    listen_socket_ = -1;
+    next_peer_ = 0;
+    connected_ = false;
+}
+
+bool Unix_Socket_Transport::open_connection()
+{
+    int peer = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (peer < 0)
+        return false;
+
+    sockaddr_un addr;
+    socklen_t addr_len = make_address(name_, addr);
+
+    if (0 != ::connect(peer, (sockaddr*)&addr, addr_len))
+    {
+        close(peer);
+        return false;
+    }
+
+    peers_.push_back(peer);
+    return true;
+}
+
+void Unix_Socket_Transport::close_peer(size_t index)
+{
+    if (peers_[index] == reply_peer_)
+        reply_peer_ = -1;
+
+    close(peers_[index]);
+    peers_.erase(peers_.begin() + index);
+}
+
+size_t Unix_Socket_Transport::receive(int peer, void* buf, size_t buf_size)
+{
+    //peeking with MSG_TRUNC reports the real message size and leaves the message in the socket,
+    //so a caller with too small buffer can retry instead of losing the message
+    ssize_t size = recv(peer, buf, buf_size, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+    if (size < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+            THROW(fplog::exceptions::Timeout);
+
+        return 0;
+    }
+
+    if (static_cast<size_t>(size) > buf_size)
+        throw fplog::exceptions::Buffer_Overflow(__FUNCTION__, __SHORT_FORM_OF_FILE__, __LINE__, "Buffer too small.", size);
+
+    //message is already in the buffer, just drop it from the socket without copying it again
+    if (recv(peer, 0, 0, MSG_DONTWAIT) < 0)
+        return 0;
+
+    return size;
+}
+
+size_t Unix_Socket_Transport::read(void* buf, size_t buf_size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> read_lock(read_mutex_);
+    if (!connected_)
+        THROW(fplog::exceptions::Read_Failed);
+
+    steady_clock::time_point timer_start(steady_clock::now());
+    std::vector<pollfd> fds;
+
+retry:
+
+    int wait = time_left(timeout, timer_start);
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (!listening_ && peers_.empty() && !open_connection())
+            THROWM(fplog::exceptions::Read_Failed, "Listener is not running.");
+
+        fds.clear();
+        for (int peer : peers_)
+        {
+            pollfd fd = { peer, POLLIN, 0 };
+            fds.push_back(fd);
+        }
+
+        if (listening_)
+        {
+            pollfd fd = { listen_socket_, POLLIN, 0 };
+            fds.push_back(fd);
+        }
+    }
+
+    int res = poll(&fds[0], static_cast<nfds_t>(fds.size()), wait);
+    if (res == 0)
+        THROW(fplog::exceptions::Timeout);
+
+    if (res < 0)
+    {
+        if (errno == EINTR)
+            goto retry;
+
+        THROW(fplog::exceptions::Read_Failed);
+    }
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (listening_ && (fds.back().revents & POLLIN))
+        {
+            int peer = accept4(listen_socket_, 0, 0, SOCK_CLOEXEC);
+            if (peer >= 0)
+                peers_.push_back(peer);
+        }
+
+        size_t count = fds.size() - (listening_ ? 1 : 0);
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t index = (next_peer_ + i) % count;
+
+            if (!fds[index].revents)
+                continue;
+
+            //connection was replaced by write in the meantime
+            if ((index >= peers_.size()) || (peers_[index] != fds[index].fd))
+                goto retry;
+
+            next_peer_ = index;
+
+            size_t bytes = 0;
+
+            try
+            {
+                bytes = receive(peers_[index], buf, buf_size);
+            }
+            catch (fplog::exceptions::Timeout&)
+            {
+                continue;
+            }
+
+            //zero-size messages are never sent, so this is the other side hanging up
+            if (bytes == 0)
+            {
+                close_peer(index);
+                goto retry;
+            }
+
+            reply_peer_ = peers_[index];
+            next_peer_ = index + 1;
+
+            return bytes;
+        }
+    }
+
+    goto retry;
+}
+
+size_t Unix_Socket_Transport::write(const void* buf, size_t buf_size, size_t timeout)
+{
+    std::lock_guard<std::recursive_mutex> write_lock(write_mutex_);
+    if (!connected_)
+        THROW(fplog::exceptions::Write_Failed);
+
+    if (buf_size == 0)
+        return 0;
+
+    steady_clock::time_point timer_start(steady_clock::now());
+    bool reconnected = false;
+
+retry:
+
+    int wait = time_left(timeout, timer_start);
+    int peer = -1;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (listening_)
+            peer = reply_peer_;
+        else
+        {
+            if (peers_.empty() && !open_connection())
+                THROWM(fplog::exceptions::Write_Failed, "Listener is not running.");
+
+            peer = peers_.front();
+        }
+    }
+
+    if (peer < 0)
+        THROWM(fplog::exceptions::Write_Failed, "No connected peer to reply to.");
+
+    pollfd fd = { peer, POLLOUT, 0 };
+
+    int res = poll(&fd, 1, wait);
+    if (res == 0)
+        THROW(fplog::exceptions::Timeout);
+
+    if (res < 0)
+    {
+        if (errno == EINTR)
+            goto retry;
+
+        THROW(fplog::exceptions::Write_Failed);
+    }
+
+    ssize_t sent = send(peer, buf, buf_size, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent == static_cast<ssize_t>(buf_size))
+        return buf_size;
+
+    int error = errno;
+
+    if ((sent < 0) && ((error == EAGAIN) || (error == EWOULDBLOCK) || (error == EINTR)))
+        goto retry;
+
+    //listener was restarted, connection is stale
+    if (!listening_ && !reconnected && ((error == EPIPE) || (error == ECONNRESET) || (error == ENOTCONN)))
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (!peers_.empty() && (peers_.front() == peer))
+            close_peer(0);
+
+        reconnected = true;
+        goto retry;
+    }
+
+    THROWM(fplog::exceptions::Write_Failed, ("Write failed, socket error = " + std::to_string(error)).c_str());
+}
+
+#else
+
+void Unix_Socket_Transport::connect(const Params& params)
+{
+    THROWM(fplog::exceptions::Connect_Failed, "Unix domain socket transport is supported only on Linux.");
+}
+
+void Unix_Socket_Transport::disconnect()
+{
+}
+
+size_t Unix_Socket_Transport::read(void* buf, size_t buf_size, size_t timeout)
+{
+    THROW(fplog::exceptions::Read_Failed);
+}
+
+size_t Unix_Socket_Transport::write(const void* buf, size_t buf_size, size_t timeout)
+{
+    THROW(fplog::exceptions::Write_Failed);
+}
+
+bool Unix_Socket_Transport::open_connection()
+{
+    return false;
+}
+
+void Unix_Socket_Transport::close_peer(size_t index)
+{
+}
+
+size_t Unix_Socket_Transport::receive(int peer, void* buf, size_t buf_size)
+{
+    return 0;
+}
+
+#endif
+
+};
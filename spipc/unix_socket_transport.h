@@ -0,0 +1,65 @@
+#pragma once
+
+#include <fplog_exceptions.h>
+#include <fplog_transport.h>
+
+#include <vector>
+#include <mutex>
+
+#ifdef SPIPC_EXPORT
+#define SPIPC_API __declspec(dllexport)
+#else
+#define SPIPC_API __declspec(dllimport)
+#endif
+
+#ifdef _LINUX
+#define SPIPC_API
+#endif
+
+namespace spipc {
+
+//Local-only transport over SOCK_SEQPACKET unix domain socket in the abstract namespace (Linux only).
+//Socket is reliable, ordered and keeps message boundaries, so unlike Socket_Transport it does not need sprot on top.
+//Connection params:
+//uid = port pair of the channel, used only to derive the socket name, e.g. 18749_18750 -> @fplog_18749_18750;
+//listen = true for the receiving side (fplogd), it accepts any number of connecting apps and reads from all of them,
+//connecting side (app) reconnects by itself on the next write if the listener was restarted.
+class SPIPC_API Unix_Socket_Transport: public fplog::Transport_Interface
+{
+    public:
+
+        virtual void connect(const Params& params);
+        virtual void disconnect();
+
+        virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait);
+        virtual size_t write(const void* buf, size_t buf_size, size_t timeout = infinite_wait);
+
+        Unix_Socket_Transport();
+        ~Unix_Socket_Transport();
+
+        static std::string socket_name(const fplog::UID& uid);
+
+
+    private:
+
+        bool connected_;
+        bool listening_;
+        std::string name_;
+
+        int listen_socket_;
+        std::vector<int> peers_; //accepted connections when listening, single connection otherwise
+        size_t next_peer_; //peer to check first, so that a busy app does not starve the rest
+        int reply_peer_; //listening side answers the app it has read from last
+
+        std::recursive_mutex mutex_;
+        std::recursive_mutex read_mutex_;
+        std::recursive_mutex write_mutex_;
+
+        bool open_connection();
+        void close_peer(size_t index);
+        size_t receive(int peer, void* buf, size_t buf_size);
+
+        Unix_Socket_Transport(const Unix_Socket_Transport&);
+};
+
+};
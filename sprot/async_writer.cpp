@@ -0,0 +1,182 @@
+#include "async_writer.h"
+
+using namespace std::chrono;
+
+namespace sprot
+{
+    Async_Writer::Async_Writer(fplog::Transport_Interface* protocol, size_t max_in_flight, int retries):
+    protocol_(protocol),
+    max_in_flight_(max_in_flight),
+    retries_(retries),
+    sending_(false),
+    stopping_(false),
+    sender_(0)
+    {
+        if (!protocol_ || (max_in_flight_ == 0) || (retries_ < 0))
+            THROW(fplog::exceptions::Incorrect_Parameter);
+
+        sender_ = new std::thread(&Async_Writer::send_loop, this);
+    }
+
+    Async_Writer::~Async_Writer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+
+            queued_.notify_all();
+            space_.notify_all();
+        }
+
+        sender_->join();
+        delete sender_;
+
+        std::deque<Pending> leftovers;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            leftovers.swap(queue_);
+        }
+
+        fplog::exceptions::Transport_Missing error(__FUNCTION__, __SHORT_FORM_OF_FILE__, __LINE__, "Writer is destroyed before message was sent.");
+        for (auto& pending : leftovers)
+            complete(pending, 0, &error, std::make_exception_ptr(error));
+    }
+
+    std::future<size_t> Async_Writer::write(const void* buf, size_t buf_size, size_t timeout)
+    {
+        Pending pending;
+
+        pending.data.assign((const char*)buf, (const char*)buf + buf_size);
+        pending.timeout = timeout;
+        pending.has_promise = true;
+
+        std::future<size_t> res(pending.promise.get_future());
+        enqueue(pending);
+
+        return res;
+    }
+
+    void Async_Writer::write(const void* buf, size_t buf_size, Completion on_complete, size_t timeout)
+    {
+        Pending pending;
+
+        pending.data.assign((const char*)buf, (const char*)buf + buf_size);
+        pending.timeout = timeout;
+        pending.on_complete = on_complete;
+
+        enqueue(pending);
+    }
+
+    bool Async_Writer::flush(size_t timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto drained = [this]() { return (queue_.empty() && !sending_) || stopping_; };
+
+        if (timeout == fplog::Transport_Interface::infinite_wait)
+        {
+            idle_.wait(lock, drained);
+            return queue_.empty() && !sending_;
+        }
+
+        return idle_.wait_for(lock, milliseconds(timeout), drained) && queue_.empty() && !sending_;
+    }
+
+    size_t Async_Writer::in_flight()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size() + (sending_ ? 1 : 0);
+    }
+
+    void Async_Writer::enqueue(Pending& pending)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        space_.wait(lock, [this]() { return (queue_.size() + (sending_ ? 1 : 0) < max_in_flight_) || stopping_; });
+
+        if (stopping_)
+            THROWM(fplog::exceptions::Write_Failed, "Writer is being destroyed.");
+
+        queue_.push_back(std::move(pending));
+        queued_.notify_one();
+    }
+
+    void Async_Writer::complete(Pending& pending, size_t bytes_written, fplog::exceptions::Generic_Exception* error, std::exception_ptr error_ptr)
+    {
+        if (pending.has_promise)
+        {
+            if (error)
+                pending.promise.set_exception(error_ptr);
+            else
+                pending.promise.set_value(bytes_written);
+        }
+
+        if (pending.on_complete)
+        {
+            try
+            {
+                pending.on_complete(bytes_written, error);
+            }
+            catch (...)
+            {
+                //exceptions from user callback must not kill the sender thread
+            }
+        }
+    }
+
+    void Async_Writer::send_loop()
+    {
+        while (true)
+        {
+            Pending pending;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                queued_.wait(lock, [this]() { return !queue_.empty() || stopping_; });
+
+                if (stopping_)
+                {
+                    idle_.notify_all();
+                    return;
+                }
+
+                pending = std::move(queue_.front());
+                queue_.pop_front();
+                sending_ = true;
+            }
+
+            size_t written = 0;
+            bool done = false;
+
+            for (int attempt = 1; !done; ++attempt)
+            {
+                try
+                {
+                    size_t timeout = pending.timeout;
+                    if (timeout != fplog::Transport_Interface::infinite_wait)
+                        timeout *= attempt;
+
+                    written = protocol_->write(pending.data.empty() ? 0 : &pending.data[0], pending.data.size(), timeout);
+                    complete(pending, written, 0, std::exception_ptr());
+                    done = true;
+                }
+                catch (fplog::exceptions::Generic_Exception& e)
+                {
+                    if ((attempt > retries_) || stopping_)
+                    {
+                        complete(pending, 0, &e, std::current_exception());
+                        done = true;
+                    }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            sending_ = false;
+
+            space_.notify_one();
+            if (queue_.empty())
+                idle_.notify_all();
+        }
+    }
+};
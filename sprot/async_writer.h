@@ -0,0 +1,80 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+#include "sprot.h"
+
+namespace sprot
+{
+    //Moves blocking protocol writes to a dedicated sender thread.
+    //Caller gets control back as soon as the message is queued and learns about the outcome from a future
+    //or a completion callback, so the next message can be prepared while the previous one waits for ACKs.
+    //At most max_in_flight messages are queued, write blocks the caller when the queue is full.
+    //Messages are sent strictly in order, failed write is retried up to the given number of times with
+    //timeout growing linearly with every attempt. There is one sender per writer and sprot does not pipeline
+    //messages, so a message being retried holds up everything queued behind it.
+    class SPROT_API Async_Writer
+    {
+        public:
+
+            //Called on the sender thread, error is 0 on success.
+            typedef std::function<void(size_t bytes_written, fplog::exceptions::Generic_Exception* error)> Completion;
+
+            //Does not take ownership of the protocol.
+            Async_Writer(fplog::Transport_Interface* protocol, size_t max_in_flight = 8, int retries = 5);
+
+            //Messages still in the queue are completed with Transport_Missing error.
+            ~Async_Writer();
+
+            std::future<size_t> write(const void* buf, size_t buf_size, size_t timeout = fplog::Transport_Interface::infinite_wait);
+            void write(const void* buf, size_t buf_size, Completion on_complete, size_t timeout = fplog::Transport_Interface::infinite_wait);
+
+            //Waits until every queued message is either acknowledged or failed, returns false on timeout.
+            bool flush(size_t timeout = fplog::Transport_Interface::infinite_wait);
+
+            size_t in_flight();
+
+
+        private:
+
+            struct Pending
+            {
+                Pending(): timeout(0), has_promise(false) {}
+
+                std::vector<char> data;
+                size_t timeout;
+
+                Completion on_complete;
+                std::promise<size_t> promise;
+                bool has_promise;
+            };
+
+            fplog::Transport_Interface* protocol_;
+            size_t max_in_flight_;
+            int retries_;
+
+            std::mutex mutex_;
+            std::condition_variable queued_;
+            std::condition_variable space_;
+            std::condition_variable idle_;
+
+            std::deque<Pending> queue_;
+            bool sending_;
+
+            volatile bool stopping_;
+            std::thread* sender_;
+
+            void enqueue(Pending& pending);
+            void send_loop();
+            void complete(Pending& pending, size_t bytes_written, fplog::exceptions::Generic_Exception* error, std::exception_ptr error_ptr);
+
+            Async_Writer();
+            Async_Writer(const Async_Writer&);
+    };
+};
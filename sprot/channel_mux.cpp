@@ -0,0 +1,235 @@
+#include "channel_mux.h"
+
+using namespace std::chrono;
+
+namespace sprot
+{
+    class Channel_Mux::Channel: public fplog::Transport_Interface
+    {
+        friend class Channel_Mux;
+
+        public:
+
+            Channel(Channel_Mux& mux, Channel_Id id): mux_(mux), id_(id) {}
+
+            virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait)
+            {
+                std::unique_lock<std::mutex> lock(mux_.mutex_);
+
+                if (!readable_.wait_for(lock, milliseconds(timeout), [this]() { return (!queue_.empty() || mux_.stopping_); }))
+                    THROW(fplog::exceptions::Timeout);
+
+                if (queue_.empty())
+                    THROW(fplog::exceptions::Read_Failed);
+
+                std::vector<unsigned char> datagram;
+                datagram.swap(queue_.front());
+                queue_.pop_front();
+
+                if (datagram.size() > buf_size)
+                    THROW(fplog::exceptions::Buffer_Overflow);
+
+                if (!datagram.empty())
+                    memcpy(buf, &datagram[0], datagram.size());
+
+                return datagram.size();
+            }
+
+            virtual size_t write(const void* buf, size_t buf_size, size_t timeout = infinite_wait)
+            {
+                return mux_.write_datagram(id_, buf, buf_size, timeout);
+            }
+
+
+        private:
+
+            Channel_Mux& mux_;
+            Channel_Id id_;
+
+            //guarded by mux_.mutex_
+            std::deque<std::vector<unsigned char>> queue_;
+            std::condition_variable readable_;
+    };
+
+    Channel_Mux::Channel_Mux(fplog::Transport_Interface* transport, size_t MTU, int frames_before_ack):
+    transport_(transport),
+    MTU_(MTU),
+    frames_before_ack_(frames_before_ack),
+    last_served_(0),
+    stopping_(false),
+    receiver_(0)
+    {
+        if (!transport_)
+            THROW(fplog::exceptions::Incorrect_Parameter);
+
+        receiver_ = new std::thread(&Channel_Mux::receive_loop, this);
+    }
+
+    Channel_Mux::~Channel_Mux()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+
+            for (auto& entry : channels_)
+                entry.second.raw->readable_.notify_all();
+
+            data_ready_.notify_all();
+        }
+
+        receiver_->join();
+        delete receiver_;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto& entry : channels_)
+        {
+            delete entry.second.protocol;
+            delete entry.second.raw;
+        }
+
+        channels_.clear();
+    }
+
+    Channel_Mux::Channel_Entry& Channel_Mux::get_entry(Channel_Id id)
+    {
+        Channel_Entry& entry = channels_[id];
+
+        if (!entry.raw)
+        {
+            entry.raw = new Channel(*this, id);
+            entry.protocol = new sprot::Protocol(entry.raw, MTU_, frames_before_ack_);
+        }
+
+        return entry;
+    }
+
+    fplog::Transport_Interface* Channel_Mux::channel(Channel_Id id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return get_entry(id).protocol;
+    }
+
+    void Channel_Mux::close_channel(Channel_Id id)
+    {
+        Channel_Entry entry;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto it = channels_.find(id);
+            if (it == channels_.end())
+                return;
+
+            entry = it->second;
+            channels_.erase(it);
+        }
+
+        //protocol destructor takes protocol lock, that one is held by readers while they wait for mux lock
+        delete entry.protocol;
+        delete entry.raw;
+    }
+
+    bool Channel_Mux::wait_readable(Channel_Id& id, size_t timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto find_ready = [this, &id]()
+        {
+            if (stopping_ || channels_.empty())
+                return stopping_;
+
+            auto it = channels_.upper_bound(last_served_);
+            for (size_t i = 0; i < channels_.size(); ++i, ++it)
+            {
+                if (it == channels_.end())
+                    it = channels_.begin();
+
+                if (!it->second.raw->queue_.empty())
+                {
+                    id = it->first;
+                    last_served_ = id;
+                    return true;
+                }
+            }
+
+            return false;
+        };
+
+        if (!data_ready_.wait_for(lock, milliseconds(timeout), find_ready))
+            return false;
+
+        return !stopping_;
+    }
+
+    std::vector<Channel_Mux::Channel_Id> Channel_Mux::get_channels()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Channel_Id> res;
+
+        for (auto& entry : channels_)
+            res.push_back(entry.first);
+
+        return res;
+    }
+
+    size_t Channel_Mux::write_datagram(Channel_Id id, const void* buf, size_t buf_size, size_t timeout)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+
+        write_buffer_.resize(header_size + buf_size);
+        memcpy(&write_buffer_[0], &id, header_size);
+        if (buf_size > 0)
+            memcpy(&write_buffer_[header_size], buf, buf_size);
+
+        size_t written = transport_->write(&write_buffer_[0], write_buffer_.size(), timeout);
+        if (written != write_buffer_.size())
+            THROW(fplog::exceptions::Write_Failed);
+
+        return buf_size;
+    }
+
+    void Channel_Mux::receive_loop()
+    {
+        std::vector<unsigned char> buf(header_size + MTU_ + Protocol::Frame::overhead);
+
+        while (!stopping_)
+        {
+            size_t sz = 0;
+
+            try
+            {
+                sz = transport_->read(&buf[0], buf.size(), receive_poll_timeout);
+            }
+            catch (fplog::exceptions::Timeout&)
+            {
+                continue;
+            }
+            catch (fplog::exceptions::Generic_Exception&)
+            {
+                std::this_thread::sleep_for(milliseconds(10));
+                continue;
+            }
+
+            if ((sz <= header_size) || (sz > buf.size()))
+                continue;
+
+            Channel_Id id = 0;
+            memcpy(&id, &buf[0], header_size);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_)
+                return;
+
+            Channel* channel = get_entry(id).raw;
+
+            if (channel->queue_.size() >= max_queued_datagrams)
+                channel->queue_.pop_front();
+
+            channel->queue_.push_back(std::vector<unsigned char>(buf.begin() + header_size, buf.begin() + sz));
+
+            channel->readable_.notify_all();
+            data_ready_.notify_all();
+        }
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "sprot.h"
+
+namespace sprot
+{
+    //Carries any number of logical channels over one datagram transport.
+    //Every datagram is prefixed with a 2-byte channel id, a single receive loop demultiplexes
+    //incoming datagrams into per-channel queues and every channel is served by its own
+    //sprot::Protocol instance, so sequence numbers and ACKs are tracked independently per channel.
+    class SPROT_API Channel_Mux
+    {
+        public:
+
+            typedef unsigned short Channel_Id;
+            static const size_t header_size = sizeof(Channel_Id);
+
+            //Datagrams queued for a channel that nobody reads are dropped after this limit,
+            //sprot on the sending side will retransmit them.
+            static const size_t max_queued_datagrams = 256;
+
+            Channel_Mux(fplog::Transport_Interface* transport, size_t MTU = 1024, int frames_before_ack = 4);
+            ~Channel_Mux();
+
+            //Returns sprot protocol instance bound to the given channel, the channel is created if needed.
+            //Returned object is owned by the mux and stays valid until close_channel() or mux destruction.
+            fplog::Transport_Interface* channel(Channel_Id id);
+            void close_channel(Channel_Id id);
+
+            //Waits until any of the channels has pending data, channels are served round-robin.
+            //Channels are created on the fly for every new id seen on the wire.
+            //Returns false on timeout.
+            bool wait_readable(Channel_Id& id, size_t timeout = fplog::Transport_Interface::infinite_wait);
+
+            std::vector<Channel_Id> get_channels();
+
+
+        private:
+
+            class Channel;
+
+            struct Channel_Entry
+            {
+                Channel_Entry(): raw(0), protocol(0) {}
+
+                Channel* raw;
+                sprot::Protocol* protocol;
+            };
+
+            fplog::Transport_Interface* transport_;
+            size_t MTU_;
+            int frames_before_ack_;
+
+            static const size_t receive_poll_timeout = 100; //ms
+
+            std::mutex mutex_;
+            std::condition_variable data_ready_;
+
+            std::mutex write_mutex_;
+            std::vector<unsigned char> write_buffer_;
+
+            std::map<Channel_Id, Channel_Entry> channels_;
+            Channel_Id last_served_;
+
+            volatile bool stopping_;
+            std::thread* receiver_;
+
+            Channel_Entry& get_entry(Channel_Id id);
+            void receive_loop();
+            size_t write_datagram(Channel_Id id, const void* buf, size_t buf_size, size_t timeout);
+
+            Channel_Mux();
+            Channel_Mux(const Channel_Mux&);
+    };
+};
@@ -0,0 +1,337 @@
+#include "compression.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace sprot
+{
+    static inline unsigned int read32(const unsigned char* ptr)
+    {
+        unsigned int val;
+        memcpy(&val, ptr, sizeof(val));
+        return val;
+    }
+
+    static inline void write_length(std::vector<unsigned char>& dst, size_t len)
+    {
+        while (len >= 255)
+        {
+            dst.push_back(255);
+            len -= 255;
+        }
+
+        dst.push_back(static_cast<unsigned char>(len));
+    }
+
+    static inline bool read_length(const unsigned char*& ip, const unsigned char* iend, size_t& len)
+    {
+        unsigned char byte = 255;
+
+        while (byte == 255)
+        {
+            if (ip >= iend)
+                return false;
+
+            byte = *ip++;
+            len += byte;
+        }
+
+        return true;
+    }
+
+    const std::string& Lz_Codec::default_dictionary()
+    {
+        //Most frequent fragments go last so that they are closest to the data being compressed.
+        static const std::string dictionary(
+            "{\"component\":\"\",\"options\":\"\",\"encrypted\":false,\"file\":\"\",\"blob\":\"\",\"warning\":\"\","
+            "\"inserted_json\":{},\"class\":\"\",\"method\":\"\",\"module\":\".cpp\",\"line\":"
+            "\"priority\":\"emergency\",\"priority\":\"alert\",\"priority\":\"notice\",\"priority\":\"critical\","
+            "\"facility\":\"security\",\"facility\":\"system\",\"facility\":\"fplog\",\"batch\":["
+            "\"priority\":\"error\",\"priority\":\"warning\",\"priority\":\"info\",\"priority\":\"debug\","
+            "\"timestamp\":\"2017-01-01T00:00:00.000+00:00\",\"facility\":\"user\",\"text\":\"\",\"sequence\":"
+            ",\"appname\":\"\",\"hostname\":\"\"},{\"priority\":\"");
+
+        return dictionary;
+    }
+
+    std::string Lz_Codec::load_dictionary(const std::string& path)
+    {
+        if (path.empty())
+            return default_dictionary();
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+            THROWM(fplog::exceptions::Incorrect_Parameter, ("Cannot open compression dictionary " + path).c_str());
+
+        std::stringstream content;
+        content << file.rdbuf();
+
+        std::string dictionary(content.str());
+
+        //only the last 64K of the dictionary is reachable by the codec
+        if (dictionary.size() > max_offset)
+            dictionary.erase(0, dictionary.size() - max_offset);
+
+        return dictionary;
+    }
+
+    Lz_Codec::Lz_Codec(const std::string& dictionary):
+    dictionary_(dictionary),
+    dictionary_id_(2166136261u)
+    {
+        for (size_t i = 0; i < dictionary_.size(); ++i)
+        {
+            dictionary_id_ ^= static_cast<unsigned char>(dictionary_[i]);
+            dictionary_id_ *= 16777619u;
+        }
+
+        hash_table_.resize(static_cast<size_t>(1) << hash_log);
+    }
+
+    bool Lz_Codec::compress(const void* src, size_t src_size, std::vector<unsigned char>& dst)
+    {
+        dst.clear();
+
+        if (!src || (src_size == 0))
+            return false;
+
+        const size_t dict_size = dictionary_.size();
+
+        window_.resize(dict_size + src_size);
+        if (dict_size > 0)
+            memcpy(&window_[0], dictionary_.c_str(), dict_size);
+        memcpy(&window_[dict_size], src, src_size);
+
+        const unsigned char* base = &window_[0];
+        const size_t end = window_.size();
+
+        auto hash = [](unsigned int val) -> size_t
+        {
+            return static_cast<size_t>((val * 2654435761u) >> (32 - hash_log));
+        };
+
+        std::fill(hash_table_.begin(), hash_table_.end(), -1);
+
+        for (size_t pos = 0; pos + min_match <= dict_size; ++pos)
+            hash_table_[hash(read32(base + pos))] = static_cast<int>(pos);
+
+        dst.reserve(src_size);
+
+        size_t anchor = dict_size;
+        size_t ip = dict_size;
+
+        auto emit = [&dst, base](size_t lit_start, size_t lit_len, size_t offset, size_t match_len)
+        {
+            size_t match_code = match_len ? match_len - min_match : 0;
+            unsigned char token = static_cast<unsigned char>(((lit_len < 15 ? lit_len : 15) << 4) | (match_code < 15 ? match_code : 15));
+
+            dst.push_back(token);
+
+            if (lit_len >= 15)
+                write_length(dst, lit_len - 15);
+
+            dst.insert(dst.end(), base + lit_start, base + lit_start + lit_len);
+
+            if (!match_len)
+                return;
+
+            dst.push_back(static_cast<unsigned char>(offset & 0xff));
+            dst.push_back(static_cast<unsigned char>((offset >> 8) & 0xff));
+
+            if (match_code >= 15)
+                write_length(dst, match_code - 15);
+        };
+
+        if (src_size > last_literals + min_match)
+        {
+            const size_t match_limit = end - last_literals;
+
+            while (ip < match_limit)
+            {
+                unsigned int seq = read32(base + ip);
+                size_t h = hash(seq);
+                int ref = hash_table_[h];
+                hash_table_[h] = static_cast<int>(ip);
+
+                if ((ref < 0) || (ip - ref > max_offset) || (read32(base + ref) != seq))
+                {
+                    ip++;
+                    continue;
+                }
+
+                size_t len = min_match;
+                while ((ip + len < match_limit) && (base[ref + len] == base[ip + len]))
+                    len++;
+
+                emit(anchor, ip - anchor, ip - ref, len);
+
+                ip += len;
+                anchor = ip;
+
+                //keeps the table fresh for repeated fragments that immediately follow the match
+                if (ip < match_limit)
+                    hash_table_[hash(read32(base + ip - 2))] = static_cast<int>(ip - 2);
+
+                if (dst.size() >= src_size)
+                    return false;
+            }
+        }
+
+        emit(anchor, end - anchor, 0, 0);
+        return (dst.size() < src_size);
+    }
+
+    void Lz_Codec::decompress(const void* src, size_t src_size, std::vector<unsigned char>& dst, size_t original_size)
+    {
+        const size_t dict_size = dictionary_.size();
+        const size_t out_limit = dict_size + original_size;
+
+        window_.resize(out_limit);
+        if (dict_size > 0)
+            memcpy(&window_[0], dictionary_.c_str(), dict_size);
+
+        unsigned char* out = window_.empty() ? 0 : &window_[0];
+        size_t op = dict_size;
+
+        const unsigned char* ip = (const unsigned char*)src;
+        const unsigned char* iend = ip + src_size;
+
+        while (ip < iend)
+        {
+            unsigned char token = *ip++;
+
+            size_t lit_len = token >> 4;
+            if ((lit_len == 15) && !read_length(ip, iend, lit_len))
+                THROWM(fplog::exceptions::Incorrect_Parameter, "Malformed compressed data.");
+
+            if ((static_cast<size_t>(iend - ip) < lit_len) || (op + lit_len > out_limit))
+                THROWM(fplog::exceptions::Incorrect_Parameter, "Malformed compressed data.");
+
+            if (lit_len > 0)
+                memcpy(out + op, ip, lit_len);
+
+            op += lit_len;
+            ip += lit_len;
+
+            //last sequence has no match part
+            if (ip == iend)
+                break;
+
+            if (iend - ip < 2)
+                THROWM(fplog::exceptions::Incorrect_Parameter, "Malformed compressed data.");
+
+            size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+
+            size_t match_len = token & 0x0f;
+            if ((match_len == 15) && !read_length(ip, iend, match_len))
+                THROWM(fplog::exceptions::Incorrect_Parameter, "Malformed compressed data.");
+            match_len += min_match;
+
+            if ((offset == 0) || (offset > op) || (op + match_len > out_limit))
+                THROWM(fplog::exceptions::Incorrect_Parameter, "Malformed compressed data.");
+
+            const unsigned char* from = out + op - offset;
+
+            //overlapping match repeats the bytes it has just produced, so it is copied byte by byte
+            if (offset >= match_len)
+                memcpy(out + op, from, match_len);
+            else
+                for (size_t i = 0; i < match_len; ++i)
+                    out[op + i] = from[i];
+
+            op += match_len;
+        }
+
+        if (op != out_limit)
+            THROWM(fplog::exceptions::Incorrect_Parameter, "Malformed compressed data.");
+
+        dst.assign(window_.begin() + dict_size, window_.end());
+    }
+
+    const unsigned char Compressing_Protocol::magic[4] = { 0x00, 'F', 'L', 'Z' };
+
+    Compressing_Protocol::Compressing_Protocol(fplog::Transport_Interface* protocol, bool compress_writes, const std::string& dictionary):
+    protocol_(protocol),
+    compress_writes_(compress_writes),
+    codec_(dictionary)
+    {
+        if (!protocol_)
+            THROW(fplog::exceptions::Incorrect_Parameter);
+    }
+
+    Compressing_Protocol::~Compressing_Protocol()
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        delete protocol_;
+    }
+
+    size_t Compressing_Protocol::read(void* buf, size_t buf_size, size_t timeout)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (!pending_.empty())
+        {
+            if (pending_.size() > buf_size)
+                throw fplog::exceptions::Buffer_Overflow(__FUNCTION__, __SHORT_FORM_OF_FILE__, __LINE__, "Buffer too small.", pending_.size());
+
+            size_t sz = pending_.size();
+            memcpy(buf, &pending_[0], sz);
+            pending_.clear();
+
+            return sz;
+        }
+
+        size_t bytes = protocol_->read(buf, buf_size, timeout);
+
+        if ((bytes < header_size) || (memcmp(buf, magic, sizeof(magic)) != 0))
+            return bytes;
+
+        unsigned int dictionary_id = 0, original_size = 0;
+        memcpy(&dictionary_id, (unsigned char*)buf + 4, 4);
+        memcpy(&original_size, (unsigned char*)buf + 8, 4);
+
+        if (dictionary_id != codec_.dictionary_id())
+            THROWM(fplog::exceptions::Read_Failed, "Compressed message uses unknown dictionary.");
+
+        if (original_size > max_original_size)
+            THROWM(fplog::exceptions::Read_Failed, "Compressed message is too large.");
+
+        scratch_.assign((unsigned char*)buf + header_size, (unsigned char*)buf + bytes);
+        codec_.decompress(scratch_.empty() ? 0 : &scratch_[0], scratch_.size(), out_, original_size);
+
+        if (out_.size() > buf_size)
+        {
+            pending_.swap(out_);
+            throw fplog::exceptions::Buffer_Overflow(__FUNCTION__, __SHORT_FORM_OF_FILE__, __LINE__, "Buffer too small.", pending_.size());
+        }
+
+        if (!out_.empty())
+            memcpy(buf, &out_[0], out_.size());
+
+        return out_.size();
+    }
+
+    size_t Compressing_Protocol::write(const void* buf, size_t buf_size, size_t timeout)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (!compress_writes_ || (buf_size < min_compress_size) || (buf_size > max_original_size) || !codec_.compress(buf, buf_size, scratch_))
+            return protocol_->write(buf, buf_size, timeout);
+
+        unsigned int dictionary_id = codec_.dictionary_id();
+        unsigned int original_size = static_cast<unsigned int>(buf_size);
+
+        out_.resize(header_size + scratch_.size());
+        memcpy(&out_[0], magic, sizeof(magic));
+        memcpy(&out_[4], &dictionary_id, 4);
+        memcpy(&out_[8], &original_size, 4);
+        memcpy(&out_[header_size], &scratch_[0], scratch_.size());
+
+        size_t written = protocol_->write(&out_[0], out_.size(), timeout);
+        if (written != out_.size())
+            THROW(fplog::exceptions::Write_Failed);
+
+        return buf_size;
+    }
+};
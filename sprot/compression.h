@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include "sprot.h"
+
+namespace sprot
+{
+    //Byte-oriented LZ77 block codec in the spirit of LZ4: no entropy stage, 64K window, 4 byte minimal match.
+    //Matches may reach back into a preset dictionary known to both ends of the link, that is what makes
+    //short JSON batches compress well - field names and usual values are "seen" before the first byte.
+    class SPROT_API Lz_Codec
+    {
+        public:
+
+            Lz_Codec(const std::string& dictionary = default_dictionary());
+
+            //Built-in dictionary made of fplog field names, priorities and facilities.
+            static const std::string& default_dictionary();
+
+            //Reads custom dictionary from file, for example a recorded fplogd batch.
+            //Returns default dictionary if path is empty.
+            static std::string load_dictionary(const std::string& path);
+
+            //FNV-1a hash of the dictionary, lets the receiver detect dictionary mismatch.
+            unsigned int dictionary_id() const { return dictionary_id_; }
+
+            //Returns false if compressed form is not smaller than the source, dst content is undefined then.
+            bool compress(const void* src, size_t src_size, std::vector<unsigned char>& dst);
+
+            //Throws fplog::exceptions::Incorrect_Parameter if input is malformed.
+            void decompress(const void* src, size_t src_size, std::vector<unsigned char>& dst, size_t original_size);
+
+
+        private:
+
+            static const int hash_log = 14;
+            static const size_t max_offset = 65535;
+            static const size_t min_match = 4;
+            static const size_t last_literals = 5;
+
+            std::string dictionary_;
+            unsigned int dictionary_id_;
+
+            std::vector<int> hash_table_;
+            std::vector<unsigned char> window_;
+    };
+
+    //Compresses outgoing messages before handing them to the wrapped protocol and transparently
+    //decompresses incoming ones, uncompressed messages from peers that do not compress are passed as is.
+    //Compressed message layout: 4 byte magic, 4 byte dictionary id, 4 byte original size, codec output.
+    //Since fplog messages are JSON the leading zero byte of the magic never clashes with plain payload.
+    class SPROT_API Compressing_Protocol: public fplog::Transport_Interface
+    {
+        public:
+
+            static const unsigned char magic[4];
+            static const size_t header_size = 12;
+
+            //Messages shorter than this are sent uncompressed, gain is too small.
+            static const size_t min_compress_size = 64;
+
+            //Messages longer than this are sent uncompressed and compressed ones claiming more are rejected,
+            //so a corrupt header cannot make the receiver allocate gigabytes. Far above batch_bytes limit of fplogd.
+            static const size_t max_original_size = 16 * 1024 * 1024;
+
+            //Takes ownership of the wrapped protocol.
+            Compressing_Protocol(fplog::Transport_Interface* protocol, bool compress_writes = true, const std::string& dictionary = Lz_Codec::default_dictionary());
+            virtual ~Compressing_Protocol();
+
+            virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait);
+            virtual size_t write(const void* buf, size_t buf_size, size_t timeout = infinite_wait);
+
+
+        private:
+
+            fplog::Transport_Interface* protocol_;
+            bool compress_writes_;
+
+            std::recursive_mutex mutex_;
+            Lz_Codec codec_;
+
+            std::vector<unsigned char> scratch_;
+            std::vector<unsigned char> out_;
+
+            //decompressed message that did not fit into the caller buffer, returned by the next read
+            std::vector<unsigned char> pending_;
+
+            Compressing_Protocol();
+    };
+};
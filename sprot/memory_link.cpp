@@ -0,0 +1,182 @@
+#include "memory_link.h"
+
+using namespace std::chrono;
+
+namespace sprot
+{
+    class Memory_Link::End: public fplog::Transport_Interface
+    {
+        public:
+
+            End(Memory_Link& link, int side): link_(link), side_(side) {}
+
+            virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait)
+            {
+                return link_.read(side_, buf, buf_size, timeout);
+            }
+
+            //link never blocks a writer, full queue drops the datagram as a real network would
+            virtual size_t write(const void* buf, size_t buf_size, size_t = infinite_wait)
+            {
+                return link_.write(side_, buf, buf_size);
+            }
+
+
+        private:
+
+            Memory_Link& link_;
+            int side_;
+    };
+
+    Memory_Link::Memory_Link(const Impairments& impairments):
+    impairments_(impairments),
+    rng_(impairments.seed)
+    {
+        ends_[0] = new End(*this, 0);
+        ends_[1] = new End(*this, 1);
+    }
+
+    Memory_Link::~Memory_Link()
+    {
+        delete ends_[0];
+        delete ends_[1];
+    }
+
+    fplog::Transport_Interface* Memory_Link::end(int side)
+    {
+        if ((side != 0) && (side != 1))
+            THROW(fplog::exceptions::Incorrect_Parameter);
+
+        return ends_[side];
+    }
+
+    void Memory_Link::set_impairments(const Impairments& impairments)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        impairments_ = impairments;
+        rng_.seed(impairments.seed);
+    }
+
+    Memory_Link::Stats Memory_Link::get_stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    bool Memory_Link::chance(double probability)
+    {
+        if (probability <= 0)
+            return false;
+
+        return (std::uniform_real_distribution<double>(0, 1)(rng_) < probability);
+    }
+
+    size_t Memory_Link::write(int side, const void* buf, size_t buf_size)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        stats_.sent++;
+
+        if (chance(impairments_.loss))
+        {
+            stats_.lost++;
+            return buf_size;
+        }
+
+        int copies = 1;
+        if (chance(impairments_.duplicate))
+        {
+            stats_.duplicated++;
+            copies = 2;
+        }
+
+        Queue& queue = queue_[1 - side];
+        steady_clock::time_point now(steady_clock::now());
+
+        for (int i = 0; i < copies; ++i)
+        {
+            if (queue.size() >= impairments_.queue_limit)
+            {
+                stats_.overflowed++;
+                break;
+            }
+
+            std::vector<char> datagram((const char*)buf, (const char*)buf + buf_size);
+
+            if (!datagram.empty() && chance(impairments_.corrupt))
+            {
+                stats_.corrupted++;
+
+                size_t bit = std::uniform_int_distribution<size_t>(0, datagram.size() * 8 - 1)(rng_);
+                datagram[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+            }
+
+            size_t delay = impairments_.latency;
+            if (impairments_.jitter > 0)
+                delay += std::uniform_int_distribution<size_t>(0, impairments_.jitter)(rng_);
+
+            steady_clock::time_point delivery(now + microseconds(delay));
+
+            if (chance(impairments_.reorder))
+            {
+                stats_.reordered++;
+                delivery += microseconds(impairments_.latency + impairments_.jitter + 1000);
+            }
+            else
+            {
+                //jitter alone does not reorder, datagram never overtakes the previous one
+                //(multimap keeps insertion order for equal keys)
+                if (delivery < last_delivery_[1 - side])
+                    delivery = last_delivery_[1 - side];
+
+                last_delivery_[1 - side] = delivery;
+            }
+
+            queue.insert(std::make_pair(delivery, datagram));
+        }
+
+        readable_[1 - side].notify_all();
+        return buf_size;
+    }
+
+    size_t Memory_Link::read(int side, void* buf, size_t buf_size, size_t timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        Queue& queue = queue_[side];
+        steady_clock::time_point deadline(steady_clock::now() + milliseconds(timeout));
+
+        while (true)
+        {
+            steady_clock::time_point now(steady_clock::now());
+
+            if (!queue.empty() && (queue.begin()->first <= now))
+                break;
+
+            if (now >= deadline)
+                THROW(fplog::exceptions::Timeout);
+
+            steady_clock::time_point wake_up(deadline);
+            if (!queue.empty() && (queue.begin()->first < wake_up))
+                wake_up = queue.begin()->first;
+
+            readable_[side].wait_until(lock, wake_up);
+        }
+
+        std::vector<char> datagram;
+        datagram.swap(queue.begin()->second);
+        queue.erase(queue.begin());
+
+        //like a datagram socket, too long datagram is lost for the reader
+        if (datagram.size() > buf_size)
+            THROW(fplog::exceptions::Buffer_Overflow);
+
+        stats_.delivered++;
+
+        if (!datagram.empty())
+            memcpy(buf, &datagram[0], datagram.size());
+
+        return datagram.size();
+    }
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <random>
+#include <condition_variable>
+#include "sprot.h"
+
+namespace sprot
+{
+    //In-process datagram link between two transport ends with configurable impairments,
+    //whatever is written to one end is read from the other one.
+    //Lets protocols be tested and benchmarked reproducibly without network: with the same seed
+    //and the same sequence of writes exactly the same datagrams are lost, duplicated or corrupted.
+    class SPROT_API Memory_Link
+    {
+        public:
+
+            struct Impairments
+            {
+                Impairments(): loss(0), duplicate(0), reorder(0), corrupt(0), latency(0), jitter(0), seed(1), queue_limit(4096) {}
+
+                //probabilities, 0..1
+                double loss;
+                double duplicate;
+                double reorder; //datagram is held back so that the following ones overtake it
+                double corrupt; //single bit flip
+
+                size_t latency; //microseconds, one way
+                size_t jitter; //microseconds, added to latency uniformly at random, does not reorder datagrams
+
+                unsigned int seed;
+                size_t queue_limit; //datagrams waiting for the reader, the rest are dropped like by a full socket buffer
+            };
+
+            struct Stats
+            {
+                Stats(): sent(0), delivered(0), lost(0), duplicated(0), reordered(0), corrupted(0), overflowed(0) {}
+
+                size_t sent;
+                size_t delivered;
+                size_t lost;
+                size_t duplicated;
+                size_t reordered;
+                size_t corrupted;
+                size_t overflowed;
+            };
+
+            Memory_Link(const Impairments& impairments = Impairments());
+            ~Memory_Link();
+
+            //Returns one of the two ends, side is 0 or 1. Ends are owned by the link.
+            fplog::Transport_Interface* end(int side);
+
+            void set_impairments(const Impairments& impairments);
+            Stats get_stats();
+
+
+        private:
+
+            class End;
+
+            typedef std::multimap<std::chrono::steady_clock::time_point, std::vector<char>> Queue;
+
+            std::mutex mutex_;
+            std::condition_variable readable_[2];
+            Queue queue_[2];
+            std::chrono::steady_clock::time_point last_delivery_[2];
+
+            Impairments impairments_;
+            Stats stats_;
+            std::mt19937 rng_;
+
+            End* ends_[2];
+
+            bool chance(double probability);
+            size_t read(int side, void* buf, size_t buf_size, size_t timeout);
+            size_t write(int side, const void* buf, size_t buf_size);
+
+            Memory_Link(const Memory_Link&);
+    };
+};
@@ -56,7 +56,9 @@ namespace sprot
     evil_twin_(0),
     twin_size_(0),
     ack_after_(frames_before_ack),
-    frame_num_(0)
+    frame_num_(0),
+    rtt_sampling_(true),
+    unacked_write_(false)
     {
         std::lock_guard<std::recursive_mutex> lock(mutex_);
 
@@ -85,7 +87,8 @@ namespace sprot
 
         time_point<system_clock, system_clock::duration> timer_start(system_clock::now());
 
-        int full_retries = 100;
+        const int max_full_retries = 100;
+        int full_retries = max_full_retries;
         size_t bytes_read = 0;
         unsigned char* ptr = (unsigned char*)buf;
     
@@ -111,7 +114,9 @@ namespace sprot
         int retry_count = 5;
         Frame recv_frame, prev_frame;
 
-        auto frame_read = [check_time_out, &recv_frame, &prev_frame, &full_retries, &retry_count, &frame_num, this]()
+        //waiting for data uses fixed timeout because the sender may have nothing to send,
+        //waiting for ACK of our own ACK is a round trip and uses RTO
+        auto frame_read = [check_time_out, &recv_frame, &prev_frame, &full_retries, &retry_count, &frame_num, &timer_start, &timeout, this](bool ack_wait)
         {
             while (true)
             {
@@ -119,7 +124,13 @@ namespace sprot
 
                 try
                 {
-                    recv_frame = read_frame();
+                    size_t left = time_left(timer_start, timeout);
+
+                    //a frame that arrives after caller's deadline would be consumed without being ACKed
+                    if (ack_wait)
+                        recv_frame = read_ack_frame(left);
+                    else
+                        recv_frame = read_frame((left < Timeout::Operation) ? (left > 0 ? left : 1) : static_cast<size_t>(Timeout::Operation));
                     break;
                 }
                 catch (sprot::exceptions::Wrong_Sequence&)
@@ -152,7 +163,7 @@ namespace sprot
         {
             check_time_out();
 
-            if (!frame_read())
+            if (!frame_read(false))
                 goto full_read_retry;
 
             if ((recv_frame.type != Frame::DATA_FIRST) &&
@@ -199,6 +210,8 @@ namespace sprot
             Frame last_frame(recv_frame);
 
             bool ack_sent = false;
+            steady_clock::time_point ack_sent_at;
+
             if ((frame_num % ack_after_ == 0) || (recv_frame.type == Frame::DATA_LAST) || (!multipart))
             {
                 sequence_num_++;
@@ -211,6 +224,7 @@ namespace sprot
                     try
                     {
                         write_frame(send_frame);
+                        ack_sent_at = steady_clock::now();
                         ack_sent = true;
                         break;
                     }
@@ -227,7 +241,7 @@ namespace sprot
             {
                 frame_num = 0;
                 sequence_num_++;
-                if (!frame_read())
+                if (!frame_read(true))
                 {
                     auto duplicate_frame = [this, &bytes_read, buf] ()
                     {
@@ -278,6 +292,9 @@ namespace sprot
 
                 if (recv_frame.type == Frame::ACK)
                 {
+                    if (full_retries == max_full_retries)
+                        update_rtt(steady_clock::now() - ack_sent_at);
+
                     if (!multipart)
                     {
                         if (detect_evil_presence())
@@ -324,6 +341,10 @@ namespace sprot
         time_point<system_clock, system_clock::duration> timer_start(system_clock::now());
         int full_retries = 100;
 
+        //previous message that was not acknowledged may still produce a late ACK
+        rtt_sampling_ = !unacked_write_;
+        unacked_write_ = true;
+
     full_write_retry:
 
         sequence_num_ = 0;
@@ -344,6 +365,7 @@ namespace sprot
             ack_after_ = 1;
 
             write_data(buf, buf_size, Frame::DATA_SINGLE, timeout);
+            unacked_write_ = false;
             return buf_size;
         }
 
@@ -376,24 +398,106 @@ namespace sprot
             if (full_retries == 0)
                 THROW(fplog::exceptions::Write_Failed);
             full_retries--;
+            rtt_sampling_ = false;
             goto full_write_retry;
         }
 
+        unacked_write_ = false;
         return buf_size;
     }
 
-    Protocol::Frame Protocol::read_frame()
+    Protocol::Rtt_Stats Protocol::get_rtt_stats()
+    {
+        std::lock_guard<std::mutex> lock(rtt_mutex_);
+        return rtt_;
+    }
+
+    void Protocol::update_rtt(steady_clock::duration rtt)
+    {
+        std::lock_guard<std::mutex> lock(rtt_mutex_);
+
+        double r = duration<double, std::milli>(rtt).count();
+
+        if (rtt_.samples == 0)
+        {
+            rtt_.srtt = r;
+            rtt_.rttvar = r / 2;
+        }
+        else
+        {
+            rtt_.rttvar = 0.75 * rtt_.rttvar + 0.25 * ((rtt_.srtt > r) ? (rtt_.srtt - r) : (r - rtt_.srtt));
+            rtt_.srtt = 0.875 * rtt_.srtt + 0.125 * r;
+        }
+
+        rtt_.last_rtt = r;
+        rtt_.samples++;
+
+        //variance term is at least 1 ms - clock granularity
+        double rto = rtt_.srtt + ((4 * rtt_.rttvar > 1.0) ? 4 * rtt_.rttvar : 1.0);
+
+        if (rto < Timeout::Min_Rto)
+            rto = Timeout::Min_Rto;
+
+        if (rto > Timeout::Max_Rto)
+            rto = Timeout::Max_Rto;
+
+        rtt_.rto = static_cast<size_t>(rto + 0.5);
+    }
+
+    void Protocol::back_off()
+    {
+        std::lock_guard<std::mutex> lock(rtt_mutex_);
+
+        rtt_.timeouts++;
+        rtt_.rto = (rtt_.rto * 2 < Timeout::Max_Rto) ? rtt_.rto * 2 : static_cast<size_t>(Timeout::Max_Rto);
+    }
+
+    Protocol::Frame Protocol::read_frame(size_t timeout)
     {
         fill_frame_buf('R');
 
         const size_t max_len = MTU_ + Frame::overhead;
-        size_t recv_size = transport_->read(frame_buf_, max_len, Timeout::Operation);
+        size_t recv_size = transport_->read(frame_buf_, max_len, timeout);
         if ((recv_size == 0) || (recv_size > max_len))
             THROW(exceptions::Invalid_Frame);
         Frame frame = make_frame(frame_buf_, recv_size);
         return frame;
     }
 
+    Protocol::Frame Protocol::read_ack_frame(size_t time_left)
+    {
+        size_t rto = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(rtt_mutex_);
+            rto = rtt_.rto;
+        }
+
+        size_t wait = (time_left < rto) ? time_left : rto;
+
+        try
+        {
+            return read_frame(wait > 0 ? wait : 1);
+        }
+        catch (fplog::exceptions::Timeout&)
+        {
+            //running out of caller's time says nothing about the network
+            if (wait == rto)
+                back_off();
+
+            throw;
+        }
+    }
+
+    size_t Protocol::time_left(const std::chrono::system_clock::time_point& start, size_t timeout)
+    {
+        if (timeout == infinite_wait)
+            return infinite_wait;
+
+        long long elapsed = duration_cast<milliseconds>(system_clock::now() - start).count();
+        return (elapsed >= (long long)timeout) ? 0 : static_cast<size_t>(timeout - elapsed);
+    }
+
     void Protocol::write_frame(const Frame& frame)
     {
         fill_frame_buf('W');
@@ -474,7 +578,8 @@ namespace sprot
         Frame recv_frame;
         retry_count = 5;
 
-        auto frame_read = [&recv_frame, &retry_count, this, &check_time_out]()
+        //peer answers right away, so waiting for ACK is bounded by RTO instead of the fixed operation timeout
+        auto frame_read = [&recv_frame, &retry_count, this, &check_time_out, &timer_start, &timeout]()
         {
             while (true)
             {
@@ -482,7 +587,7 @@ namespace sprot
 
                 try
                 {
-                    recv_frame = read_frame();
+                    recv_frame = read_ack_frame(time_left(timer_start, timeout));
                     break;
                 }
                 catch (sprot::exceptions::Wrong_Sequence&)
@@ -507,6 +612,8 @@ namespace sprot
         if ((frame_num_ % ack_after_ == 0) || (type == Frame::DATA_LAST))
         {
             sequence_num_++;
+
+            steady_clock::time_point sent_at(steady_clock::now());
             
             if (!frame_read())
             {
@@ -519,6 +626,9 @@ namespace sprot
                 frame_num_ = 0;
                 THROW(exceptions::Invalid_Frame);
             }
+
+            if (rtt_sampling_)
+                update_rtt(steady_clock::now() - sent_at);
             
             sequence_num_++;
             retry_count = 5;
@@ -87,16 +87,35 @@ namespace sprot
             {
                 enum Type
                 {
-                    Operation = 500 //ms
+                    Operation = 500, //ms, waiting for data and initial retransmission timeout before any RTT is measured
+                    Min_Rto = 200, //ms, RTO of a loopback link would fall below scheduling delays of a busy receiver
+                    Max_Rto = 4000 //ms
                 };
             };
 
+            //Round trip time as seen when waiting for ACKs, RTO is derived Jacobson/Karels style:
+            //rto = srtt + 4 * rttvar, doubled on every timeout and reset with the next valid sample.
+            struct Rtt_Stats
+            {
+                Rtt_Stats(): srtt(0), rttvar(0), last_rtt(0), rto(Timeout::Operation), samples(0), timeouts(0) {}
+
+                double srtt; //ms
+                double rttvar; //ms
+                double last_rtt; //ms
+                size_t rto; //ms
+
+                size_t samples;
+                size_t timeouts;
+            };
+
             Protocol(fplog::Transport_Interface* transport, size_t MTU = 1024, int frames_before_ack = 4);
             virtual ~Protocol();
 
             virtual size_t read(void* buf, size_t buf_size, size_t timeout = infinite_wait);
             virtual size_t write(const void* buf, size_t buf_size, size_t timeout = infinite_wait);
 
+            Rtt_Stats get_rtt_stats();
+
 
         private:
 
@@ -118,10 +137,22 @@ namespace sprot
             int ack_after_;
             int frame_num_;
 
+            Rtt_Stats rtt_;
+            std::mutex rtt_mutex_; //every access to rtt_, get_rtt_stats() is called without mutex_
+
+            //Karn's rule: no RTT samples from messages that were (or might have been) sent more than once
+            bool rtt_sampling_;
+            bool unacked_write_;
+
+            void update_rtt(std::chrono::steady_clock::duration rtt);
+            void back_off();
+
             Frame make_frame(const Frame::Type type, unsigned char* data = 0, size_t data_length = 0);
             Frame make_frame(const unsigned char* buf, size_t length);
 
-            Frame read_frame();
+            Frame read_frame(size_t timeout = Timeout::Operation);
+            Frame read_ack_frame(size_t time_left); //uses RTO and backs it off on timeout
+            static size_t time_left(const std::chrono::system_clock::time_point& start, size_t timeout);
 
             void write_frame(const Frame& frame);
             void write_data(const void* buf, size_t buf_size, Frame::Type type = Frame::Type::DATA_SINGLE, size_t timeout = Timeout::Operation);
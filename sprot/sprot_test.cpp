@@ -1,13 +1,668 @@
 #include "sprot.h"
+#include "channel_mux.h"
+#include "compression.h"
+#include "async_writer.h"
+#include "memory_link.h"
 
 #include <mutex>
 #include <thread>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <algorithm>
 
 namespace sprot { namespace testing
 {
+    typedef std::function<fplog::Transport_Interface*(fplog::Transport_Interface*)> Protocol_Maker;
+
+    struct Benchmark_Result
+    {
+        Benchmark_Result(): delivered(0), damaged(0), duplicates(0), seconds(0) {}
+
+        size_t delivered;
+        size_t damaged;
+        size_t duplicates;
+        double seconds;
+
+        std::vector<double> latencies; //ms, from the start of write until the message is read
+
+        double percentile(double p)
+        {
+            if (latencies.empty())
+                return 0;
+
+            std::sort(latencies.begin(), latencies.end());
+            size_t i = static_cast<size_t>(p * latencies.size());
+            return latencies[(i < latencies.size()) ? i : latencies.size() - 1];
+        }
+    };
+
+    //Sends messages over impaired in-memory link and checks every received message.
+    //Message layout: 8 bytes send time, 4 bytes message index, pattern derived from the index.
+    Benchmark_Result run_protocol(Protocol_Maker make_protocol, const sprot::Memory_Link::Impairments& impairments,
+                                  size_t message_size, int messages, size_t time_budget)
+    {
+        const size_t header_size = 12;
+        if (message_size < header_size)
+            message_size = header_size;
+
+        sprot::Memory_Link link(impairments);
+        std::auto_ptr<fplog::Transport_Interface> sender(make_protocol(link.end(0)));
+        std::auto_ptr<fplog::Transport_Interface> receiver(make_protocol(link.end(1)));
+
+        const size_t write_timeout = 400;
+
+        volatile bool done = false, all_sent = false;
+        auto start = std::chrono::steady_clock::now();
+
+        auto fill = [message_size](std::vector<char>& msg, int index)
+        {
+            for (size_t i = header_size; i < message_size; ++i)
+                msg[i] = static_cast<char>(index * 31 + i);
+        };
+
+        std::thread writer([&]()
+        {
+            std::vector<char> msg(message_size);
+
+            for (int i = 0; (i < messages) && !done; ++i)
+            {
+                long long now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+                memcpy(&msg[0], &now, 8);
+                memcpy(&msg[8], &i, 4);
+                fill(msg, i);
+
+                //sprot gives up on a message instead of resending it when ACK is lost, so retry the way fplogd does
+                for (int attempt = 1; (attempt <= 6) && !done; ++attempt)
+                {
+                    try
+                    {
+                        sender->write(&msg[0], msg.size(), write_timeout * attempt);
+                        break;
+                    }
+                    catch (fplog::exceptions::Generic_Exception&)
+                    {
+                    }
+                }
+            }
+
+            all_sent = true;
+        });
+
+        Benchmark_Result res;
+        std::vector<char> buf(message_size + 1), expected(message_size);
+        std::vector<bool> seen(messages, false);
+
+        while ((res.delivered < (size_t)messages) && (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(time_budget)))
+        {
+            size_t sz = 0;
+
+            bool finished = all_sent;
+
+            try
+            {
+                sz = receiver->read(&buf[0], buf.size(), 100);
+            }
+            catch (fplog::exceptions::Generic_Exception&)
+            {
+                //whatever was not delivered by now is lost
+                if (finished)
+                    break;
+
+                continue;
+            }
+
+            long long sent = 0;
+            int index = -1;
+
+            if (sz == message_size)
+            {
+                memcpy(&sent, &buf[0], 8);
+                memcpy(&index, &buf[8], 4);
+            }
+
+            if ((index < 0) || (index >= messages))
+            {
+                res.damaged++;
+                continue;
+            }
+
+            fill(expected, index);
+            if (memcmp(&buf[header_size], &expected[header_size], message_size - header_size) != 0)
+            {
+                res.damaged++;
+                continue;
+            }
+
+            if (seen[index])
+            {
+                res.duplicates++;
+                continue;
+            }
+
+            seen[index] = true;
+            res.delivered++;
+
+            long long now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            res.latencies.push_back((now - sent) / 1000.0);
+        }
+
+        res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        done = true;
+        writer.join();
+
+        return res;
+    }
+
     bool proto_test()
     {
-        return true;
+        sprot::Memory_Link::Impairments clean, lossy;
+        clean.latency = lossy.latency = 100;
+        clean.jitter = lossy.jitter = 50;
+
+        lossy.loss = 0.01;
+        lossy.duplicate = 0.01;
+        lossy.reorder = 0.01;
+
+        const int messages = 100;
+        bool res = true;
+
+        size_t sizes[] = { 100, 3000 };
+        for (size_t size : sizes)
+        {
+            Benchmark_Result result(run_protocol([](fplog::Transport_Interface* t) { return new sprot::Protocol(t); }, clean, size, messages, 10000));
+
+            if ((result.delivered != messages) || result.damaged || result.duplicates)
+            {
+                printf("proto_test: %d of %d messages of size %d delivered over clean link.\n", (int)result.delivered, messages, (int)size);
+                res = false;
+            }
+
+            //multi-frame messages may be reassembled damaged when frames are lost, see benchmark
+            if (size > 100)
+                continue;
+
+            //receiver drops the message if the very last ACK is lost, so some losses are expected
+            result = run_protocol([](fplog::Transport_Interface* t) { return new sprot::Protocol(t); }, lossy, size, messages, 20000);
+
+            if ((result.delivered < messages * 9 / 10) || result.damaged)
+            {
+                printf("proto_test: %d of %d messages of size %d delivered over lossy link, %d damaged.\n", (int)result.delivered, messages, (int)size, (int)result.damaged);
+                res = false;
+            }
+        }
+
+        return res;
+    }
+
+    //Goodput and latency for every combination of message size, MTU, frames_before_ack and loss rate.
+    //Runs only on demand (sprot_test benchmark), takes a few minutes.
+    void protocol_benchmark()
+    {
+        size_t sizes[] = { 128, 4096, 30000 };
+        size_t mtus[] = { 512, 1400, 8192 };
+        int acks[] = { 1, 4, 16 };
+        double losses[] = { 0, 0.01, 0.05 };
+
+        const size_t time_budget = 3000; //ms for every combination
+        const size_t bytes_per_run = 2 * 1024 * 1024;
+
+        printf("%-7s %6s %5s %4s %5s %9s %8s %8s %8s %8s %9s %4s %4s\n",
+               "proto", "size", "mtu", "ack", "loss", "MB/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "delivered", "dmg", "dup");
+
+        for (double loss : losses)
+        for (size_t size : sizes)
+        for (size_t mtu : mtus)
+        {
+            sprot::Memory_Link::Impairments impairments;
+            impairments.loss = loss;
+            impairments.latency = 100;
+            impairments.jitter = 50;
+
+            int messages = static_cast<int>(bytes_per_run / size);
+            if (messages > 2000)
+                messages = 2000;
+
+            auto report = [&](const char* name, const char* ack, Benchmark_Result& r)
+            {
+                printf("%-7s %6d %5d %4s %5.2f %9.2f %8.2f %8.2f %8.2f %8.2f %4d/%-4d %4d %4d\n",
+                       name, (int)size, (int)mtu, ack, loss, (r.delivered * size) / r.seconds / 1048576.0,
+                       r.percentile(0.5), r.percentile(0.9), r.percentile(0.99), r.percentile(1.0),
+                       (int)r.delivered, messages, (int)r.damaged, (int)r.duplicates);
+            };
+
+            for (int ack : acks)
+            {
+                Benchmark_Result r(run_protocol([mtu, ack](fplog::Transport_Interface* t) { return new sprot::Protocol(t, mtu, ack); }, impairments, size, messages, time_budget));
+                report("sprot", std::to_string(ack).c_str(), r);
+            }
+
+            //no ACKs in vsprot, it relies on the transport to be reliable, so losses show up as undelivered messages
+            Benchmark_Result r(run_protocol([mtu](fplog::Transport_Interface* t) { return new vsprot::Protocol(t, mtu); }, impairments, size, messages, time_budget));
+            report("vsprot", "-", r);
+        }
+    }
+
+    bool mux_test()
+    {
+        sprot::Memory_Link link;
+        sprot::Channel_Mux client(link.end(0)), server(link.end(1));
+
+        const int channels = 3;
+        const int messages = 100;
+
+        auto writer = [&client](int channel)
+        {
+            fplog::Transport_Interface* proto = client.channel(static_cast<sprot::Channel_Mux::Channel_Id>(channel));
+
+            for (int i = 0; i < messages; ++i)
+            {
+                std::string msg(std::to_string(channel) + "_" + std::to_string(i) + "_");
+                msg.append(1 + (i * 37) % 3000, static_cast<char>('a' + channel));
+
+                int retries = 10;
+                while (retries-- > 0)
+                {
+                    try
+                    {
+                        proto->write(msg.c_str(), msg.size(), 3000);
+                        break;
+                    }
+                    catch (fplog::exceptions::Generic_Exception&)
+                    {
+                    }
+                }
+            }
+        };
+
+        std::vector<std::thread> writers;
+        for (int c = 1; c <= channels; ++c)
+            writers.push_back(std::thread(writer, c));
+
+        std::map<sprot::Channel_Mux::Channel_Id, int> expected;
+        int received = 0;
+        bool res = true;
+
+        char buf[4096];
+
+        while (res && (received < channels * messages))
+        {
+            sprot::Channel_Mux::Channel_Id id = 0;
+            if (!server.wait_readable(id, 5000))
+            {
+                printf("mux_test: timed out waiting for data.\n");
+                res = false;
+                break;
+            }
+
+            try
+            {
+                size_t sz = server.channel(id)->read(buf, sizeof(buf) - 1, 1000);
+                buf[sz] = 0;
+
+                std::string prefix(std::to_string(id) + "_" + std::to_string(expected[id]) + "_");
+                if (std::string(buf).find(prefix) != 0)
+                {
+                    printf("mux_test: unexpected message on channel %d, expected prefix %s.\n", id, prefix.c_str());
+                    res = false;
+                }
+
+                expected[id]++;
+                received++;
+            }
+            catch (fplog::exceptions::Generic_Exception&)
+            {
+            }
+        }
+
+        for (auto& t : writers)
+            t.join();
+
+        return res;
+    }
+
+    //Resembles what fplogd sends to fpcollect: batch of messages with appended hostname.
+    std::string make_batch(int batch_size, int seed)
+    {
+        static const char* prios[] = { "debug", "info", "warning", "error", "critical" };
+        static const char* facilities[] = { "user", "system", "security", "fplog" };
+        static const char* texts[] = { "connection established", "retrying request after timeout", "cache miss, loading from disk",
+                                       "user logged in", "queue size exceeded soft limit", "configuration reloaded" };
+
+        std::string batch("{\"batch\":[");
+
+        for (int i = 0; i < batch_size; ++i)
+        {
+            int n = seed * batch_size + i;
+
+            if (i > 0)
+                batch += ",";
+
+            batch += "{\"priority\":\"" + std::string(prios[n % 5]) + "\",\"facility\":\"" + facilities[n % 4] +
+                "\",\"timestamp\":\"2017-03-1" + std::to_string(n % 10) + "T12:" + std::to_string(10 + n % 50) + ":" + std::to_string(10 + (n * 7) % 50) +
+                "." + std::to_string(100 + n % 900) + "+01:00\",\"text\":\"" + texts[(n * 5) % 6] + ", id " + std::to_string(n * 7919) +
+                "\",\"module\":\"worker.cpp\",\"line\":" + std::to_string(100 + n % 400) + ",\"sequence\":" + std::to_string(n) +
+                ",\"appname\":\"fplog_testapp\",\"hostname\":\"build-host-01\"}";
+        }
+
+        batch += "]}";
+        return batch;
+    }
+
+    bool compression_test()
+    {
+        sprot::Lz_Codec codec, no_dict_codec("");
+        std::vector<unsigned char> compressed, decompressed;
+
+        std::vector<std::string> samples;
+        samples.push_back(make_batch(31, 1));
+        samples.push_back(make_batch(1, 2));
+        samples.push_back(std::string(5000, 'z'));
+        samples.push_back("short");
+
+        std::string noise;
+        for (int i = 0; i < 4000; ++i)
+            noise += static_cast<char>((i * 2654435761u) >> 13);
+        samples.push_back(noise);
+
+        for (auto& sample : samples)
+        {
+            for (sprot::Lz_Codec* c : { &codec, &no_dict_codec })
+            {
+                if (!c->compress(sample.c_str(), sample.size(), compressed))
+                {
+                    if (sample.size() > 100 && sample != noise)
+                    {
+                        printf("compression_test: sample of size %d is not compressible.\n", (int)sample.size());
+                        return false;
+                    }
+
+                    continue;
+                }
+
+                c->decompress(&compressed[0], compressed.size(), decompressed, sample.size());
+                if (std::string(decompressed.begin(), decompressed.end()) != sample)
+                {
+                    printf("compression_test: round trip mismatch.\n");
+                    return false;
+                }
+            }
+        }
+
+        //malformed input must be rejected, not crash
+        codec.compress(samples[0].c_str(), samples[0].size(), compressed);
+        compressed[compressed.size() / 2] ^= 0x5a;
+        compressed.resize(compressed.size() - 3);
+
+        try
+        {
+            codec.decompress(&compressed[0], compressed.size(), decompressed, samples[0].size());
+            if (std::string(decompressed.begin(), decompressed.end()) == samples[0])
+                return false;
+        }
+        catch (fplog::exceptions::Incorrect_Parameter&)
+        {
+        }
+
+        //compressed and plain messages over the same sprot link, receiver buffer fits the wire size but not every decompressed message
+        sprot::Memory_Link link;
+        sprot::Compressing_Protocol sender(new sprot::Protocol(link.end(0)));
+        sprot::Compressing_Protocol receiver(new sprot::Protocol(link.end(1)), false);
+
+        std::thread writer([&sender, &samples]()
+        {
+            for (auto& sample : samples)
+                sender.write(sample.c_str(), sample.size(), 3000);
+        });
+
+        bool res = true;
+        std::vector<char> buf(4096);
+
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            size_t sz = 0;
+
+            try
+            {
+                sz = receiver.read(&buf[0], buf.size(), 3000);
+            }
+            catch (fplog::exceptions::Buffer_Overflow& e)
+            {
+                buf.resize(e.get_required_size());
+                sz = receiver.read(&buf[0], buf.size(), 3000);
+            }
+
+            if (std::string(&buf[0], sz) != samples[i])
+            {
+                printf("compression_test: message %d corrupted over the link.\n", (int)i);
+                res = false;
+            }
+        }
+
+        writer.join();
+
+        //header claiming more than max_original_size is refused before anything is allocated for it
+        sprot::Memory_Link forged_link;
+        sprot::Protocol forger(forged_link.end(0));
+        sprot::Compressing_Protocol forged_receiver(new sprot::Protocol(forged_link.end(1)), false);
+
+        std::thread forged_writer([&forger]()
+        {
+            unsigned char forged[sprot::Compressing_Protocol::header_size + 16];
+            unsigned int dictionary_id = sprot::Lz_Codec().dictionary_id(), original_size = 0xfffffff0;
+
+            memset(forged, 0, sizeof(forged));
+            memcpy(forged, sprot::Compressing_Protocol::magic, sizeof(sprot::Compressing_Protocol::magic));
+            memcpy(forged + 4, &dictionary_id, 4);
+            memcpy(forged + 8, &original_size, 4);
+
+            forger.write(forged, sizeof(forged), 3000);
+        });
+
+        try
+        {
+            forged_receiver.read(&buf[0], buf.size(), 3000);
+            printf("compression_test: oversized message accepted.\n");
+            res = false;
+        }
+        catch (fplog::exceptions::Read_Failed&)
+        {
+        }
+
+        forged_writer.join();
+        return res;
+    }
+
+    void compression_benchmark()
+    {
+        const int batches = 2000;
+
+        std::vector<std::string> recorded;
+        size_t total = 0;
+
+        for (int i = 0; i < batches; ++i)
+        {
+            recorded.push_back(make_batch(31, i));
+            total += recorded.back().size();
+        }
+
+        sprot::Lz_Codec codec, no_dict_codec("");
+        std::vector<unsigned char> compressed, decompressed;
+
+        for (sprot::Lz_Codec* c : { &codec, &no_dict_codec })
+        {
+            size_t compressed_total = 0;
+            double compress_time = 0, decompress_time = 0;
+
+            for (auto& batch : recorded)
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                c->compress(batch.c_str(), batch.size(), compressed);
+                auto middle = std::chrono::high_resolution_clock::now();
+                c->decompress(&compressed[0], compressed.size(), decompressed, batch.size());
+                auto end = std::chrono::high_resolution_clock::now();
+
+                compressed_total += compressed.size();
+                compress_time += std::chrono::duration<double>(middle - start).count();
+                decompress_time += std::chrono::duration<double>(end - middle).count();
+            }
+
+            printf("compression_benchmark (%s dictionary): %d batches, avg %d bytes, ratio %.2f, compress %.1f MB/s, decompress %.1f MB/s\n",
+                   (c == &codec) ? "fplog" : "no", batches, (int)(total / batches), (double)total / compressed_total,
+                   total / compress_time / 1048576.0, total / decompress_time / 1048576.0);
+        }
+
+        //single messages are where the dictionary matters most
+        size_t single_total = 0, single_compressed = 0, single_no_dict = 0;
+        for (int i = 0; i < batches; ++i)
+        {
+            std::string msg(make_batch(1, i));
+            single_total += msg.size();
+            single_compressed += codec.compress(msg.c_str(), msg.size(), compressed) ? compressed.size() : msg.size();
+            single_no_dict += no_dict_codec.compress(msg.c_str(), msg.size(), compressed) ? compressed.size() : msg.size();
+        }
+
+        printf("compression_benchmark (single messages): ratio %.2f with fplog dictionary, %.2f without\n",
+               (double)single_total / single_compressed, (double)single_total / single_no_dict);
+    }
+
+    bool async_writer_test()
+    {
+        sprot::Memory_Link link;
+        sprot::Protocol sender(link.end(0)), receiver(link.end(1));
+
+        const int messages = 50;
+        bool res = true;
+
+        std::thread reader([&receiver, &res]()
+        {
+            char buf[4096];
+
+            for (int i = 0; i < messages; ++i)
+            {
+                try
+                {
+                    size_t sz = receiver.read(buf, sizeof(buf) - 1, 3000);
+                    buf[sz] = 0;
+
+                    if (std::string(buf).find(std::to_string(i) + "_") != 0)
+                    {
+                        printf("async_writer_test: message %d is out of order.\n", i);
+                        res = false;
+                    }
+                }
+                catch (fplog::exceptions::Generic_Exception&)
+                {
+                    printf("async_writer_test: message %d is lost.\n", i);
+                    res = false;
+                }
+            }
+        });
+
+        {
+            sprot::Async_Writer writer(&sender, 4);
+            std::vector<std::future<size_t>> results;
+
+            for (int i = 0; i < messages; ++i)
+            {
+                std::string msg(std::to_string(i) + "_");
+                msg.append(1 + (i * 53) % 3000, 'x');
+
+                results.push_back(writer.write(msg.c_str(), msg.size(), 1000));
+
+                if (writer.in_flight() > 4)
+                    res = false;
+            }
+
+            if (!writer.flush(10000))
+                res = false;
+
+            for (auto& result : results)
+            {
+                try
+                {
+                    result.get();
+                }
+                catch (fplog::exceptions::Generic_Exception&)
+                {
+                    res = false;
+                }
+            }
+        }
+
+        reader.join();
+
+        //nobody acknowledges, every attempt times out and error is reported through both future and callback
+        sprot::Memory_Link dead_link;
+        sprot::Protocol dead(dead_link.end(0));
+
+        sprot::Async_Writer writer(&dead, 2, 1);
+        bool callback_error = false;
+
+        std::future<size_t> failed(writer.write("test", 5, 50));
+        writer.write("test", 5, [&callback_error](size_t, fplog::exceptions::Generic_Exception* e) { callback_error = (e != 0); }, 50);
+        writer.flush();
+
+        try
+        {
+            failed.get();
+            res = false;
+        }
+        catch (fplog::exceptions::Timeout&)
+        {
+        }
+        catch (fplog::exceptions::Generic_Exception&)
+        {
+        }
+
+        return res && callback_error;
+    }
+
+    bool rtt_test()
+    {
+        sprot::Memory_Link link;
+        sprot::Protocol sender(link.end(0)), receiver(link.end(1));
+
+        const int messages = 30;
+
+        std::thread reader([&receiver]()
+        {
+            char buf[4096];
+
+            for (int i = 0; i < messages; ++i)
+            {
+                try
+                {
+                    receiver.read(buf, sizeof(buf), 3000);
+                }
+                catch (fplog::exceptions::Generic_Exception&)
+                {
+                }
+            }
+        });
+
+        std::string msg(2500, 'r');
+        for (int i = 0; i < messages; ++i)
+        {
+            try
+            {
+                sender.write(msg.c_str(), msg.size(), 3000);
+            }
+            catch (fplog::exceptions::Generic_Exception&)
+            {
+            }
+        }
+
+        reader.join();
+
+        sprot::Protocol::Rtt_Stats stats(sender.get_rtt_stats());
+        printf("rtt_test: srtt %.3f ms, rttvar %.3f ms, rto %d ms, %d samples, %d timeouts\n",
+               stats.srtt, stats.rttvar, (int)stats.rto, (int)stats.samples, (int)stats.timeouts);
+
+        //in-process loopback is way below minimal RTO
+        return (stats.samples >= (size_t)messages) && (stats.rto == sprot::Protocol::Timeout::Min_Rto);
     }
 
     bool crc_test()
@@ -40,6 +695,20 @@ namespace sprot { namespace testing
         
         if (!proto_test())
             printf("proto_test failed.\n");
+
+        if (!rtt_test())
+            printf("rtt_test failed.\n");
+
+        if (!mux_test())
+            printf("mux_test failed.\n");
+
+        if (!async_writer_test())
+            printf("async_writer_test failed.\n");
+
+        if (!compression_test())
+            printf("compression_test failed.\n");
+
+        compression_benchmark();
         
         printf("tests finished.\n");
     }
@@ -47,7 +716,10 @@ namespace sprot { namespace testing
 
 int main(int argc, char* argv[])
 {
-    sprot::testing::run_all_tests();
+    if ((argc > 1) && (strcmp(argv[1], "benchmark") == 0))
+        sprot::testing::protocol_benchmark();
+    else
+        sprot::testing::run_all_tests();
 
-	return 0;
+    return 0;
 }
@@ -312,3 +312,145 @@ void CUDTCC::onTimeout()
       */
    }
 }
+
+//
+CFplogCC::CFplogCC(double maxrate, int maxdelay, int burst):
+m_dMaxRate(maxrate),
+m_iMaxDelay(maxdelay),
+m_iBurstWindow(burst),
+m_dMinSndPeriod(1.0),
+m_iRCInterval(),
+m_LastRCTime(),
+m_LastDecTime(),
+m_LastSndTime(),
+m_iMinRTT(),
+m_MinRTTTime(),
+m_bLoss(),
+m_iLastDecSeq()
+{
+}
+
+void CFplogCC::init()
+{
+   m_iRCInterval = m_iSYNInterval;
+   m_LastRCTime = CTimer::getTime();
+   m_LastDecTime = m_LastRCTime;
+   m_LastSndTime = m_LastRCTime;
+   m_MinRTTTime = m_LastRCTime;
+   setACKTimer(m_iRCInterval);
+
+   // one packet of m_iMSS bytes every m_dMinSndPeriod microseconds is the ceiling in Mbps
+   m_dMinSndPeriod = (m_dMaxRate > 0) ? m_iMSS * 8.0 / m_dMaxRate : 1.0;
+
+   m_iMinRTT = m_iRTT;
+   m_bLoss = false;
+   m_iLastDecSeq = CSeqNo::decseq(m_iSndCurrSeqNo);
+
+   // no slow start, the first burst goes out at the ceiling
+   m_dCWndSize = m_iBurstWindow;
+   m_dPktSndPeriod = m_dMinSndPeriod;
+
+   limitRate();
+}
+
+void CFplogCC::onACK(int32_t)
+{
+   uint64_t currtime = CTimer::getTime();
+   if (currtime - m_LastRCTime < (uint64_t)m_iRCInterval)
+      return;
+
+   m_LastRCTime = currtime;
+
+   // the path may change, so the minimum is sampled anew every 10 seconds
+   if ((m_iRTT < m_iMinRTT) || (currtime - m_MinRTTTime > 10000000))
+   {
+      m_iMinRTT = m_iRTT;
+      m_MinRTTTime = currtime;
+   }
+
+   // enough packets in flight to keep the delivery rate for one RTT, but never less than a burst
+   m_dCWndSize = m_iRcvRate / 1000000.0 * (m_iRTT + m_iRCInterval) + 16;
+   if (m_dCWndSize < m_iBurstWindow)
+      m_dCWndSize = m_iBurstWindow;
+
+   if (m_bLoss)
+   {
+      m_bLoss = false;
+      limitRate();
+      return;
+   }
+
+   // RTT above its minimum means packets wait in some queue on the path,
+   // back off once per RTT before the queue overflows and other traffic starts losing packets
+   if (m_iRTT - m_iMinRTT > m_iMaxDelay)
+   {
+      if (currtime - m_LastDecTime > (uint64_t)m_iRTT)
+         decrease(1.25);
+
+      limitRate();
+      return;
+   }
+
+   // no queuing, rate goes up by 1/16 every rate control interval until the ceiling
+   m_dPktSndPeriod /= 1.0625;
+   limitRate();
+}
+
+void CFplogCC::onLoss(const int32_t* losslist, int)
+{
+   m_bLoss = true;
+
+   // one decrease per congestion epoch, the rest of the losses of the epoch are caused by the same overflow
+   if (CSeqNo::seqcmp(losslist[0] & 0x7FFFFFFF, m_iLastDecSeq) > 0)
+   {
+      decrease(1.25);
+      m_iLastDecSeq = m_iSndCurrSeqNo;
+   }
+
+   limitRate();
+}
+
+void CFplogCC::onTimeout()
+{
+   decrease(2.0);
+   m_dCWndSize = m_iBurstWindow;
+
+   limitRate();
+}
+
+void CFplogCC::onPktSent(const CPacket*)
+{
+   uint64_t currtime = CTimer::getTime();
+
+   // log batches come in bursts, after a few idle RTTs whatever was learned about the queues is outdated
+   // and the next burst starts at the ceiling again, delay and loss bring the rate down within an RTT if needed
+   if (currtime - m_LastSndTime > (uint64_t)(m_iRTT * 4 + m_iRCInterval))
+   {
+      m_dPktSndPeriod = m_dMinSndPeriod;
+      if (m_dCWndSize < m_iBurstWindow)
+         m_dCWndSize = m_iBurstWindow;
+
+      limitRate();
+   }
+
+   m_LastSndTime = currtime;
+}
+
+void CFplogCC::decrease(double factor)
+{
+   m_dPktSndPeriod *= factor;
+   m_LastDecTime = CTimer::getTime();
+}
+
+void CFplogCC::limitRate()
+{
+   // backoff never goes below 100 packets per second, unless the ceiling itself is lower
+   if (m_dPktSndPeriod > 10000)
+      m_dPktSndPeriod = 10000;
+
+   if (m_dPktSndPeriod < m_dMinSndPeriod)
+      m_dPktSndPeriod = m_dMinSndPeriod;
+
+   if (m_dCWndSize > m_dMaxCWndSize)
+      m_dCWndSize = m_dMaxCWndSize;
+}
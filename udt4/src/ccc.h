@@ -275,4 +275,62 @@ private:
    int m_iDecCount;			// number of decreases in a congestion epoch
 };
 
+// Congestion control for log shipping: traffic comes in small bursts (batches) and should
+// neither wait for slow start nor push queues up on a shared LAN.
+// The sending rate never exceeds the configured ceiling, every burst after an idle period
+// starts right away with the full burst window, and the rate is decreased as soon as the RTT
+// grows above its minimum by more than the allowed queuing delay, before any loss happens.
+
+class UDT_API CFplogCC: public CCC
+{
+public:
+   CFplogCC(double maxrate = 0, int maxdelay = 5000, int burst = 128);
+
+public:
+   virtual void init();
+   virtual void onACK(int32_t);
+   virtual void onLoss(const int32_t*, int);
+   virtual void onTimeout();
+   virtual void onPktSent(const CPacket*);
+
+private:
+   void decrease(double factor);
+   void limitRate();
+
+private:
+   double m_dMaxRate;			// rate ceiling, in Mbps, 0 for no ceiling
+   int m_iMaxDelay;			// queuing delay allowed above the minimum RTT, in microseconds
+   int m_iBurstWindow;			// congestion window at the start of a burst, in packets
+
+   double m_dMinSndPeriod;		// packet sending period at the rate ceiling, in microseconds
+   int m_iRCInterval;			// rate control interval
+   uint64_t m_LastRCTime;		// last rate control time
+   uint64_t m_LastDecTime;		// last rate decrease time
+   uint64_t m_LastSndTime;		// last data packet sending time
+   int m_iMinRTT;			// minimum RTT observed, in microseconds
+   uint64_t m_MinRTTTime;		// when minimum RTT was sampled anew last time
+   bool m_bLoss;			// if loss happened since last rate control
+   int32_t m_iLastDecSeq;		// max pkt seq no sent out when last decrease on loss happened
+};
+
+// CCCFactory creates congestion control with its default parameters, this one passes them on:
+//    CFplogCCFactory factory(maxrate, maxdelay, burst);
+//    UDT::setsockopt(u, 0, UDT_CC, &factory, sizeof(CFplogCCFactory));
+
+class CFplogCCFactory: public CCCVirtualFactory
+{
+public:
+   CFplogCCFactory(double maxrate = 0, int maxdelay = 5000, int burst = 128):
+   m_dMaxRate(maxrate), m_iMaxDelay(maxdelay), m_iBurstWindow(burst) {}
+   virtual ~CFplogCCFactory() {}
+
+   virtual CCC* create() {return new CFplogCC(m_dMaxRate, m_iMaxDelay, m_iBurstWindow);}
+   virtual CCCVirtualFactory* clone() {return new CFplogCCFactory(m_dMaxRate, m_iMaxDelay, m_iBurstWindow);}
+
+private:
+   double m_dMaxRate;
+   int m_iMaxDelay;
+   int m_iBurstWindow;
+};
+
 #endif